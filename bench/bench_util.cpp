@@ -0,0 +1,111 @@
+#include "bench_util.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "idevice/instrument/dtxmessagetransmitter.h"
+#include "idevice/utils/gatherbuffer.h"
+
+using namespace idevice;
+
+static std::atomic<uint64_t> allocation_count(0);
+
+#if defined(__GLIBC__)
+
+// the allocator of glibc is wrapped, so the buffers allocated by `malloc()` are counted too
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+}  // extern "C"
+
+#else  // !__GLIBC__
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+#endif  // __GLIBC__
+
+uint64_t idevice::BenchAllocationCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+void idevice::BenchReport(benchmark::State& state, size_t bytes_per_iteration,
+                          uint64_t allocations) {
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes_per_iteration));
+  state.counters["allocs/op"] =
+      benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+}
+
+std::vector<char> idevice::BenchReadTestData(const std::string& filename) {
+  std::vector<char> bytes;
+  std::string path = std::string(IDEVICE_BENCH_DATA_DIR) + filename;
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr) {
+    return bytes;
+  }
+  char buffer[16 * 1024];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+  }
+  fclose(f);
+  return bytes;
+}
+
+std::shared_ptr<DTXMessage> idevice::BenchCreateMessage(size_t payload_size) {
+  std::vector<char> payload(payload_size);
+  for (size_t i = 0; i < payload_size; ++i) {
+    payload[i] = static_cast<char>('0' + i % 10);
+  }
+  return DTXMessage::CreateWithBuffer(payload.data(), payload.size(), true);
+}
+
+std::vector<char> idevice::BenchEncodeMessages(
+    const std::vector<std::shared_ptr<DTXMessage>>& messages, uint32_t fragment_size) {
+  DTXMessageTransmitter transmitter;
+  transmitter.SetSuggestedFragmentSize(fragment_size);
+  GatherBuffer gathered;
+  uint32_t msg_identifier = 1;
+  for (const std::shared_ptr<DTXMessage>& message : messages) {
+    DTXMessageRoutingInfo routing_info = {msg_identifier++, 0, 1, 0};
+    if (!transmitter.GatherMessage(message, routing_info, &gathered)) {
+      return std::vector<char>();
+    }
+  }
+  std::vector<char> bytes;
+  bytes.reserve(gathered.Size());
+  for (const IoVec& segment : gathered.Segments()) {
+    bytes.insert(bytes.end(), segment.data, segment.data + segment.size);
+  }
+  return bytes;
+}
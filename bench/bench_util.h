@@ -0,0 +1,62 @@
+#ifndef IDEVICE_BENCH_BENCH_UTIL_H
+#define IDEVICE_BENCH_BENCH_UTIL_H
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>  // std::shared_ptr
+#include <string>
+#include <vector>
+
+#include "idevice/instrument/dtxmessage.h"
+
+namespace idevice {
+
+/**
+ * Get the count of heap allocations made by the process so far
+ * With glibc every `malloc()`/`calloc()`/`realloc()` is counted, which includes `operator new`,
+ * otherwise only `operator new` is counted.
+ *
+ * @return uint64_t the count
+ */
+uint64_t BenchAllocationCount();
+
+/**
+ * Report the throughput and the allocations per iteration of a finished benchmark loop
+ *
+ * @param state the state of the benchmark
+ * @param bytes_per_iteration count of bytes processed by each iteration
+ * @param allocations count of allocations made by the loop, see `BenchAllocationCount()`
+ */
+void BenchReport(benchmark::State& state, size_t bytes_per_iteration, uint64_t allocations);
+
+/**
+ * Read a captured message from test/data
+ *
+ * @param filename the file name, e.g. "dtxmsg_runningprocesses.bin"
+ * @return std::vector<char> the bytes, empty if it can not be read
+ */
+std::vector<char> BenchReadTestData(const std::string& filename);
+
+/**
+ * Create a message with a payload of the given size
+ *
+ * @param payload_size size of the payload
+ * @return std::shared_ptr<DTXMessage> the message
+ */
+std::shared_ptr<DTXMessage> BenchCreateMessage(size_t payload_size);
+
+/**
+ * Encode messages into the bytes a device would send, fragmented by `DTXMessageTransmitter`
+ *
+ * @param messages the messages
+ * @param fragment_size the suggested fragment size, including the header
+ * @return std::vector<char> the bytes, empty if any message can not be encoded
+ */
+std::vector<char> BenchEncodeMessages(const std::vector<std::shared_ptr<DTXMessage>>& messages,
+                                      uint32_t fragment_size = 64 * 1024);
+
+}  // namespace idevice
+
+#endif  // IDEVICE_BENCH_BENCH_UTIL_H
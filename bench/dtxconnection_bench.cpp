@@ -0,0 +1,145 @@
+#include "idevice/instrument/dtxconnection.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>  // std::unique_ptr, std::shared_ptr
+#include <thread>
+#include <vector>
+
+#include "bench_util.h"
+#include "idevice/instrument/dtxchannel.h"
+#include "idevice/instrument/dtxfakeserver.h"
+#include "idevice/instrument/dtxloopbacktransport.h"
+#include "idevice/instrument/dtxrequest.h"
+
+using namespace idevice;
+
+static constexpr uint32_t kReplyTimeout = 10 * 1000;
+static constexpr uint64_t kStreamBatch = 64;  // messages received by each iteration of a stream
+
+// a connection talking to a fake server through a loopback transport, with one channel open
+class LoopbackSession {
+ public:
+  LoopbackSession()
+      : transports_(LoopbackDTXTransport::CreatePair()),
+        server_(transports_.second.get()),
+        connection_(transports_.first.get()) {
+    if (server_.Start() && connection_.Connect()) {
+      channel_ = connection_.MakeChannelWithIdentifier("bench");
+    }
+  }
+
+  ~LoopbackSession() {
+    connection_.Disconnect();
+    server_.Stop();
+  }
+
+  DTXFakeServer& Server() { return server_; }
+  DTXConnection& Connection() { return connection_; }
+  const std::shared_ptr<DTXChannel>& Channel() { return channel_; }
+
+ private:
+  std::pair<std::unique_ptr<LoopbackDTXTransport>, std::unique_ptr<LoopbackDTXTransport>>
+      transports_;
+  DTXFakeServer server_;
+  DTXConnection connection_;
+  std::shared_ptr<DTXChannel> channel_;
+};
+
+static void ReportRoundTrip(benchmark::State& state, const DTXConnectionMetrics& metrics) {
+  state.counters["p50_us"] = static_cast<double>(metrics.round_trip.PercentileUs(50));
+  state.counters["p99_us"] = static_cast<double>(metrics.round_trip.PercentileUs(99));
+  state.counters["max_us"] = static_cast<double>(metrics.round_trip.max_us);
+}
+
+// one request at a time through the whole pipeline: send queue, transport, the server's parser
+// and transmitter, then the receive, parsing and dispatching threads
+static void BM_RequestReply(benchmark::State& state) {
+  size_t payload_size = static_cast<size_t>(state.range(0));
+  LoopbackSession session;
+  if (session.Channel() == nullptr) {
+    state.SkipWithError("can not open the channel");
+    return;
+  }
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    if (session.Channel()->SendMessageSync(BenchCreateMessage(payload_size), kReplyTimeout) ==
+        nullptr) {
+      state.SkipWithError("no reply");
+      break;
+    }
+  }
+  BenchReport(state, payload_size, BenchAllocationCount() - allocations);
+  ReportRoundTrip(state, session.Connection().Metrics());
+}
+BENCHMARK(BM_RequestReply)
+    ->Arg(0)
+    ->Arg(4 * 1024)
+    ->Arg(256 * 1024)
+    ->ArgName("payload")
+    ->UseRealTime();
+
+// many requests in flight at the same time, so the batching of both ends is exercised
+static void BM_PipelinedRequests(benchmark::State& state) {
+  size_t depth = static_cast<size_t>(state.range(0));
+  LoopbackSession session;
+  if (session.Channel() == nullptr) {
+    state.SkipWithError("can not open the channel");
+    return;
+  }
+  std::vector<std::shared_ptr<DTXRequest>> requests;
+  requests.reserve(depth);
+  for (auto _ : state) {
+    requests.clear();
+    for (size_t i = 0; i < depth; ++i) {
+      requests.push_back(session.Channel()->SendMessage(BenchCreateMessage(0), kReplyTimeout));
+    }
+    bool replied = true;
+    for (auto& request : requests) {
+      replied = request->Get(kReplyTimeout) != nullptr && replied;
+    }
+    if (!replied) {
+      state.SkipWithError("no reply");
+      break;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * depth));
+  ReportRoundTrip(state, session.Connection().Metrics());
+}
+BENCHMARK(BM_PipelinedRequests)->Arg(1)->Arg(16)->Arg(128)->ArgName("depth")->UseRealTime();
+
+// the server pushes messages as fast as the client takes them, like a sampling service
+static void BM_Streaming(benchmark::State& state) {
+  size_t payload_size = static_cast<size_t>(state.range(0));
+  LoopbackSession session;
+  if (session.Channel() == nullptr) {
+    state.SkipWithError("can not open the channel");
+    return;
+  }
+  std::atomic<uint64_t> received_count(0);
+  session.Channel()->SetMessageHandler(
+      [&received_count](std::shared_ptr<DTXMessage> msg) { received_count++; });
+  if (!session.Server().StartStreaming(session.Channel()->ChannelIdentifier(), payload_size, 0)) {
+    state.SkipWithError("can not start streaming");
+    return;
+  }
+  uint64_t target = 0;
+  for (auto _ : state) {
+    target += kStreamBatch;
+    while (received_count.load(std::memory_order_relaxed) < target &&
+           session.Connection().IsConnected()) {
+      std::this_thread::yield();
+    }
+  }
+  session.Server().StopStreaming();
+  // the allocations are made by both ends, so they are not reported per message
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kStreamBatch * payload_size));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kStreamBatch));
+}
+BENCHMARK(BM_Streaming)
+    ->Arg(1024)
+    ->Arg(64 * 1024)
+    ->Arg(1024 * 1024)
+    ->ArgName("payload")
+    ->UseRealTime();
@@ -0,0 +1,102 @@
+#include "idevice/instrument/dtxmessageparser.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>  // std::min
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+
+using namespace idevice;
+
+static constexpr size_t kReceiveChunkSize = 16 * 1024;  // the size of each read of a connection
+
+static const char* const kCaptures[] = {
+    "dtxmsg_requestchannelwithcode.bin",
+    "dtxmsg_enableexpiredpidtracking.bin",
+    "dtxmsg_runningprocesses.bin",  // 3 fragments
+};
+
+// feed the bytes in chunks like the connection does, and take the messages out
+static bool ParseInChunks(DTXMessageParser& parser, const std::vector<char>& bytes,
+                          size_t chunk_size, size_t* message_count) {
+  for (size_t offset = 0; offset < bytes.size(); offset += chunk_size) {
+    if (!parser.ParseIncomingBytes(bytes.data() + offset,
+                                   std::min(chunk_size, bytes.size() - offset))) {
+      return false;
+    }
+  }
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  *message_count = messages.size();
+  return true;
+}
+
+static void BM_ParseCapture(benchmark::State& state) {
+  const char* filename = kCaptures[state.range(0)];
+  std::vector<char> bytes = BenchReadTestData(filename);
+  if (bytes.empty()) {
+    state.SkipWithError("can not read the capture");
+    return;
+  }
+  state.SetLabel(filename);
+  DTXMessageParser parser;
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    size_t message_count = 0;
+    if (!ParseInChunks(parser, bytes, bytes.size(), &message_count) || message_count != 1) {
+      state.SkipWithError("can not parse the capture");
+      break;
+    }
+  }
+  BenchReport(state, bytes.size(), BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_ParseCapture)->DenseRange(0, 2);
+
+// one large message split into 64KB fragments, received in 16KB chunks
+static void BM_ParseFragmentedStream(benchmark::State& state) {
+  size_t payload_size = static_cast<size_t>(state.range(0));
+  bool zero_copy = state.range(1) != 0;
+  std::vector<char> bytes = BenchEncodeMessages({BenchCreateMessage(payload_size)});
+  DTXMessageParser parser;
+  parser.SetZeroCopy(zero_copy);
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    size_t message_count = 0;
+    if (!ParseInChunks(parser, bytes, kReceiveChunkSize, &message_count) || message_count != 1) {
+      state.SkipWithError("can not parse the stream");
+      break;
+    }
+  }
+  BenchReport(state, bytes.size(), BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_ParseFragmentedStream)
+    ->ArgsProduct({{256 * 1024, 4 * 1024 * 1024}, {0, 1}})
+    ->ArgNames({"payload", "zero_copy"});
+
+// many small messages back to back, received in 16KB chunks which split some of them
+static void BM_ParseSmallMessageStream(benchmark::State& state) {
+  size_t message_count = static_cast<size_t>(state.range(0));
+  std::vector<std::shared_ptr<DTXMessage>> messages;
+  for (size_t i = 0; i < message_count; ++i) {
+    messages.push_back(BenchCreateMessage(100 + i % 200));
+  }
+  std::vector<char> bytes = BenchEncodeMessages(messages);
+  DTXMessageParser parser;
+  parser.SetZeroCopy(state.range(1) != 0);
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    size_t parsed_count = 0;
+    if (!ParseInChunks(parser, bytes, kReceiveChunkSize, &parsed_count) ||
+        parsed_count != message_count) {
+      state.SkipWithError("can not parse the stream");
+      break;
+    }
+  }
+  BenchReport(state, bytes.size(), BenchAllocationCount() - allocations);
+  state.counters["msgs/s"] = benchmark::Counter(static_cast<double>(message_count),
+                                                benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_ParseSmallMessageStream)
+    ->ArgsProduct({{1000}, {0, 1}})
+    ->ArgNames({"messages", "zero_copy"});
@@ -0,0 +1,163 @@
+#include "idevice/instrument/dtxmessagetransmitter.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>   // std::min
+#include <cstring>     // memcpy
+#include <functional>  // std::ref
+#include <vector>
+
+#include "bench_util.h"
+#include "idevice/utils/gatherbuffer.h"
+
+using namespace idevice;
+
+static const DTXMessageRoutingInfo kRoutingInfo = {1, 0, 1, 1};
+
+// a sink copying the frames into a reused buffer, like a socket would
+class CopyingSink {
+ public:
+  explicit CopyingSink(size_t capacity) { bytes_.reserve(capacity); }
+
+  void Clear() { bytes_.clear(); }
+
+  bool operator()(const char* data, size_t size) {
+    bytes_.insert(bytes_.end(), data, data + size);
+    return true;
+  }
+
+  size_t Size() const { return bytes_.size(); }
+
+ private:
+  std::vector<char> bytes_;
+};
+
+// a sink copying the frames into a fixed buffer over and over, like the send buffer of a socket,
+// so a large message is measured without growing a buffer of its size
+class StreamingSink {
+ public:
+  explicit StreamingSink(size_t capacity) : buffer_(capacity) {}
+
+  bool operator()(const char* data, size_t size) {
+    while (size > 0) {
+      size_t chunk = std::min(size, buffer_.size() - offset_);
+      memcpy(buffer_.data() + offset_, data, chunk);
+      offset_ = (offset_ + chunk) % buffer_.size();
+      data += chunk;
+      size -= chunk;
+      written_ += chunk;
+      writes_++;
+    }
+    return true;
+  }
+
+  size_t Written() const { return written_; }
+  size_t Writes() const { return writes_; }
+
+ private:
+  std::vector<char> buffer_;
+  size_t offset_ = 0;
+  size_t written_ = 0;
+  size_t writes_ = 0;
+};
+
+static std::shared_ptr<DTXMessage> CreateRequestChannelMessage() {
+  std::shared_ptr<DTXMessage> message =
+      DTXMessage::CreateWithSelector("_requestChannelWithCode:identifier:");
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int32_t>(1)));
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int64_t>(2)));
+  return message;
+}
+
+static void BM_TransmitMessage(benchmark::State& state) {
+  size_t payload_size = static_cast<size_t>(state.range(0));
+  std::shared_ptr<DTXMessage> message =
+      payload_size == 0 ? CreateRequestChannelMessage() : BenchCreateMessage(payload_size);
+  DTXMessageTransmitter transmitter;
+  size_t length = message->SerializedLength();
+  state.SetLabel(transmitter.FragmentsForLength(length) == 1 ? "single fragment"
+                                                            : "multiple fragments");
+  CopyingSink sink(length * 2);
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    sink.Clear();
+    if (!transmitter.TransmitMessage(message, kRoutingInfo, std::ref(sink))) {
+      state.SkipWithError("TransmitMessage failed");
+      break;
+    }
+  }
+  BenchReport(state, sink.Size(), BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_TransmitMessage)
+    ->Arg(0)
+    ->Arg(16 * 1024)
+    ->Arg(1024 * 1024)
+    ->Arg(16 * 1024 * 1024)
+    ->ArgName("payload");
+
+// large blobs(e.g. files and configs) split into many fragments, written straight from the payload
+static void BM_TransmitLargeMessage(benchmark::State& state) {
+  size_t payload_size = static_cast<size_t>(state.range(0));
+  std::shared_ptr<DTXMessage> message = BenchCreateMessage(payload_size);
+  DTXMessageTransmitter transmitter;
+  StreamingSink sink(256 * 1024);
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    if (!transmitter.TransmitMessage(message, kRoutingInfo, std::ref(sink))) {
+      state.SkipWithError("TransmitMessage failed");
+      break;
+    }
+  }
+  size_t iterations = state.iterations() > 0 ? static_cast<size_t>(state.iterations()) : 1;
+  BenchReport(state, sink.Written() / iterations, BenchAllocationCount() - allocations);
+  state.counters["fragments"] = transmitter.FragmentsForLength(message->SerializedLength()) + 1;
+  state.counters["writes/op"] = static_cast<double>(sink.Writes()) / iterations;
+}
+BENCHMARK(BM_TransmitLargeMessage)
+    ->Arg(1024 * 1024)
+    ->Arg(10 * 1024 * 1024)
+    ->Arg(100 * 1024 * 1024)
+    ->ArgName("payload")
+    ->Unit(benchmark::kMillisecond);
+
+// the path of the connections: the segments are referenced instead of being copied
+static void BM_GatherMessage(benchmark::State& state) {
+  size_t payload_size = static_cast<size_t>(state.range(0));
+  std::shared_ptr<DTXMessage> message = BenchCreateMessage(payload_size);
+  DTXMessageTransmitter transmitter;
+  GatherBuffer gathered;
+  size_t frame_size = 0;
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    gathered.Clear();
+    if (!transmitter.GatherMessage(message, kRoutingInfo, &gathered)) {
+      state.SkipWithError("GatherMessage failed");
+      break;
+    }
+    benchmark::DoNotOptimize(gathered.Segments().data());
+    frame_size = gathered.Size();
+  }
+  BenchReport(state, frame_size, BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_GatherMessage)
+    ->Arg(16 * 1024)
+    ->Arg(1024 * 1024)
+    ->Arg(16 * 1024 * 1024)
+    ->ArgName("payload");
+
+// the path of the connections for single-fragment messages: one reused contiguous frame
+static void BM_FrameMessage(benchmark::State& state) {
+  std::shared_ptr<DTXMessage> message = CreateRequestChannelMessage();
+  DTXMessageTransmitter transmitter;
+  BufferMemory frame;
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    if (!transmitter.FrameMessage(message, kRoutingInfo, &frame)) {
+      state.SkipWithError("FrameMessage failed");
+      break;
+    }
+    benchmark::DoNotOptimize(frame.GetPtr(0));
+  }
+  BenchReport(state, frame.Size(), BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_FrameMessage);
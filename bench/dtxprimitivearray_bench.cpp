@@ -0,0 +1,114 @@
+#include "idevice/instrument/dtxprimitivearray.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+
+using namespace idevice;
+
+static constexpr size_t kPayloadHeaderSize = 0x10;
+
+// the auxiliary of the capture, a dictionary with one large archived object
+static std::vector<char> ReadCapturedAuxiliary() {
+  std::vector<char> bytes = BenchReadTestData("dtxmsg_notifyofpublishedcapabilities.bin");
+  if (bytes.size() < kPayloadHeaderSize) {
+    return std::vector<char>();
+  }
+  uint32_t auxiliary_length = *reinterpret_cast<const uint32_t*>(bytes.data() + 0x04);
+  if (bytes.size() < kPayloadHeaderSize + auxiliary_length) {
+    return std::vector<char>();
+  }
+  return std::vector<char>(bytes.begin() + kPayloadHeaderSize,
+                           bytes.begin() + kPayloadHeaderSize + auxiliary_length);
+}
+
+// the auxiliary of a typical sampling request, many small items
+static std::vector<char> SerializeSyntheticAuxiliary() {
+  DTXPrimitiveArray array;
+  for (int i = 0; i < 64; ++i) {
+    switch (i % 4) {
+      case 0:
+        array.Append(DTXPrimitiveValue(static_cast<int32_t>(i)));
+        break;
+      case 1:
+        array.Append(DTXPrimitiveValue(static_cast<int64_t>(i) << 32));
+        break;
+      case 2:
+        array.Append(DTXPrimitiveValue(static_cast<double>(i) / 3));
+        break;
+      default: {
+        std::string text = "item-" + std::to_string(i);
+        array.Append(DTXPrimitiveValue(const_cast<char*>(text.data()), text.size()));
+        break;
+      }
+    }
+  }
+  std::vector<char> bytes;
+  array.SerializeTo([&bytes](const char* data, size_t size) {
+    bytes.insert(bytes.end(), data, data + size);
+    return true;
+  });
+  return bytes;
+}
+
+static std::vector<char> AuxiliaryOf(benchmark::State& state) {
+  if (state.range(0) == 0) {
+    state.SetLabel("capture");
+    return ReadCapturedAuxiliary();
+  }
+  state.SetLabel("synthetic");
+  return SerializeSyntheticAuxiliary();
+}
+
+static void BM_PrimitiveArrayDeserialize(benchmark::State& state) {
+  std::vector<char> bytes = AuxiliaryOf(state);
+  bool should_copy = state.range(1) != 0;
+  if (bytes.empty()) {
+    state.SkipWithError("can not read the auxiliary");
+    return;
+  }
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    std::unique_ptr<DTXPrimitiveArray> array =
+        DTXPrimitiveArray::Deserialize(bytes.data(), bytes.size(), should_copy);
+    if (array == nullptr) {
+      state.SkipWithError("can not deserialize the auxiliary");
+      break;
+    }
+    benchmark::DoNotOptimize(array.get());
+  }
+  BenchReport(state, bytes.size(), BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_PrimitiveArrayDeserialize)
+    ->ArgsProduct({{0, 1}, {0, 1}})
+    ->ArgNames({"synthetic", "copy"});
+
+static void BM_PrimitiveArraySerialize(benchmark::State& state) {
+  std::vector<char> bytes = AuxiliaryOf(state);
+  std::unique_ptr<DTXPrimitiveArray> array =
+      bytes.empty() ? nullptr : DTXPrimitiveArray::Deserialize(bytes.data(), bytes.size());
+  if (array == nullptr) {
+    state.SkipWithError("can not deserialize the auxiliary");
+    return;
+  }
+  std::vector<char> output;
+  output.reserve(array->SerializedLength());
+  uint64_t allocations = BenchAllocationCount();
+  for (auto _ : state) {
+    output.clear();
+    bool ret = array->SerializeTo([&output](const char* data, size_t size) {
+      output.insert(output.end(), data, data + size);
+      return true;
+    });
+    if (!ret) {
+      state.SkipWithError("can not serialize the auxiliary");
+      break;
+    }
+    benchmark::DoNotOptimize(output.data());
+  }
+  BenchReport(state, array->SerializedLength(), BenchAllocationCount() - allocations);
+}
+BENCHMARK(BM_PrimitiveArraySerialize)->Arg(0)->Arg(1)->ArgName("synthetic");
@@ -0,0 +1,130 @@
+#ifndef IDEVICE_COMMON_LOGGER_H
+#define IDEVICE_COMMON_LOGGER_H
+
+#include <atomic>
+#include <climits>  // INT_MIN
+#include <cstddef>
+#include <cstdint>
+#include <functional>  // std::function
+
+#if defined(__GNUC__) || defined(__clang__)
+#define IDEVICE_LOGGER_PRINTF_FORMAT(format_index, args_index) \
+  __attribute__((format(printf, format_index, args_index)))
+#else
+#define IDEVICE_LOGGER_PRINTF_FORMAT(format_index, args_index)
+#endif
+
+namespace idevice {
+
+/**
+ * The levels of the logs, a log is written if its level is not greater than the current level
+ */
+enum LogLevel : int {
+  kLogLevelError = 0,
+  kLogLevelInfo = 1,
+  kLogLevelDebug = 2,
+  kLogLevelVerbose = 3,
+};
+
+/**
+ * The logger behind the `IDEVICE_LOG_*` macros of "macro_def.h"
+ *
+ * The logs are filtered twice:
+ * - at compile time, the macros above `IDEVICE_LOG_LEVEL` expand to nothing
+ * - at runtime, the others check the current level first, which is one relaxed load and one
+ *   branch, so the arguments are not even evaluated if the log is disabled
+ *
+ * The enabled logs are formatted by the calling thread into a slot of a bounded lock-free ring,
+ * and written out by a background writer thread, so the hot paths never wait for the lock of
+ * stdout. If the ring is full, the log is dropped rather than blocking the caller, and the writer
+ * reports the count of the dropped logs. The logs still in the ring are written out at exit, call
+ * `Flush()` to write them out earlier, e.g. before a crash is expected.
+ *
+ * The initial level is `kLogLevelInfo`, or the value of the environment variable
+ * `IDEVICE_LOG_LEVEL`(0-3) if it's set, which is read on the first use of the level.
+ */
+class Logger {
+ public:
+  /**
+   * Receiver of the formatted logs, called on the writer thread
+   *
+   * @param level the level of the log
+   * @param line the formatted log, e.g. "[INFO] file.cpp:12:Func(): text\n"
+   * @param size size of the log
+   */
+  using Writer = std::function<void(int level, const char* line, size_t size)>;
+
+  /**
+   * Check whether the logs of the level are enabled at runtime
+   *
+   * @param level the level
+   * @return enabled or not
+   */
+  static bool IsEnabled(int level) { return level <= Level(); }
+
+  /**
+   * Set the runtime level
+   *
+   * @param level the level, e.g. `kLogLevelDebug`
+   */
+  static void SetLevel(int level) { level_.store(level, std::memory_order_relaxed); }
+
+  /**
+   * Get the runtime level
+   *
+   * @return int the level
+   */
+  static int Level() {
+    int level = level_.load(std::memory_order_relaxed);
+    return level != kLevelUnset ? level : InitLevel();
+  }
+
+  /**
+   * Set the receiver of the formatted logs
+   *
+   * @param writer the receiver, null to restore the default one, which writes the errors to stderr
+   * and the others to stdout
+   */
+  static void SetWriter(Writer writer);
+
+  /**
+   * Format a log and queue it for the writer thread, use the `IDEVICE_LOG_*` macros instead
+   * The message is truncated if it's longer than `kMaxMessageSize`.
+   *
+   * @param level the level
+   * @param file the source file, it must be a string literal, e.g. `__FILE__`
+   * @param line the line in the source file
+   * @param function the function, it must be a string literal, e.g. `__FUNCTION__`
+   * @param format the printf-style format
+   */
+  static void Write(int level, const char* file, int line, const char* function,
+                    const char* format, ...) IDEVICE_LOGGER_PRINTF_FORMAT(5, 6);
+
+  /**
+   * Wait until the logs queued so far have been written out
+   */
+  static void Flush();
+
+  /**
+   * Get the count of logs dropped because the ring was full
+   *
+   * @return uint64_t the count
+   */
+  static uint64_t DroppedCount();
+
+  static constexpr size_t kMaxMessageSize = 400;  ///< in bytes, not including the prefix
+  static constexpr size_t kRingCapacity = 1024;   ///< count of logs waiting for the writer
+
+ private:
+  static constexpr int kLevelUnset = INT_MIN;  ///< the environment has not been read yet
+
+  static int InitLevel();
+
+  static std::atomic<int> level_;
+};  // class Logger
+
+}  // namespace idevice
+
+#undef IDEVICE_LOGGER_PRINTF_FORMAT
+
+#endif  // IDEVICE_COMMON_LOGGER_H
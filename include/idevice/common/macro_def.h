@@ -18,29 +18,44 @@
 #define IDEVICE_DEBUG 1
 #endif
 
-// LOG 
-#define IDEVICE_LOG_LEVEL 2
+// LOG
+// the compile-time floor, the logs above it are compiled out, while the others are filtered by the
+// runtime level of the `Logger`. it can be set with `-DIDEVICE_LOG_FLOOR=<0-3>`.
+#include "idevice/common/logger.h"
+#if defined(IDEVICE_LOG_FLOOR)
+#define IDEVICE_LOG_LEVEL IDEVICE_LOG_FLOOR
+#elif IDEVICE_DEBUG
+#define IDEVICE_LOG_LEVEL 3
+#else
+#define IDEVICE_LOG_LEVEL 1
+#endif
+// whether the logs of the level are enabled by both the floor and the runtime level, for the dumps
+// which are not written with the macros below(e.g. `hexdump()`)
+#define IDEVICE_LOG_ENABLED(level) \
+  ((level) <= IDEVICE_LOG_LEVEL && idevice::Logger::IsEnabled(level))
+#define IDEVICE_LOG(level, fmt, ...) \
+  do { \
+    if (idevice::Logger::IsEnabled(level)) { \
+      idevice::Logger::Write(level, __FILE__, __LINE__, __FUNCTION__, fmt, ##__VA_ARGS__); \
+    } \
+  } while (0)
 #if IDEVICE_LOG_LEVEL >= 0
-#define IDEVICE_LOG_E(fmt, ...) \
-  fprintf(stderr, "[ERROR] %s:%d:%s(): " fmt, __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)
+#define IDEVICE_LOG_E(fmt, ...) IDEVICE_LOG(idevice::kLogLevelError, fmt, ##__VA_ARGS__)
 #else
 #define IDEVICE_LOG_E(fmt, ...)
 #endif
 #if IDEVICE_LOG_LEVEL >= 1
-#define IDEVICE_LOG_I(fmt, ...) \
-  printf("[INFO] %s:%d:%s(): " fmt, __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)
+#define IDEVICE_LOG_I(fmt, ...) IDEVICE_LOG(idevice::kLogLevelInfo, fmt, ##__VA_ARGS__)
 #else
 #define IDEVICE_LOG_I(fmt, ...)
 #endif
 #if IDEVICE_LOG_LEVEL >= 2
-#define IDEVICE_LOG_D(fmt, ...) \
-  printf("[DEBUG] %s:%d:%s(): " fmt, __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)
+#define IDEVICE_LOG_D(fmt, ...) IDEVICE_LOG(idevice::kLogLevelDebug, fmt, ##__VA_ARGS__)
 #else
 #define IDEVICE_LOG_D(fmt, ...)
 #endif
 #if IDEVICE_LOG_LEVEL >= 3
-#define IDEVICE_LOG_V(fmt, ...) \
-  printf("[VERBOSE] %s:%d:%s(): " fmt, __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)
+#define IDEVICE_LOG_V(fmt, ...) IDEVICE_LOG(idevice::kLogLevelVerbose, fmt, ##__VA_ARGS__)
 #else
 #define IDEVICE_LOG_V(fmt, ...)
 #endif
@@ -77,17 +92,12 @@
 
 // DTXMESSAGE
 #define IDEVICE_DUMP_DTXMESSAGE_HEADER(header) \
-  printf("==============\n"); \
-  printf("magic: %x\n", (header).magic); \
-  printf("message_header_size: %d\n", (header).message_header_size); \
-  printf("fragment_index: %d\n", (header).fragment_index); \
-  printf("fragment_count: %d\n", (header).fragment_count); \
-  printf("length: %d\n", (header).length); \
-  printf("identifier: %d\n", (header).identifier); \
-  printf("conversation_index: %d\n", (header).conversation_index); \
-  printf("channel_code: %d\n", (header).channel_code); \
-  printf("expects_reply: %d\n", (header).expects_reply); \
-  printf("==============\n"); \
+  IDEVICE_LOG_V("message header: magic: %x, message_header_size: %d, fragment_index: %d, " \
+                "fragment_count: %d, length: %d, identifier: %d, conversation_index: %d, " \
+                "channel_code: %d, expects_reply: %d\n", \
+                (header).magic, (header).message_header_size, (header).fragment_index, \
+                (header).fragment_count, (header).length, (header).identifier, \
+                (header).conversation_index, (header).channel_code, (header).expects_reply)
 
 #define IDEVICE_DTXMESSAGE_IDENTIFIER(channel_code, msg_identifier) static_cast<uint64_t>(channel_code) << 32 | msg_identifier
 
@@ -6,6 +6,8 @@
 
 // LOG
 #undef IDEVICE_LOG_LEVEL
+#undef IDEVICE_LOG_ENABLED
+#undef IDEVICE_LOG
 #undef IDEVICE_LOG_E
 #undef IDEVICE_LOG_I
 #undef IDEVICE_LOG_D
@@ -0,0 +1,125 @@
+#ifndef IDEVICE_INSTRUMENT_DEVICEFLEET_H
+#define IDEVICE_INSTRUMENT_DEVICEFLEET_H
+
+#include <cstdint>
+#include <map>
+#include <memory>  // std::unique_ptr, std::shared_ptr
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "idevice/utils/executor.h"
+#include "idevice/instrument/dtxconnection.h"
+#include "idevice/instrument/dtxeventloop.h"
+#include "idevice/instrument/dtxtransport.h"
+
+namespace idevice {
+
+/**
+ * Aggregate counters of a fleet
+ */
+struct DeviceFleetStat {
+  size_t device_count;             ///< count of devices added
+  size_t connected_count;          ///< count of devices still connected
+  size_t pending_send_count;       ///< count of messages waiting in the send queues of all devices
+  std::vector<size_t> loop_loads;  ///< count of devices driven by each event loop
+  ExecutorStat dispatch;           ///< counters of the shared dispatch executor
+};
+
+/**
+ * A manager of the connections of many devices
+ *
+ * All connections share a fixed number of threads instead of running three threads each: a few
+ * event loops do the IO and the parsing(see `DTXEventLoop`), and one `SerialExecutor` runs the
+ * message handlers, which keeps the messages of each channel of each device in order.
+ * A new device goes to the event loop driving the fewest devices. The devices whose transports
+ * can't be driven by an event loop, or all devices on the platforms without event loops, fall back
+ * to the threads of their own.
+ *
+ * The connections handed out by the fleet are shared: a removed device is disconnected at once,
+ * but it's only destructed once the handlers already dispatched for it have run, and the
+ * connections returned by `Add()` and `Find()` are released.
+ *
+ * NOTE: the fleet must not be destructed by a handler, as it waits for the pending handlers.
+ */
+class DeviceFleet {
+ public:
+  /**
+   * Constructor
+   *
+   * @param io_thread_count count of event loops, 0 for the count of cores
+   * @param dispatch_thread_count count of threads running the handlers, 0 for the count of cores
+   */
+  explicit DeviceFleet(size_t io_thread_count = 0, size_t dispatch_thread_count = 0);
+
+  /**
+   * Destructor, all devices are disconnected, and it waits for their pending handlers
+   */
+  ~DeviceFleet();
+
+  DeviceFleet(const DeviceFleet&) = delete;
+  void operator=(const DeviceFleet&) = delete;
+
+  /**
+   * Add a device and connect to it
+   *
+   * @param name a unique name of the device, e.g. the UDID
+   * @param transport the transport to the device, the fleet takes it over
+   * @return std::shared_ptr<DTXConnection> the connection, which keeps the device alive, null if
+   * failed to connect or the name exists
+   */
+  std::shared_ptr<DTXConnection> Add(const std::string& name,
+                                     std::unique_ptr<IDTXTransport> transport);
+
+  /**
+   * Disconnect from a device and remove it
+   * It doesn't wait for the pending handlers of the device, the device is destructed on a thread
+   * of the dispatch executor once they have run.
+   *
+   * @param name name of the device
+   * @return true if the device existed
+   */
+  bool Remove(const std::string& name);
+
+  /**
+   * Find the connection of a device
+   *
+   * @param name name of the device
+   * @return std::shared_ptr<DTXConnection> the connection, which stays valid even if the device is
+   * removed meanwhile(it's disconnected then), null if not found
+   */
+  std::shared_ptr<DTXConnection> Find(const std::string& name) const;
+
+  /**
+   * Get the names of all devices
+   *
+   * @return std::vector<std::string> the names
+   */
+  std::vector<std::string> Names() const;
+
+  /**
+   * Get the aggregate counters of all devices
+   *
+   * @return DeviceFleetStat the counters
+   */
+  DeviceFleetStat Stat() const;
+
+ private:
+  struct Device {
+    std::unique_ptr<IDTXTransport> transport;
+    std::unique_ptr<DTXConnection> connection;
+    DTXEventLoop* event_loop;  // null if driven by the threads of its own
+  };
+
+  DTXEventLoop* LeastLoadedEventLoop() const;
+
+  std::vector<std::unique_ptr<DTXEventLoop>> event_loops_;  // only the started ones
+  std::shared_ptr<SerialExecutor> dispatch_executor_;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<Device>> devices_;
+};  // class DeviceFleet
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DEVICEFLEET_H
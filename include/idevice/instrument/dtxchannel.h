@@ -50,6 +50,17 @@ class DTXChannel /* : public DTXMessenger */ {
   std::shared_ptr<DTXMessage> SendMessageSync(std::shared_ptr<DTXMessage> msg,
                                               uint32_t timeout_ms = -1);
 
+  /**
+   * Send message, and get a handle of the request waiting for the response, see
+   * `DTXMessenger::SendMessage()`
+   *
+   * @param msg message to be sent
+   * @param timeout_ms the deadline from now in milliseconds, -1 means no deadline
+   * @return std::shared_ptr<DTXRequest> the request
+   */
+  std::shared_ptr<DTXRequest> SendMessage(std::shared_ptr<DTXMessage> msg,
+                                          uint32_t timeout_ms = -1);
+
   /**
    * Send message asynchronously
    *
@@ -58,6 +69,13 @@ class DTXChannel /* : public DTXMessenger */ {
    */
   void SendMessageAsync(std::shared_ptr<DTXMessage> msg, DTXMessenger::ReplyHandler callback);
 
+  /**
+   * Send a batch of messages asynchronously, in order, see `DTXMessenger::SendMessagesAsync()`
+   *
+   * @param batch messages to be sent, with the callbacks for their responses
+   */
+  void SendMessagesAsync(std::vector<DTXMessenger::MessageWithHandler> batch);
+
   /**
    * Get the handler for response messages of this channel.
    * When the message does not have a specific handler, it is routed to the channel's handler.
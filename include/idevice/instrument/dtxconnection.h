@@ -3,20 +3,31 @@
 
 #include <atomic>
 #include <memory>  // std::unique_ptr, std::shared_ptr
+#include <mutex>
 #include <thread>
 #include <unordered_map>
 #include <utility>  // std::pair
+#include <vector>
 
-#include "idevice/utils/blockingqueue.h"
+#include "idevice/utils/bufferpool.h"
+#include "idevice/utils/bytewatermark.h"
+#include "idevice/utils/executor.h"
+#include "idevice/utils/ringqueue.h"
+#include "idevice/utils/shardedmap.h"
+#include "idevice/utils/timingwheel.h"
 #include "idevice/instrument/dtxchannel.h"
 #include "idevice/instrument/dtxmessage.h"
 #include "idevice/instrument/dtxmessageparser.h"
 #include "idevice/instrument/dtxmessagetransmitter.h"
 #include "idevice/instrument/dtxmessenger.h"
+#include "idevice/instrument/dtxmetrics.h"
+#include "idevice/instrument/dtxrequest.h"
 #include "idevice/instrument/dtxtransport.h"
 
 namespace idevice {
 
+class DTXEventLoop;
+
 /**
  * The connection for communication with instrument service using DTXMessage protocol.
  */
@@ -32,14 +43,20 @@ class DTXConnection : public DTXMessenger {
    * 
    * @param transport A transport
    */
-  DTXConnection(IDTXTransport* transport) : transport_(transport) {}
+  DTXConnection(IDTXTransport* transport)
+      : send_queue_(kSendQueueCapacity),
+        receive_queue_(kReceiveQueueCapacity),
+        receive_watermark_(
+            new ByteWatermark(kDefaultReceiveHighWatermark, kDefaultReceiveLowWatermark)),
+        deadlines_(kDeadlineTick, NowMs()),
+        transport_(transport) {}
 
   /**
    * Destructor
+   * The requests still pending are left pending, while they can't be cancelled through this
+   * connection any more.
    */
-  virtual ~DTXConnection() {
-    // IDEVICE_ASSERT(!IsConnected());
-  }
+  virtual ~DTXConnection();
 
   /**
    * Connect to the service 
@@ -48,6 +65,18 @@ class DTXConnection : public DTXMessenger {
    */
   bool Connect();
 
+  /**
+   * Connect to the service, and let an event loop drive this connection instead of the threads
+   * of its own
+   * The transport must support `IDTXTransport::PollableFd()`. The reply handlers and the message
+   * handlers of channels run on the loop thread unless a dispatch executor is set, see
+   * `SetDispatchExecutor()`.
+   *
+   * @param event_loop the event loop, null to connect with the threads
+   * @return succeed or fail
+   */
+  bool Connect(DTXEventLoop* event_loop);
+
   /**
    * Disconnect from the service
    * 
@@ -80,14 +109,27 @@ class DTXConnection : public DTXMessenger {
 
   /**
    * Send message synchronously
+   * If it times out, the request is cancelled, so a response arriving later is dropped.
    *
    * @param msg message to be sent
-   * @param timeout_ms timeout in milliseconds
-   * @return std::shared_ptr<DTXMessage> the response message
+   * @param timeout_ms timeout in milliseconds, -1 means wait forever
+   * @return std::shared_ptr<DTXMessage> the response message, null if timed out or disconnected
    */
   virtual std::shared_ptr<DTXMessage> SendMessageSync(std::shared_ptr<DTXMessage> msg,
                                                       uint32_t timeout_ms = -1) override;
 
+  /**
+   * Send message, and get a handle of the request waiting for the response
+   * The deadlines are checked every 100ms by the parsing thread, or by the event loop driving this
+   * connection. All pending requests fail when it's disconnected.
+   *
+   * @param msg message to be sent
+   * @param timeout_ms the deadline from now in milliseconds, -1 means no deadline
+   * @return std::shared_ptr<DTXRequest> the request, never null
+   */
+  virtual std::shared_ptr<DTXRequest> SendMessage(std::shared_ptr<DTXMessage> msg,
+                                                  uint32_t timeout_ms = -1) override;
+
   /**
    * Send message asynchronously
    *
@@ -97,6 +139,147 @@ class DTXConnection : public DTXMessenger {
   virtual void SendMessageAsync(std::shared_ptr<DTXMessage> msg,
                                 ReplyHandler callback) override;
 
+  /**
+   * Enable or disable the direct receive mode, it must be set before connecting
+   * In direct receive mode, the receive thread reads into recycled buffers from a pool, and the
+   * parser takes these buffers over instead of copying them, so there is neither heap allocation
+   * per read nor a second copy of the data. The buffers and their references are recycled through
+   * lock-free rings, and the packets are queued by value. The reads still hop from the receive
+   * thread to the parsing thread through a queue, unless the connection is driven by an event loop,
+   * which parses them on the loop thread.
+   *
+   * @param direct_receive enable or not
+   */
+  void SetDirectReceive(bool direct_receive) { direct_receive_ = direct_receive; }
+
+  /**
+   * Enable or disable the zero-copy mode of the parser, it must be set before connecting
+   * See `DTXMessageParser::SetZeroCopy()`
+   *
+   * @param zero_copy enable or not
+   */
+  void SetZeroCopy(bool zero_copy) { incoming_parser_.SetZeroCopy(zero_copy); }
+
+  /**
+   * Enable or disable the compression, it must be set before connecting
+   * If it's enabled, the connection advertises the support of compression to the service when it
+   * connects, then the service may compress large payloads, which is worth it if the bandwidth is
+   * the bottleneck. Compressed messages are always accepted, whether it's enabled or not.
+   *
+   * @param compression enable or not
+   */
+  void SetCompression(bool compression) { compression_ = compression; }
+
+  /**
+   * Set the executor running the reply handlers and the message handlers of channels, it must be
+   * set before connecting
+   * By default the handlers run inline on the parsing thread, so a slow handler holds up the
+   * parsing of all following messages. The key of every handler is its channel code, so a
+   * `SerialExecutor` keeps the messages of each channel in order, while a `ThreadPoolExecutor`
+   * keeps no order at all.
+   *
+   * @param executor the executor, null for the inline executor
+   */
+  void SetDispatchExecutor(std::shared_ptr<Executor> executor) {
+    dispatch_executor_ = executor ? std::move(executor) : std::make_shared<InlineExecutor>();
+  }
+
+  /**
+   * Get the counters of the dispatch executor, e.g. the count of handlers waiting to run
+   *
+   * @return ExecutorStat the counters
+   */
+  ExecutorStat DispatchStat() const { return dispatch_executor_->Stat(); }
+
+  /**
+   * Send a batch of messages asynchronously, in order
+   * The messages are queued all at once(up to 256 at a time), so the sender never takes only a
+   * part of them, and they are written out together with as few writes as possible, see
+   * `SetSendCoalescingWindow()`. The callbacks of the messages which can't be queued(e.g. it's
+   * disconnected) are called with a null message.
+   *
+   * @param batch messages to be sent, with the callbacks for their responses
+   */
+  virtual void SendMessagesAsync(std::vector<MessageWithHandler> batch) override;
+
+  /**
+   * Set how long the send thread waits for more messages before writing out the queued ones, it
+   * must be set before connecting
+   * The sender always writes out everything queued(up to 256 messages or about 1MB) together. With
+   * a window, it also waits for the messages queued shortly afterwards, which trades a little
+   * latency for fewer writes. It doesn't apply to the connections driven by an event loop.
+   *
+   * @param window_ms the window in milliseconds, 0 by default
+   */
+  void SetSendCoalescingWindow(uint32_t window_ms) { send_coalescing_window_ms_ = window_ms; }
+
+  /**
+   * Set the watermarks of the pending incoming bytes, it must be set before connecting
+   * The bytes received but not parsed yet, and the messages waiting for their handlers(see
+   * `SetDispatchExecutor()`) are pending. When they reach the high watermark, the connection stops
+   * reading from the transport until they drop to the low watermark, so the memory is bounded and
+   * the backpressure reaches the device. By default it pauses at 64MB and resumes at 32MB.
+   *
+   * @param high_watermark pause reading at this many bytes, 0 means never
+   * @param low_watermark resume reading at this many bytes
+   * @param handler called on the thread crossing a watermark, with true when it pauses and false
+   * when it resumes, it must not block
+   */
+  void SetReceiveWatermarks(size_t high_watermark, size_t low_watermark,
+                            ByteWatermark::Listener handler = nullptr) {
+    receive_watermark_->SetWatermarks(high_watermark, low_watermark);
+    receive_watermark_handler_ = std::move(handler);
+  }
+
+  /**
+   * Get the counters of the pending incoming bytes
+   *
+   * @return const ByteWatermark& the counters, see `SetReceiveWatermarks()`
+   */
+  const ByteWatermark& ReceiveWatermark() const { return *receive_watermark_; }
+
+  /**
+   * Set how long the callbacks of `SendMessageAsync()` wait for the responses, it must be set
+   * before connecting
+   * Once a callback times out, it's called with a null message, so it must handle that. Without
+   * a timeout, the callbacks of lost responses are kept until it's disconnected.
+   *
+   * @param timeout_ms timeout in milliseconds, -1 by default which means wait forever
+   */
+  void SetReplyTimeout(uint32_t timeout_ms) { reply_timeout_ms_ = timeout_ms; }
+
+  /**
+   * Get the count of messages waiting for their responses, including the requests
+   *
+   * @return size_t the count
+   */
+  size_t PendingReplyCount() const { return _handlers_by_identifier_.Size(); }
+
+  /**
+   * Get the count of requests and callbacks which have timed out
+   *
+   * @return uint64_t the count
+   */
+  uint64_t ExpiredReplyCount() const {
+    return expired_reply_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the count of messages waiting in the send queue
+   *
+   * @return size_t the count
+   */
+  size_t SendQueueSize() const { return send_queue_.Size(); }
+
+  /**
+   * Get a snapshot of the metrics, it can be called from any thread
+   * The counters are updated without any lock, so they are always on, while the snapshot is not
+   * atomic as a whole, e.g. a message may be counted by its channel but not by the connection yet.
+   *
+   * @return DTXConnectionMetrics the snapshot
+   */
+  DTXConnectionMetrics Metrics() const;
+
   /**
    * Dump all stat of this connection 
    * Used for debugging
@@ -105,22 +288,66 @@ class DTXConnection : public DTXMessenger {
 
  private:
   struct Packet {
-    char* buffer;
-    size_t size;
+    char* buffer = nullptr;
+    size_t size = 0;
+    SharedBufferMemory memory;  // the pooled buffer in direct receive mode, otherwise null
+  };
+
+  friend class DTXEventLoop;
+
+  // a message being written out, its serialized length walks all auxiliary items, so it's only
+  // computed once
+  struct OutgoingMessage {
+    std::shared_ptr<DTXMessage> message;
+    DTXMessageRoutingInfo routing_info;
+    size_t serialized_length;
+  };
+
+  // what waits for the response of a message, either a callback or a request
+  struct PendingReply {
+    ReplyHandler handler;
+    std::shared_ptr<DTXRequest> request;
+    uint64_t sent_us = 0;  ///< when it was queued, for the round trip
   };
 
   void StartSendThread();
   void SendThread();
   void StopSendThread(bool await);
+  DTXMessageWithRoutingInfo PrepareMessage(std::shared_ptr<DTXMessage> msg,
+                                           PendingReply pending_reply, uint32_t timeout_ms);
+  bool EnqueueMessages(DTXMessageWithRoutingInfo* messages, size_t count,
+                       DTXEventLoop* event_loop);
+  void AbandonMessages(const DTXMessageWithRoutingInfo* messages, size_t count,
+                       DTXRequestStatus status);
+  void WakeupSender(DTXEventLoop* event_loop);
+  void FlushSendQueue();
+  void AddToSendBatch(DTXMessageWithRoutingInfo&& message_with_routing_info);
+  void CollectSendBatch(uint32_t window_ms);
+  bool SendBatch();
+  void FinishSendBatch();
+  static bool TrimSegments(std::vector<IoVec>* segments, size_t sent);
+  void HandleWritable();
 
   void StartReceiveThread();
   void ReceiveThread();
   void StopReceiveThread(bool await);
+  bool NewPacket(Packet* packet);
+  static void FreePacket(Packet* packet);
+  void HandleReadable();
 
   void StartParsingThread();
   void ParsingThread();
   void StopParsingThread(bool await);
+  bool ParsePacket(Packet* packet);
+  void Dispatch(uint64_t key, ReplyHandler handler, std::shared_ptr<DTXMessage> msg, size_t bytes);
+  void ExpireRequests();
+  void ScheduleDeadline(ReplyIdentifier reply_identifier, uint32_t timeout_ms);
+  static uint64_t NowMs();
+  static uint64_t NowUs();
+  void FailPendingReplies();
+  void WatchReceiveWatermark();
 
+  void PublishCapabilities();
   void RouteMessage(std::shared_ptr<DTXMessage> msg);
   void ReplyMessage(std::shared_ptr<DTXMessage> msg);
 
@@ -133,16 +360,58 @@ class DTXConnection : public DTXMessenger {
   std::atomic_bool parsing_thread_running_ = ATOMIC_VAR_INIT(false);
   std::unique_ptr<std::thread> parsing_thread_ = nullptr;  ///< consumer of incoming packets
 
-  BlockingQueue<DTXMessageWithRoutingInfo> send_queue_;
-  BlockingQueue<std::unique_ptr<Packet>> receive_queue_;
+  static constexpr size_t kSendQueueCapacity = 4096;    ///< max count of queued outgoing messages
+  static constexpr size_t kReceiveQueueCapacity = 1024;  ///< max count of queued incoming packets
+  static constexpr size_t kDefaultReceiveHighWatermark = 64 * 1024 * 1024;  ///< pending bytes
+  static constexpr size_t kDefaultReceiveLowWatermark = 32 * 1024 * 1024;
+
+  MpscRingQueue<DTXMessageWithRoutingInfo> send_queue_;  ///< fed by any thread, drained by the sender
+  SpscRingQueue<Packet> receive_queue_;  ///< from the receiver to the parser
+  std::shared_ptr<ByteWatermark> receive_watermark_;  ///< shared with the pending dispatch tasks
+  ByteWatermark::Listener receive_watermark_handler_;
 
   std::atomic<ChannelIdentifier> next_channel_code_ = ATOMIC_VAR_INIT(1);
-  std::unordered_map<ChannelIdentifier, std::shared_ptr<DTXChannel>> channels_by_code_;
+  // both maps are written by the callers and read by the parsing thread
+  ShardedMap<ChannelIdentifier, std::shared_ptr<DTXChannel>> channels_by_code_;
+
+  ShardedMap<ReplyIdentifier, PendingReply> _handlers_by_identifier_;
 
-  std::unordered_map<ReplyIdentifier, ReplyHandler> _handlers_by_identifier_;
+  static constexpr uint32_t kDeadlineTick = 10;  ///< resolution of the deadlines in milliseconds
+  std::mutex deadlines_mutex_;
+  // the pending replies with a deadline, an entry is left behind when its reply arrives in time
+  TimingWheel<ReplyIdentifier> deadlines_;
+  uint32_t reply_timeout_ms_ = -1;  ///< of the callbacks
+  std::atomic<uint64_t> expired_reply_count_ = ATOMIC_VAR_INIT(0);
 
   std::atomic<MessageIdentifier> next_msg_identifier_ = ATOMIC_VAR_INIT(1);
 
+  DTXMetrics metrics_;
+
+  bool direct_receive_ = false;
+  bool compression_ = false;
+  std::shared_ptr<Executor> dispatch_executor_ = std::make_shared<InlineExecutor>();
+  std::shared_ptr<BufferPool> receive_buffer_pool_ = nullptr;
+
+  std::atomic<DTXEventLoop*> event_loop_ = ATOMIC_VAR_INIT(nullptr);  ///< null if driven by threads
+  std::mutex disconnect_mutex_;
+  std::atomic_bool send_scheduled_ = ATOMIC_VAR_INIT(false);  ///< woken up the loop to send or not
+  bool driven_by_loop_ = false;  ///< set by `Connect()`, the writes must not block then
+  bool loop_reading_ = true;     ///< the events watched by the loop, guarded by its interest mutex
+  bool loop_writing_ = false;
+
+  static constexpr size_t kMaxSendBatchCount = 256;          ///< max count of messages per write
+  static constexpr size_t kMaxSendBatchBytes = 1024 * 1024;  ///< max bytes per write, roughly
+
+  uint32_t send_coalescing_window_ms_ = 0;
+  std::vector<OutgoingMessage> send_batch_;  ///< messages being written out together
+  size_t send_batch_bytes_ = 0;              ///< serialized length of the batch
+  BufferMemory frame_buffer_;  ///< reused for the batches of one single-fragment message
+  GatherBuffer send_buffer_;   ///< reused for all other batches
+  // the unsent segments of the batch, when the transport of the loop took only a part of it, the
+  // rest is written once it's writable, and the queued messages wait until then
+  std::vector<IoVec> send_tail_;
+  bool send_blocked_ = false;
+
   IDTXTransport* transport_;
   DTXMessageParser incoming_parser_;
   DTXMessageTransmitter outgoing_transmitter_;
@@ -0,0 +1,285 @@
+#ifndef IDEVICE_INSTRUMENT_DTXCOROUTINE_H
+#define IDEVICE_INSTRUMENT_DTXCOROUTINE_H
+
+/**
+ * Optional C++20 coroutine layer over the request API
+ *
+ * Built with C++20(see the IDEVICE_ENABLE_COROUTINES option of CMake), IDEVICE_HAS_COROUTINES is 1
+ * and the helpers below let a coroutine await requests and messages instead of blocking a thread:
+ *
+ *   DTXTask Sample(std::shared_ptr<DTXChannel> channel, std::shared_ptr<Executor> executor) {
+ *     std::shared_ptr<DTXMessage> reply =
+ *         co_await Send(*channel, DTXMessage::CreateWithSelector("start"), 1000, executor);
+ *     DTXMessageStream stream(channel, executor);
+ *     while (std::shared_ptr<DTXMessage> msg = co_await stream.Next()) {
+ *       ...
+ *     }
+ *   }
+ *
+ * Otherwise IDEVICE_HAS_COROUTINES is 0 and this header declares nothing, so the C++14 API stays
+ * buildable as is.
+ */
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define IDEVICE_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifndef IDEVICE_HAS_COROUTINES
+#define IDEVICE_HAS_COROUTINES 0
+#endif
+
+#if IDEVICE_HAS_COROUTINES
+
+#include <coroutine>
+#include <cstdlib>  // std::abs, std::terminate
+#include <deque>
+#include <memory>  // std::shared_ptr
+#include <mutex>
+
+#include "idevice/instrument/dtxchannel.h"
+#include "idevice/instrument/dtxmessage.h"
+#include "idevice/instrument/dtxrequest.h"
+#include "idevice/utils/executor.h"
+
+namespace idevice {
+
+namespace internal {
+
+// resume a coroutine on the executor, or on the calling thread if there is no executor
+inline void ResumeOn(const std::shared_ptr<Executor>& executor, uint64_t key,
+                     std::coroutine_handle<> handle) {
+  if (executor) {
+    executor->Execute(key, [handle]() { handle.resume(); });
+  } else {
+    handle.resume();
+  }
+}
+
+inline uint64_t ExecutorKey(const DTXChannel& channel) {
+  return static_cast<uint64_t>(std::abs(static_cast<int32_t>(channel.ChannelIdentifier())));
+}
+
+}  // namespace internal
+
+/**
+ * A coroutine started at once and never awaited, e.g. a sampling conversation
+ * The frame is destroyed when the coroutine returns. Exceptions are not supported.
+ */
+struct DTXTask {
+  struct promise_type {
+    DTXTask get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+/**
+ * Awaits a request, resumes with its reply(null if it's not replied, see `DTXRequest::Status()`)
+ */
+class DTXRequestAwaiter {
+ public:
+  /**
+   * Constructor
+   *
+   * @param request the request
+   * @param executor resume the awaiting coroutine on it, null to resume on the thread completing
+   * the request
+   * @param key the key of the resumption, see `Executor::Execute()`
+   */
+  DTXRequestAwaiter(std::shared_ptr<DTXRequest> request, std::shared_ptr<Executor> executor,
+                    uint64_t key)
+      : request_(std::move(request)), executor_(std::move(executor)), key_(key) {}
+
+  bool await_ready() const { return request_->IsDone(); }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    // it may be resumed before `OnComplete()` returns, so nothing is touched afterwards
+    std::shared_ptr<Executor> executor = executor_;
+    uint64_t key = key_;
+    request_->OnComplete(
+        [executor, key, handle](DTXRequestStatus, std::shared_ptr<DTXMessage>) {
+          internal::ResumeOn(executor, key, handle);
+        });
+  }
+
+  std::shared_ptr<DTXMessage> await_resume() const { return request_->Reply(); }
+
+  /**
+   * Get the request, e.g. to cancel it, or to check its status after resuming
+   *
+   * @return const std::shared_ptr<DTXRequest>& the request
+   */
+  const std::shared_ptr<DTXRequest>& Request() const { return request_; }
+
+ private:
+  std::shared_ptr<DTXRequest> request_;
+  std::shared_ptr<Executor> executor_;
+  uint64_t key_;
+};
+
+/**
+ * Send a message on a channel, and get an awaitable of its reply
+ *
+ * @param channel the channel
+ * @param msg message to be sent
+ * @param timeout_ms the deadline from now in milliseconds, -1 means no deadline
+ * @param executor resume the awaiting coroutine on it, keyed by the channel code, null to resume
+ * on the thread completing the request
+ * @return DTXRequestAwaiter the awaitable
+ */
+inline DTXRequestAwaiter Send(DTXChannel& channel, std::shared_ptr<DTXMessage> msg,
+                              uint32_t timeout_ms = -1,
+                              std::shared_ptr<Executor> executor = nullptr) {
+  return DTXRequestAwaiter(channel.SendMessage(std::move(msg), timeout_ms), std::move(executor),
+                           internal::ExecutorKey(channel));
+}
+
+/**
+ * The stream of messages arriving on a channel without a reply handler, for one coroutine to
+ * await one by one
+ *
+ * It takes over the message handler of the channel, so it must be created before the messages
+ * arrive, like `DTXChannel::SetMessageHandler()`. The messages arriving while nobody awaits are
+ * queued, up to `capacity` of them, the older ones are dropped when it's full.
+ */
+class DTXMessageStream {
+  struct State;
+
+ public:
+  /**
+   * Constructor
+   *
+   * @param channel the channel
+   * @param executor resume the awaiting coroutine on it, keyed by the channel code, null to resume
+   * on the thread routing the messages
+   * @param capacity max count of queued messages
+   */
+  explicit DTXMessageStream(const std::shared_ptr<DTXChannel>& channel,
+                            std::shared_ptr<Executor> executor = nullptr,
+                            size_t capacity = 1024)
+      : state_(std::make_shared<State>()) {
+    state_->executor = std::move(executor);
+    state_->key = internal::ExecutorKey(*channel);
+    state_->capacity = capacity == 0 ? 1 : capacity;
+    std::shared_ptr<State> state = state_;  // the handler may outlive the stream
+    channel->SetMessageHandler([state](std::shared_ptr<DTXMessage> msg) { state->Push(msg); });
+  }
+
+  ~DTXMessageStream() { Close(); }
+
+  DTXMessageStream(const DTXMessageStream&) = delete;
+  void operator=(const DTXMessageStream&) = delete;
+
+  /**
+   * Awaitable of the next message, resumes with null once it's closed and drained
+   */
+  class NextAwaiter {
+   public:
+    bool await_ready() const {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      return !state_->messages.empty() || state_->closed;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (!state_->messages.empty() || state_->closed) {
+        return false;  // arrived meanwhile
+      }
+      state_->waiter = handle;
+      return true;
+    }
+
+    std::shared_ptr<DTXMessage> await_resume() const {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->messages.empty()) {
+        return nullptr;
+      }
+      std::shared_ptr<DTXMessage> msg = std::move(state_->messages.front());
+      state_->messages.pop_front();
+      return msg;
+    }
+
+   private:
+    friend class DTXMessageStream;
+    explicit NextAwaiter(std::shared_ptr<State> state) : state_(std::move(state)) {}
+    std::shared_ptr<State> state_;
+  };
+
+  /**
+   * Wait for the next message, only one coroutine may wait at a time
+   *
+   * @return NextAwaiter the awaitable
+   */
+  NextAwaiter Next() { return NextAwaiter(state_); }
+
+  /**
+   * Stop queueing, the waiting coroutine resumes with null once the queued messages are taken
+   */
+  void Close() {
+    std::coroutine_handle<> waiter;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->closed = true;
+      waiter = state_->waiter;
+      state_->waiter = nullptr;
+    }
+    if (waiter) {
+      internal::ResumeOn(state_->executor, state_->key, waiter);
+    }
+  }
+
+  /**
+   * Get the count of messages dropped because the queue was full
+   *
+   * @return uint64_t the count
+   */
+  uint64_t DroppedCount() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->dropped;
+  }
+
+ private:
+  // shared with the message handler of the channel
+  struct State {
+    void Push(std::shared_ptr<DTXMessage> msg) {
+      std::coroutine_handle<> resumed;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) {
+          return;
+        }
+        if (messages.size() >= capacity) {
+          messages.pop_front();
+          dropped++;
+        }
+        messages.push_back(std::move(msg));
+        resumed = waiter;
+        waiter = nullptr;
+      }
+      if (resumed) {
+        internal::ResumeOn(executor, key, resumed);
+      }
+    }
+
+    std::mutex mutex;
+    std::deque<std::shared_ptr<DTXMessage>> messages;
+    std::coroutine_handle<> waiter;
+    bool closed = false;
+    uint64_t dropped = 0;
+    size_t capacity = 0;
+    std::shared_ptr<Executor> executor;
+    uint64_t key = 0;
+  };
+
+  std::shared_ptr<State> state_;
+};  // class DTXMessageStream
+
+}  // namespace idevice
+
+#endif  // IDEVICE_HAS_COROUTINES
+
+#endif  // IDEVICE_INSTRUMENT_DTXCOROUTINE_H
@@ -0,0 +1,156 @@
+#ifndef IDEVICE_INSTRUMENT_DTXEVENTLOOP_H
+#define IDEVICE_INSTRUMENT_DTXEVENTLOOP_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>  // std::unique_ptr
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace idevice {
+
+class DTXConnection;
+
+/**
+ * An event loop driving many connections on one thread
+ *
+ * Instead of running three threads per connection, the connections added to the loop are driven
+ * by the readiness notification of their transports(epoll), so idle connections cost nothing but
+ * a registered fd. The loop reads and parses the incoming bytes, routes the messages, and writes
+ * out the queued messages of the connections woken up by `Wakeup()`. The writes never block: if
+ * the transport takes only a part of them, the loop watches the fd for writability and resumes
+ * the rest then, while the other connections keep going.
+ *
+ * The transports must support `IDTXTransport::PollableFd()`, e.g. `SocketDTXTransport`.
+ * It's only available on Linux, `Start()` and `Add()` fail on the other platforms.
+ *
+ * NOTE: the handlers of messages run on the loop thread by default(see
+ * `DTXConnection::SetDispatchExecutor()`), they must not block, e.g. by `SendMessageSync()`. For
+ * the same reason, a message sent by them fails if the send queue is full while the transport is
+ * full as well.
+ */
+class DTXEventLoop {
+ public:
+  DTXEventLoop();
+  ~DTXEventLoop();
+
+  DTXEventLoop(const DTXEventLoop&) = delete;
+  void operator=(const DTXEventLoop&) = delete;
+
+  /**
+   * Start the loop thread
+   *
+   * @return succeed or fail
+   */
+  bool Start();
+
+  /**
+   * Stop the loop thread and wait for it
+   * It can be called by a handler on the loop thread, which returns to the loop and the loop exits
+   * then, but the thread is only joined by a `Stop()` or the destruction on another thread.
+   */
+  void Stop();
+
+  /**
+   * Run one iteration of the loop on the calling thread, it's called by the loop thread, or by
+   * the users who drive the loop by themselves instead of `Start()`
+   * The deadlines of the requests(see `DTXConnection::SendMessage()`) are checked at most every
+   * 100ms, so the users should call it with a timeout not longer than that.
+   *
+   * @param timeout_ms max time to wait for events, -1 means wait forever
+   * @return count of handled events, -1 if failed
+   */
+  int RunOnce(int timeout_ms);
+
+  /**
+   * Start watching a connection, called by `DTXConnection::Connect(DTXEventLoop*)`
+   *
+   * @param connection the connection
+   * @return succeed or fail
+   */
+  bool Add(DTXConnection* connection);
+
+  /**
+   * Stop watching a connection, called by `DTXConnection::Disconnect()`
+   * Once it returns, the loop doesn't touch the connection anymore, unless it's called on the loop
+   * thread by a handler of that connection, which returns to the loop afterwards.
+   *
+   * @param connection the connection
+   * @return true if the connection was watched
+   */
+  bool Remove(DTXConnection* connection);
+
+  /**
+   * Start or stop reading from a connection, it's thread-safe
+   * It's used for backpressure, the peer is not read, so it stops sending once the buffers of the
+   * transport are full.
+   *
+   * @param connection the connection, it must be watched by this loop
+   * @param enabled read or not
+   */
+  void SetReading(DTXConnection* connection, bool enabled);
+
+  /**
+   * Start or stop watching a connection for writability, it's thread-safe
+   * It's used by the connection when the transport is full, to resume writing once it's writable.
+   *
+   * @param connection the connection, it must be watched by this loop
+   * @param enabled watch or not
+   */
+  void SetWriting(DTXConnection* connection, bool enabled);
+
+  /**
+   * Ask the loop to write out the queued messages of a connection, it's thread-safe
+   *
+   * @param connection the connection
+   */
+  void Wakeup(DTXConnection* connection);
+
+  /**
+   * Check whether the calling thread is the thread running the loop
+   *
+   * @return true if it is
+   */
+  bool InLoopThread() const;
+
+  /**
+   * Get the count of connections being watched
+   *
+   * @return size_t the count
+   */
+  size_t ConnectionCount() const;
+
+ private:
+  void Run();
+  void Notify();
+  void UpdateEvents(DTXConnection* connection);
+  void FlushPendingConnections();
+  void ExpireRequests();
+
+  int epoll_fd_ = -1;
+  int wakeup_fd_ = -1;  // an eventfd interrupting the wait
+
+  // held while a connection is being handled, so `Remove()` waits for the handling to finish
+  mutable std::recursive_mutex connections_mutex_;
+  std::unordered_set<DTXConnection*> connections_;  ///< changed with both mutexes held
+
+  // guards the events watched for each connection, which are changed by both the loop thread(when
+  // the transport is full) and the other threads(for the backpressure), taken after
+  // `connections_mutex_`, it's enough to read `connections_`
+  std::mutex events_mutex_;
+
+  std::mutex pending_mutex_;
+  std::vector<DTXConnection*> pending_connections_;  // connections having messages to send
+
+  std::chrono::steady_clock::time_point next_expiry_;  // touched by the running thread only
+
+  std::atomic_bool running_ = ATOMIC_VAR_INIT(false);
+  std::unique_ptr<std::thread> thread_ = nullptr;
+  std::atomic<std::thread::id> loop_thread_id_{std::thread::id()};
+};  // class DTXEventLoop
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DTXEVENTLOOP_H
@@ -0,0 +1,181 @@
+#ifndef IDEVICE_INSTRUMENT_DTXFAKESERVER_H
+#define IDEVICE_INSTRUMENT_DTXFAKESERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>  // std::function
+#include <memory>      // std::unique_ptr, std::shared_ptr
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "idevice/instrument/dtxmessage.h"
+#include "idevice/instrument/dtxmessageparser.h"
+#include "idevice/instrument/dtxmessagetransmitter.h"
+#include "idevice/instrument/dtxtransport.h"
+#include "idevice/utils/gatherbuffer.h"
+
+namespace idevice {
+
+/**
+ * An in-process stand-in for the instruments service, for end-to-end tests and load tests without
+ * a device
+ *
+ * It speaks the DTXMessage protocol on its own end of a transport(e.g. `LoopbackDTXTransport`)
+ * with the same parser and transmitter as `DTXConnection`:
+ * - `_requestChannelWithCode:identifier:` and `_channelCanceled:` open and close the channels
+ * - the other selectors are answered by the handlers set with `SetSelectorHandler()`
+ * - every message expecting a reply gets one, an empty one if there is no handler
+ * - `StartStreaming()` pushes messages on a channel at a given rate, like a sampling service
+ *
+ *   DTXFakeServer server(server_transport.get());
+ *   server.SetSelectorHandler("start", [&server](const std::shared_ptr<DTXMessage>& msg) {
+ *     server.StartStreaming(msg->ChannelCode(), 1024, 1000);  // 1KB, 1000 per second
+ *     return nullptr;  // an empty reply
+ *   });
+ *   server.Start();
+ */
+class DTXFakeServer {
+ public:
+  /**
+   * Handler of a selector, called on the serving thread
+   *
+   * @param msg the incoming message
+   * @return the reply, its identifier, conversation index and channel code are filled by the
+   * server, null for an empty reply
+   */
+  using SelectorHandler =
+      std::function<std::shared_ptr<DTXMessage>(const std::shared_ptr<DTXMessage>& msg)>;
+
+  /**
+   * Constructor
+   *
+   * @param transport the server end of a transport, it's connected by `Start()`
+   */
+  explicit DTXFakeServer(IDTXTransport* transport) : transport_(transport) {}
+
+  /**
+   * Destructor
+   */
+  ~DTXFakeServer() { Stop(); }
+
+  DTXFakeServer(const DTXFakeServer&) = delete;
+  void operator=(const DTXFakeServer&) = delete;
+
+  /**
+   * Set the handler of a selector, it must be set before starting
+   *
+   * @param selector the selector, e.g. "runningProcesses"
+   * @param handler the handler
+   */
+  void SetSelectorHandler(const std::string& selector, SelectorHandler handler) {
+    handlers_by_selector_[selector] = std::move(handler);
+  }
+
+  /**
+   * Connect the transport, and start serving on a thread of its own
+   *
+   * @return succeed or fail
+   */
+  bool Start();
+
+  /**
+   * Stop streaming and serving, and disconnect the transport
+   */
+  void Stop();
+
+  /**
+   * Start pushing messages on a channel, replacing the current stream if any
+   * The messages go out on the negative channel code like the service does, without expecting
+   * replies. If the client reads slower than the rate, the transport pushes back on the stream.
+   *
+   * @param channel_code the code of the channel, as the client opened it
+   * @param payload_size size of the payload of each message
+   * @param messages_per_second the rate, 0 means as fast as possible
+   * @param message_count count of messages to push, 0 means until it's stopped
+   * @return succeed or fail
+   */
+  bool StartStreaming(uint32_t channel_code, size_t payload_size, uint32_t messages_per_second,
+                      uint64_t message_count = 0);
+
+  /**
+   * Stop pushing messages, it may be called on the serving thread, e.g. by a selector handler
+   */
+  void StopStreaming();
+
+  /**
+   * Get the label of an open channel
+   *
+   * @param channel_code the code of the channel
+   * @return std::string the label, empty if it's not open
+   */
+  std::string ChannelLabel(uint32_t channel_code) const;
+
+  /**
+   * Get the count of open channels
+   *
+   * @return size_t the count
+   */
+  size_t ChannelCount() const;
+
+  /**
+   * Get the count of messages received from the client
+   *
+   * @return uint64_t the count
+   */
+  uint64_t ReceivedMessageCount() const {
+    return received_message_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the count of messages pushed by the streams
+   *
+   * @return uint64_t the count
+   */
+  uint64_t StreamedMessageCount() const {
+    return streamed_message_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the selector of a message
+   *
+   * @param msg the message
+   * @return std::string the selector, empty if the payload is not a selector
+   */
+  static std::string SelectorOf(const DTXMessage& msg);
+
+ private:
+  void ServingThread();
+  void HandleMessage(const std::shared_ptr<DTXMessage>& msg);
+  void StreamingThread(uint32_t channel_code, size_t payload_size, uint32_t messages_per_second,
+                       uint64_t message_count);
+  bool SendMessage(const std::shared_ptr<DTXMessage>& msg,
+                   const DTXMessageRoutingInfo& routing_info);
+
+  IDTXTransport* transport_;
+  DTXMessageParser parser_;
+  std::unordered_map<std::string, SelectorHandler> handlers_by_selector_;
+
+  mutable std::mutex channels_mutex_;
+  std::unordered_map<uint32_t, std::string> labels_by_channel_code_;
+
+  std::mutex send_mutex_;  ///< the serving thread and the streaming thread write to the transport
+  DTXMessageTransmitter transmitter_;
+  GatherBuffer send_buffer_;
+  uint32_t next_msg_identifier_ = 1;  ///< of the messages pushed by the server, guarded by send
+
+  std::atomic_bool serving_ = ATOMIC_VAR_INIT(false);
+  std::unique_ptr<std::thread> serving_thread_;
+
+  std::mutex streaming_mutex_;
+  std::atomic_bool streaming_ = ATOMIC_VAR_INIT(false);
+  std::unique_ptr<std::thread> streaming_thread_;
+
+  std::atomic<uint64_t> received_message_count_ = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> streamed_message_count_ = ATOMIC_VAR_INIT(0);
+};  // class DTXFakeServer
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DTXFAKESERVER_H
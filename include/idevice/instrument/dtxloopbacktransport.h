@@ -0,0 +1,116 @@
+#ifndef IDEVICE_INSTRUMENT_DTXLOOPBACKTRANSPORT_H
+#define IDEVICE_INSTRUMENT_DTXLOOPBACKTRANSPORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>   // std::unique_ptr, std::shared_ptr
+#include <utility>  // std::pair
+
+#include "idevice/instrument/dtxtransport.h"
+
+namespace idevice {
+
+/**
+ * One end of an in-process transport pair, the bytes sent by one end are received by the other
+ *
+ * Each direction is a bounded in-memory pipe: `Send()` waits while the pipe is full, so a slow
+ * reader pushes back on the writer like a socket does, and `Receive()` returns at once with
+ * nothing received if there is no data. Once either end disconnects, both directions are closed:
+ * the bytes already in the pipes can still be received, after that `Receive()` fails.
+ * It can't be driven by an event loop, see `SocketDTXTransport` for that.
+ */
+class LoopbackDTXTransport : public IDTXTransport {
+  struct Pipe;
+
+ public:
+  static constexpr size_t kDefaultCapacity = 4 * 1024 * 1024;  ///< per direction
+
+  /**
+   * Create a pair of connected ends
+   *
+   * @param capacity max count of bytes buffered in each direction
+   * @return the two ends
+   */
+  static std::pair<std::unique_ptr<LoopbackDTXTransport>, std::unique_ptr<LoopbackDTXTransport>>
+  CreatePair(size_t capacity = kDefaultCapacity);
+
+  /**
+   * Destructor
+   */
+  virtual ~LoopbackDTXTransport() { Disconnect(); }
+
+  /**
+   * Connect to the peer, the pipes are ready already, it fails once it has been disconnected
+   *
+   * @return succeed or fail
+   */
+  virtual bool Connect() override;
+
+  /**
+   * Disconnect from the peer, and close both directions
+   *
+   * @return succeed or fail
+   */
+  virtual bool Disconnect() override;
+
+  /**
+   * Check whether it's connected or not
+   *
+   * @return connected or not
+   */
+  virtual bool IsConnected() const override { return connected_.load(std::memory_order_acquire); }
+
+  /**
+   * Write data to the peer, it waits while the pipe is full
+   *
+   * @param data the buffer
+   * @param size size of the buffer
+   * @param sent actual sent size
+   * @return succeed or fail, it fails if the pipe is closed
+   */
+  virtual bool Send(const char* data, uint32_t size, uint32_t* sent) override;
+
+  /**
+   * Write a list of segments to the peer, it waits while the pipe is full
+   *
+   * @param segments the segments
+   * @param count count of the segments
+   * @param sent actual sent size
+   * @return succeed or fail, it fails if the pipe is closed
+   */
+  virtual bool SendV(const IoVec* segments, size_t count, size_t* sent) override;
+
+  /**
+   * Read the available data from the peer, it doesn't block
+   *
+   * @param buffer the buffer
+   * @param size size of the buffer
+   * @param received actual received size, 0 if there is no data
+   * @return succeed or fail, it fails if the pipe is closed and drained
+   */
+  virtual bool Receive(char* buffer, uint32_t size, uint32_t* received) override;
+
+  /**
+   * Read data from the peer with a timeout
+   *
+   * @param buffer the buffer
+   * @param size  size of the buffer
+   * @param timeout timeout in milliseconds
+   * @param received actual received size, 0 if timed out
+   * @return succeed or fail, it fails if the pipe is closed and drained
+   */
+  virtual bool ReceiveWithTimeout(char* buffer, uint32_t size, uint32_t timeout,
+                                  uint32_t* received) override;
+
+ private:
+  LoopbackDTXTransport(std::shared_ptr<Pipe> incoming, std::shared_ptr<Pipe> outgoing)
+      : incoming_(std::move(incoming)), outgoing_(std::move(outgoing)) {}
+
+  std::shared_ptr<Pipe> incoming_;
+  std::shared_ptr<Pipe> outgoing_;
+  std::atomic_bool connected_ = ATOMIC_VAR_INIT(false);
+};  // class LoopbackDTXTransport
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DTXLOOPBACKTRANSPORT_H
@@ -1,12 +1,16 @@
 #ifndef IDEVICE_INSTRUMENT_DTXMESSAGE_H
 #define IDEVICE_INSTRUMENT_DTXMESSAGE_H
 
+#include <atomic>
 #include <functional>
 #include <memory>  // std::shared_ptr
+#include <mutex>
 #include <unordered_map>
 
 #include "idevice/common/idevice.h"
 #include "idevice/instrument/dtxprimitivearray.h"
+#include "idevice/utils/bufferpool.h"
+#include "idevice/utils/bytesink.h"
 #include "nskeyedarchiver/kavalue.hpp"
 
 namespace idevice {
@@ -71,9 +75,27 @@ class DTXMessage {
    *
    * @param bytes incoming bytes
    * @param size size of bytes
+   * @param storage the storage which owns the `bytes`, if it's not null, the message will not copy
+   * anything but just reference the bytes in it(zero-copy), and keep it alive.
+   * @param decompression_buffers the pool which a compressed payload is inflated into, the buffer
+   * goes back to the pool when the message dies, if it's null, a buffer is allocated per message.
    * @return ptr of new instance
    */
-  static std::shared_ptr<DTXMessage> Deserialize(const char* bytes, size_t size);
+  static std::shared_ptr<DTXMessage> Deserialize(const char* bytes, size_t size,
+                                                 std::shared_ptr<void> storage = nullptr,
+                                                 BufferPool* decompression_buffers = nullptr);
+
+  /**
+   * Serialize to a sink
+   * The sink is any callable like `bool(const char* data, size_t size)`, so the compiler can
+   * inline it. The bytes of the auxiliary and the payload passed to the sink are valid as long as
+   * the message is alive, while the others are only valid during the call.
+   *
+   * @param sink the sink
+   * @return succeed or fail
+   */
+  template <typename Sink>
+  bool SerializeTo(Sink&& sink);
 
   /**
    * Serialize to bytes
@@ -129,6 +151,21 @@ class DTXMessage {
    */
   void SetPayloadBuffer(char* buffer, size_t size, bool should_copy);
 
+  /**
+   * Set the storage which the payload buffer and the auxiliary reference to.
+   * The message keeps it alive, so it will be released when the last message referencing it dies.
+   *
+   * @param storage the storage
+   */
+  void SetBackingStorage(std::shared_ptr<void> storage) { backing_storage_ = std::move(storage); }
+
+  /**
+   * Get the storage which the payload buffer and the auxiliary reference to
+   *
+   * @return const std::shared_ptr<void>& the storage, or null if the message owns its bytes
+   */
+  const std::shared_ptr<void>& BackingStorage() const { return backing_storage_; }
+
   /**
    * Get the payload buffer
    *
@@ -149,15 +186,32 @@ class DTXMessage {
    * @param payload_object
    */
   void SetPayloadObject(std::unique_ptr<nskeyedarchiver::KAValue>&& payload_object) {
+    std::lock_guard<std::mutex> lock(payload_object_mutex_);
     payload_object_ = std::move(payload_object);
+    payload_object_pending_.store(false, std::memory_order_release);
+    // the bytes of the old payload are stale, it will be serialized again from the object
+    if (should_free_payload_buffer_ && payload_buffer_ != nullptr) {
+      free(payload_buffer_);
+    }
+    payload_buffer_ = nullptr;
+    payload_size_ = 0;
+    should_free_payload_buffer_ = false;
+    payload_storage_ = nullptr;
   }
 
   /**
    * Get the payload object
+   * The payload buffer of a deserialized message is decoded lazily on the first call, and the
+   * result is memoized, it's safe to call it from any thread.
    *
    * @return const std::unique_ptr<nskeyedarchiver::KAValue>& the payload object
    */
-  const std::unique_ptr<nskeyedarchiver::KAValue>& PayloadObject() const { return payload_object_; }
+  const std::unique_ptr<nskeyedarchiver::KAValue>& PayloadObject() const {
+    if (payload_object_pending_.load(std::memory_order_acquire)) {
+      MaybeDeserializePayloadObject();
+    }
+    return payload_object_;
+  }
 
   /**
    * Get the auxiliary, list of arguments of the selector(function)
@@ -264,6 +318,15 @@ class DTXMessage {
    */
   void SetCostSize(size_t cost_size) { cost_size_ = cost_size; }
 
+  /**
+   * Check whether the message was compressed on the wire
+   * The payload of a compressed message is decompressed when it's deserialized, and the message
+   * type is restored to the type of the original message.
+   *
+   * @return compressed or not
+   */
+  bool Compressed() const { return compressed_; }
+
   /**
    * Mark whether the message is deserialized
    *
@@ -291,13 +354,21 @@ class DTXMessage {
  private:
   void MaybeSerializeAuxiliaryObjects();
   void MaybeSerializePayloadObject();
-
-  std::unique_ptr<nskeyedarchiver::KAValue> payload_object_ = nullptr;
+  void MaybeDeserializePayloadObject() const;
+  void DumpPayloadHeader(uint32_t auxiliary_length, uint64_t total_length) const;
+  bool DecompressPayload(const char* bytes, size_t size, BufferPool* decompression_buffers);
+
+  std::shared_ptr<void> backing_storage_ = nullptr;  // declared first, so released last
+  SharedBufferMemory payload_storage_ = nullptr;     // owns the decompressed payload
+  mutable std::unique_ptr<nskeyedarchiver::KAValue> payload_object_ = nullptr;
+  mutable std::mutex payload_object_mutex_;
+  mutable std::atomic_bool payload_object_pending_ = ATOMIC_VAR_INIT(false);  // not decoded yet
   char* payload_buffer_ = nullptr;
   bool should_free_payload_buffer_ = false;
   size_t cost_size_ = 0;
   size_t payload_size_ = 0;
   uint32_t message_type_ = kInterruptionMessage;
+  bool compressed_ = false;
   std::unique_ptr<DTXPrimitiveArray> auxiliary_ = nullptr;
   std::unordered_map<size_t, nskeyedarchiver::KAValue> auxiliary_objects_;
 
@@ -311,6 +382,34 @@ class DTXMessage {
 
 };  // class DTXMessage
 
+template <typename Sink>
+bool DTXMessage::SerializeTo(Sink&& sink) {
+  // Serialize DTXMessagePayloadHeader
+  MaybeSerializeAuxiliaryObjects();
+  uint32_t auxiliary_length = auxiliary_ ? auxiliary_->SerializedLength() : 0;
+  MaybeSerializePayloadObject();
+  uint64_t total_length = auxiliary_length + payload_size_;
+  DumpPayloadHeader(auxiliary_length, total_length);
+  if (!sink(reinterpret_cast<const char*>(&message_type_), sizeof(uint32_t)) ||
+      !WriteTransient(sink, reinterpret_cast<const char*>(&auxiliary_length), sizeof(uint32_t)) ||
+      !WriteTransient(sink, reinterpret_cast<const char*>(&total_length), sizeof(uint64_t))) {
+    return false;
+  }
+
+  // Serialize auxiliary
+  if (auxiliary_length > 0 /* auxiliary_ != nullptr */) {
+    if (!auxiliary_->SerializeTo<Sink&>(sink)) {
+      return false;
+    }
+  }
+
+  // Serialize payload
+  if (payload_size_ > 0) {
+    return sink(payload_buffer_, payload_size_);
+  }
+  return true;
+}
+
 }  // namespace idevice
 
 #endif  // IDEVICE_INSTRUMENT_DTXMESSAGE_H
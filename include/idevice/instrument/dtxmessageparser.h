@@ -1,13 +1,16 @@
 #ifndef IDEVICE_INSTRUMENT_DTXMESSAGE_PARSER_H
 #define IDEVICE_INSTRUMENT_DTXMESSAGE_PARSER_H
 
+#include <chrono>
 #include <queue>
 #include <unordered_map>
 #include <vector>
 
 #include "idevice/common/idevice.h"
 #include "idevice/instrument/dtxmessage.h"
+#include "idevice/utils/bufferpool.h"
 #include "idevice/utils/bytebuffer.h"
+#include "idevice/utils/segmentedbuffer.h"
 
 namespace idevice {
 
@@ -36,6 +39,16 @@ class DTXMessageParser {
    */
   bool ParseIncomingBytes(const char* buffer, size_t size);
 
+  /**
+   * parse an incoming buffer
+   * The parser takes the buffer over as a part of its parsing buffer instead of copying the data
+   * in it, the caller must not write to it anymore.
+   *
+   * @param buffer the incoming buffer
+   * @return succeed or fail
+   */
+  bool ParseIncomingBuffer(SharedBufferMemory buffer);
+
   /**
    * Pop all parsed messages
    *
@@ -50,13 +63,115 @@ class DTXMessageParser {
    */
   size_t ParsedMessageCount() const { return parsed_message_queue_.size(); }
 
+  /**
+   * Enable or disable the zero-copy mode
+   * In zero-copy mode, parsed messages do not copy their auxiliary and payload, but hold views into
+   * the ref-counted segments of the parser's buffer, which is released when the last message
+   * referencing it dies.
+   *
+   * @param zero_copy enable or not
+   */
+  void SetZeroCopy(bool zero_copy) { zero_copy_ = zero_copy; }
+
+  /**
+   * Check whether the zero-copy mode is enabled or not
+   *
+   * @return enabled or not
+   */
+  bool ZeroCopy() const { return zero_copy_; }
+
+  /**
+   * Set the memory budget for reassembling fragmented messages
+   * When the buffers of partial messages would exceed the budget, the least recently updated ones
+   * are evicted, and a message larger than the budget is dropped.
+   *
+   * @param budget the budget in bytes
+   */
+  void SetFragmentMemoryBudget(size_t budget) { fragment_memory_budget_ = budget; }
+
+  /**
+   * Get the memory budget for reassembling fragmented messages
+   *
+   * @return size_t the budget in bytes
+   */
+  size_t FragmentMemoryBudget() const { return fragment_memory_budget_; }
+
+  /**
+   * Set the timeout of partial messages
+   * A partial message which has not received any fragment for this long is considered stale, and
+   * will be evicted the next time a new fragmented message arrives.
+   *
+   * @param timeout_ms timeout in milliseconds, 0 means never
+   */
+  void SetFragmentTimeout(uint32_t timeout_ms) { fragment_timeout_ms_ = timeout_ms; }
+
+  /**
+   * Get the size of memory used by the buffers of partial messages
+   *
+   * @return size_t the size in bytes
+   */
+  size_t FragmentMemoryUsage() const { return fragment_memory_usage_; }
+
+  /**
+   * Get the count of partial messages which are waiting for more fragments
+   *
+   * @return size_t the count of partial messages
+   */
+  size_t FragmentedMessageCount() const { return fragmented_messages_.size(); }
+
+  /**
+   * Get the count of messages which have been reassembled from fragments
+   *
+   * @return size_t the count of reassembled messages
+   */
+  size_t ReassembledMessageCount() const { return fragments_reassembled_count_; }
+
+  /**
+   * Get the count of partial messages which have been evicted or dropped
+   *
+   * @return size_t the count of evicted messages
+   */
+  size_t EvictedFragmentedMessageCount() const { return evicted_fragmented_message_count_; }
+
+  /**
+   * Get the count of messages which straddled a segment boundary of the parsing buffer, and have
+   * been copied out of it
+   *
+   * @return size_t the count of copied messages
+   */
+  size_t CopiedMessageCount() const { return copied_message_count_; }
+
+  /**
+   * Get the count of buffers which have been allocated to decompress the payloads
+   * The buffers are reused once the messages referencing them die.
+   *
+   * @return size_t the count of buffers
+   */
+  size_t DecompressionBufferCount() const { return decompression_buffers_->AllocatedCount(); }
+
  private:
-  // const char* Read(ByteReader& reader, size_t size, size_t* actual_size);
-  size_t ParseMessageWithHeader(const DTXMessageHeader* header, const char* data, size_t size);
+  struct FragmentedMessage {
+    SharedBufferMemory buffer;  // allocated once by the `length` in the header of the 1st fragment
+    std::chrono::steady_clock::time_point last_update;
+  };
+
+  bool ParseBufferedBytes();
+  bool ParseMessageWithHeader(const DTXMessageHeader& header, size_t size);
+  bool ParseFragmentWithHeader(const DTXMessageHeader& header, size_t size);
+  void EvictFragmentedMessages(size_t incoming_size, std::chrono::steady_clock::time_point now);
 
   bool eof_ = false;
-  BufferMemory parsing_buffer_;
-  std::unordered_map<uint32_t, ByteBuffer> fragmented_buffers_by_identifier;
+  bool zero_copy_ = false;
+  SegmentedBuffer parsing_buffer_;
+  std::unordered_map<uint64_t, FragmentedMessage> fragmented_messages_;
+  size_t fragment_memory_budget_ = 256 * 1024 * 1024;  // 256MB
+  size_t fragment_memory_usage_ = 0;
+  uint32_t fragment_timeout_ms_ = 0;
+  size_t fragments_reassembled_count_ = 0;
+  size_t evicted_fragmented_message_count_ = 0;
+  size_t copied_message_count_ = 0;
+  std::shared_ptr<BufferPool> decompression_buffers_ =
+      BufferPool::Create(64 * 1024 /* 64KB, grows to fit */, 8);
   std::queue<std::shared_ptr<DTXMessage>> parsed_message_queue_;
 };  // class DTXMessageParser
 
@@ -1,11 +1,118 @@
 #ifndef IDEVICE_INSTRUMENT_DTXMESSAGE_TRANSMITTER_H
 #define IDEVICE_INSTRUMENT_DTXMESSAGE_TRANSMITTER_H
 
+#include <algorithm>  // std::min
+
 #include "idevice/common/idevice.h"
 #include "idevice/instrument/dtxmessage.h"
+#include "idevice/utils/bytebuffer.h"
+#include "idevice/utils/bytesink.h"
+#include "idevice/utils/gatherbuffer.h"
 
 namespace idevice {
 
+/**
+ * A sink which splits the serialized message into fragments, and writes them to the next sink
+ * The header of each fragment is written before the first byte of it, and the bytes of the message
+ * are passed through without being copied.
+ * If the message has multiple fragments, the first fragment only contains the header, which has the
+ * length of the whole message.
+ *
+ * NOTE: the headers are written to the next sink with `WriteTransient()`, as they are only valid
+ * during the call, and so are the slices of the transient pieces.
+ */
+template <typename Sink>
+class DTXFragmentWriter {
+ public:
+  /**
+   * Constructor
+   *
+   * @param header the header of the first fragment, with the length of the whole message
+   * @param fragment_length max length of each fragment, not including the header
+   * @param sink the next sink
+   */
+  DTXFragmentWriter(const DTXMessageHeader& header, size_t fragment_length, Sink& sink)
+      : header_(header),
+        total_length_(header.length),
+        fragment_length_(fragment_length),
+        sink_(sink) {}
+
+  /**
+   * Write bytes of the message
+   *
+   * @param data the bytes
+   * @param size size of the bytes
+   * @return succeed or fail, it fails if the next sink fails or it overflows the message
+   */
+  bool operator()(const char* data, size_t size) { return Write(data, size, false); }
+
+  /**
+   * Write bytes of the message which are only valid during the call, see "bytesink.h"
+   *
+   * @param writer the writer
+   * @param data the bytes
+   * @param size size of the bytes
+   * @return succeed or fail, see `operator()`
+   */
+  friend bool WriteTransient(DTXFragmentWriter& writer, const char* data, size_t size) {
+    return writer.Write(data, size, true);
+  }
+
+  /**
+   * Check whether the whole message has been written
+   *
+   * @return finished or not
+   */
+  bool Finished() const { return started_ && written_ == total_length_; }
+
+ private:
+  bool Write(const char* data, size_t size, bool transient) {
+    while (size > 0) {
+      if (fragment_remaining_ == 0 && !BeginFragment()) {
+        return false;
+      }
+      size_t slice_size = std::min(size, fragment_remaining_);
+      if (!(transient ? WriteTransient(sink_, data, slice_size) : sink_(data, slice_size))) {
+        return false;
+      }
+      data += slice_size;
+      size -= slice_size;
+      fragment_remaining_ -= slice_size;
+      written_ += slice_size;
+    }
+    return true;
+  }
+
+  bool BeginFragment() {
+    if (!started_) {
+      started_ = true;
+      if (!WriteTransient(sink_, reinterpret_cast<const char*>(&header_),
+                          sizeof(DTXMessageHeader))) {
+        return false;
+      }
+      if (header_.fragment_count <= 1) {
+        fragment_remaining_ = total_length_;  // single fragment
+        return fragment_remaining_ > 0;
+      }
+    }
+    if (written_ >= total_length_) {
+      return false;  // overflow
+    }
+    header_.fragment_index += 1;
+    header_.length = std::min(fragment_length_, total_length_ - written_);
+    fragment_remaining_ = header_.length;
+    return WriteTransient(sink_, reinterpret_cast<const char*>(&header_), sizeof(DTXMessageHeader));
+  }
+
+  DTXMessageHeader header_;
+  size_t total_length_;
+  size_t fragment_length_;
+  Sink& sink_;
+  bool started_ = false;
+  size_t written_ = 0;
+  size_t fragment_remaining_ = 0;
+};  // class DTXFragmentWriter
+
 /**
  * A Transmitter for the DTXMessage 
  * It is responsible for serializing the DTXMessage into binary data and transmiting it to the server.
@@ -26,14 +133,74 @@ class DTXMessageTransmitter {
   
   /**
    * Transmit a message
-   * 
+   * The message is split into fragments like `GatherMessage()` does, and its buffers are passed to
+   * the transmitter piece by piece without being copied, so a large message doesn't need to be
+   * staged in memory. The headers passed to the transmitter are only valid during the call.
+   *
    * @param message the message
-   * @param message_routing_info the routing info of the message 
+   * @param message_routing_info the routing info of the message
    * @param transmitter transmitter
-   * @return succeed or fail
+   * @return succeed or fail, it fails as soon as the transmitter fails
    */
   bool TransmitMessage(const std::shared_ptr<DTXMessage>& message, const DTXMessageRoutingInfo& message_routing_info, Transmitter transmitter);
 
+  /**
+   * Gather all segments of a message(with the headers of all fragments) for a vectored write
+   * The large buffers of the message(e.g. the payload) are referenced instead of being copied, so
+   * the message must be kept alive until the segments have been written out.
+   *
+   * @param message the message
+   * @param message_routing_info the routing info of the message
+   * @param output the buffer to append the segments to
+   * @return succeed or fail
+   */
+  bool GatherMessage(const std::shared_ptr<DTXMessage>& message,
+                     const DTXMessageRoutingInfo& message_routing_info, GatherBuffer* output) {
+    return GatherMessage(message, message_routing_info, message->SerializedLength(), output);
+  }
+
+  /**
+   * Gather all segments of a message, with its serialized length already known, see above
+   *
+   * @param message the message
+   * @param message_routing_info the routing info of the message
+   * @param serialized_length the result of `DTXMessage::SerializedLength()`
+   * @param output the buffer to append the segments to
+   * @return succeed or fail
+   */
+  bool GatherMessage(const std::shared_ptr<DTXMessage>& message,
+                     const DTXMessageRoutingInfo& message_routing_info, size_t serialized_length,
+                     GatherBuffer* output);
+
+  /**
+   * Frame a single-fragment message(the header and the payload) into one contiguous buffer
+   * The buffer is resized to the exact size of the frame, and its memory is reused if it's large
+   * enough, so a connection can keep one buffer for all small messages, and send each of them with
+   * one write.
+   *
+   * @param message the message, it must fit in a single fragment
+   * @param message_routing_info the routing info of the message
+   * @param output the buffer
+   * @return succeed or fail, it fails if the message has multiple fragments
+   */
+  bool FrameMessage(const std::shared_ptr<DTXMessage>& message,
+                    const DTXMessageRoutingInfo& message_routing_info, BufferMemory* output) {
+    return FrameMessage(message, message_routing_info, message->SerializedLength(), output);
+  }
+
+  /**
+   * Frame a single-fragment message, with its serialized length already known, see above
+   *
+   * @param message the message, it must fit in a single fragment
+   * @param message_routing_info the routing info of the message
+   * @param serialized_length the result of `DTXMessage::SerializedLength()`
+   * @param output the buffer
+   * @return succeed or fail, it fails if the message has multiple fragments
+   */
+  bool FrameMessage(const std::shared_ptr<DTXMessage>& message,
+                    const DTXMessageRoutingInfo& message_routing_info, size_t serialized_length,
+                    BufferMemory* output);
+
   /**
    * Get the count of fragments for the length of the message
    * If a message is too long, we need to split it into multiple fragments for transmission.
@@ -2,12 +2,15 @@
 #define IDEVICE_INSTRUMENT_DTXMESSENGER_H
 
 #include <functional>
-#include <memory>  // std::shared_ptr
+#include <memory>   // std::shared_ptr
+#include <utility>  // std::pair
+#include <vector>
 
 namespace idevice {
 
 class DTXMessage;
 class DTXChannel;
+class DTXRequest;
 
 /**
  * Interface of messenger that can send and receive DTXMessage.
@@ -20,6 +23,11 @@ class DTXMessenger {
    */
   using ReplyHandler = std::function<void(std::shared_ptr<DTXMessage>)>;
 
+  /**
+   * A message to be sent, with the callback for its response(null if no response is expected)
+   */
+  using MessageWithHandler = std::pair<std::shared_ptr<DTXMessage>, ReplyHandler>;
+
   virtual ~DTXMessenger() {}
 
   /**
@@ -32,6 +40,18 @@ class DTXMessenger {
   virtual std::shared_ptr<DTXMessage> SendMessageSync(std::shared_ptr<DTXMessage> msg,
                                                       uint32_t timeout_ms = -1) = 0;
 
+  /**
+   * Send message, and get a handle of the request waiting for the response
+   * The request completes when the response arrives, when the deadline passes, when it's cancelled,
+   * or when the connection is closed, see `DTXRequest`.
+   *
+   * @param msg message to be sent
+   * @param timeout_ms the deadline from now in milliseconds, -1 means no deadline
+   * @return std::shared_ptr<DTXRequest> the request, never null
+   */
+  virtual std::shared_ptr<DTXRequest> SendMessage(std::shared_ptr<DTXMessage> msg,
+                                                  uint32_t timeout_ms = -1) = 0;
+
   /**
    * Send message asynchronously
    *
@@ -40,6 +60,19 @@ class DTXMessenger {
    */
   virtual void SendMessageAsync(std::shared_ptr<DTXMessage> msg, ReplyHandler callback) = 0;
 
+  /**
+   * Send a batch of messages asynchronously, in order
+   * The messengers which can write them out together override it, by default they are sent one by
+   * one.
+   *
+   * @param batch messages to be sent, with the callbacks for their responses
+   */
+  virtual void SendMessagesAsync(std::vector<MessageWithHandler> batch) {
+    for (MessageWithHandler& item : batch) {
+      SendMessageAsync(std::move(item.first), std::move(item.second));
+    }
+  }
+
   /**
    * Cancel the channel
    * TODO: move it method out of this interface
@@ -0,0 +1,137 @@
+#ifndef IDEVICE_INSTRUMENT_DTXMETRICS_H
+#define IDEVICE_INSTRUMENT_DTXMETRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "idevice/utils/latencyhistogram.h"
+
+namespace idevice {
+
+/**
+ * Metrics of a channel, the channels are identified by their codes regardless of the sign, i.e.
+ * the messages of the service on the channel -N count towards the channel N
+ */
+struct DTXChannelMetrics {
+  uint32_t channel_code = 0;
+  uint64_t messages_in = 0;       ///< count of messages received
+  uint64_t bytes_in = 0;          ///< serialized length of messages received
+  uint64_t messages_out = 0;      ///< count of messages written out
+  uint64_t bytes_out = 0;         ///< serialized length of messages written out
+  uint64_t dropped_messages = 0;  ///< count of messages received without any handler
+  LatencyHistogramSnapshot round_trip;  ///< from sending a message to receiving its reply
+};
+
+/**
+ * Metrics of a connection, see `DTXConnection::Metrics()`
+ */
+struct DTXConnectionMetrics {
+  uint64_t messages_in = 0;            ///< count of messages received
+  uint64_t bytes_in = 0;               ///< count of bytes read from the transport
+  uint64_t messages_out = 0;           ///< count of messages written out
+  uint64_t bytes_out = 0;              ///< count of bytes written to the transport
+  uint64_t fragments_reassembled = 0;  ///< count of messages reassembled from fragments
+  uint64_t parse_errors = 0;           ///< count of malformed incoming bytes
+  uint64_t dropped_messages = 0;       ///< count of messages received without any handler
+  uint64_t expired_replies = 0;        ///< count of requests and callbacks timed out
+  size_t send_queue_depth = 0;         ///< count of messages waiting to be written out
+  size_t receive_queue_depth = 0;      ///< count of packets waiting to be parsed
+  size_t dispatch_queue_depth = 0;     ///< count of handlers waiting to run
+  size_t pending_replies = 0;          ///< count of messages waiting for their replies
+  size_t pending_receive_bytes = 0;    ///< see `DTXConnection::SetReceiveWatermarks()`
+  LatencyHistogramSnapshot round_trip;       ///< of all channels
+  std::vector<DTXChannelMetrics> channels;  ///< the channels with any traffic, by code
+};
+
+/**
+ * The counters behind `DTXConnectionMetrics`
+ *
+ * Every counter is a relaxed atomic, and the counters of a channel are found by its code in a
+ * table allocated lazily in chunks, so the hot paths update them without any lock. The channels
+ * beyond `kMaxChannelCount` only count towards the totals of the connection.
+ */
+class DTXMetrics {
+ public:
+  static constexpr size_t kChannelChunkSize = 64;
+  static constexpr size_t kMaxChannelChunkCount = 64;
+  static constexpr size_t kMaxChannelCount = kChannelChunkSize * kMaxChannelChunkCount;
+
+  struct ChannelCounters {
+    std::atomic<uint64_t> messages_in = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> bytes_in = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> messages_out = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> bytes_out = ATOMIC_VAR_INIT(0);
+    std::atomic<uint64_t> dropped_messages = ATOMIC_VAR_INIT(0);
+    LatencyHistogram round_trip;
+  };
+
+  DTXMetrics();
+  ~DTXMetrics();
+
+  DTXMetrics(const DTXMetrics&) = delete;
+  void operator=(const DTXMetrics&) = delete;
+
+  /**
+   * Get the counters of a channel, allocating them on the first use
+   *
+   * @param channel_code the channel code, of either sign
+   * @return ChannelCounters* the counters, null if the channel is beyond `kMaxChannelCount`
+   */
+  ChannelCounters* Channel(uint32_t channel_code);
+
+  /**
+   * Count a message received on a channel
+   *
+   * @param channel_code the channel code
+   * @param bytes serialized length of the message
+   */
+  void CountMessageIn(uint32_t channel_code, size_t bytes);
+
+  /**
+   * Count a message written out on a channel
+   *
+   * @param channel_code the channel code
+   * @param bytes serialized length of the message
+   */
+  void CountMessageOut(uint32_t channel_code, size_t bytes);
+
+  /**
+   * Count a message received on a channel without any handler
+   *
+   * @param channel_code the channel code
+   */
+  void CountDroppedMessage(uint32_t channel_code);
+
+  /**
+   * Record the round trip of a reply
+   *
+   * @param channel_code the channel code
+   * @param latency_us from sending the message to receiving its reply, in microseconds
+   */
+  void RecordRoundTrip(uint32_t channel_code, uint64_t latency_us);
+
+  /**
+   * Fill the counters in a snapshot, the queue depths are left as they are
+   *
+   * @param metrics the snapshot
+   */
+  void Fill(DTXConnectionMetrics* metrics) const;
+
+  std::atomic<uint64_t> bytes_in = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> bytes_out = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> fragments_reassembled = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> parse_errors = ATOMIC_VAR_INIT(0);
+
+ private:
+  std::atomic<uint64_t> messages_in_ = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> messages_out_ = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> dropped_messages_ = ATOMIC_VAR_INIT(0);
+  LatencyHistogram round_trip_;
+  std::atomic<ChannelCounters*> channel_chunks_[kMaxChannelChunkCount];
+};  // class DTXMetrics
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DTXMETRICS_H
@@ -1,19 +1,29 @@
 #ifndef IDEVICE_INSTRUMENT_DTXPRIMITIVE_ARRAY_H
 #define IDEVICE_INSTRUMENT_DTXPRIMITIVE_ARRAY_H
 
+#include <algorithm>  // std::max
 #include <cstdint>  // int32_t, int64_t, uint64_t
 #include <cstdlib>  // malloc, free
 #include <cstring>  // memcpy
+#include <functional>
 #include <memory>   // std::unique_ptr
 #include <string>
 #include <vector>
 
 #include "idevice/common/idevice.h"    // hexdump
 #include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+#include "idevice/utils/bytesink.h"
 #include "nskeyedarchiver/nskeyedunarchiver.hpp"
 
 namespace idevice {
 
+constexpr size_t kDTXPrimitiveArrayDefaultSize = 0x200;
+constexpr size_t kDTXPrimitiveArrayHeaderSize = 0x10;
+constexpr size_t kDTXPrimitiveArrayCapacityAlignment =
+    kDTXPrimitiveArrayDefaultSize + kDTXPrimitiveArrayHeaderSize;  // 0x210
+constexpr size_t kDTXPrimitiveArrayDefaultCapacity =
+    kDTXPrimitiveArrayDefaultSize - kDTXPrimitiveArrayHeaderSize;  // 0x1F0, F0 01 00 00 00 00 00 00
+
 /**
  * DTXPrimitiveValue 
  */
@@ -36,6 +46,7 @@ class DTXPrimitiveValue {
 #define DTXPRIMITIVEVALUE_MOVE_VALUE(other) \
   t_ = other.t_;                            \
   s_ = other.s_;                            \
+  owned_ = other.owned_;                    \
   switch (other.t_) {                       \
     case kNull:                             \
     case kEmptyKey:                         \
@@ -64,7 +75,7 @@ class DTXPrimitiveValue {
 
   DTXPrimitiveValue() : t_(kNull), s_(0) {}  // null
   ~DTXPrimitiveValue() {
-    if (t_ == kString || t_ == kBuffer) {
+    if (owned_ && (t_ == kString || t_ == kBuffer)) {
       if (d_.b) {
         free(d_.b);
       }
@@ -103,6 +114,24 @@ class DTXPrimitiveValue {
   explicit DTXPrimitiveValue(double d) : t_(kFloat64), s_(sizeof(double)) { d_.d = d; }
   explicit DTXPrimitiveValue(uint64_t u) : t_(kInteger), s_(sizeof(uint64_t)) { d_.u = u; }
 
+  /**
+   * Create a value which only references the bytes of a string or buffer, without copying or
+   * owning them. The caller must keep the bytes alive as long as the value is in use.
+   * NOTE: a string view is not null-terminated, use `Size()` to get the length of it.
+   *
+   * @param type kString or kBuffer
+   * @param data the bytes
+   * @param size size of the bytes
+   */
+  static DTXPrimitiveValue CreateView(Type type, const char* data, size_t size) {
+    DTXPrimitiveValue value;
+    value.SetType(type);
+    value.SetSize(size);
+    value.d_.b = const_cast<char*>(data);
+    value.owned_ = false;
+    return value;
+  }
+
   static DTXPrimitiveValue CreateEmptyDictionaryKey() {
     DTXPrimitiveValue value;
     value.SetType(kEmptyKey);
@@ -110,15 +139,15 @@ class DTXPrimitiveValue {
     return value;
   }
 
-  char* ToStr() { return d_.b; }
-  char* ToBuffer() { return d_.b; }
-  int32_t ToSignedInt32() { return d_.i32; }
-  int64_t ToSignedInt64() { return d_.i64; }
-  float ToFloat32() { return d_.f; }
-  double ToFloat64() { return d_.d; }
-  uint64_t ToInteger() { return d_.u; }
+  char* ToStr() const { return d_.b; }
+  char* ToBuffer() const { return d_.b; }
+  int32_t ToSignedInt32() const { return d_.i32; }
+  int64_t ToSignedInt64() const { return d_.i64; }
+  float ToFloat32() const { return d_.f; }
+  double ToFloat64() const { return d_.d; }
+  uint64_t ToInteger() const { return d_.u; }
 
-  const void* RawData() { return reinterpret_cast<const void*>(&d_.b); }
+  const void* RawData() const { return reinterpret_cast<const void*>(&d_.b); }
 
   size_t Size() const { return s_; }
   void SetSize(size_t s) { s_ = s; }
@@ -126,6 +155,8 @@ class DTXPrimitiveValue {
   Type GetType() const { return t_; }
   void SetType(Type t) { t_ = t; }
 
+  bool IsView() const { return !owned_; }
+
   void Dump(bool dumphex = true) const {
     switch (t_) {
       case kNull:
@@ -181,6 +212,7 @@ class DTXPrimitiveValue {
   } d_;
   size_t s_ = 0;
   Type t_ = kNull;
+  bool owned_ = true;  // false if the value is a view of bytes owned by someone else
 
 #undef DTXPRIMITIVEVALUE_MOVE_VALUE
 };  // class DTXPrimitiveValue
@@ -193,10 +225,39 @@ class DTXPrimitiveArray {
   DTXPrimitiveArray(bool as_dict = true) : as_dict_(as_dict) {}
   ~DTXPrimitiveArray() {}
 
-  static std::unique_ptr<DTXPrimitiveArray> Deserialize(const char* buffer, size_t size);
+  /**
+   * Deserialize from bytes
+   *
+   * @param buffer incoming bytes
+   * @param size size of bytes
+   * @param should_copy copy the bytes of string and buffer items, or just reference them, in the
+   * latter case the caller must keep the bytes alive as long as the array is in use.
+   * @return ptr of new instance
+   */
+  static std::unique_ptr<DTXPrimitiveArray> Deserialize(const char* buffer, size_t size,
+                                                        bool should_copy = true);
 
   size_t SerializedLength() const;
-  bool SerializeTo(std::function<bool(const char*, size_t)> serializer);
+
+  /**
+   * Serialize to a sink
+   * The sink is any callable like `bool(const char* data, size_t size)`, it's called for each
+   * piece of bytes, and the serialization stops once it returns false. The bytes passed to the
+   * sink are only valid during the call, unless they are the bytes of the string or buffer items.
+   *
+   * @param sink the sink
+   * @return succeed or fail
+   */
+  template <typename Sink>
+  bool SerializeTo(Sink&& sink) const;
+
+  /**
+   * Serialize to a type-erased serializer, see the templated `SerializeTo()`
+   *
+   * @param serializer serialize function
+   * @return succeed or fail
+   */
+  bool SerializeTo(std::function<bool(const char*, size_t)> serializer) const;
 
   void Append(DTXPrimitiveValue&& item) {
     items_.emplace_back(std::forward<DTXPrimitiveValue>(item));
@@ -215,6 +276,73 @@ class DTXPrimitiveArray {
   bool as_dict_ = false;
 };  // class DTXPrimitiveArray
 
+template <typename Sink>
+bool DTXPrimitiveArray::SerializeTo(Sink&& sink) const {
+  // Serialize DTXPrimitiveArrayHeader
+  uint64_t size = SerializedLength() - kDTXPrimitiveArrayHeaderSize;
+  uint64_t capacity = IDEVICE_MEM_ALIGN(std::max<uint64_t>(kDTXPrimitiveArrayDefaultCapacity, size),
+                                        kDTXPrimitiveArrayCapacityAlignment);
+  if (!WriteTransient(sink, reinterpret_cast<const char*>(&capacity), sizeof(uint64_t)) ||
+      !WriteTransient(sink, reinterpret_cast<const char*>(&size), sizeof(uint64_t))) {
+    return false;
+  }
+
+  const uint32_t empty_key_type = DTXPrimitiveValue::kEmptyKey;
+  // Serialize items
+  for (const auto& item : items_) {
+    uint32_t type = item.GetType();
+    if (type == DTXPrimitiveValue::kNull) {
+      continue;
+    }
+
+    if (as_dict_) {
+      // insert an empty key for DTXPrimitiveDictionary
+      if (!WriteTransient(sink, reinterpret_cast<const char*>(&empty_key_type), sizeof(uint32_t))) {
+        return false;
+      }
+    }
+
+    if (!WriteTransient(sink, reinterpret_cast<const char*>(&type), sizeof(uint32_t))) {
+      return false;
+    }
+    if (item.Size() == 0) {
+      continue;
+    }
+
+    bool ret = true;
+    switch (type) {
+      case DTXPrimitiveValue::kString:
+      case DTXPrimitiveValue::kBuffer: {
+        // length
+        uint32_t length = item.Size();
+        // str or buffer
+        const char* ptr = type == DTXPrimitiveValue::kString ? item.ToStr() : item.ToBuffer();
+        ret = WriteTransient(sink, reinterpret_cast<const char*>(&length), sizeof(uint32_t)) &&
+              sink(ptr, length);
+        break;
+      }
+      case DTXPrimitiveValue::kSignedInt32:
+      case DTXPrimitiveValue::kSignedInt64:
+      case DTXPrimitiveValue::kFloat32:
+      case DTXPrimitiveValue::kFloat64:
+      case DTXPrimitiveValue::kInteger: {
+        ret = sink(reinterpret_cast<const char*>(item.RawData()), item.Size());
+        break;
+      }
+      case DTXPrimitiveValue::kEmptyKey: {
+        break;  // empty dictionary key, the keys are empty and we ignore them
+      }
+      default:
+        IDEVICE_ASSERT(false, "unknown type %d\n", type);
+        break;
+    }
+    if (!ret) {
+      return false;
+    }
+  }
+  return true;
+}
+
 // Actually we didn't implement the DTXPrimitiveDictionary, but implement the DTXPrimitiveArray
 // instead and use it as the DTXPrimitiveDictionary, 'cause they both have very similar memory
 // layouts. for now all DTXPrimitiveDictionary we've seen only have empty keys, so we just ignore
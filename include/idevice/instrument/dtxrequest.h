@@ -0,0 +1,143 @@
+#ifndef IDEVICE_INSTRUMENT_DTXREQUEST_H
+#define IDEVICE_INSTRUMENT_DTXREQUEST_H
+
+#include <condition_variable>
+#include <cstdint>     // uint32_t
+#include <functional>  // std::function
+#include <memory>      // std::shared_ptr
+#include <mutex>
+
+namespace idevice {
+
+class DTXMessage;
+
+/**
+ * Status of a request
+ */
+enum class DTXRequestStatus {
+  kPending,       ///< waiting for the reply
+  kReplied,       ///< the reply has arrived
+  kTimedOut,      ///< no reply before the deadline
+  kCancelled,     ///< cancelled by `DTXRequest::Cancel()`
+  kDisconnected,  ///< the connection was closed before the reply arrived
+};
+
+/**
+ * Get the name of a request status, e.g. "TimedOut"
+ *
+ * @param status the status
+ * @return const char* the name
+ */
+const char* DTXRequestStatusName(DTXRequestStatus status);
+
+/**
+ * The handle of a message waiting for its reply, returned by `DTXMessenger::SendMessage()`
+ *
+ * A request completes exactly once: when the reply arrives, when its deadline passes, when it's
+ * cancelled, or when the connection is closed. Whatever completes it, the connection forgets the
+ * request at the same time, so nothing waits for a reply which will never arrive. A handle can be
+ * waited on by any number of threads, or observed by a completion handler, so many requests can
+ * be issued at once without blocking a thread per request.
+ */
+class DTXRequest {
+ public:
+  /**
+   * Callback for completion
+   *
+   * @param status the final status
+   * @param reply the reply if replied, otherwise null
+   */
+  using CompletionHandler =
+      std::function<void(DTXRequestStatus status, std::shared_ptr<DTXMessage> reply)>;
+
+  DTXRequest() {}
+
+  DTXRequest(const DTXRequest&) = delete;
+  void operator=(const DTXRequest&) = delete;
+
+  /**
+   * Get the status
+   *
+   * @return DTXRequestStatus the status
+   */
+  DTXRequestStatus Status() const;
+
+  /**
+   * Check whether it's completed or still pending
+   *
+   * @return completed or not
+   */
+  bool IsDone() const { return Status() != DTXRequestStatus::kPending; }
+
+  /**
+   * Wait until it's completed
+   * The request is not cancelled if the wait times out, see `Cancel()`.
+   *
+   * @param timeout_ms max time to wait in milliseconds, -1 means wait forever
+   * @return true if it's completed, false if timed out
+   */
+  bool Wait(uint32_t timeout_ms = -1) const;
+
+  /**
+   * Wait until it's completed, and get the reply
+   *
+   * @param timeout_ms max time to wait in milliseconds, -1 means wait forever
+   * @return std::shared_ptr<DTXMessage> the reply, null if it's not replied
+   */
+  std::shared_ptr<DTXMessage> Get(uint32_t timeout_ms = -1) const;
+
+  /**
+   * Get the reply without waiting
+   *
+   * @return std::shared_ptr<DTXMessage> the reply, null if it's not replied(yet)
+   */
+  std::shared_ptr<DTXMessage> Reply() const;
+
+  /**
+   * Cancel the request, a reply arriving later is dropped
+   *
+   * @return true if it was pending and is cancelled now, false if it was already completed
+   */
+  bool Cancel();
+
+  /**
+   * Set the handler called when it's completed, on the thread completing it
+   * The replies and the timeouts are handled on the dispatch executor of the connection, see
+   * `DTXConnection::SetDispatchExecutor()`. If it's already completed, the handler is called on the
+   * calling thread before it returns.
+   *
+   * @param handler the handler
+   */
+  void OnComplete(CompletionHandler handler);
+
+  /**
+   * Complete the request, used by the messengers
+   *
+   * @param status the final status, not `kPending`
+   * @param reply the reply if replied, otherwise null
+   * @return true if it's completed by this call, false if it was already completed
+   */
+  bool Complete(DTXRequestStatus status, std::shared_ptr<DTXMessage> reply);
+
+  /**
+   * Set the function making the messenger forget the request when it's cancelled, used by the
+   * messengers
+   * It's called with the internal lock held, so a reply or a disconnection arriving meanwhile
+   * waits for the cancellation to finish.
+   *
+   * @param canceller the function
+   */
+  void SetCanceller(std::function<void()> canceller);
+
+ private:
+  mutable std::mutex mutex_;
+  mutable std::condition_variable completed_;
+  DTXRequestStatus status_ = DTXRequestStatus::kPending;
+  std::shared_ptr<DTXMessage> reply_;
+  CompletionHandler completion_handler_;
+  std::function<void()> canceller_;
+};  // class DTXRequest
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DTXREQUEST_H
@@ -0,0 +1,126 @@
+#ifndef IDEVICE_INSTRUMENT_DTXSOCKETTRANSPORT_H
+#define IDEVICE_INSTRUMENT_DTXSOCKETTRANSPORT_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "idevice/instrument/dtxtransport.h"
+
+namespace idevice {
+
+/**
+ * A transport over a connected stream socket(e.g. TCP, a unix socket or one end of a `socketpair`)
+ *
+ * The socket is switched to non-blocking mode when connecting, so it can be driven by an event
+ * loop: `Receive()` returns at once with nothing received if there is no data, and `TrySendV()`
+ * returns at once with a part of the bytes written if the send buffer is full. `Send()` and
+ * `SendV()` still write all bytes, they wait for the socket to become writable.
+ */
+class SocketDTXTransport : public IDTXTransport {
+ public:
+  /**
+   * Constructor
+   *
+   * @param fd a connected socket
+   * @param owns_fd close the socket on disconnecting or not
+   */
+  explicit SocketDTXTransport(int fd, bool owns_fd = true) : fd_(fd), owns_fd_(owns_fd) {}
+
+  /**
+   * Destructor
+   */
+  virtual ~SocketDTXTransport() { Disconnect(); }
+
+  /**
+   * Connect to the service
+   * The socket is connected already, this only switches it to non-blocking mode.
+   *
+   * @return succeed or fail
+   */
+  virtual bool Connect() override;
+
+  /**
+   * Disconnect from the service
+   *
+   * @return succeed or fail
+   */
+  virtual bool Disconnect() override;
+
+  /**
+   * Check whether it's connected or not
+   *
+   * @return connected or not
+   */
+  virtual bool IsConnected() const override { return connected_.load(std::memory_order_acquire); }
+
+  /**
+   * Write data to the server
+   *
+   * @param data the buffer
+   * @param size size of the buffer
+   * @param sent actual sent size
+   * @return succeed or fail
+   */
+  virtual bool Send(const char* data, uint32_t size, uint32_t* sent) override;
+
+  /**
+   * Write a list of segments to the server with `writev`
+   *
+   * @param segments the segments
+   * @param count count of the segments
+   * @param sent actual sent size
+   * @return succeed or fail
+   */
+  virtual bool SendV(const IoVec* segments, size_t count, size_t* sent) override;
+
+  /**
+   * Write a list of segments to the server until the send buffer is full, it doesn't block
+   *
+   * @param segments the segments
+   * @param count count of the segments
+   * @param sent actual sent size, it may be less than the size of the segments
+   * @return succeed or fail
+   */
+  virtual bool TrySendV(const IoVec* segments, size_t count, size_t* sent) override;
+
+  /**
+   * Read the available data from the server, it doesn't block
+   *
+   * @param buffer the buffer
+   * @param size size of the buffer
+   * @param received actual received size, 0 if there is no data
+   * @return succeed or fail, it fails if the peer closed the socket
+   */
+  virtual bool Receive(char* buffer, uint32_t size, uint32_t* received) override;
+
+  /**
+   * Read data from the server with a timeout
+   *
+   * @param buffer the buffer
+   * @param size  size of the buffer
+   * @param timeout timeout in milliseconds
+   * @param received actual received size, 0 if timed out
+   * @return succeed or fail
+   */
+  virtual bool ReceiveWithTimeout(char* buffer, uint32_t size, uint32_t timeout,
+                                  uint32_t* received) override;
+
+  /**
+   * Get the socket
+   *
+   * @return int the socket
+   */
+  virtual int PollableFd() const override { return fd_.load(std::memory_order_acquire); }
+
+ private:
+  bool WaitForWritable();
+  bool SendSegments(const IoVec* segments, size_t count, size_t* sent, bool wait);
+
+  std::atomic<int> fd_;  // -1 once disconnected
+  bool owns_fd_;
+  std::atomic_bool connected_ = ATOMIC_VAR_INIT(false);
+};  // class SocketDTXTransport
+
+}  // namespace idevice
+
+#endif  // IDEVICE_INSTRUMENT_DTXSOCKETTRANSPORT_H
@@ -9,6 +9,7 @@
 
 #include "idevice/common/idevice.h"  // hexdump
 #include "idevice/instrument/instrument.h"
+#include "idevice/utils/gatherbuffer.h"
 
 namespace idevice {
 
@@ -49,6 +50,44 @@ class IDTXTransport {
    * @return succeed or fail
    */
   virtual bool Send(const char* data, uint32_t size, uint32_t* sent) = 0;
+
+  /**
+   * Write a list of segments to the server(vectored write)
+   * The default implementation writes the segments one by one, the transports which support
+   * vectored IO natively(e.g. `writev`) should override it.
+   *
+   * @param segments the segments
+   * @param count count of the segments
+   * @param sent actual sent size
+   * @return succeed or fail
+   */
+  virtual bool SendV(const IoVec* segments, size_t count, size_t* sent) {
+    *sent = 0;
+    for (size_t i = 0; i < count; ++i) {
+      uint32_t segment_sent = 0;
+      bool ret = Send(segments[i].data, segments[i].size, &segment_sent);
+      *sent += segment_sent;
+      if (!ret) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Write as many bytes of a list of segments as the transport takes without blocking
+   * It's used by the event loop, which resumes writing the rest once `PollableFd()` becomes
+   * writable. The default implementation writes all bytes like `SendV()`, the transports returning
+   * a valid `PollableFd()` should override it.
+   *
+   * @param segments the segments
+   * @param count count of the segments
+   * @param sent actual sent size, it may be less than the size of the segments
+   * @return succeed or fail
+   */
+  virtual bool TrySendV(const IoVec* segments, size_t count, size_t* sent) {
+    return SendV(segments, count, sent);
+  }
   
   /**
    * Read data from the server 
@@ -71,6 +110,16 @@ class IDTXTransport {
    */
   virtual bool ReceiveWithTimeout(char* buffer, uint32_t size, uint32_t timeout,
                                   uint32_t* received) = 0;
+
+  /**
+   * Get the file descriptor which becomes readable when data arrives, so the transport can be
+   * driven by an event loop(see `DTXEventLoop`)
+   * The transports returning a valid fd must not block in `Receive()`, it returns true with
+   * nothing received if there is no data.
+   *
+   * @return int the fd, or -1 if it's not supported
+   */
+  virtual int PollableFd() const { return -1; }
 };
 
 /**
@@ -0,0 +1,195 @@
+#ifndef IDEVICE_UTILS_BUFFER_POOL_H
+#define IDEVICE_UTILS_BUFFER_POOL_H
+
+#include <atomic>
+#include <memory>  // std::shared_ptr, std::enable_shared_from_this
+#include <new>  // operator new
+
+#include "idevice/utils/bytebuffer.h"
+#include "idevice/utils/ringqueue.h"
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A pool of fixed size buffers
+ *
+ * The buffers acquired from the pool are ref-counted, when the last reference of a buffer dies, it
+ * goes back to the pool instead of being freed, so a steady stream of buffers costs no allocation.
+ * The control blocks of the references are recycled as well, and both free lists are lock-free
+ * rings, so a buffer released by another thread(e.g. the parser) never contends with the thread
+ * acquiring buffers on a mutex. A buffer may outlive the pool, in which case it is simply freed.
+ *
+ * NOTE: `Acquire()` must not be called by several threads at the same time, while the buffers can
+ * be released by any thread.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+ public:
+  /**
+   * Create a new pool
+   *
+   * @param buffer_size capacity of each buffer
+   * @param max_pooled_count max count of idle buffers kept in the pool, the rest are freed, it's
+   * rounded up to a power of 2
+   * @return std::shared_ptr<BufferPool> the pool
+   */
+  static std::shared_ptr<BufferPool> Create(size_t buffer_size, size_t max_pooled_count) {
+    return std::shared_ptr<BufferPool>(new BufferPool(buffer_size, max_pooled_count));
+  }
+
+  ~BufferPool() {
+    BufferMemory* buffer = nullptr;
+    while (idle_buffers_.TryPop(&buffer)) {
+      delete buffer;
+    }
+  }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(BufferPool);
+
+  /**
+   * Acquire an empty buffer from the pool, or allocate a new one if the pool is empty
+   *
+   * @return SharedBufferMemory the buffer, or nullptr if OOM
+   */
+  SharedBufferMemory Acquire() {
+    BufferMemory* buffer = nullptr;
+    if (!idle_buffers_.TryPop(&buffer)) {
+      buffer = new BufferMemory(buffer_size_);
+      if (buffer->Capacity() < buffer_size_) {
+        delete buffer;
+        return nullptr;
+      }
+      allocated_count_++;
+    }
+    buffer->SetSize(0);
+    std::weak_ptr<BufferPool> weak_pool = shared_from_this();
+    return SharedBufferMemory(
+        buffer,
+        [weak_pool](BufferMemory* buffer) {
+          std::shared_ptr<BufferPool> pool = weak_pool.lock();
+          if (pool) {
+            pool->Recycle(buffer);
+          } else {
+            delete buffer;
+          }
+        },
+        ControlBlockAllocator<BufferMemory>(control_blocks_));
+  }
+
+  /**
+   * Get the capacity of each buffer
+   *
+   * @return size_t the capacity
+   */
+  size_t BufferSize() const { return buffer_size_; }
+
+  /**
+   * Get the count of idle buffers in the pool
+   *
+   * @return size_t the count
+   */
+  size_t IdleCount() const { return idle_buffers_.Size(); }
+
+  /**
+   * Get the count of buffers which have been allocated by the pool
+   *
+   * @return size_t the count
+   */
+  size_t AllocatedCount() const { return allocated_count_; }
+
+ private:
+  // the recycled control blocks of the references, they all have the same size, the first block
+  // freed decides it
+  class ControlBlockCache {
+   public:
+    explicit ControlBlockCache(size_t capacity) : idle_blocks_(capacity) {}
+
+    ~ControlBlockCache() {
+      void* block = nullptr;
+      while (idle_blocks_.TryPop(&block)) {
+        ::operator delete(block);
+      }
+    }
+
+    IDEVICE_DISALLOW_COPY_AND_ASSIGN(ControlBlockCache);
+
+    void* Allocate(size_t size) {
+      void* block = nullptr;
+      if (size == block_size_.load(std::memory_order_relaxed) && idle_blocks_.TryPop(&block)) {
+        return block;
+      }
+      return ::operator new(size);
+    }
+
+    void Free(void* block, size_t size) {
+      size_t block_size = 0;
+      if (!block_size_.compare_exchange_strong(block_size, size, std::memory_order_relaxed) &&
+          block_size != size) {
+        ::operator delete(block);
+        return;
+      }
+      if (!idle_blocks_.TryPush(std::move(block))) {
+        ::operator delete(block);
+      }
+    }
+
+   private:
+    std::atomic<size_t> block_size_ = ATOMIC_VAR_INIT(0);
+    MpscRingQueue<void*> idle_blocks_;
+  };  // class ControlBlockCache
+
+  // the allocator of the control blocks, it keeps the cache alive while a reference does
+  template <typename T>
+  class ControlBlockAllocator {
+   public:
+    using value_type = T;
+
+    explicit ControlBlockAllocator(std::shared_ptr<ControlBlockCache> cache)
+        : cache_(std::move(cache)) {}
+
+    template <typename U>
+    ControlBlockAllocator(const ControlBlockAllocator<U>& other) : cache_(other.cache_) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(cache_->Allocate(n * sizeof(T))); }
+
+    void deallocate(T* block, size_t n) { cache_->Free(block, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const ControlBlockAllocator<U>& other) const {
+      return cache_ == other.cache_;
+    }
+
+    template <typename U>
+    bool operator!=(const ControlBlockAllocator<U>& other) const {
+      return cache_ != other.cache_;
+    }
+
+   private:
+    template <typename U>
+    friend class ControlBlockAllocator;
+
+    std::shared_ptr<ControlBlockCache> cache_;
+  };  // class ControlBlockAllocator
+
+  BufferPool(size_t buffer_size, size_t max_pooled_count)
+      : buffer_size_(buffer_size),
+        idle_buffers_(max_pooled_count),
+        control_blocks_(std::make_shared<ControlBlockCache>(max_pooled_count)) {}
+
+  void Recycle(BufferMemory* buffer) {
+    if (!idle_buffers_.TryPush(std::move(buffer))) {
+      delete buffer;  // the pool is full
+    }
+  }
+
+  size_t buffer_size_;
+  std::atomic<size_t> allocated_count_ = ATOMIC_VAR_INIT(0);
+  MpscRingQueue<BufferMemory*> idle_buffers_;  ///< pushed by any thread, popped by `Acquire()`
+  std::shared_ptr<ControlBlockCache> control_blocks_;
+};  // class BufferPool
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_BUFFER_POOL_H
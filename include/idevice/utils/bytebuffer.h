@@ -16,6 +16,7 @@ namespace idevice {
 class BufferMemory {
  public:
   BufferMemory() {}
+  explicit BufferMemory(size_t capacity) { Reserve(capacity); }
   ~BufferMemory() {
     if (buffer_) {
       free(buffer_);
@@ -65,6 +66,13 @@ class BufferMemory {
    */
   void SetSize(size_t size) { size_ = size; }
 
+  /**
+   * Get the capacity of the buffer, it can be filled up to this size without reallocating
+   *
+   * @return size_t capacity of the buffer
+   */
+  size_t Capacity() const { return capacity_; }
+
  private:
   bool Reserve(size_t capacity) {
     size_t new_capacity = IDEVICE_MEM_ALIGN(capacity, 128);
@@ -85,6 +93,12 @@ class BufferMemory {
   size_t capacity_ = 0;
 };
 
+/**
+ * A ref-counted BufferMemory, which can be shared by everyone who references the bytes in it.
+ * It is released when the last reference dies.
+ */
+using SharedBufferMemory = std::shared_ptr<BufferMemory>;
+
 /**
  * Bytes buffer
  */
@@ -0,0 +1,101 @@
+#ifndef IDEVICE_UTILS_BYTE_SINK_H
+#define IDEVICE_UTILS_BYTE_SINK_H
+
+#include <cstddef>
+#include <cstring>  // memcpy
+
+namespace idevice {
+
+// The sinks for the templated serializers(e.g. `DTXMessage::SerializeTo()`).
+// A sink is any callable like `bool(const char* data, size_t size)`, which is called for each piece
+// of the serialized bytes, and the serialization stops once it returns false.
+// The pieces live as long as the serialized object, except the ones written with
+// `WriteTransient()`(e.g. a header or a length in a local variable), which are only valid during
+// the call. A sink keeping references to the pieces(e.g. `GatherBuffer`) overloads it to copy them.
+
+/**
+ * Write a piece which is only valid during the call to a sink
+ *
+ * @param sink the sink
+ * @param data the piece
+ * @param size size of the piece
+ * @return the result of the sink
+ */
+template <typename Sink>
+bool WriteTransient(Sink& sink, const char* data, size_t size) {
+  return sink(data, size);
+}
+
+/**
+ * A sink which writes the bytes into a contiguous buffer
+ */
+class BufferWriter {
+ public:
+  /**
+   * Constructor
+   *
+   * @param buffer the buffer
+   * @param capacity capacity of the buffer
+   */
+  BufferWriter(char* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {}
+
+  /**
+   * Write bytes to the buffer
+   *
+   * @param data the bytes
+   * @param size size of the bytes
+   * @return succeed or fail, it fails if the buffer is full
+   */
+  bool operator()(const char* data, size_t size) {
+    if (size > capacity_ - size_) {
+      return false;
+    }
+    memcpy(buffer_ + size_, data, size);
+    size_ += size;
+    return true;
+  }
+
+  /**
+   * Get the size of the written bytes
+   *
+   * @return size_t the size
+   */
+  size_t Size() const { return size_; }
+
+ private:
+  char* buffer_;
+  size_t capacity_;
+  size_t size_ = 0;
+};  // class BufferWriter
+
+/**
+ * A sink which only counts the bytes
+ */
+class SizeCounter {
+ public:
+  /**
+   * Count bytes
+   *
+   * @param data the bytes
+   * @param size size of the bytes
+   * @return always true
+   */
+  bool operator()(const char* /*data*/, size_t size) {
+    size_ += size;
+    return true;
+  }
+
+  /**
+   * Get the size of the counted bytes
+   *
+   * @return size_t the size
+   */
+  size_t Size() const { return size_; }
+
+ private:
+  size_t size_ = 0;
+};  // class SizeCounter
+
+}  // namespace idevice
+
+#endif  // IDEVICE_UTILS_BYTE_SINK_H
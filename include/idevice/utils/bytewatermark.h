@@ -0,0 +1,198 @@
+#ifndef IDEVICE_UTILS_BYTE_WATERMARK_H
+#define IDEVICE_UTILS_BYTE_WATERMARK_H
+
+#include <algorithm>  // std::max
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>  // std::function
+#include <mutex>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A counter of pending bytes with a high and a low watermark, used for backpressure
+ *
+ * The producer adds bytes and the consumers release them. Once the count reaches the high
+ * watermark it's paused, and it stays paused until the count drops to the low watermark, so the
+ * producer doesn't flap around a single threshold. The listener is notified on both crossings.
+ *
+ * The listener is invoked after the internal lock is released, so it may call this watermark(e.g.
+ * `Bytes()`). The notifications are serialized, and a crossing which has been undone by another
+ * thread before being notified may be skipped, so the last notification always matches the
+ * current state.
+ */
+class ByteWatermark {
+ public:
+  /**
+   * Listener of the crossings
+   *
+   * @param above_high_watermark true if it's just paused, false if it's just resumed
+   * @param bytes the pending bytes when it's notified
+   */
+  using Listener = std::function<void(bool above_high_watermark, size_t bytes)>;
+
+  /**
+   * Constructor
+   *
+   * @param high_watermark pause at this many bytes, 0 means never
+   * @param low_watermark resume at this many bytes
+   */
+  ByteWatermark(size_t high_watermark, size_t low_watermark) {
+    SetWatermarks(high_watermark, low_watermark);
+  }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(ByteWatermark);
+
+  /**
+   * Change the watermarks, the low one is capped to the high one
+   *
+   * @param high_watermark pause at this many bytes, 0 means never
+   * @param low_watermark resume at this many bytes
+   */
+  void SetWatermarks(size_t high_watermark, size_t low_watermark) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    high_watermark_ = high_watermark;
+    low_watermark_ = std::min(low_watermark, high_watermark);
+  }
+
+  /**
+   * Set the listener of the crossings
+   * Once it returns, the previous listener is not running and will not be invoked anymore.
+   *
+   * @param listener the listener, null to remove it
+   */
+  void SetListener(Listener listener) {
+    std::lock_guard<std::recursive_mutex> lock(listener_mutex_);
+    listener_ = std::move(listener);
+  }
+
+  /**
+   * Add pending bytes, it may pause
+   *
+   * @param bytes count of bytes
+   */
+  void Add(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      bytes_ += bytes;
+      max_bytes_ = std::max(max_bytes_, bytes_);
+      if (paused_ || high_watermark_ == 0 || bytes_ < high_watermark_) {
+        return;
+      }
+      paused_ = true;
+      pause_count_++;
+    }
+    NotifyListener();
+  }
+
+  /**
+   * Release pending bytes, it may resume
+   *
+   * @param bytes count of bytes
+   */
+  void Release(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      bytes_ -= std::min(bytes, bytes_);
+      if (!paused_ || bytes_ > low_watermark_) {
+        return;
+      }
+      paused_ = false;
+      resumed_.notify_all();
+    }
+    NotifyListener();
+  }
+
+  /**
+   * Check whether it's paused
+   *
+   * @return paused or not
+   */
+  bool Paused() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return paused_;
+  }
+
+  /**
+   * Wait until it's not paused
+   *
+   * @param timeout_ms max time to wait
+   * @return true if it's not paused, false if timed out
+   */
+  bool WaitUntilResumed(uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return resumed_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                             [this] { return !paused_; });
+  }
+
+  /**
+   * Get the pending bytes
+   *
+   * @return size_t count of bytes
+   */
+  size_t Bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+  /**
+   * Get the highest count of pending bytes ever seen
+   *
+   * @return size_t count of bytes
+   */
+  size_t MaxBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_bytes_;
+  }
+
+  /**
+   * Get how many times it has paused
+   *
+   * @return uint64_t the count
+   */
+  uint64_t PauseCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pause_count_;
+  }
+
+ private:
+  void NotifyListener() {
+    // recursive, the listener may cross a watermark again, or replace itself
+    std::lock_guard<std::recursive_mutex> listener_lock(listener_mutex_);
+    bool paused = false;
+    size_t bytes = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      paused = paused_;
+      bytes = bytes_;
+    }
+    if (paused == notified_paused_) {
+      return;  // undone by another thread, or notified by it already
+    }
+    notified_paused_ = paused;
+    if (listener_) {
+      listener_(paused, bytes);
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable resumed_;
+  std::recursive_mutex listener_mutex_;  ///< held while notifying, taken before `mutex_`
+  Listener listener_;
+  bool notified_paused_ = false;  ///< the state last notified, guarded by `listener_mutex_`
+  size_t high_watermark_ = 0;
+  size_t low_watermark_ = 0;
+  size_t bytes_ = 0;
+  size_t max_bytes_ = 0;
+  uint64_t pause_count_ = 0;
+  bool paused_ = false;
+};  // class ByteWatermark
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_BYTE_WATERMARK_H
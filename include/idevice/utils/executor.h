@@ -0,0 +1,252 @@
+#ifndef IDEVICE_UTILS_EXECUTOR_H
+#define IDEVICE_UTILS_EXECUTOR_H
+
+#include <algorithm>  // std::max
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>  // std::function
+#include <memory>      // std::unique_ptr, std::shared_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * Counters of an executor
+ */
+struct ExecutorStat {
+  size_t pending;      ///< count of tasks waiting to run
+  size_t max_pending;  ///< the highest `pending` ever seen
+  uint64_t executed;   ///< count of tasks that have finished
+};
+
+/**
+ * Runs tasks somewhere, e.g. on the calling thread or on worker threads
+ *
+ * Every task comes with a key, executors which keep an order use it to decide which tasks must
+ * run one after another.
+ */
+class Executor {
+ public:
+  using Task = std::function<void()>;
+
+  virtual ~Executor() {}
+
+  /**
+   * Run a task
+   *
+   * @param key tasks with the same key run in the order they are submitted, if the executor keeps
+   * an order
+   * @param task the task
+   */
+  virtual void Execute(uint64_t key, Task task) = 0;
+
+  /**
+   * Get the counters
+   *
+   * @return ExecutorStat the counters
+   */
+  virtual ExecutorStat Stat() const = 0;
+};
+
+/**
+ * Runs tasks on the calling thread immediately
+ */
+class InlineExecutor : public Executor {
+ public:
+  InlineExecutor() {}
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(InlineExecutor);
+
+  void Execute(uint64_t /*key*/, Task task) override {
+    task();
+    executed_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ExecutorStat Stat() const override {
+    return {0, 0, executed_.load(std::memory_order_relaxed)};
+  }
+
+ private:
+  std::atomic<uint64_t> executed_ = ATOMIC_VAR_INIT(0);
+};  // class InlineExecutor
+
+/**
+ * A FIFO of tasks drained by one or more threads, the building block of the executors below
+ *
+ * Tasks queued before the destruction are still run, and then the threads are joined.
+ */
+class TaskQueue {
+ public:
+  /**
+   * Constructor
+   *
+   * @param thread_count count of threads draining the queue, at least 1
+   */
+  explicit TaskQueue(size_t thread_count) {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i) {
+      threads_.emplace_back(&TaskQueue::Run, this);
+    }
+  }
+
+  ~TaskQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    not_empty_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(TaskQueue);
+
+  /**
+   * Add a task to the end of the queue
+   *
+   * @param task the task
+   */
+  void Push(Executor::Task task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+      max_pending_ = std::max(max_pending_, tasks_.size());
+    }
+    not_empty_.notify_one();
+  }
+
+  /**
+   * Get the counters
+   *
+   * @return ExecutorStat the counters
+   */
+  ExecutorStat Stat() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {tasks_.size(), max_pending_, executed_};
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      not_empty_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;  // stopping, and all tasks are done
+      }
+      Executor::Task task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      task();
+      task = nullptr;  // release the captured objects outside of the lock
+      lock.lock();
+      executed_++;
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<Executor::Task> tasks_;
+  size_t max_pending_ = 0;
+  uint64_t executed_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};  // class TaskQueue
+
+/**
+ * Runs tasks on a shared pool of threads, in no particular order
+ */
+class ThreadPoolExecutor : public Executor {
+ public:
+  /**
+   * Constructor
+   *
+   * @param thread_count count of worker threads
+   */
+  explicit ThreadPoolExecutor(size_t thread_count) : queue_(thread_count) {}
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(ThreadPoolExecutor);
+
+  void Execute(uint64_t /*key*/, Task task) override { queue_.Push(std::move(task)); }
+
+  ExecutorStat Stat() const override { return queue_.Stat(); }
+
+ private:
+  TaskQueue queue_;
+};  // class ThreadPoolExecutor
+
+/**
+ * Runs tasks on worker threads, tasks with the same key run one after another in order
+ *
+ * Every key is bound to one of the workers, so a slow key only holds up the keys sharing its
+ * worker, while tasks of different workers run in parallel.
+ */
+class SerialExecutor : public Executor {
+ public:
+  /**
+   * Constructor
+   *
+   * @param thread_count count of worker threads, each one has its own queue
+   */
+  explicit SerialExecutor(size_t thread_count) {
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t i = 0; i < thread_count; ++i) {
+      queues_.emplace_back(new TaskQueue(1));
+    }
+  }
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(SerialExecutor);
+
+  void Execute(uint64_t key, Task task) override {
+    queues_[key % queues_.size()]->Push(std::move(task));
+  }
+
+  /**
+   * Run a task once all tasks submitted before it have run, whatever their keys are, it doesn't
+   * wait
+   * A barrier is queued to every worker, and the task runs on the worker passing the last one,
+   * e.g. to release the objects used by the earlier tasks.
+   *
+   * @param task the task
+   */
+  void ExecuteAfterAll(Task task) {
+    struct Barrier {
+      std::atomic<size_t> remaining;
+      Task task;
+    };
+    std::shared_ptr<Barrier> barrier = std::make_shared<Barrier>();
+    barrier->remaining.store(queues_.size(), std::memory_order_relaxed);
+    barrier->task = std::move(task);
+    for (auto& queue : queues_) {
+      queue->Push([barrier]() {
+        if (barrier->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          barrier->task();
+          barrier->task = nullptr;  // release the captured objects on this worker
+        }
+      });
+    }
+  }
+
+  ExecutorStat Stat() const override {
+    ExecutorStat stat = {0, 0, 0};
+    for (const auto& queue : queues_) {
+      ExecutorStat queue_stat = queue->Stat();
+      stat.pending += queue_stat.pending;
+      stat.max_pending = std::max(stat.max_pending, queue_stat.max_pending);
+      stat.executed += queue_stat.executed;
+    }
+    return stat;
+  }
+
+ private:
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+};  // class SerialExecutor
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_EXECUTOR_H
@@ -0,0 +1,174 @@
+#ifndef IDEVICE_UTILS_GATHER_BUFFER_H
+#define IDEVICE_UTILS_GATHER_BUFFER_H
+
+#include <cstddef>
+#include <cstring>  // memcpy
+#include <vector>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A segment of memory, same as the `struct iovec` of POSIX
+ */
+struct IoVec {
+  const char* data;
+  size_t size;
+};
+
+/**
+ * A list of memory segments to be written out together(scatter-gather IO)
+ *
+ * Small pieces(e.g. the fields of headers) are copied into an internal buffer and merged with the
+ * adjacent small pieces, while large buffers are only referenced, so they go out without being
+ * copied. The referenced buffers must outlive the use of `Segments()`.
+ */
+class GatherBuffer {
+ public:
+  static constexpr size_t kDefaultCopyThreshold = 512;
+
+  /**
+   * Constructor
+   *
+   * @param copy_threshold pieces smaller than it are copied, the others are referenced
+   */
+  explicit GatherBuffer(size_t copy_threshold = kDefaultCopyThreshold)
+      : copy_threshold_(copy_threshold) {}
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(GatherBuffer);
+
+  /**
+   * Append a piece, copy it or reference it depends on its size
+   *
+   * @param data the piece
+   * @param size size of the piece
+   * @return always true
+   */
+  bool Append(const char* data, size_t size) {
+    if (size < copy_threshold_) {
+      Copy(data, size);
+    } else {
+      Reference(data, size);
+    }
+    return true;
+  }
+
+  /**
+   * Append a piece, so it can be used as a sink of the serializers, see `Append()`
+   *
+   * @param data the piece
+   * @param size size of the piece
+   * @return always true
+   */
+  bool operator()(const char* data, size_t size) { return Append(data, size); }
+
+  /**
+   * Append a piece which is only valid during the call, it's always copied, see "bytesink.h"
+   *
+   * @param buffer the buffer
+   * @param data the piece
+   * @param size size of the piece
+   * @return always true
+   */
+  friend bool WriteTransient(GatherBuffer& buffer, const char* data, size_t size) {
+    buffer.Copy(data, size);
+    return true;
+  }
+
+  /**
+   * Append a piece by copying it
+   *
+   * @param data the piece
+   * @param size size of the piece
+   */
+  void Copy(const char* data, size_t size) {
+    if (size == 0) {
+      return;
+    }
+    size_t offset = scratch_.size();
+    scratch_.resize(offset + size);
+    memcpy(&scratch_[offset], data, size);
+    // merge it into the last segment if they are adjacent in the scratch buffer
+    if (!segments_.empty() && segments_.back().data == nullptr &&
+        segments_.back().offset + segments_.back().size == offset) {
+      segments_.back().size += size;
+    } else {
+      segments_.push_back({nullptr, offset, size});
+    }
+    size_ += size;
+  }
+
+  /**
+   * Append a piece by referencing it
+   *
+   * @param data the piece, it must outlive the use of `Segments()`
+   * @param size size of the piece
+   */
+  void Reference(const char* data, size_t size) {
+    if (size == 0) {
+      return;
+    }
+    segments_.push_back({data, 0, size});
+    size_ += size;
+  }
+
+  /**
+   * Get all segments
+   * The result is valid until the next modification of this buffer.
+   *
+   * @return const std::vector<IoVec>& the segments
+   */
+  const std::vector<IoVec>& Segments() {
+    // the scratch buffer may be reallocated while appending, so resolve its pointers at last
+    iovecs_.clear();
+    for (const Segment& segment : segments_) {
+      const char* data = segment.data ? segment.data : scratch_.data() + segment.offset;
+      iovecs_.push_back({data, segment.size});
+    }
+    return iovecs_;
+  }
+
+  /**
+   * Get the total size of all segments
+   *
+   * @return size_t the size
+   */
+  size_t Size() const { return size_; }
+
+  /**
+   * Get the count of segments
+   *
+   * @return size_t the count
+   */
+  size_t SegmentCount() const { return segments_.size(); }
+
+  /**
+   * Remove all segments, the memory is kept for reuse
+   */
+  void Clear() {
+    segments_.clear();
+    scratch_.clear();
+    iovecs_.clear();
+    size_ = 0;
+  }
+
+ private:
+  struct Segment {
+    const char* data;  // null if the bytes are in the scratch buffer
+    size_t offset;     // offset in the scratch buffer
+    size_t size;
+  };
+
+  size_t copy_threshold_;
+  size_t size_ = 0;
+  std::vector<Segment> segments_;
+  std::vector<char> scratch_;
+  std::vector<IoVec> iovecs_;
+};  // class GatherBuffer
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_GATHER_BUFFER_H
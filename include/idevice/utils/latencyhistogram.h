@@ -0,0 +1,142 @@
+#ifndef IDEVICE_UTILS_LATENCY_HISTOGRAM_H
+#define IDEVICE_UTILS_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A copy of the counters of a `LatencyHistogram`
+ */
+struct LatencyHistogramSnapshot {
+  std::vector<uint64_t> buckets;  ///< count of samples per bucket, see `LatencyHistogram`
+  uint64_t count = 0;             ///< count of samples
+  uint64_t sum_us = 0;            ///< sum of samples in microseconds
+  uint64_t max_us = 0;            ///< the largest sample in microseconds
+
+  /**
+   * Get the mean of the samples
+   *
+   * @return uint64_t the mean in microseconds, 0 if there is no sample
+   */
+  uint64_t MeanUs() const { return count == 0 ? 0 : sum_us / count; }
+
+  /**
+   * Get a percentile of the samples, as the upper bound of the bucket holding it
+   *
+   * @param percentile the percentile, e.g. 99 or 99.9
+   * @return uint64_t the percentile in microseconds(capped to `max_us`), 0 if there is no sample
+   */
+  uint64_t PercentileUs(double percentile) const {
+    if (count == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100 * count);
+    rank = rank == 0 ? 1 : (rank > count ? count : rank);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        uint64_t upper_bound = (static_cast<uint64_t>(1) << i) - 1;
+        return upper_bound < max_us ? upper_bound : max_us;
+      }
+    }
+    return max_us;
+  }
+};
+
+/**
+ * A histogram of latencies with power-of-two buckets in microseconds
+ *
+ * The bucket 0 holds the samples of 0us, and the bucket i holds [2^(i-1), 2^i) us, the last one
+ * holds everything above. Recording is a few relaxed atomic adds without any lock, so it's cheap
+ * enough for the hot path, while a snapshot taken meanwhile may be slightly inconsistent, e.g. the
+ * count may not match the sum of the buckets.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr size_t kBucketCount = 32;  ///< the last bucket starts at about 18 minutes
+
+  LatencyHistogram() {
+    for (std::atomic<uint64_t>& bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+
+  /**
+   * Record a sample
+   *
+   * @param latency_us the latency in microseconds
+   */
+  void Record(uint64_t latency_us) {
+    buckets_[BucketIndex(latency_us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(latency_us, std::memory_order_relaxed);
+    uint64_t max_us = max_us_.load(std::memory_order_relaxed);
+    while (latency_us > max_us &&
+           !max_us_.compare_exchange_weak(max_us, latency_us, std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * Get a copy of the counters
+   *
+   * @return LatencyHistogramSnapshot the copy
+   */
+  LatencyHistogramSnapshot Snapshot() const {
+    LatencyHistogramSnapshot snapshot;
+    snapshot.buckets.reserve(kBucketCount);
+    for (const std::atomic<uint64_t>& bucket : buckets_) {
+      snapshot.buckets.push_back(bucket.load(std::memory_order_relaxed));
+    }
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    snapshot.sum_us = sum_us_.load(std::memory_order_relaxed);
+    snapshot.max_us = max_us_.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+  /**
+   * Get the count of samples
+   *
+   * @return uint64_t the count
+   */
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+  /**
+   * Get the bucket of a latency
+   *
+   * @param latency_us the latency in microseconds
+   * @return size_t index of the bucket
+   */
+  static size_t BucketIndex(uint64_t latency_us) {
+    size_t index = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    index = latency_us == 0 ? 0 : 64 - __builtin_clzll(latency_us);
+#else
+    while (latency_us != 0) {
+      latency_us >>= 1;
+      index++;
+    }
+#endif
+    return index < kBucketCount ? index : kBucketCount - 1;
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[kBucketCount];
+  std::atomic<uint64_t> count_ = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> sum_us_ = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> max_us_ = ATOMIC_VAR_INIT(0);
+};  // class LatencyHistogram
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_LATENCY_HISTOGRAM_H
@@ -0,0 +1,523 @@
+#ifndef IDEVICE_UTILS_RING_QUEUE_H
+#define IDEVICE_UTILS_RING_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>  // std::function
+#include <memory>      // std::unique_ptr
+#include <mutex>
+#include <new>          // placement new
+#include <thread>       // std::this_thread::yield
+#include <type_traits>  // std::aligned_storage
+#include <utility>      // std::move
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+constexpr size_t kRingQueueCacheLineSize = 64;
+
+/**
+ * The blocking wait of the ring queues
+ *
+ * The fast paths of the queues are lock-free, a thread only parks on the condition variable when
+ * the queue is empty(or full) after a short spin, and the other side only takes the lock to wake
+ * it up if someone is actually parked, so an uncontended push or pop never touches the mutex.
+ *
+ * The operation itself(e.g. the pop) is never performed while holding the mutex, as it notifies
+ * the waiter of the other side, which takes the mutex of that waiter, the two sides would take
+ * the two mutexes in opposite orders otherwise.
+ */
+class RingQueueWaiter {
+ public:
+  RingQueueWaiter() {}
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(RingQueueWaiter);
+
+  /**
+   * Perform `operation()` until it succeeds, or timeout
+   *
+   * @param operation the operation to perform(e.g. try to pop), it returns succeed or fail
+   * @param ready the read-only check whether the operation may succeed(e.g. not empty), it's
+   * called while holding the mutex
+   * @param timeout_ms timeout in milliseconds
+   * @return true if `operation()` succeeded
+   */
+  template <typename Operation, typename Ready>
+  bool Wait(Operation&& operation, Ready&& ready, uint32_t timeout_ms) {
+    constexpr int spin_count = 64;
+    for (int i = 0; i < spin_count; ++i) {
+      if (operation()) {
+        return true;
+      }
+      std::this_thread::yield();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+      bool timeout = false;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiters_.fetch_add(1, std::memory_order_relaxed);
+        // pairs with the fence in `Notify()`: either we see the new state, or the notifier sees us
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!ready()) {
+          if (condition_.wait_until(lock, deadline) == std::cv_status::timeout) {
+            timeout = true;
+            break;
+          }
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      // another thread may have taken it first, e.g. one of the producers of a full queue
+      if (operation()) {
+        return true;
+      }
+      if (timeout) {
+        return false;
+      }
+    }
+  }
+
+  /**
+   * Wake up the waiting threads, if there is any
+   * It must be called after the state of the queue has been changed.
+   */
+  void Notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      condition_.notify_all();
+    }
+  }
+
+ private:
+  std::atomic<int> waiters_ = ATOMIC_VAR_INIT(0);
+  std::mutex mutex_;
+  std::condition_variable condition_;
+};  // class RingQueueWaiter
+
+/**
+ * A bounded lock-free single-producer/single-consumer queue
+ *
+ * `Push()` must only be called from one thread, and `Pop()`/`Clear()` from another one.
+ */
+template <typename T>
+class SpscRingQueue {
+ public:
+  /**
+   * Constructor
+   *
+   * @param capacity max count of elements, it's rounded up to a power of 2
+   */
+  explicit SpscRingQueue(size_t capacity)
+      : capacity_(RoundUpToPowerOf2(capacity)),
+        mask_(capacity_ - 1),
+        slots_(new Slot[capacity_]) {}
+
+  ~SpscRingQueue() { Clear(); }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(SpscRingQueue);
+
+  /**
+   * Add(move) a new element to the end of the queue if it's not full
+   *
+   * @param data new element, it's only moved if it succeeds
+   * @return succeed or fail
+   */
+  bool TryPush(T&& data) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == capacity_) {
+        return false;  // full
+      }
+    }
+    new (&slots_[tail & mask_]) T(std::move(data));
+    tail_.store(tail + 1, std::memory_order_release);
+    not_empty_.Notify();
+    return true;
+  }
+
+  /**
+   * Add(move) a new element to the end of the queue, wait if it's full
+   *
+   * @param data new element, it's only moved if it succeeds
+   * @param timeout_ms timeout in milliseconds
+   * @return succeed or timeout
+   */
+  bool Push(T&& data, uint32_t timeout_ms) {
+    return TryPush(std::move(data)) ||
+           not_full_.Wait([&]() { return TryPush(std::move(data)); }, [this]() { return !Full(); },
+                          timeout_ms);
+  }
+
+  /**
+   * Take(move) the first element out of the queue if it's not empty
+   *
+   * @param data out param, the first element
+   * @return succeed or fail
+   */
+  bool TryPop(T* data) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;  // empty
+      }
+    }
+    T* item = reinterpret_cast<T*>(&slots_[head & mask_]);
+    *data = std::move(*item);
+    item->~T();
+    head_.store(head + 1, std::memory_order_release);
+    not_full_.Notify();
+    return true;
+  }
+
+  /**
+   * Take(move) the first element out of the queue, wait if it's empty
+   *
+   * @param data out param, the first element
+   * @param timeout_ms timeout in milliseconds
+   * @return succeed or timeout
+   */
+  bool Pop(T* data, uint32_t timeout_ms) {
+    return TryPop(data) ||
+           not_empty_.Wait([&]() { return TryPop(data); }, [this]() { return !Empty(); },
+                           timeout_ms);
+  }
+
+  /**
+   * Clear the queue, it must be called from the consumer thread
+   *
+   * @param destructor called with each element before it's destroyed
+   */
+  void Clear(std::function<void(T&)> destructor = nullptr) {
+    T data;
+    while (TryPop(&data)) {
+      if (destructor) {
+        destructor(data);
+      }
+    }
+  }
+
+  /**
+   * Get the size of the queue, it's only a snapshot if the queue is in use
+   *
+   * @return size_t the size
+   */
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Check whether the queue is empty, it's only a snapshot if the queue is in use
+   *
+   * @return empty or not
+   */
+  bool Empty() const { return Size() == 0; }
+
+  /**
+   * Get the max count of elements
+   *
+   * @return size_t the capacity
+   */
+  size_t Capacity() const { return capacity_; }
+
+ private:
+  using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  bool Full() const { return Size() == capacity_; }
+
+  static size_t RoundUpToPowerOf2(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  // the consumer side and the producer side are kept in different cache lines
+  char head_padding_[kRingQueueCacheLineSize];
+  std::atomic<size_t> head_ = ATOMIC_VAR_INIT(0);
+  size_t cached_tail_ = 0;
+  char tail_padding_[kRingQueueCacheLineSize];
+  std::atomic<size_t> tail_ = ATOMIC_VAR_INIT(0);
+  size_t cached_head_ = 0;
+  char waiter_padding_[kRingQueueCacheLineSize];
+
+  RingQueueWaiter not_empty_;
+  RingQueueWaiter not_full_;
+};  // class SpscRingQueue
+
+/**
+ * A bounded lock-free multi-producer/single-consumer queue
+ *
+ * `Push()` can be called from any thread, while `Pop()`/`Clear()` must only be called from one
+ * thread. Each slot has a sequence number which tells whether it's ready to be written or read,
+ * so the producers only contend on a CAS of the tail.
+ */
+template <typename T>
+class MpscRingQueue {
+ public:
+  /**
+   * Constructor
+   *
+   * @param capacity max count of elements, it's rounded up to a power of 2, and at least 2, as the
+   * sequence of a single slot could not tell a written slot from a free one
+   */
+  explicit MpscRingQueue(size_t capacity)
+      : capacity_(RoundUpToPowerOf2(capacity < 2 ? 2 : capacity)),
+        mask_(capacity_ - 1),
+        slots_(new Slot[capacity_]) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MpscRingQueue() { Clear(); }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(MpscRingQueue);
+
+  /**
+   * Add(move) a new element to the end of the queue if it's not full
+   *
+   * @param data new element, it's only moved if it succeeds
+   * @return succeed or fail
+   */
+  bool TryPush(T&& data) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Slot* slot = nullptr;
+    while (true) {
+      slot = &slots_[tail & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+          break;  // the slot is ours
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);  // someone else took the slot
+      }
+    }
+    new (&slot->storage) T(std::move(data));
+    slot->sequence.store(tail + 1, std::memory_order_release);
+    not_empty_.Notify();
+    return true;
+  }
+
+  /**
+   * Add(move) a new element to the end of the queue, wait if it's full
+   *
+   * @param data new element, it's only moved if it succeeds
+   * @param timeout_ms timeout in milliseconds
+   * @return succeed or timeout
+   */
+  bool Push(T&& data, uint32_t timeout_ms) {
+    return TryPush(std::move(data)) ||
+           not_full_.Wait([&]() { return TryPush(std::move(data)); }, [this]() { return !Full(); },
+                          timeout_ms);
+  }
+
+  /**
+   * Add(move) new elements to the end of the queue if there is room for all of them
+   * The elements become visible to the consumer at once, so it never takes only a part of them.
+   *
+   * @param data new elements, they are only moved if it succeeds
+   * @param count count of the elements, it fails if it's greater than the capacity
+   * @return succeed or fail
+   */
+  bool TryPushAll(T* data, size_t count) {
+    if (count == 0) {
+      return true;
+    }
+    if (count > capacity_) {
+      return false;
+    }
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      size_t sequence = slots_[tail & mask_].sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+      if (diff < 0) {
+        return false;  // full
+      }
+      if (diff == 0) {
+        // the slots are freed in order, so all of them are free if the last one is
+        size_t last = tail + count - 1;
+        size_t last_sequence = slots_[last & mask_].sequence.load(std::memory_order_acquire);
+        intptr_t last_diff = static_cast<intptr_t>(last_sequence) - static_cast<intptr_t>(last);
+        if (last_diff < 0) {
+          return false;  // not enough room
+        }
+        if (last_diff == 0 &&
+            tail_.compare_exchange_weak(tail, tail + count, std::memory_order_relaxed)) {
+          break;  // the slots are ours
+        }
+      }
+      tail = tail_.load(std::memory_order_relaxed);  // someone else took the slots
+    }
+    for (size_t i = 0; i < count; ++i) {
+      new (&slots_[(tail + i) & mask_].storage) T(std::move(data[i]));
+    }
+    // the consumer takes the slots in order, so it sees none of them until the first one is
+    // published, which is the last one to be published
+    for (size_t i = count - 1; i > 0; --i) {
+      slots_[(tail + i) & mask_].sequence.store(tail + i + 1, std::memory_order_release);
+    }
+    slots_[tail & mask_].sequence.store(tail + 1, std::memory_order_release);
+    not_empty_.Notify();
+    return true;
+  }
+
+  /**
+   * Add(move) new elements to the end of the queue all at once, wait if there is not enough room
+   *
+   * @param data new elements, they are only moved if it succeeds
+   * @param count count of the elements, it fails if it's greater than the capacity
+   * @param timeout_ms timeout in milliseconds
+   * @return succeed or timeout
+   */
+  bool PushAll(T* data, size_t count, uint32_t timeout_ms) {
+    return TryPushAll(data, count) ||
+           (count <= capacity_ &&
+            not_full_.Wait([&]() { return TryPushAll(data, count); },
+                           [this, count]() { return HasRoom(count); }, timeout_ms));
+  }
+
+  /**
+   * Take(move) the first element out of the queue if it's not empty
+   *
+   * @param data out param, the first element
+   * @return succeed or fail
+   */
+  bool TryPop(T* data) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    Slot* slot = &slots_[head & mask_];
+    if (slot->sequence.load(std::memory_order_acquire) != head + 1) {
+      return false;  // empty, or the producer has not finished writing it
+    }
+    T* item = reinterpret_cast<T*>(&slot->storage);
+    *data = std::move(*item);
+    item->~T();
+    slot->sequence.store(head + capacity_, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_release);
+    not_full_.Notify();
+    return true;
+  }
+
+  /**
+   * Take(move) the first element out of the queue, wait if it's empty
+   *
+   * @param data out param, the first element
+   * @param timeout_ms timeout in milliseconds
+   * @return succeed or timeout
+   */
+  bool Pop(T* data, uint32_t timeout_ms) {
+    return TryPop(data) ||
+           not_empty_.Wait([&]() { return TryPop(data); }, [this]() { return Readable(); },
+                           timeout_ms);
+  }
+
+  /**
+   * Clear the queue, it must be called from the consumer thread
+   *
+   * @param destructor called with each element before it's destroyed
+   */
+  void Clear(std::function<void(T&)> destructor = nullptr) {
+    T data;
+    while (TryPop(&data)) {
+      if (destructor) {
+        destructor(data);
+      }
+    }
+  }
+
+  /**
+   * Get the size of the queue, it's only a snapshot if the queue is in use
+   *
+   * @return size_t the size
+   */
+  size_t Size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+
+  /**
+   * Check whether the queue is empty, it's only a snapshot if the queue is in use
+   *
+   * @return empty or not
+   */
+  bool Empty() const { return Size() == 0; }
+
+  /**
+   * Get the max count of elements
+   *
+   * @return size_t the capacity
+   */
+  size_t Capacity() const { return capacity_; }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  // the slot of the tail is not free yet, it's only a snapshot
+  bool Full() const {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t sequence = slots_[tail & mask_].sequence.load(std::memory_order_acquire);
+    return static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail) < 0;
+  }
+
+  // the slot of the last one of `count` elements pushed at the tail is free, it's only a snapshot
+  bool HasRoom(size_t count) const {
+    size_t last = tail_.load(std::memory_order_relaxed) + count - 1;
+    size_t sequence = slots_[last & mask_].sequence.load(std::memory_order_acquire);
+    return static_cast<intptr_t>(sequence) - static_cast<intptr_t>(last) >= 0;
+  }
+
+  // the slot of the head has been written, unlike `Empty()`, it's false while the producer is
+  // still writing it
+  bool Readable() const {
+    size_t head = head_.load(std::memory_order_relaxed);
+    return slots_[head & mask_].sequence.load(std::memory_order_acquire) == head + 1;
+  }
+
+  static size_t RoundUpToPowerOf2(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  // the consumer side and the producer side are kept in different cache lines
+  char head_padding_[kRingQueueCacheLineSize];
+  std::atomic<size_t> head_ = ATOMIC_VAR_INIT(0);
+  char tail_padding_[kRingQueueCacheLineSize];
+  std::atomic<size_t> tail_ = ATOMIC_VAR_INIT(0);
+  char waiter_padding_[kRingQueueCacheLineSize];
+
+  RingQueueWaiter not_empty_;
+  RingQueueWaiter not_full_;
+};  // class MpscRingQueue
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_RING_QUEUE_H
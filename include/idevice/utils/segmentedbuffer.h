@@ -0,0 +1,242 @@
+#ifndef IDEVICE_UTILS_SEGMENTED_BUFFER_H
+#define IDEVICE_UTILS_SEGMENTED_BUFFER_H
+
+#include <algorithm>  // std::min, std::max
+#include <cstring>    // memcpy
+#include <deque>
+#include <memory>  // std::make_shared
+
+#include "idevice/utils/bytebuffer.h"
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN, IDEVICE_ASSERT
+
+namespace idevice {
+
+/**
+ * A Segmented Buffer
+ *
+ * Incoming bytes are appended to a list of fixed capacity segments, and consumed from the head.
+ * Unlike a single growing buffer, the data is never shifted or reallocated, so a pointer to the
+ * bytes in a segment stays valid as long as someone holds a reference of the segment, even after
+ * the bytes have been consumed.
+ *
+ * |-- segment #0 --|-- segment #1 --|-- segment #2 --|
+ * | consumed | readable bytes ...               | free |
+ *            ^ read offset                      ^ write offset
+ */
+class SegmentedBuffer {
+ public:
+  /**
+   * Constructor
+   *
+   * @param segment_size the default capacity of each segment
+   */
+  explicit SegmentedBuffer(size_t segment_size = 64 * 1024) : segment_size_(segment_size) {}
+  ~SegmentedBuffer() {}
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(SegmentedBuffer);
+
+  /**
+   * write(copy) some data to the end of the buffer
+   *
+   * @param data the src buffer
+   * @param size size of the src buffer
+   * @return return true if all data has been written successfully
+   */
+  bool Append(const char* data, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+      if (segments_.empty() || segments_.back()->Size() == segments_.back()->Capacity()) {
+        if (!NewSegment(std::max(segment_size_, size - offset))) {
+          return false;
+        }
+      }
+      BufferMemory* tail = segments_.back().get();
+      size_t len = std::min(tail->Capacity() - tail->Size(), size - offset);
+      memcpy(tail->Allocate(len), data + offset, len);  // never reallocates, len <= free space
+      offset += len;
+    }
+    size_ += size;
+    return true;
+  }
+
+  /**
+   * add(move) a filled buffer to the end of the buffer as a new segment, without copying it
+   *
+   * @param segment the filled buffer
+   */
+  void Append(SharedBufferMemory&& segment) {
+    if (segment == nullptr || segment->Size() == 0) {
+      return;
+    }
+    if (size_ == 0) {
+      // nothing readable is left, drop the old segments so the head always has readable bytes
+      while (!segments_.empty()) {
+        ReleaseSegment(std::move(segments_.front()));
+        segments_.pop_front();
+      }
+      read_offset_ = 0;
+    }
+    size_ += segment->Size();
+    segments_.emplace_back(std::move(segment));
+  }
+
+  /**
+   * Make room for the first `size` readable bytes in a single segment
+   * If they can't fit in the segment where they start, a new segment is started for them, and the
+   * readable bytes buffered so far are moved to it, so call it before most of the bytes are
+   * appended, they will be contiguous once they are all appended.
+   *
+   * @param size size of the bytes
+   * @return return false if OOM
+   */
+  bool Reserve(size_t size) {
+    if (size <= size_) {
+      return true;  // all appended already, too late to move them
+    }
+    if (segments_.size() == 1 && read_offset_ + size <= segments_.back()->Capacity()) {
+      return true;  // fits in the tail
+    }
+    if (segments_.empty() && size <= segment_size_) {
+      return true;  // the next segment is large enough
+    }
+    SharedBufferMemory segment = AcquireSegment(std::max(segment_size_, size));
+    if (segment == nullptr) {
+      return false;
+    }
+    CopyTo(segment->Allocate(size_), size_);
+    while (!segments_.empty()) {
+      ReleaseSegment(std::move(segments_.front()));
+      segments_.pop_front();
+    }
+    read_offset_ = 0;
+    segments_.emplace_back(std::move(segment));
+    return true;
+  }
+
+  /**
+   * Get a pointer to the readable bytes if the first `size` bytes are contiguous in memory
+   *
+   * @param size size of the bytes
+   * @param segment out param, the segment which owns the bytes, can be null
+   * @return const char* the bytes, or nullptr if they straddle a segment boundary (or there's not
+   * enough data)
+   */
+  const char* Contiguous(size_t size, SharedBufferMemory* segment = nullptr) const {
+    if (size > size_ || segments_.empty()) {
+      return nullptr;
+    }
+    const SharedBufferMemory& head = segments_.front();
+    if (head->Size() - read_offset_ < size) {
+      return nullptr;
+    }
+    if (segment) {
+      *segment = head;
+    }
+    return head->GetPtr(read_offset_);
+  }
+
+  /**
+   * read(copy) the first `size` readable bytes, without consuming them
+   *
+   * @param dest the dest buffer
+   * @param size size to read
+   * @return return true if there's enough data to read
+   */
+  bool CopyTo(char* dest, size_t size) const {
+    if (size > size_) {
+      return false;
+    }
+    size_t offset = read_offset_;
+    size_t copied = 0;
+    for (const auto& segment : segments_) {
+      size_t len = std::min(segment->Size() - offset, size - copied);
+      memcpy(dest + copied, segment->GetPtr(offset), len);
+      copied += len;
+      offset = 0;
+      if (copied == size) {
+        break;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * consume the first `size` readable bytes
+   *
+   * @param size size to consume
+   */
+  void Consume(size_t size) {
+    IDEVICE_ASSERT(size <= size_, "size <= size_");
+    size_ -= size;
+    read_offset_ += size;
+    while (!segments_.empty() && read_offset_ >= segments_.front()->Size()) {
+      if (segments_.size() == 1 && read_offset_ < segments_.front()->Capacity()) {
+        break;  // the tail still has free space to write
+      }
+      read_offset_ -= segments_.front()->Size();
+      ReleaseSegment(std::move(segments_.front()));
+      segments_.pop_front();
+    }
+    if (size_ == 0 && !segments_.empty() && segments_.front().use_count() == 1) {
+      // nobody else references the bytes, rewind the only segment to reuse it from the beginning
+      segments_.front()->SetSize(0);
+      read_offset_ = 0;
+    }
+  }
+
+  /**
+   * Get the size of readable bytes
+   *
+   * @return size_t size of readable bytes
+   */
+  size_t Size() const { return size_; }
+
+  /**
+   * Get the count of segments
+   *
+   * @return size_t count of segments
+   */
+  size_t SegmentCount() const { return segments_.size(); }
+
+ private:
+  bool NewSegment(size_t capacity) {
+    SharedBufferMemory segment = AcquireSegment(capacity);
+    if (segment == nullptr) {
+      return false;
+    }
+    segments_.emplace_back(std::move(segment));
+    return true;
+  }
+
+  SharedBufferMemory AcquireSegment(size_t capacity) {
+    if (spare_segment_ && spare_segment_->Capacity() >= capacity) {
+      return std::move(spare_segment_);
+    }
+    SharedBufferMemory segment = std::make_shared<BufferMemory>(capacity);
+    if (segment->Capacity() < capacity) {
+      return nullptr;  // OOM
+    }
+    return segment;
+  }
+
+  void ReleaseSegment(SharedBufferMemory&& segment) {
+    // keep one unreferenced segment of the default size for reuse, to avoid allocations in the
+    // steady state
+    if (segment.use_count() == 1 && segment->Capacity() == IDEVICE_MEM_ALIGN(segment_size_, 128)) {
+      segment->SetSize(0);
+      spare_segment_ = std::move(segment);
+    }
+  }
+
+  size_t segment_size_;
+  size_t size_ = 0;         // readable bytes
+  size_t read_offset_ = 0;  // offset of the first readable byte in the head segment
+  std::deque<SharedBufferMemory> segments_;
+  SharedBufferMemory spare_segment_ = nullptr;
+};  // class SegmentedBuffer
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_SEGMENTED_BUFFER_H
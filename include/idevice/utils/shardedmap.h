@@ -0,0 +1,199 @@
+#ifndef IDEVICE_UTILS_SHARDED_MAP_H
+#define IDEVICE_UTILS_SHARDED_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>  // std::hash, std::function
+#include <mutex>
+#include <unordered_map>
+#include <utility>  // std::move
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A thread-safe hash map split into shards
+ *
+ * Every shard is an `unordered_map` guarded by its own mutex, so threads working on different keys
+ * rarely contend for the same lock. The shard of a key is picked by the high bits of its
+ * (scrambled) hash, because the keys of DTX are usually sequential numbers which `std::hash`
+ * returns as is.
+ *
+ * NOTE: the values are copied out, never referenced, so they can't be modified by other threads
+ * while being used. Don't call the map back inside the function of `ForEach()`.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class ShardedMap {
+ public:
+  static constexpr size_t kDefaultShardCountBits = 4;  // 16 shards
+
+  /**
+   * Constructor
+   *
+   * @param shard_count_bits there are (1 << shard_count_bits) shards, 0 for a single shard
+   */
+  explicit ShardedMap(size_t shard_count_bits = kDefaultShardCountBits)
+      : shard_count_bits_(shard_count_bits),
+        shards_(new Shard[static_cast<size_t>(1) << shard_count_bits_]) {}
+
+  ~ShardedMap() { delete[] shards_; }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(ShardedMap);
+
+  /**
+   * Insert a new element, or replace the value of an existing key
+   *
+   * @param key the key
+   * @param value the value
+   * @return true if inserted, false if replaced
+   */
+  bool Insert(const K& key, V value) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.map.find(key);
+    if (found != shard.map.end()) {
+      found->second = std::move(value);
+      return false;
+    }
+    shard.map.emplace(key, std::move(value));
+    return true;
+  }
+
+  /**
+   * Find the value of a key
+   *
+   * @param key the key
+   * @param value out param, a copy of the value, it's untouched if not found
+   * @return found or not
+   */
+  bool Find(const K& key, V* value) const {
+    const Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.map.find(key);
+    if (found == shard.map.end()) {
+      return false;
+    }
+    if (value) {
+      *value = found->second;
+    }
+    return true;
+  }
+
+  /**
+   * Find and remove a key in one step, so only one thread can take it
+   *
+   * @param key the key
+   * @param value out param, the removed value, it's untouched if not found
+   * @return found or not
+   */
+  bool Take(const K& key, V* value) {
+    Shard& shard = ShardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.map.find(key);
+    if (found == shard.map.end()) {
+      return false;
+    }
+    if (value) {
+      *value = std::move(found->second);
+    }
+    shard.map.erase(found);
+    return true;
+  }
+
+  /**
+   * Remove a key
+   *
+   * @param key the key
+   * @return removed or not
+   */
+  bool Erase(const K& key) { return Take(key, nullptr); }
+
+  /**
+   * Get the count of elements
+   * Shards are counted one by one, so it's a snapshot if other threads are modifying the map.
+   *
+   * @return size_t the count
+   */
+  size_t Size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < ShardCount(); ++i) {
+      std::lock_guard<std::mutex> lock(shards_[i].mutex);
+      size += shards_[i].map.size();
+    }
+    return size;
+  }
+
+  /**
+   * Remove all elements
+   *
+   * @param function called with every removed element, outside of the lock, so it may call the
+   * map back
+   */
+  void Clear(std::function<void(const K&, V&)> function = nullptr) {
+    for (size_t i = 0; i < ShardCount(); ++i) {
+      std::unordered_map<K, V, Hash> removed;
+      {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        removed.swap(shards_[i].map);
+      }
+      // the values are visited and destructed outside of the lock
+      if (function) {
+        for (auto& item : removed) {
+          function(item.first, item.second);
+        }
+      }
+    }
+  }
+
+  /**
+   * Visit all elements, shard by shard, with the lock of the shard held
+   *
+   * @param function the visitor
+   */
+  void ForEach(std::function<void(const K&, const V&)> function) const {
+    for (size_t i = 0; i < ShardCount(); ++i) {
+      std::lock_guard<std::mutex> lock(shards_[i].mutex);
+      for (const auto& item : shards_[i].map) {
+        function(item.first, item.second);
+      }
+    }
+  }
+
+  /**
+   * Get the count of shards
+   *
+   * @return size_t the count
+   */
+  size_t ShardCount() const { return static_cast<size_t>(1) << shard_count_bits_; }
+
+ private:
+  static constexpr size_t kCacheLineSize = 64;
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<K, V, Hash> map;
+    char padding[kCacheLineSize];  // keeps the locks of neighbours out of one cache line
+  };
+
+  size_t ShardIndex(const K& key) const {
+    if (shard_count_bits_ == 0) {
+      return 0;  // shifting a 64-bit value by 64 is undefined
+    }
+    // fibonacci hashing, spreads sequential hashes over all shards
+    uint64_t hash = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> (64 - shard_count_bits_));
+  }
+
+  Shard& ShardOf(const K& key) { return shards_[ShardIndex(key)]; }
+  const Shard& ShardOf(const K& key) const { return shards_[ShardIndex(key)]; }
+
+  size_t shard_count_bits_;
+  Shard* shards_;
+};  // class ShardedMap
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_SHARDED_MAP_H
@@ -0,0 +1,173 @@
+#ifndef IDEVICE_UTILS_TIMING_WHEEL_H
+#define IDEVICE_UTILS_TIMING_WHEEL_H
+
+#include <algorithm>  // std::max
+#include <cstddef>
+#include <cstdint>
+#include <utility>  // std::move
+#include <vector>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A hierarchical timing wheel, tracking a large number of deadlines in O(1)
+ *
+ * The time is split into ticks. There are 4 levels of 64 slots: a slot of level 0 holds the
+ * deadlines of one tick, a slot of level 1 holds 64 ticks, and so on. A deadline is put into the
+ * lowest level covering it, and every time a lower level wraps around, one slot of the level above
+ * is cascaded into the lower levels. So scheduling is O(1), and every deadline is moved at most
+ * once per level before it expires. Deadlines further than 64^4 ticks are cascaded again and
+ * again at the top level until they are in range.
+ *
+ * There is no way to remove a deadline, the users drop the expired values which are no longer
+ * interesting instead. It's not thread-safe.
+ */
+template <typename T>
+class TimingWheel {
+ public:
+  static constexpr size_t kLevelCount = 4;
+  static constexpr size_t kSlotCountBits = 6;  // 64 slots per level
+
+  /**
+   * Constructor
+   *
+   * @param tick_ms the length of a tick in milliseconds, the deadlines are rounded up to ticks
+   * @param now_ms the current time in milliseconds, of any clock
+   */
+  TimingWheel(uint32_t tick_ms, uint64_t now_ms)
+      : tick_ms_(tick_ms == 0 ? 1 : tick_ms), current_tick_(now_ms / tick_ms_) {}
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(TimingWheel);
+
+  /**
+   * Add a deadline
+   *
+   * @param deadline_ms the deadline in milliseconds, of the clock of the constructor
+   * @param value the value returned when it expires
+   */
+  void Schedule(uint64_t deadline_ms, T value) {
+    uint64_t expire_tick = (deadline_ms + tick_ms_ - 1) / tick_ms_;
+    if (expire_tick <= current_tick_) {
+      expire_tick = current_tick_ + 1;  // the slot of the current tick has been handled
+    }
+    Place({expire_tick, std::move(value)});
+    size_++;
+  }
+
+  /**
+   * Move the time forward, and take out the expired values
+   *
+   * @param now_ms the current time in milliseconds, of the clock of the constructor
+   * @param on_expired called with every expired value, in the order of their deadlines
+   * @return size_t count of expired values
+   */
+  template <typename Function>
+  size_t Advance(uint64_t now_ms, Function on_expired) {
+    uint64_t now_tick = now_ms / tick_ms_;
+    if (size_ == 0) {
+      current_tick_ = std::max(current_tick_, now_tick);  // nothing to cascade on the way
+      return 0;
+    }
+    size_t expired_count = 0;
+    while (current_tick_ < now_tick) {
+      current_tick_++;
+      Cascade();
+      std::vector<Entry>& slot = levels_[0][SlotIndex(current_tick_, 0)];
+      if (slot.empty()) {
+        continue;
+      }
+      std::vector<Entry> expired;
+      expired.swap(slot);
+      size_ -= expired.size();
+      expired_count += expired.size();
+      for (Entry& entry : expired) {
+        on_expired(entry.value);
+      }
+      if (size_ == 0) {
+        current_tick_ = now_tick;
+      }
+    }
+    return expired_count;
+  }
+
+  /**
+   * Remove all deadlines
+   */
+  void Clear() {
+    for (auto& slots : levels_) {
+      for (std::vector<Entry>& slot : slots) {
+        std::vector<Entry>().swap(slot);  // the memory is released too
+      }
+    }
+    size_ = 0;
+  }
+
+  /**
+   * Get the count of deadlines not expired yet
+   *
+   * @return size_t the count
+   */
+  size_t Size() const { return size_; }
+
+ private:
+  static constexpr size_t kSlotCount = static_cast<size_t>(1) << kSlotCountBits;
+  static constexpr uint64_t kSlotMask = kSlotCount - 1;
+
+  struct Entry {
+    uint64_t expire_tick;
+    T value;
+  };
+
+  static size_t SlotIndex(uint64_t tick, size_t level) {
+    return static_cast<size_t>((tick >> (level * kSlotCountBits)) & kSlotMask);
+  }
+
+  // count of ticks covered by a slot of this level
+  static uint64_t LevelSpan(size_t level) {
+    return static_cast<uint64_t>(1) << (level * kSlotCountBits);
+  }
+
+  // put an entry into the lowest level covering it, `expire_tick >= current_tick_`
+  void Place(Entry&& entry) {
+    uint64_t delta = entry.expire_tick - current_tick_;
+    size_t level = 0;
+    while (level + 1 < kLevelCount && delta >= LevelSpan(level + 1)) {
+      level++;
+    }
+    uint64_t tick = entry.expire_tick;
+    uint64_t max_delta = LevelSpan(kLevelCount) - 1;
+    if (delta > max_delta) {
+      tick = current_tick_ + max_delta;  // cascaded again when the top level comes round
+    }
+    levels_[level][SlotIndex(tick, level)].push_back(std::move(entry));
+  }
+
+  // when the lower levels wrap around at the current tick, move the current slots of the upper
+  // levels down, starting from the highest one
+  void Cascade() {
+    size_t top = 0;
+    while (top + 1 < kLevelCount && SlotIndex(current_tick_, top) == 0) {
+      top++;
+    }
+    for (size_t level = top; level > 0; --level) {
+      std::vector<Entry> entries;
+      entries.swap(levels_[level][SlotIndex(current_tick_, level)]);
+      for (Entry& entry : entries) {
+        Place(std::move(entry));
+      }
+    }
+  }
+
+  uint64_t tick_ms_;
+  uint64_t current_tick_;  ///< the slots of this tick have been handled
+  size_t size_ = 0;
+  std::vector<Entry> levels_[kLevelCount][kSlotCount];
+};  // class TimingWheel
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_TIMING_WHEEL_H
@@ -0,0 +1,104 @@
+#ifndef IDEVICE_UTILS_ZLIB_INFLATER_H
+#define IDEVICE_UTILS_ZLIB_INFLATER_H
+
+#include <zlib.h>
+
+#include <algorithm>  // std::min
+#include <cstring>    // memset
+#include <limits>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_DISALLOW_COPY_AND_ASSIGN
+
+namespace idevice {
+
+/**
+ * A reusable zlib decompressor
+ *
+ * The inflate state(including its 32KB window) is allocated once and reset between streams, so
+ * decompressing many small messages doesn't pay for the setup of zlib every time.
+ * Both zlib and gzip streams are accepted.
+ *
+ * NOTE: it's not thread-safe, use one inflater per thread, see `ThreadLocal()`.
+ */
+class ZlibInflater {
+ public:
+  ZlibInflater() {
+    memset(&stream_, 0, sizeof(stream_));
+    initialized_ = inflateInit2(&stream_, MAX_WBITS + 32 /* detect zlib or gzip header */) == Z_OK;
+  }
+
+  ~ZlibInflater() {
+    if (initialized_) {
+      inflateEnd(&stream_);
+    }
+  }
+
+  IDEVICE_DISALLOW_COPY_AND_ASSIGN(ZlibInflater);
+
+  /**
+   * Get the inflater of the current thread
+   *
+   * @return ZlibInflater& the inflater
+   */
+  static ZlibInflater& ThreadLocal() {
+    static thread_local ZlibInflater inflater;
+    return inflater;
+  }
+
+  /**
+   * Decompress a whole stream into the output buffer
+   * The input is fed in chunks, so the size of it is not limited by the `uInt` of zlib.
+   *
+   * @param input compressed bytes
+   * @param input_size size of the compressed bytes
+   * @param output the output buffer
+   * @param output_capacity capacity of the output buffer
+   * @param output_size out param, size of the decompressed bytes
+   * @return succeed or fail, it fails if the stream is corrupted, truncated, or larger than the
+   * output buffer
+   */
+  bool Inflate(const char* input, size_t input_size, char* output, size_t output_capacity,
+               size_t* output_size) {
+    if (!initialized_ || inflateReset(&stream_) != Z_OK) {
+      return false;
+    }
+    constexpr size_t max_chunk_size = std::numeric_limits<uInt>::max();
+    size_t input_offset = 0;
+    size_t output_offset = 0;
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+      if (stream_.avail_in == 0) {
+        size_t chunk_size = std::min(input_size - input_offset, max_chunk_size);
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input + input_offset));
+        stream_.avail_in = static_cast<uInt>(chunk_size);
+        input_offset += chunk_size;
+      }
+      if (stream_.avail_out == 0) {
+        size_t chunk_size = std::min(output_capacity - output_offset, max_chunk_size);
+        stream_.next_out = reinterpret_cast<Bytef*>(output + output_offset);
+        stream_.avail_out = static_cast<uInt>(chunk_size);
+        output_offset += chunk_size;
+      }
+      if (stream_.avail_in == 0 || stream_.avail_out == 0) {
+        break;  // truncated, or the output buffer is full
+      }
+      ret = inflate(&stream_, Z_NO_FLUSH);
+    }
+    if (output_size) {
+      *output_size = output_offset - stream_.avail_out;
+    }
+    stream_.avail_in = 0;
+    stream_.avail_out = 0;
+    return ret == Z_STREAM_END;
+  }
+
+ private:
+  z_stream stream_;
+  bool initialized_ = false;
+};  // class ZlibInflater
+
+}  // namespace idevice
+
+#include "idevice/common/macro_undef.h"
+
+#endif  // IDEVICE_UTILS_ZLIB_INFLATER_H
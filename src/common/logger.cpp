@@ -0,0 +1,200 @@
+#include "idevice/common/logger.h"
+
+#include <algorithm>  // std::min
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>  // getenv, atexit
+#include <cstring>  // memcpy
+#include <mutex>
+#include <thread>
+
+#include "idevice/utils/ringqueue.h"
+
+using namespace idevice;
+
+static constexpr uint32_t kWriterTimeout = 1000;  // ms
+static constexpr int kWakeupLevel = -1;           // the level of the record waking up the writer
+static constexpr size_t kMaxPrefixSize = 256;     // "[VERBOSE] file:line:function(): "
+
+static const char* const kLevelNames[] = {"ERROR", "INFO", "DEBUG", "VERBOSE"};
+
+// constant-initialized, the environment is read on the first use instead, so nothing runs during
+// the dynamic initialization, the order of which is unspecified across the translation units
+std::atomic<int> Logger::level_(Logger::kLevelUnset);
+
+// static
+int Logger::InitLevel() {
+  int level = kLogLevelInfo;
+  const char* env = getenv("IDEVICE_LOG_LEVEL");
+  if (env != nullptr && env[0] >= '0' && env[0] <= '3' && env[1] == '\0') {
+    level = env[0] - '0';
+  }
+  int expected = kLevelUnset;
+  if (!level_.compare_exchange_strong(expected, level, std::memory_order_relaxed)) {
+    return expected;  // set meanwhile
+  }
+  return level;
+}
+
+namespace {
+
+// a log waiting for the writer, the file and the function are literals, so only the message is
+// copied
+struct LogRecord {
+  int level;
+  int line;
+  const char* file;
+  const char* function;
+  size_t size;
+  char message[Logger::kMaxMessageSize];
+};
+
+// the ring and the writer thread behind the logger
+class LogWriterThread {
+ public:
+  static LogWriterThread* Instance() {
+    // it's never destroyed, so the logs written by the other static destructors are still safe,
+    // they are written synchronously once the thread has been stopped at exit
+    static LogWriterThread* instance = new LogWriterThread();
+    return instance;
+  }
+
+  void Push(LogRecord* record) {
+    if (!running_.load(std::memory_order_acquire)) {
+      Emit(*record);
+      return;
+    }
+    if (!ring_.TryPush(std::move(*record))) {
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    queued_count_.fetch_add(1, std::memory_order_release);
+  }
+
+  void Flush() {
+    uint64_t queued_count = queued_count_.load(std::memory_order_acquire);
+    auto written = [this, queued_count]() {
+      return !running_.load(std::memory_order_acquire) ||
+             written_count_.load(std::memory_order_acquire) >= queued_count;
+    };
+    while (!written_.Wait(written, written, kWriterTimeout)) {
+    }
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    fflush(stdout);
+    fflush(stderr);
+  }
+
+  void SetWriter(Logger::Writer writer) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    writer_ = std::move(writer);
+  }
+
+  uint64_t DroppedCount() const { return dropped_count_.load(std::memory_order_relaxed); }
+
+ private:
+  LogWriterThread() : ring_(Logger::kRingCapacity) {
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread(&LogWriterThread::Run, this);
+    atexit([]() { Instance()->Stop(); });
+  }
+
+  void Stop() {
+    running_.store(false, std::memory_order_release);
+    written_.Notify();  // nothing is written asynchronously anymore, wake up the flushing threads
+    LogRecord wakeup = LogRecord();
+    wakeup.level = kWakeupLevel;
+    ring_.TryPush(std::move(wakeup));  // if it's full, the writer is not waiting anyway
+    thread_.join();
+    // the thread only stops once the ring is drained, but a log may have sneaked in since
+    LogRecord record;
+    while (ring_.TryPop(&record)) {
+      if (record.level != kWakeupLevel) {
+        Emit(record);
+      }
+    }
+    Flush();
+  }
+
+  void Run() {
+    LogRecord record;
+    uint64_t reported_dropped_count = 0;
+    while (running_.load(std::memory_order_acquire) || !ring_.Empty()) {
+      if (ring_.Pop(&record, kWriterTimeout) && record.level != kWakeupLevel) {
+        Emit(record);
+        written_count_.fetch_add(1, std::memory_order_release);
+        written_.Notify();
+      }
+      uint64_t dropped_count = dropped_count_.load(std::memory_order_relaxed);
+      if (dropped_count != reported_dropped_count && ring_.Empty()) {
+        EmitDropped(dropped_count - reported_dropped_count);
+        reported_dropped_count = dropped_count;
+      }
+    }
+  }
+
+  void Emit(const LogRecord& record) {
+    char line[kMaxPrefixSize + Logger::kMaxMessageSize];
+    int prefix_size = snprintf(line, kMaxPrefixSize, "[%s] %s:%d:%s(): ",
+                               kLevelNames[std::min(record.level, 3)], record.file, record.line,
+                               record.function);
+    size_t size = std::min(static_cast<size_t>(std::max(prefix_size, 0)), kMaxPrefixSize - 1);
+    memcpy(line + size, record.message, record.size);
+    size += record.size;
+    WriteLine(record.level, line, size);
+  }
+
+  void EmitDropped(uint64_t count) {
+    char line[128];
+    int size = snprintf(line, sizeof(line), "[ERROR] %llu logs were dropped, the ring was full\n",
+                        static_cast<unsigned long long>(count));
+    WriteLine(kLogLevelError, line, static_cast<size_t>(size));
+  }
+
+  void WriteLine(int level, const char* line, size_t size) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    if (writer_) {
+      writer_(level, line, size);
+    } else {
+      fwrite(line, 1, size, level == kLogLevelError ? stderr : stdout);
+    }
+  }
+
+  MpscRingQueue<LogRecord> ring_;
+  std::atomic_bool running_ = ATOMIC_VAR_INIT(false);
+  std::thread thread_;
+  std::atomic<uint64_t> queued_count_ = ATOMIC_VAR_INIT(0);
+  std::atomic<uint64_t> written_count_ = ATOMIC_VAR_INIT(0);
+  RingQueueWaiter written_;  ///< notified once a log has been written, waited by `Flush()`
+  std::atomic<uint64_t> dropped_count_ = ATOMIC_VAR_INIT(0);
+  std::mutex writer_mutex_;  ///< the writer is called by the thread, and by `Push()` after stopping
+  Logger::Writer writer_;
+};  // class LogWriterThread
+
+}  // namespace
+
+void Logger::SetWriter(Writer writer) { LogWriterThread::Instance()->SetWriter(std::move(writer)); }
+
+void Logger::Write(int level, const char* file, int line, const char* function,
+                   const char* format, ...) {
+  LogRecord record;
+  record.level = level;
+  record.line = line;
+  record.file = file;
+  record.function = function;
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(record.message, sizeof(record.message), format, args);
+  va_end(args);
+  if (size < 0) {
+    return;
+  }
+  record.size = std::min(static_cast<size_t>(size), sizeof(record.message) - 1);
+  if (record.size < static_cast<size_t>(size)) {
+    record.message[record.size - 1] = '\n';  // truncated
+  }
+  LogWriterThread::Instance()->Push(&record);
+}
+
+void Logger::Flush() { LogWriterThread::Instance()->Flush(); }
+
+uint64_t Logger::DroppedCount() { return LogWriterThread::Instance()->DroppedCount(); }
@@ -0,0 +1,146 @@
+#include "idevice/instrument/devicefleet.h"
+
+#include <algorithm>  // std::max
+#include <condition_variable>
+#include <thread>  // std::thread::hardware_concurrency
+
+#include "idevice/common/macro_def.h"  // IDEVICE_LOG_E, IDEVICE_LOG_I
+
+using namespace idevice;
+
+static size_t thread_count_or_cores(size_t thread_count) {
+  if (thread_count > 0) {
+    return thread_count;
+  }
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+DeviceFleet::DeviceFleet(size_t io_thread_count, size_t dispatch_thread_count)
+    : dispatch_executor_(
+          std::make_shared<SerialExecutor>(thread_count_or_cores(dispatch_thread_count))) {
+  io_thread_count = thread_count_or_cores(io_thread_count);
+  for (size_t i = 0; i < io_thread_count; ++i) {
+    std::unique_ptr<DTXEventLoop> event_loop = std::make_unique<DTXEventLoop>();
+    if (!event_loop->Start()) {
+      IDEVICE_LOG_I("event loops are not available, every device runs its own threads.\n");
+      break;
+    }
+    event_loops_.push_back(std::move(event_loop));
+  }
+}
+
+DeviceFleet::~DeviceFleet() {
+  std::map<std::string, std::shared_ptr<Device>> devices;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    devices.swap(devices_);
+  }
+  for (auto& item : devices) {
+    item.second->connection->Disconnect();
+  }
+  for (auto& event_loop : event_loops_) {
+    event_loop->Stop();
+  }
+  // wait for the handlers already dispatched, including those of the removed devices
+  std::mutex mutex;
+  std::condition_variable drained_condition;
+  bool drained = false;
+  dispatch_executor_->ExecuteAfterAll([&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    drained = true;
+    drained_condition.notify_all();
+  });
+  std::unique_lock<std::mutex> lock(mutex);
+  drained_condition.wait(lock, [&]() { return drained; });
+  // the devices are destructed here, after the loops and the handlers stopped touching them
+}
+
+std::shared_ptr<DTXConnection> DeviceFleet::Add(const std::string& name,
+                                                std::unique_ptr<IDTXTransport> transport) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (devices_.count(name) > 0) {
+    IDEVICE_LOG_E("Error: the device %s exists.\n", name.c_str());
+    return nullptr;
+  }
+
+  std::shared_ptr<Device> device = std::make_shared<Device>();
+  device->transport = std::move(transport);
+  device->connection = std::make_unique<DTXConnection>(device->transport.get());
+  device->connection->SetDispatchExecutor(dispatch_executor_);
+  device->event_loop =
+      device->transport->PollableFd() >= 0 ? LeastLoadedEventLoop() : nullptr;
+  if (!device->connection->Connect(device->event_loop)) {
+    IDEVICE_LOG_E("Error: can not connect to the device %s.\n", name.c_str());
+    return nullptr;
+  }
+  // shares the ownership of the device
+  std::shared_ptr<DTXConnection> connection(device, device->connection.get());
+  devices_.emplace(name, std::move(device));
+  return connection;
+}
+
+bool DeviceFleet::Remove(const std::string& name) {
+  std::shared_ptr<Device> device;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = devices_.find(name);
+    if (found == devices_.end()) {
+      return false;
+    }
+    device = std::move(found->second);
+    devices_.erase(found);
+  }
+  device->connection->Disconnect();
+  // the handlers dispatched before the disconnection may still be pending on the shared executor,
+  // and the channels only keep a raw pointer to the connection
+  dispatch_executor_->ExecuteAfterAll([device]() {});
+  return true;
+}
+
+std::shared_ptr<DTXConnection> DeviceFleet::Find(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = devices_.find(name);
+  if (found == devices_.end()) {
+    return nullptr;
+  }
+  return std::shared_ptr<DTXConnection>(found->second, found->second->connection.get());
+}
+
+std::vector<std::string> DeviceFleet::Names() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> names;
+  for (const auto& item : devices_) {
+    names.push_back(item.first);
+  }
+  return names;
+}
+
+DeviceFleetStat DeviceFleet::Stat() const {
+  DeviceFleetStat stat = {0, 0, 0, {}, dispatch_executor_->Stat()};
+  for (const auto& event_loop : event_loops_) {
+    stat.loop_loads.push_back(event_loop->ConnectionCount());
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  stat.device_count = devices_.size();
+  for (const auto& item : devices_) {
+    const DTXConnection* connection = item.second->connection.get();
+    if (connection->IsConnected()) {
+      stat.connected_count++;
+    }
+    stat.pending_send_count += connection->SendQueueSize();
+  }
+  return stat;
+}
+
+DTXEventLoop* DeviceFleet::LeastLoadedEventLoop() const {
+  DTXEventLoop* least_loaded = nullptr;
+  size_t least_load = 0;
+  for (const auto& event_loop : event_loops_) {
+    size_t load = event_loop->ConnectionCount();
+    if (least_loaded == nullptr || load < least_load) {
+      least_loaded = event_loop.get();
+      least_load = load;
+    }
+  }
+  return least_loaded;
+}
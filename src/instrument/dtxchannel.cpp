@@ -10,12 +10,25 @@ std::shared_ptr<DTXMessage> DTXChannel::SendMessageSync(std::shared_ptr<DTXMessa
   return connection_->SendMessageSync(msg, timeout_ms);
 }
 
+std::shared_ptr<DTXRequest> DTXChannel::SendMessage(std::shared_ptr<DTXMessage> msg,
+                                                    uint32_t timeout_ms) {
+  msg->SetChannelCode(channel_identifier_);
+  return connection_->SendMessage(msg, timeout_ms);
+}
+
 void DTXChannel::SendMessageAsync(std::shared_ptr<DTXMessage> msg,
                                   DTXMessenger::ReplyHandler callback) {
   msg->SetChannelCode(channel_identifier_);
   connection_->SendMessageAsync(msg, callback);
 }
 
+void DTXChannel::SendMessagesAsync(std::vector<DTXMessenger::MessageWithHandler> batch) {
+  for (DTXMessenger::MessageWithHandler& item : batch) {
+    item.first->SetChannelCode(channel_identifier_);
+  }
+  connection_->SendMessagesAsync(std::move(batch));
+}
+
 void DTXChannel::Cancel() {
   canceled_ = connection_->CancelChannel(*this);
 }
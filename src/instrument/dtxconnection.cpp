@@ -1,35 +1,100 @@
 #include "idevice/instrument/dtxconnection.h"
 
 #include <algorithm>  // std::max
+#include <chrono>
 #include <cstdlib>    // std::abs
-#include <future>     // std::promise
 
+#include "nskeyedarchiver/kamap.hpp"
+#include "idevice/instrument/dtxeventloop.h"
 #include "idevice/common/macro_def.h"  // IDEVICE_START_THREAD, IDEVICE_STOP_THREAD, IDEVICE_ATOMIC_SET_MAX, IDEVICE_DTXMESSAGE_IDENTIFIER
 
 using namespace idevice;
 
 static constexpr size_t kReceiveBufferSize = 16 * 1024;  // 0x4000(16384)
+static constexpr size_t kReceiveBufferPoolSize = 64;  // max count of idle receive buffers
 static constexpr uint32_t kReceiveTimeout = 1 * 1000;
 static constexpr uint32_t kSendQueueTimeout = 1 * 1000;
 static constexpr uint32_t kReceiveQueueTimeout = 1 * 1000;
+static constexpr uint32_t kRequestExpiryInterval = 100;  // how often the deadlines are checked
+static constexpr uint32_t kDTXBlockCompressionVersion = 2;
+
+DTXConnection::~DTXConnection() {
+  // IDEVICE_ASSERT(!IsConnected());
+  _handlers_by_identifier_.Clear([](const ReplyIdentifier&, PendingReply& pending_reply) {
+    if (pending_reply.request) {
+      pending_reply.request->SetCanceller(nullptr);  // it refers to this connection
+    }
+  });
+}
 
 bool DTXConnection::Connect() {
+  driven_by_loop_ = false;
+  if (direct_receive_ && receive_buffer_pool_ == nullptr) {
+    receive_buffer_pool_ = BufferPool::Create(kReceiveBufferSize, kReceiveBufferPoolSize);
+  }
   bool ret = transport_->Connect();
   if (ret) {
+    WatchReceiveWatermark();
     StartSendThread();
     StartParsingThread();
     StartReceiveThread();
+    if (compression_) {
+      PublishCapabilities();
+    }
   }
   return ret;
 }
 
+bool DTXConnection::Connect(DTXEventLoop* event_loop) {
+  if (event_loop == nullptr) {
+    return Connect();
+  }
+  if (direct_receive_ && receive_buffer_pool_ == nullptr) {
+    receive_buffer_pool_ = BufferPool::Create(kReceiveBufferSize, kReceiveBufferPoolSize);
+  }
+  if (!transport_->Connect()) {
+    return false;
+  }
+  if (transport_->PollableFd() < 0) {
+    IDEVICE_LOG_E("Error: the transport can not be driven by an event loop.\n");
+    transport_->Disconnect();
+    return false;
+  }
+  driven_by_loop_ = true;
+  event_loop_.store(event_loop, std::memory_order_release);
+  if (!event_loop->Add(this)) {
+    event_loop_.store(nullptr, std::memory_order_release);
+    transport_->Disconnect();
+    return false;
+  }
+  WatchReceiveWatermark();
+  if (compression_) {
+    PublishCapabilities();
+  }
+  return true;
+}
+
 bool DTXConnection::Disconnect() {
+  receive_watermark_->SetListener(nullptr);  // the loop may be gone after the removal
+  DTXEventLoop* event_loop = event_loop_.exchange(nullptr);
+  if (event_loop != nullptr) {
+    event_loop->Remove(this);
+  }
   StopSendThread(true);
   StopReceiveThread(true);
   StopParsingThread(true);
 
+  // the loop thread and the users may disconnect at the same time, e.g. the peer closed the socket
+  std::lock_guard<std::mutex> lock(disconnect_mutex_);
   send_queue_.Clear();
-  receive_queue_.Clear([](std::unique_ptr<Packet>& packet) { free(packet->buffer); });
+  send_tail_.clear();
+  send_blocked_ = false;
+  send_batch_.clear();
+  receive_queue_.Clear([this](Packet& packet) {
+    receive_watermark_->Release(packet.size);
+    FreePacket(&packet);
+  });
+  FailPendingReplies();
 
   return transport_->Disconnect();
 }
@@ -39,7 +104,7 @@ std::shared_ptr<DTXChannel> DTXConnection::MakeChannelWithIdentifier(
   uint32_t channel_code = next_channel_code_.fetch_add(1);
   std::shared_ptr<DTXChannel> channel =
       std::make_shared<DTXChannel>(this, channel_identifier, channel_code);
-  channels_by_code_.insert(std::make_pair(channel_code, channel));
+  channels_by_code_.Insert(channel_code, channel);
 
   std::shared_ptr<DTXMessage> message =
       DTXMessage::CreateWithSelector("_requestChannelWithCode:identifier:");
@@ -48,10 +113,10 @@ std::shared_ptr<DTXChannel> DTXConnection::MakeChannelWithIdentifier(
 
   std::shared_ptr<DTXMessage> response =
       SendMessageSync(message, -1 /* wait forever */);
-#if IDEVICE_DEBUG
-  IDEVICE_LOG_D("response message:\n");
-  response->Dump();
-#endif
+  if (response && IDEVICE_LOG_ENABLED(kLogLevelDebug)) {
+    IDEVICE_LOG_D("response message:\n");
+    response->Dump();
+  }
   return channel;
 }
 
@@ -62,32 +127,99 @@ bool DTXConnection::CancelChannel(const DTXChannel& channel) {
 
   std::shared_ptr<DTXMessage> response =
       SendMessageSync(message, -1 /* wait forever */);
-#if IDEVICE_DEBUG
-  IDEVICE_LOG_D("response message:\n");
-  response->Dump();
-#endif
+  if (response && IDEVICE_LOG_ENABLED(kLogLevelDebug)) {
+    IDEVICE_LOG_D("response message:\n");
+    response->Dump();
+  }
   
-  channels_by_code_.erase(channel.ChannelIdentifier());
+  channels_by_code_.Erase(channel.ChannelIdentifier());
   return true;
 }
 
+void DTXConnection::PublishCapabilities() {
+  nskeyedarchiver::KAMap capabilities("NSDictionary", {"NSDictionary", "NSObject"});
+  capabilities["com.apple.private.DTXConnection"] = 1;
+  capabilities["com.apple.private.DTXBlockCompression"] = kDTXBlockCompressionVersion;
+
+  std::shared_ptr<DTXMessage> message =
+      DTXMessage::CreateWithSelector("_notifyOfPublishedCapabilities:");
+  message->AppendAuxiliary(nskeyedarchiver::KAValue(std::move(capabilities)));
+  SendMessageAsync(message, nullptr /* no reply */);
+}
+
+DTXConnectionMetrics DTXConnection::Metrics() const {
+  DTXConnectionMetrics metrics;
+  metrics_.Fill(&metrics);
+  metrics.expired_replies = expired_reply_count_.load(std::memory_order_relaxed);
+  metrics.send_queue_depth = send_queue_.Size();
+  metrics.receive_queue_depth = receive_queue_.Size();
+  metrics.dispatch_queue_depth = dispatch_executor_->Stat().pending;
+  metrics.pending_replies = _handlers_by_identifier_.Size();
+  metrics.pending_receive_bytes = receive_watermark_->Bytes();
+  return metrics;
+}
+
+static void DumpRoundTrip(const char* indent, const LatencyHistogramSnapshot& round_trip) {
+  if (round_trip.count == 0) {
+    return;
+  }
+  printf("%sround trip: count %llu, mean %lluus, p50 %lluus, p99 %lluus, max %lluus\n", indent,
+         static_cast<unsigned long long>(round_trip.count),
+         static_cast<unsigned long long>(round_trip.MeanUs()),
+         static_cast<unsigned long long>(round_trip.PercentileUs(50)),
+         static_cast<unsigned long long>(round_trip.PercentileUs(99)),
+         static_cast<unsigned long long>(round_trip.max_us));
+}
+
 void DTXConnection::DumpStat() const {
+  DTXConnectionMetrics metrics = Metrics();
   printf("==== DTXConnection Stat ====\n");
   printf("send_thread_ running: %d\n", send_thread_running_.load());
   printf("receive_thread_ running: %d\n", receive_thread_running_.load());
   printf("parsing_thread_ running: %d\n", parsing_thread_running_.load());
-  printf("send_queue_.size: %zu\n", send_queue_.Size());
-  printf("receive_queue_.size: %zu\n", receive_queue_.Size());
+  printf("messages in: %llu(%llu bytes), out: %llu(%llu bytes)\n",
+         static_cast<unsigned long long>(metrics.messages_in),
+         static_cast<unsigned long long>(metrics.bytes_in),
+         static_cast<unsigned long long>(metrics.messages_out),
+         static_cast<unsigned long long>(metrics.bytes_out));
+  printf("fragments reassembled: %llu, parse errors: %llu, dropped: %llu\n",
+         static_cast<unsigned long long>(metrics.fragments_reassembled),
+         static_cast<unsigned long long>(metrics.parse_errors),
+         static_cast<unsigned long long>(metrics.dropped_messages));
+  printf("send queue: %zu, receive queue: %zu, dispatch queue: %zu\n", metrics.send_queue_depth,
+         metrics.receive_queue_depth, metrics.dispatch_queue_depth);
+  printf("pending receive bytes: %zu, max: %zu, paused %llu times\n",
+         metrics.pending_receive_bytes, receive_watermark_->MaxBytes(),
+         static_cast<unsigned long long>(receive_watermark_->PauseCount()));
+  printf("pending replies: %zu, expired: %llu\n", metrics.pending_replies,
+         static_cast<unsigned long long>(metrics.expired_replies));
+  DumpRoundTrip("", metrics.round_trip);
   printf("next_channel_code_: %d\n", next_channel_code_.load());
   printf("next_msg_identifier_: %d\n", next_msg_identifier_.load());
   printf("channels_by_code_:\n");
-  for (const auto& item : channels_by_code_) {
-    printf("\tchannel code: %d, label: %s\n", item.first, item.second->Label().c_str());
+  channels_by_code_.ForEach([](ChannelIdentifier code, const std::shared_ptr<DTXChannel>& channel) {
+    printf("\tchannel code: %d, label: %s\n", code, channel->Label().c_str());
+  });
+  printf("channel metrics:\n");
+  for (const DTXChannelMetrics& channel : metrics.channels) {
+    printf("\tchannel code: %u, in: %llu(%llu bytes), out: %llu(%llu bytes), dropped: %llu\n",
+           channel.channel_code, static_cast<unsigned long long>(channel.messages_in),
+           static_cast<unsigned long long>(channel.bytes_in),
+           static_cast<unsigned long long>(channel.messages_out),
+           static_cast<unsigned long long>(channel.bytes_out),
+           static_cast<unsigned long long>(channel.dropped_messages));
+    DumpRoundTrip("\t\t", channel.round_trip);
   }
   printf("_handlers_by_identifier_:\n");
-  for (const auto& item : _handlers_by_identifier_) {
-    printf("\tcallback identifier: %llx, callback function ptr: %p\n", item.first, &item.second);
-  }
+  _handlers_by_identifier_.ForEach([](ReplyIdentifier identifier, const PendingReply& pending) {
+    if (pending.request) {
+      printf("\tcallback identifier: %llx, request ptr: %p\n",
+             static_cast<unsigned long long>(identifier), pending.request.get());
+    } else {
+      printf("\tcallback identifier: %llx, callback function ptr: %p\n",
+             static_cast<unsigned long long>(identifier), &pending.handler);
+    }
+  });
   printf("==== /DTXConnection Stat ====\n");
 }
 
@@ -121,36 +253,154 @@ void DTXConnection::DumpStat() const {
  * └─────────────┘        └────────────┘
  */
 void DTXConnection::SendMessageAsync(std::shared_ptr<DTXMessage> msg, ReplyHandler callback) {
-  // put the message into the send queue
+  DTXEventLoop* event_loop = event_loop_.load(std::memory_order_acquire);
+  DTXMessageWithRoutingInfo message =
+      PrepareMessage(std::move(msg), {std::move(callback), nullptr}, -1);
+  if (EnqueueMessages(&message, 1, event_loop)) {
+    WakeupSender(event_loop);
+  }
+}
+
+std::shared_ptr<DTXRequest> DTXConnection::SendMessage(std::shared_ptr<DTXMessage> msg,
+                                                       uint32_t timeout_ms) {
+  std::shared_ptr<DTXRequest> request = std::make_shared<DTXRequest>();
+  DTXEventLoop* event_loop = event_loop_.load(std::memory_order_acquire);
+  DTXMessageWithRoutingInfo message =
+      PrepareMessage(std::move(msg), {nullptr, request}, timeout_ms);
+  if (EnqueueMessages(&message, 1, event_loop)) {
+    WakeupSender(event_loop);
+  }
+  return request;
+}
+
+void DTXConnection::SendMessagesAsync(std::vector<MessageWithHandler> batch) {
+  DTXEventLoop* event_loop = event_loop_.load(std::memory_order_acquire);
+  std::vector<DTXMessageWithRoutingInfo> messages;
+  messages.reserve(batch.size());
+  for (MessageWithHandler& item : batch) {
+    messages.push_back(
+        PrepareMessage(std::move(item.first), {std::move(item.second), nullptr}, -1));
+  }
+  if (EnqueueMessages(messages.data(), messages.size(), event_loop)) {
+    WakeupSender(event_loop);
+  }
+}
+
+DTXConnection::DTXMessageWithRoutingInfo DTXConnection::PrepareMessage(
+    std::shared_ptr<DTXMessage> msg, PendingReply pending_reply, uint32_t timeout_ms) {
   DTXMessageRoutingInfo routing_info = {0};
-  routing_info.msg_identifier = next_msg_identifier_.fetch_add(1);
+  // a reply keeps the identifier of the message it replies to
+  routing_info.msg_identifier = msg->ConversationIndex() > 0 ? msg->Identifier()
+                                                             : next_msg_identifier_.fetch_add(1);
   routing_info.channel_code = msg->ChannelCode();
   routing_info.conversation_index = msg->ConversationIndex();
-  routing_info.expects_reply = callback != nullptr;
+  routing_info.expects_reply = pending_reply.handler != nullptr || pending_reply.request != nullptr;
+
+  // save the callback of the message first, the reply may arrive before the push returns
+  uint64_t reply_identifier =
+      IDEVICE_DTXMESSAGE_IDENTIFIER(routing_info.channel_code, routing_info.msg_identifier);
+  std::shared_ptr<DTXRequest> request = pending_reply.request;
+  if (request != nullptr) {
+    // the request is forgotten once it's cancelled. The canceller is removed as soon as the request
+    // is taken out of the registry(see `RouteMessage()` and `ExpireRequests()`) or completed, so
+    // it's never called after the connection is gone, even if the request completes later on the
+    // dispatch executor
+    request->SetCanceller([this, reply_identifier]() {
+      _handlers_by_identifier_.Erase(reply_identifier);
+    });
+  } else if (pending_reply.handler != nullptr) {
+    timeout_ms = reply_timeout_ms_;
+  }
+  if (routing_info.expects_reply) {
+    pending_reply.sent_us = NowUs();
+    if (timeout_ms != static_cast<uint32_t>(-1)) {
+      ScheduleDeadline(reply_identifier, timeout_ms);
+    }
+    _handlers_by_identifier_.Insert(reply_identifier, std::move(pending_reply));
+  }
+  return std::make_pair(std::move(msg), routing_info);
+}
 
-  IDEVICE_LOG_D("push the message(%d|%d) in the send queue.\n", routing_info.channel_code, routing_info.msg_identifier);
-  send_queue_.Push(std::make_pair(msg, std::move(routing_info)));
+bool DTXConnection::EnqueueMessages(DTXMessageWithRoutingInfo* messages, size_t count,
+                                    DTXEventLoop* event_loop) {
+  bool in_loop_thread = event_loop != nullptr && event_loop->InLoopThread();
+  size_t queued = 0;
+  while (queued < count) {
+    // the messages are pushed all at once, up to the count of one write, so the sender never takes
+    // only a part of them, even if it's already collecting a batch
+    DTXMessageWithRoutingInfo* chunk = messages + queued;
+    size_t chunk_size = count - queued < kMaxSendBatchCount ? count - queued : kMaxSendBatchCount;
+    const DTXMessageRoutingInfo& routing_info = chunk->second;
+    IDEVICE_LOG_D("push the message(%d|%d) and %zu more in the send queue.\n",
+                  routing_info.channel_code, routing_info.msg_identifier, chunk_size - 1);
+    while (in_loop_thread ? !send_queue_.TryPushAll(chunk, chunk_size)
+                          : !send_queue_.PushAll(chunk, chunk_size, kSendQueueTimeout)) {
+      // the send queue is full, wait for the sender unless the connection is gone, while the loop
+      // can't wait for itself, so it drains the queue at once(e.g. when it sends many replies)
+      if (in_loop_thread) {
+        FlushSendQueue();
+        if (send_blocked_ && IsConnected()) {
+          // the transport is full as well, and the loop must not wait for it
+          IDEVICE_LOG_E("Error: can not push the message(%d|%d), the send queue is full.\n",
+                        routing_info.channel_code, routing_info.msg_identifier);
+          AbandonMessages(chunk, count - queued, DTXRequestStatus::kCancelled);
+          return queued > 0;
+        }
+      }
+      if (!IsConnected()) {
+        IDEVICE_LOG_E("Error: can not push the message(%d|%d), the connection is closed.\n",
+                      routing_info.channel_code, routing_info.msg_identifier);
+        AbandonMessages(chunk, count - queued, DTXRequestStatus::kDisconnected);
+        return queued > 0;
+      }
+    }
+    queued += chunk_size;
+  }
+  if (!IsConnected()) {
+    // they will never be sent, the routing info is still there after the messages are moved out
+    AbandonMessages(messages, count, DTXRequestStatus::kDisconnected);
+  }
+  return true;
+}
+
+void DTXConnection::AbandonMessages(const DTXMessageWithRoutingInfo* messages, size_t count,
+                                    DTXRequestStatus status) {
+  // nobody waits for the replies of the messages never sent: the requests fail, while the
+  // callbacks are called with null, like when they time out
+  for (size_t i = 0; i < count; ++i) {
+    const DTXMessageRoutingInfo& routing_info = messages[i].second;
+    PendingReply pending_reply;
+    if (!routing_info.expects_reply ||
+        !_handlers_by_identifier_.Take(
+            IDEVICE_DTXMESSAGE_IDENTIFIER(routing_info.channel_code, routing_info.msg_identifier),
+            &pending_reply)) {
+      continue;
+    }
+    if (pending_reply.request) {
+      pending_reply.request->Complete(status, nullptr);
+    } else if (pending_reply.handler) {
+      pending_reply.handler(nullptr);
+    }
+  }
+}
 
-  // and save the callback of the message
-  if (callback != nullptr) {
-    uint64_t reply_identifier =
-        IDEVICE_DTXMESSAGE_IDENTIFIER(routing_info.channel_code, routing_info.msg_identifier);
-    _handlers_by_identifier_.insert(std::make_pair(reply_identifier, callback));
+void DTXConnection::WakeupSender(DTXEventLoop* event_loop) {
+  // the send thread wakes up by itself when the queue is not empty, while the loop is woken up
+  // explicitly, and the messages queued on the loop thread(e.g. replies) are written out together
+  // at the end of the current iteration
+  if (event_loop != nullptr) {
+    event_loop->Wakeup(this);
   }
 }
 
 std::shared_ptr<DTXMessage> DTXConnection::SendMessageSync(std::shared_ptr<DTXMessage> msg, uint32_t timeout_ms) {
-  std::promise<std::shared_ptr<DTXMessage>> promise;
-  std::future<std::shared_ptr<DTXMessage>> future = promise.get_future();
-  SendMessageAsync(msg, [&promise](auto response_msg) { promise.set_value(response_msg); });
-  if (timeout_ms != -1) {
-    return future.get();
-  } else {
-    if (future.wait_for(std::chrono::milliseconds(timeout_ms)) == std::future_status::timeout) {
-      return nullptr;
-    }
-    return future.get();
+  std::shared_ptr<DTXRequest> request = SendMessage(std::move(msg), timeout_ms);
+  // the deadlines are only checked periodically, so the waiting gives up by itself in time, and
+  // the request is cancelled then, so the reply handler never outlives the waiting
+  if (!request->Wait(timeout_ms)) {
+    request->Cancel();
   }
+  return request->Reply();
 }
 
 void DTXConnection::StartSendThread() {
@@ -163,37 +413,174 @@ void DTXConnection::StopSendThread(bool await) {
 
 void DTXConnection::SendThread() {
   IDEVICE_LOG_I("SendThread start\n");
-  constexpr size_t send_buffer_size = 8 * 1024;
-  char* send_buffer = static_cast<char*>(malloc(send_buffer_size));
   while (send_thread_running_.load(std::memory_order_acquire)) {
     if (!IsConnected()) {
       return;
     }
 
-    if (send_queue_.WaitToTake(kSendQueueTimeout)) {
-      DTXMessageWithRoutingInfo message_with_routing_info = send_queue_.Take();
-      std::shared_ptr<DTXMessage> message = message_with_routing_info.first;
-      const DTXMessageRoutingInfo& routing_info = message_with_routing_info.second;
-      IDEVICE_LOG_D("take the message(%d|%d) out of the send queue.\n", routing_info.channel_code, routing_info.msg_identifier);
-
-      BufferedDTXTransport buffered_transport(transport_, send_buffer, send_buffer_size);
-      bool ret = outgoing_transmitter_.TransmitMessage(message, routing_info,
-                                                       [&](const char* buffer, size_t size) -> bool {
-                                                         return buffered_transport.Send(buffer, size);
-                                                       });
-      buffered_transport.Flush();
-
-      if (!ret) {  // TODO: can we trust this return value?
+    DTXMessageWithRoutingInfo message_with_routing_info;
+    if (send_queue_.Pop(&message_with_routing_info, kSendQueueTimeout)) {
+      send_batch_.clear();
+      send_batch_bytes_ = 0;
+      AddToSendBatch(std::move(message_with_routing_info));
+      CollectSendBatch(send_coalescing_window_ms_);
+      if (!SendBatch()) {  // TODO: can we trust this return value?
         IDEVICE_LOG_E("Error: can not send outgoing message, diconnecting.\n");
         Disconnect();
         break;
       }
     }
   }
-  free(send_buffer);
   IDEVICE_LOG_I("SendThread stop\n");
 }
 
+void DTXConnection::FlushSendQueue() {
+  // if the transport is full, the queued messages are written once the tail of the batch is done
+  while (!send_blocked_) {
+    send_batch_.clear();
+    send_batch_bytes_ = 0;
+    CollectSendBatch(0 /* no waiting */);
+    if (send_batch_.empty()) {
+      return;
+    }
+    if (!SendBatch()) {
+      IDEVICE_LOG_E("Error: can not send outgoing message, diconnecting.\n");
+      Disconnect();
+      return;
+    }
+  }
+}
+
+void DTXConnection::AddToSendBatch(DTXMessageWithRoutingInfo&& message_with_routing_info) {
+  const DTXMessageRoutingInfo& routing_info = message_with_routing_info.second;
+  IDEVICE_LOG_D("take the message(%d|%d) out of the send queue.\n", routing_info.channel_code, routing_info.msg_identifier);
+  size_t serialized_length = message_with_routing_info.first->SerializedLength();
+  send_batch_bytes_ += serialized_length;
+  send_batch_.push_back(
+      {std::move(message_with_routing_info.first), routing_info, serialized_length});
+}
+
+void DTXConnection::CollectSendBatch(uint32_t window_ms) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(window_ms);
+  while (send_batch_.size() < kMaxSendBatchCount && send_batch_bytes_ < kMaxSendBatchBytes) {
+    DTXMessageWithRoutingInfo message_with_routing_info;
+    if (!send_queue_.TryPop(&message_with_routing_info)) {
+      // the queue is drained, wait for more messages within the coalescing window
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (window_ms == 0 || remaining.count() <= 0 ||
+          !send_queue_.Pop(&message_with_routing_info, static_cast<uint32_t>(remaining.count()))) {
+        break;
+      }
+    }
+    AddToSendBatch(std::move(message_with_routing_info));
+  }
+}
+
+bool DTXConnection::SendBatch() {
+  bool ret = false;
+  IoVec frame_segment = {nullptr, 0};
+  const IoVec* segments = &frame_segment;
+  size_t segment_count = 1;
+  size_t size = 0;
+  if (send_batch_.size() == 1 &&
+      outgoing_transmitter_.FragmentsForLength(send_batch_bytes_) == 1) {
+    // the message is framed into one exactly sized buffer, and sent with one write
+    const OutgoingMessage& outgoing = send_batch_.front();
+    ret = outgoing_transmitter_.FrameMessage(outgoing.message, outgoing.routing_info,
+                                             outgoing.serialized_length, &frame_buffer_);
+    frame_segment = {frame_buffer_.GetPtr(0), frame_buffer_.Size()};
+    size = frame_buffer_.Size();
+  } else {
+    // all messages of the batch are gathered and sent with one vectored write: the headers and the
+    // small fields are copied side by side, while the large buffers go out without being copied
+    send_buffer_.Clear();
+    for (const OutgoingMessage& outgoing : send_batch_) {
+      ret = outgoing_transmitter_.GatherMessage(outgoing.message, outgoing.routing_info,
+                                                outgoing.serialized_length, &send_buffer_);
+      if (!ret) {
+        break;
+      }
+    }
+    const std::vector<IoVec>& gathered_segments = send_buffer_.Segments();
+    segments = gathered_segments.data();
+    segment_count = gathered_segments.size();
+    size = send_buffer_.Size();
+  }
+  if (!ret) {
+    send_batch_.clear();
+    return false;
+  }
+
+  size_t sent = 0;
+  if (!driven_by_loop_) {
+    ret = transport_->SendV(segments, segment_count, &sent);
+  } else {
+    // the loop must not block, the rest is written by `HandleWritable()`
+    ret = transport_->TrySendV(segments, segment_count, &sent);
+    DTXEventLoop* event_loop = event_loop_.load(std::memory_order_acquire);
+    if (ret && sent < size && event_loop != nullptr) {
+      metrics_.bytes_out.fetch_add(sent, std::memory_order_relaxed);
+      send_tail_.assign(segments, segments + segment_count);
+      TrimSegments(&send_tail_, sent);
+      send_blocked_ = true;
+      event_loop->SetWriting(this, true);
+      return true;
+    }
+    ret = ret && sent == size;  // partially written while disconnecting
+  }
+  if (!ret) {
+    send_batch_.clear();
+    return false;
+  }
+  metrics_.bytes_out.fetch_add(sent, std::memory_order_relaxed);
+  FinishSendBatch();
+  return true;
+}
+
+void DTXConnection::FinishSendBatch() {
+  for (const OutgoingMessage& outgoing : send_batch_) {
+    metrics_.CountMessageOut(outgoing.routing_info.channel_code, outgoing.serialized_length);
+  }
+  send_batch_.clear();  // the gathered buffers are referenced until here
+}
+
+bool DTXConnection::TrimSegments(std::vector<IoVec>* segments, size_t sent) {
+  size_t index = 0;
+  while (index < segments->size() && sent >= (*segments)[index].size) {
+    sent -= (*segments)[index].size;
+    index++;
+  }
+  segments->erase(segments->begin(), segments->begin() + index);
+  if (!segments->empty()) {
+    (*segments)[0].data += sent;
+    (*segments)[0].size -= sent;
+  }
+  return segments->empty();
+}
+
+void DTXConnection::HandleWritable() {
+  DTXEventLoop* event_loop = event_loop_.load(std::memory_order_acquire);
+  if (send_blocked_) {
+    size_t sent = 0;
+    if (!transport_->TrySendV(send_tail_.data(), send_tail_.size(), &sent)) {
+      IDEVICE_LOG_E("Error: can not send outgoing message, diconnecting.\n");
+      Disconnect();
+      return;
+    }
+    metrics_.bytes_out.fetch_add(sent, std::memory_order_relaxed);
+    if (!TrimSegments(&send_tail_, sent)) {
+      return;  // still full, wait for the next writable event
+    }
+    send_blocked_ = false;
+    FinishSendBatch();
+  }
+  if (event_loop != nullptr) {
+    event_loop->SetWriting(this, false);
+  }
+  FlushSendQueue();  // the messages queued while it was blocked
+}
+
 #pragma mark - Receive Messages
 
 void DTXConnection::StartReceiveThread() {
@@ -206,37 +593,51 @@ void DTXConnection::StopReceiveThread(bool await) {
 
 void DTXConnection::ReceiveThread() {
   IDEVICE_LOG_I("ReceiveThread start\n");
-  std::unique_ptr<Packet> receive_packet = nullptr;
+  Packet receive_packet;
   while (receive_thread_running_.load(std::memory_order_acquire)) {
     if (!IsConnected()) {
-      return;
+      break;
     }
 
-    if (!receive_packet) {
-      receive_packet = std::make_unique<Packet>();
-      receive_packet->buffer = static_cast<char*>(
-          malloc(kReceiveBufferSize));  // the customer is responsible for freeing it
-      receive_packet->size = 0;
+    if (receive_watermark_->Paused()) {
+      // too many bytes are waiting to be parsed or handled, stop reading until they are drained,
+      // so the backpressure reaches the device through the transport
+      receive_watermark_->WaitUntilResumed(kReceiveTimeout);
+      continue;
     }
 
-    if (!transport_->ReceiveWithTimeout(receive_packet->buffer, kReceiveBufferSize, kReceiveTimeout,
-                                        (uint32_t*)&receive_packet->size)) {
+    if (receive_packet.buffer == nullptr && !NewPacket(&receive_packet)) {
+      break;
+    }
+
+    uint32_t received = 0;
+    if (!transport_->ReceiveWithTimeout(receive_packet.buffer, kReceiveBufferSize, kReceiveTimeout,
+                                        &received)) {
       IDEVICE_LOG_E("Error: Receive ret != 0\n");
       break;
     }
 
-    if (receive_packet->size > 0) {
-      IDEVICE_LOG_V("received %zu bytes\n", receive_packet->size);
-      receive_queue_.Push(std::move(receive_packet));
+    if (received > 0) {
+      IDEVICE_LOG_V("received %u bytes\n", received);
+      receive_packet.size = received;
+      receive_watermark_->Add(received);
+      // the queue is bounded, wait for the parser when it's full
+      bool queued = receive_queue_.Push(std::move(receive_packet), kReceiveQueueTimeout);
+      while (!queued && receive_thread_running_.load(std::memory_order_acquire)) {
+        queued = receive_queue_.Push(std::move(receive_packet), kReceiveQueueTimeout);
+      }
+      if (!queued) {
+        receive_watermark_->Release(received);
+        break;  // stopped while waiting, the packet is freed below
+      }
+      receive_packet = Packet();  // the queue owns the buffer now
     }
 
     // std::this_thread::sleep_for(std::chrono::seconds(1));
     std::this_thread::yield();
   }
 
-  if (receive_packet) {
-    free(receive_packet->buffer);
-  }
+  FreePacket(&receive_packet);
 
   // if (IsConnected()) {
   //   Disconnect(); // TODO:
@@ -244,6 +645,61 @@ void DTXConnection::ReceiveThread() {
   IDEVICE_LOG_I("ReceiveThread stop\n");
 }
 
+bool DTXConnection::NewPacket(Packet* packet) {
+  if (receive_buffer_pool_) {
+    // read directly into a recycled buffer, which is taken over by the parser
+    packet->memory = receive_buffer_pool_->Acquire();
+    packet->buffer = packet->memory ? packet->memory->GetPtr(0) : nullptr;
+  } else {
+    packet->buffer =
+        static_cast<char*>(malloc(kReceiveBufferSize));  // the customer is responsible for freeing it
+  }
+  packet->size = 0;
+  if (packet->buffer == nullptr) {
+    IDEVICE_LOG_E("Error: can not allocate the receive buffer, OOM.\n");
+    return false;
+  }
+  return true;
+}
+
+void DTXConnection::FreePacket(Packet* packet) {
+  if (!packet->memory) {
+    free(packet->buffer);
+  }
+  packet->buffer = nullptr;
+  packet->memory = nullptr;
+}
+
+void DTXConnection::HandleReadable() {
+  Packet packet;
+  if (!NewPacket(&packet)) {
+    Disconnect();
+    return;
+  }
+
+  uint32_t received = 0;
+  if (!transport_->Receive(packet.buffer, kReceiveBufferSize, &received)) {
+    IDEVICE_LOG_E("Error: Receive ret != 0\n");
+    FreePacket(&packet);
+    Disconnect();
+    return;
+  }
+  if (received == 0) {
+    FreePacket(&packet);  // woken up spuriously
+    return;
+  }
+
+  IDEVICE_LOG_V("received %u bytes\n", received);
+  packet.size = received;
+  receive_watermark_->Add(received);
+  bool ret = ParsePacket(&packet);
+  receive_watermark_->Release(received);
+  if (!ret) {
+    IDEVICE_LOG_E("Error: can not parse incoming bytes, diconnecting.\n");
+    Disconnect();
+  }
+}
+
 #pragma mark - Parsing Messages
 
 void DTXConnection::StartParsingThread() {
@@ -261,66 +717,199 @@ void DTXConnection::ParsingThread() {
       return;
     }
 
-    if (receive_queue_.WaitToTake(kReceiveQueueTimeout)) {
-      std::unique_ptr<Packet> packet = receive_queue_.Take();
-      IDEVICE_LOG_D("parsing %zu bytes\n", packet->size);
-      bool ret = incoming_parser_.ParseIncomingBytes(packet->buffer, packet->size);
-      free(packet->buffer);  // all data in the packet buffer has been copied to the parser buffer
+    ExpireRequests();
 
+    Packet packet;
+    if (receive_queue_.Pop(&packet, kRequestExpiryInterval)) {
+      size_t size = packet.size;
+      bool ret = ParsePacket(&packet);
+      receive_watermark_->Release(size);
       if (!ret) {
         IDEVICE_LOG_E("Error: can not parse incoming bytes, diconnecting.\n");
         Disconnect();
         break;
       }
-
-      std::vector<std::shared_ptr<DTXMessage>> messages = incoming_parser_.PopAllParsedMessages();
-      uint32_t max_msg_identifier = 0;
-      for (auto& msg : messages) {
-        RouteMessage(msg);
-        if (msg->ExpectsReply()) {
-          ReplyMessage(msg);
-        }
-        max_msg_identifier = std::max(max_msg_identifier, msg->Identifier());
-      }
-      IDEVICE_ATOMIC_SET_MAX(next_msg_identifier_, max_msg_identifier + 1);
     }
   }
   IDEVICE_LOG_I("ParsingThread stop\n");
 }
 
+bool DTXConnection::ParsePacket(Packet* packet) {
+  IDEVICE_LOG_D("parsing %zu bytes\n", packet->size);
+  metrics_.bytes_in.fetch_add(packet->size, std::memory_order_relaxed);
+  bool ret = false;
+  if (packet->memory) {
+    packet->memory->SetSize(packet->size);
+    ret = incoming_parser_.ParseIncomingBuffer(std::move(packet->memory));
+  } else {
+    ret = incoming_parser_.ParseIncomingBytes(packet->buffer, packet->size);
+    free(packet->buffer);  // all data in the packet buffer has been copied to the parser buffer
+    packet->buffer = nullptr;
+  }
+  if (!ret) {
+    metrics_.parse_errors.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  metrics_.fragments_reassembled.store(incoming_parser_.ReassembledMessageCount(),
+                                       std::memory_order_relaxed);
+
+  std::vector<std::shared_ptr<DTXMessage>> messages = incoming_parser_.PopAllParsedMessages();
+  uint32_t max_msg_identifier = 0;
+  for (auto& msg : messages) {
+    RouteMessage(msg);
+    if (msg->ExpectsReply()) {
+      ReplyMessage(msg);
+    }
+    max_msg_identifier = std::max(max_msg_identifier, msg->Identifier());
+  }
+  IDEVICE_ATOMIC_SET_MAX(next_msg_identifier_, max_msg_identifier + 1);
+  return true;
+}
+
 void DTXConnection::RouteMessage(std::shared_ptr<DTXMessage> msg) {
   uint32_t msg_identifier = msg->Identifier();
   uint32_t channel_code = msg->ChannelCode();
   uint64_t callback_identifier = IDEVICE_DTXMESSAGE_IDENTIFIER(channel_code, msg_identifier);
-
-  auto callback_found = _handlers_by_identifier_.find(callback_identifier);
-  if (callback_found != _handlers_by_identifier_.end()) {
-    auto callback = callback_found->second;
-    IDEVICE_LOG_D("route the message(%d|%d) to the callback %p\n", channel_code, msg_identifier, &callback);
-    callback(msg);  // -> invoke callback with the parsed message TODO: the callback may slow down
-                    // the parser, and thus make the receive queue larger.
-    // TODO: notify all
-    // TODO: release anything associated with this message
-    _handlers_by_identifier_.erase(callback_found);
+  // the length on the wire is known by the parser, while `SerializedLength()` walks all the
+  // auxiliary items
+  size_t serialized_length =
+      msg->CostSize() > kDTXMessageHeaderSize ? msg->CostSize() - kDTXMessageHeaderSize : 0;
+  metrics_.CountMessageIn(channel_code, serialized_length);
+
+  // the handlers are dispatched by the channel, so a serial executor keeps each channel in order
+  uint64_t dispatch_key = static_cast<uint64_t>(std::abs(static_cast<int32_t>(channel_code)));
+
+  // the handler is taken out of the registry, so it's invoked once and without any lock held
+  PendingReply pending_reply;
+  if (_handlers_by_identifier_.Take(callback_identifier, &pending_reply)) {
+    IDEVICE_LOG_D("route the message(%d|%d) to the callback %p\n", channel_code, msg_identifier, &pending_reply);
+    uint64_t now_us = NowUs();
+    metrics_.RecordRoundTrip(channel_code,
+                             now_us > pending_reply.sent_us ? now_us - pending_reply.sent_us : 0);
+    if (pending_reply.request) {
+      std::shared_ptr<DTXRequest> request = std::move(pending_reply.request);
+      request->SetCanceller(nullptr);  // nothing is left to cancel, and it may outlive this
+      pending_reply.handler = [request](std::shared_ptr<DTXMessage> reply) {
+        request->Complete(DTXRequestStatus::kReplied, std::move(reply));
+      };
+    }
+    Dispatch(dispatch_key, std::move(pending_reply.handler), msg,
+             serialized_length);  // -> invoke callback with the parsed message
     return;
   }
 
-  auto found = channels_by_code_.find(std::abs(static_cast<int32_t>(channel_code)));
-  if (found != channels_by_code_.end()) {
-    std::shared_ptr<DTXChannel> channel = found->second;
+  std::shared_ptr<DTXChannel> channel;
+  if (channels_by_code_.Find(std::abs(static_cast<int32_t>(channel_code)), &channel)) {
     IDEVICE_LOG_D("route the message(%d|%d) to the channel %s(%d)\n", channel_code, msg_identifier,
                   channel->Label().c_str(), channel->ChannelIdentifier());
-    auto callback = channel->MessageHandler();
-    if (callback != nullptr) {
-      callback(msg);
+    ReplyHandler message_handler = channel->MessageHandler();
+    if (message_handler != nullptr) {
+      Dispatch(dispatch_key, std::move(message_handler), msg, serialized_length);
       return;
     }
   }
-  
+
+  metrics_.CountDroppedMessage(channel_code);
   IDEVICE_LOG_I("dropped message (no message handler). channel code: %d, msg identifier: %d\n", channel_code, msg_identifier);
-#if IDEVICE_DEBUG
-  msg->Dump();
-#endif
+  if (IDEVICE_LOG_ENABLED(kLogLevelVerbose)) {
+    msg->Dump();
+  }
+}
+
+void DTXConnection::Dispatch(uint64_t key, ReplyHandler handler, std::shared_ptr<DTXMessage> msg,
+                             size_t bytes) {
+  // the messages waiting for their handlers count towards the receive watermark too, so slow
+  // handlers also stop the reading. The watermark is shared, the task may outlive this connection.
+  std::shared_ptr<ByteWatermark> watermark = receive_watermark_;
+  watermark->Add(bytes);
+  dispatch_executor_->Execute(key, [handler = std::move(handler), msg, watermark, bytes]() {
+    handler(msg);
+    watermark->Release(bytes);
+  });
+}
+
+uint64_t DTXConnection::NowMs() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+uint64_t DTXConnection::NowUs() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+void DTXConnection::ScheduleDeadline(ReplyIdentifier reply_identifier, uint32_t timeout_ms) {
+  uint64_t now_ms = NowMs();
+  std::lock_guard<std::mutex> lock(deadlines_mutex_);
+  if (deadlines_.Size() == 0) {
+    deadlines_.Advance(now_ms, [](ReplyIdentifier) {});  // catch up after idling, costs nothing
+  }
+  deadlines_.Schedule(now_ms + timeout_ms, reply_identifier);
+}
+
+void DTXConnection::ExpireRequests() {
+  std::vector<ReplyIdentifier> expired;
+  {
+    std::lock_guard<std::mutex> lock(deadlines_mutex_);
+    if (deadlines_.Size() == 0) {
+      return;
+    }
+    deadlines_.Advance(NowMs(), [&expired](ReplyIdentifier reply_identifier) {
+      expired.push_back(reply_identifier);
+    });
+  }
+  for (ReplyIdentifier reply_identifier : expired) {
+    PendingReply pending_reply;
+    if (!_handlers_by_identifier_.Take(reply_identifier, &pending_reply)) {
+      continue;  // completed in time
+    }
+    expired_reply_count_.fetch_add(1, std::memory_order_relaxed);
+    uint32_t channel_code = static_cast<uint32_t>(reply_identifier >> 32);
+    uint64_t dispatch_key = static_cast<uint64_t>(std::abs(static_cast<int32_t>(channel_code)));
+    IDEVICE_LOG_I("the message(%d|%d) timed out\n", channel_code,
+                  static_cast<uint32_t>(reply_identifier));
+    std::shared_ptr<DTXRequest> request = std::move(pending_reply.request);
+    if (request) {
+      request->SetCanceller(nullptr);  // nothing is left to cancel, and it may outlive this
+    }
+    ReplyHandler handler = std::move(pending_reply.handler);
+    dispatch_executor_->Execute(dispatch_key, [request, handler]() {
+      if (request) {
+        request->Complete(DTXRequestStatus::kTimedOut, nullptr);
+      } else {
+        handler(nullptr);
+      }
+    });
+  }
+}
+
+void DTXConnection::FailPendingReplies() {
+  {
+    std::lock_guard<std::mutex> lock(deadlines_mutex_);
+    deadlines_.Clear();
+  }
+  // the callbacks are dropped, while the requests fail, so nobody waits for them forever
+  _handlers_by_identifier_.Clear([](const ReplyIdentifier&, PendingReply& pending_reply) {
+    if (pending_reply.request) {
+      pending_reply.request->Complete(DTXRequestStatus::kDisconnected, nullptr);
+    }
+  });
+}
+
+void DTXConnection::WatchReceiveWatermark() {
+  receive_watermark_->SetListener([this](bool above_high_watermark, size_t bytes) {
+    IDEVICE_LOG_I("%s reading, %zu bytes are pending\n", above_high_watermark ? "pause" : "resume",
+                  bytes);
+    DTXEventLoop* event_loop = event_loop_.load(std::memory_order_acquire);
+    if (event_loop != nullptr) {
+      event_loop->SetReading(this, !above_high_watermark);
+    }
+    if (receive_watermark_handler_) {
+      receive_watermark_handler_(above_high_watermark, bytes);
+    }
+  });
 }
 
 void DTXConnection::ReplyMessage(std::shared_ptr<DTXMessage> msg) {
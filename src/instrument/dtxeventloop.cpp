@@ -0,0 +1,285 @@
+#include "idevice/instrument/dtxeventloop.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>  // std::find
+
+#include "idevice/instrument/dtxconnection.h"
+#include "idevice/common/macro_def.h"  // IDEVICE_LOG_E
+
+using namespace idevice;
+
+#ifdef __linux__
+
+static constexpr int kMaxEventsPerWait = 64;
+static constexpr int kRequestExpiryInterval = 100;  // how often the deadlines are checked
+
+DTXEventLoop::DTXEventLoop() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || wakeup_fd_ < 0) {
+    IDEVICE_LOG_E("Error: can not create the event loop, errno=%d\n", errno);
+    return;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;  // the wakeup fd is the only one without a connection
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) < 0) {
+    IDEVICE_LOG_E("Error: can not watch the wakeup fd, errno=%d\n", errno);
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+}
+
+DTXEventLoop::~DTXEventLoop() {
+  Stop();
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+}
+
+bool DTXEventLoop::Start() {
+  if (epoll_fd_ < 0 || thread_ != nullptr) {
+    return false;
+  }
+  running_.store(true, std::memory_order_release);
+  thread_ = std::make_unique<std::thread>(&DTXEventLoop::Run, this);
+  return true;
+}
+
+void DTXEventLoop::Stop() {
+  running_.store(false, std::memory_order_release);
+  Notify();
+  // if it's stopped by a handler on the loop thread, the thread is joined by the next `Stop()`
+  if (thread_ && thread_->get_id() != std::this_thread::get_id()) {
+    thread_->join();
+    thread_ = nullptr;
+  }
+}
+
+void DTXEventLoop::Run() {
+  IDEVICE_LOG_I("EventLoop start\n");
+  while (running_.load(std::memory_order_acquire)) {
+    if (RunOnce(kRequestExpiryInterval) < 0) {
+      break;
+    }
+  }
+  IDEVICE_LOG_I("EventLoop stop\n");
+}
+
+int DTXEventLoop::RunOnce(int timeout_ms) {
+  loop_thread_id_.store(std::this_thread::get_id(), std::memory_order_release);
+  struct epoll_event events[kMaxEventsPerWait];
+  int count = epoll_wait(epoll_fd_, events, kMaxEventsPerWait, timeout_ms);
+  if (count < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    IDEVICE_LOG_E("Error: epoll_wait failed, errno=%d\n", errno);
+    return -1;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    DTXConnection* connection = static_cast<DTXConnection*>(events[i].data.ptr);
+    if (connection == nullptr) {
+      uint64_t value = 0;
+      while (read(wakeup_fd_, &value, sizeof(value)) > 0) {
+      }
+      continue;  // the pending connections are flushed below
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+    if (connections_.count(connection) == 0) {
+      continue;  // removed by a handler of an earlier event
+    }
+    if (events[i].events & EPOLLOUT) {
+      connection->HandleWritable();
+      if (connections_.count(connection) == 0 || events[i].events == EPOLLOUT) {
+        continue;  // disconnected by the failed write, or nothing to read
+      }
+    }
+    connection->HandleReadable();
+  }
+
+  FlushPendingConnections();
+  ExpireRequests();
+  return count;
+}
+
+bool DTXEventLoop::Add(DTXConnection* connection) {
+  int fd = connection->transport_->PollableFd();
+  if (epoll_fd_ < 0 || fd < 0) {
+    return false;
+  }
+  std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+  // level-triggered, so a handler reading only a part of the available bytes is woken up again
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.ptr = connection;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    IDEVICE_LOG_E("Error: can not watch the fd %d, errno=%d\n", fd, errno);
+    return false;
+  }
+  connection->send_scheduled_.store(false, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> events_lock(events_mutex_);
+    connections_.insert(connection);
+    connection->loop_reading_ = true;
+    connection->loop_writing_ = false;
+  }
+  return true;
+}
+
+bool DTXEventLoop::Remove(DTXConnection* connection) {
+  std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+  {
+    std::lock_guard<std::mutex> events_lock(events_mutex_);
+    if (connections_.erase(connection) == 0) {
+      return false;
+    }
+    int fd = connection->transport_->PollableFd();
+    if (fd >= 0) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+    auto found =
+        std::find(pending_connections_.begin(), pending_connections_.end(), connection);
+    if (found != pending_connections_.end()) {
+      pending_connections_.erase(found);
+    }
+  }
+  connection->send_scheduled_.store(false, std::memory_order_release);
+  return true;
+}
+
+void DTXEventLoop::SetReading(DTXConnection* connection, bool enabled) {
+  // `connections_mutex_` is not taken, it may be called by a handler holding other locks(e.g. the
+  // listener of a watermark) which the loop thread takes while holding `connections_mutex_`, the
+  // registration is checked under `events_mutex_` instead, which `Remove()` takes as well
+  std::lock_guard<std::mutex> lock(events_mutex_);
+  if (connections_.count(connection) == 0) {
+    return;  // removed, its fd may have been closed, or even reused
+  }
+  connection->loop_reading_ = enabled;
+  UpdateEvents(connection);
+}
+
+void DTXEventLoop::SetWriting(DTXConnection* connection, bool enabled) {
+  std::lock_guard<std::mutex> lock(events_mutex_);
+  if (connections_.count(connection) == 0) {
+    return;
+  }
+  if (connection->loop_writing_ != enabled) {
+    connection->loop_writing_ = enabled;
+    UpdateEvents(connection);
+  }
+}
+
+void DTXEventLoop::UpdateEvents(DTXConnection* connection) {
+  int fd = connection->transport_->PollableFd();
+  if (epoll_fd_ < 0 || fd < 0) {
+    return;
+  }
+  struct epoll_event event = {};
+  // the errors and hangups are always reported
+  event.events =
+      (connection->loop_reading_ ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u) |
+      (connection->loop_writing_ ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+  event.data.ptr = connection;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+}
+
+void DTXEventLoop::Notify() {
+  if (wakeup_fd_ < 0) {
+    return;
+  }
+  uint64_t value = 1;
+  ssize_t ret = write(wakeup_fd_, &value, sizeof(value));
+  (void)ret;  // it only fails if the counter is about to overflow, and then the loop is awake
+}
+
+#else  // !__linux__
+
+DTXEventLoop::DTXEventLoop() {}
+DTXEventLoop::~DTXEventLoop() {}
+bool DTXEventLoop::Start() { return false; }
+void DTXEventLoop::Stop() {}
+void DTXEventLoop::Run() {}
+int DTXEventLoop::RunOnce(int timeout_ms) { return -1; }
+bool DTXEventLoop::Add(DTXConnection* connection) { return false; }
+bool DTXEventLoop::Remove(DTXConnection* connection) { return false; }
+void DTXEventLoop::SetReading(DTXConnection* connection, bool enabled) {}
+void DTXEventLoop::SetWriting(DTXConnection* connection, bool enabled) {}
+void DTXEventLoop::UpdateEvents(DTXConnection* connection) {}
+void DTXEventLoop::Notify() {}
+
+#endif  // __linux__
+
+void DTXEventLoop::Wakeup(DTXConnection* connection) {
+  if (connection->send_scheduled_.exchange(true, std::memory_order_acq_rel)) {
+    return;  // the loop will flush it soon
+  }
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_connections_.push_back(connection);
+  }
+  if (!InLoopThread()) {
+    Notify();  // otherwise it's flushed at the end of the current iteration
+  }
+}
+
+void DTXEventLoop::FlushPendingConnections() {
+  std::vector<DTXConnection*> connections;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    connections.swap(pending_connections_);
+  }
+  for (DTXConnection* connection : connections) {
+    std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+    if (connections_.count(connection) == 0) {
+      continue;
+    }
+    // cleared before flushing, so a message queued meanwhile wakes up the loop again
+    connection->send_scheduled_.store(false, std::memory_order_release);
+    connection->FlushSendQueue();
+  }
+}
+
+void DTXEventLoop::ExpireRequests() {
+  auto now = std::chrono::steady_clock::now();
+  if (now < next_expiry_) {
+    return;
+  }
+  next_expiry_ = now + std::chrono::milliseconds(kRequestExpiryInterval);
+  std::vector<DTXConnection*> connections;
+  {
+    std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+    connections.assign(connections_.begin(), connections_.end());
+  }
+  for (DTXConnection* connection : connections) {
+    // a timed-out request may be handled inline, and its handler may remove connections
+    std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+    if (connections_.count(connection) > 0) {
+      connection->ExpireRequests();
+    }
+  }
+}
+
+bool DTXEventLoop::InLoopThread() const {
+  return loop_thread_id_.load(std::memory_order_acquire) == std::this_thread::get_id();
+}
+
+size_t DTXEventLoop::ConnectionCount() const {
+  std::lock_guard<std::recursive_mutex> lock(connections_mutex_);
+  return connections_.size();
+}
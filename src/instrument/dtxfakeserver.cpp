@@ -0,0 +1,186 @@
+#include "idevice/instrument/dtxfakeserver.h"
+
+#include <chrono>
+#include <vector>
+
+#include "nskeyedarchiver/nskeyedunarchiver.hpp"
+#include "idevice/common/macro_def.h"  // IDEVICE_LOG_E
+
+using namespace idevice;
+
+static constexpr size_t kReceiveBufferSize = 64 * 1024;
+static constexpr uint32_t kReceiveTimeout = 100;  // how often the serving thread checks stopping
+
+std::string DTXFakeServer::SelectorOf(const DTXMessage& msg) {
+  const std::unique_ptr<nskeyedarchiver::KAValue>& payload = msg.PayloadObject();
+  if (payload == nullptr || payload->GetDataType() != nskeyedarchiver::KAValue::Str) {
+    return "";
+  }
+  return payload->ToStr();
+}
+
+bool DTXFakeServer::Start() {
+  if (serving_thread_ != nullptr || !transport_->Connect()) {
+    return false;
+  }
+  serving_.store(true, std::memory_order_release);
+  serving_thread_ = std::make_unique<std::thread>(&DTXFakeServer::ServingThread, this);
+  return true;
+}
+
+void DTXFakeServer::Stop() {
+  serving_.store(false, std::memory_order_release);
+  streaming_.store(false, std::memory_order_release);
+  transport_->Disconnect();  // wakes up the threads waiting for the transport
+  if (serving_thread_ != nullptr) {
+    serving_thread_->join();
+    serving_thread_ = nullptr;
+  }
+  std::lock_guard<std::mutex> lock(streaming_mutex_);
+  if (streaming_thread_ != nullptr) {
+    streaming_thread_->join();
+    streaming_thread_ = nullptr;
+  }
+}
+
+bool DTXFakeServer::StartStreaming(uint32_t channel_code, size_t payload_size,
+                                   uint32_t messages_per_second, uint64_t message_count) {
+  StopStreaming();
+  std::lock_guard<std::mutex> lock(streaming_mutex_);
+  if (!transport_->IsConnected()) {
+    return false;
+  }
+  streaming_.store(true, std::memory_order_release);
+  streaming_thread_ =
+      std::make_unique<std::thread>(&DTXFakeServer::StreamingThread, this, channel_code,
+                                    payload_size, messages_per_second, message_count);
+  return true;
+}
+
+void DTXFakeServer::StopStreaming() {
+  std::lock_guard<std::mutex> lock(streaming_mutex_);
+  streaming_.store(false, std::memory_order_release);
+  if (streaming_thread_ != nullptr) {
+    streaming_thread_->join();
+    streaming_thread_ = nullptr;
+  }
+}
+
+std::string DTXFakeServer::ChannelLabel(uint32_t channel_code) const {
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  auto found = labels_by_channel_code_.find(channel_code);
+  return found != labels_by_channel_code_.end() ? found->second : "";
+}
+
+size_t DTXFakeServer::ChannelCount() const {
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  return labels_by_channel_code_.size();
+}
+
+void DTXFakeServer::ServingThread() {
+  std::vector<char> buffer(kReceiveBufferSize);
+  while (serving_.load(std::memory_order_acquire)) {
+    uint32_t received = 0;
+    if (!transport_->ReceiveWithTimeout(buffer.data(), static_cast<uint32_t>(buffer.size()),
+                                        kReceiveTimeout, &received)) {
+      break;  // the client is gone
+    }
+    if (received == 0) {
+      continue;
+    }
+    if (!parser_.ParseIncomingBytes(buffer.data(), received)) {
+      IDEVICE_LOG_E("Error: the fake server can not parse incoming bytes.\n");
+      break;
+    }
+    for (const std::shared_ptr<DTXMessage>& msg : parser_.PopAllParsedMessages()) {
+      received_message_count_.fetch_add(1, std::memory_order_relaxed);
+      HandleMessage(msg);
+    }
+  }
+}
+
+void DTXFakeServer::HandleMessage(const std::shared_ptr<DTXMessage>& msg) {
+  std::string selector = SelectorOf(*msg);
+  const std::unique_ptr<DTXPrimitiveArray>& auxiliary = msg->Auxiliary();
+  std::shared_ptr<DTXMessage> reply;
+  if (selector == "_requestChannelWithCode:identifier:" && auxiliary && auxiliary->Size() >= 2) {
+    // aux_0: the channel code, aux_1: the archived label
+    uint32_t channel_code = static_cast<uint32_t>(auxiliary->At(0).ToSignedInt32());
+    const DTXPrimitiveValue& label = auxiliary->At(1);
+    nskeyedarchiver::KAValue label_object =
+        nskeyedarchiver::NSKeyedUnarchiver::UnarchiveTopLevelObjectWithData(
+            label.ToBuffer(), static_cast<uint32_t>(label.Size()));
+    std::lock_guard<std::mutex> lock(channels_mutex_);
+    labels_by_channel_code_[channel_code] = label_object.ToStr();
+  } else if (selector == "_channelCanceled:" && auxiliary && auxiliary->Size() >= 1) {
+    uint32_t channel_code = static_cast<uint32_t>(auxiliary->At(0).ToSignedInt32());
+    std::lock_guard<std::mutex> lock(channels_mutex_);
+    labels_by_channel_code_.erase(channel_code);
+  } else {
+    auto found = handlers_by_selector_.find(selector);
+    if (found != handlers_by_selector_.end()) {
+      reply = found->second(msg);
+    }
+  }
+
+  if (!msg->ExpectsReply()) {
+    return;
+  }
+  if (reply == nullptr) {
+    reply = DTXMessage::NewReply(msg);
+  }
+  DTXMessageRoutingInfo routing_info = {};
+  routing_info.msg_identifier = msg->Identifier();
+  routing_info.conversation_index = msg->ConversationIndex() + 1;
+  routing_info.channel_code = msg->ChannelCode();
+  routing_info.expects_reply = 0;
+  SendMessage(reply, routing_info);
+}
+
+void DTXFakeServer::StreamingThread(uint32_t channel_code, size_t payload_size,
+                                    uint32_t messages_per_second, uint64_t message_count) {
+  std::vector<char> payload(payload_size);
+  for (size_t i = 0; i < payload_size; ++i) {
+    payload[i] = static_cast<char>(i);
+  }
+  // the same message is sent again and again, only the routing info differs
+  std::shared_ptr<DTXMessage> msg =
+      DTXMessage::CreateWithBuffer(payload.data(), payload.size(), true);
+  DTXMessageRoutingInfo routing_info = {};
+  routing_info.channel_code = static_cast<uint32_t>(-static_cast<int32_t>(channel_code));
+
+  auto interval = std::chrono::nanoseconds(
+      messages_per_second > 0 ? 1000 * 1000 * 1000 / messages_per_second : 0);
+  auto next_send = std::chrono::steady_clock::now();
+  for (uint64_t sent = 0; message_count == 0 || sent < message_count; ++sent) {
+    if (!streaming_.load(std::memory_order_acquire)) {
+      break;
+    }
+    if (messages_per_second > 0) {
+      // paced by the schedule rather than by the previous send, so a late message doesn't delay
+      // all following ones
+      std::this_thread::sleep_until(next_send);
+      next_send += interval;
+    }
+    if (!SendMessage(msg, routing_info)) {
+      break;
+    }
+    streamed_message_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool DTXFakeServer::SendMessage(const std::shared_ptr<DTXMessage>& msg,
+                                const DTXMessageRoutingInfo& routing_info) {
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  DTXMessageRoutingInfo message_routing_info = routing_info;
+  if (message_routing_info.conversation_index == 0) {
+    message_routing_info.msg_identifier = next_msg_identifier_++;
+  }
+  send_buffer_.Clear();
+  if (!transmitter_.GatherMessage(msg, message_routing_info, &send_buffer_)) {
+    return false;
+  }
+  const std::vector<IoVec>& segments = send_buffer_.Segments();
+  size_t sent = 0;
+  return transport_->SendV(segments.data(), segments.size(), &sent);
+}
@@ -0,0 +1,124 @@
+#include "idevice/instrument/dtxloopbacktransport.h"
+
+#include <algorithm>  // std::min
+#include <chrono>
+#include <condition_variable>
+#include <cstring>  // memcpy
+#include <mutex>
+#include <vector>
+
+using namespace idevice;
+
+// a bounded ring of bytes, written by one end and read by the other
+struct LoopbackDTXTransport::Pipe {
+  explicit Pipe(size_t capacity) : buffer(capacity == 0 ? 1 : capacity) {}
+
+  // copy in as many bytes as fit, wait while it's full, return false once it's closed
+  bool Write(const char* data, size_t size, size_t* written) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (size > 0) {
+      writable.wait(lock, [this] { return closed || length < buffer.size(); });
+      if (closed) {
+        return false;
+      }
+      size_t tail = (head + length) % buffer.size();
+      size_t chunk = std::min({size, buffer.size() - length, buffer.size() - tail});
+      memcpy(buffer.data() + tail, data, chunk);
+      length += chunk;
+      data += chunk;
+      size -= chunk;
+      *written += chunk;
+      readable.notify_one();
+    }
+    return true;
+  }
+
+  // copy out the available bytes, wait for them up to the timeout, return false once it's closed
+  // and drained
+  bool Read(char* data, size_t size, uint32_t timeout_ms, uint32_t* received) {
+    std::unique_lock<std::mutex> lock(mutex);
+    *received = 0;
+    if (timeout_ms > 0) {
+      readable.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                        [this] { return closed || length > 0; });
+    }
+    if (length == 0) {
+      return !closed;
+    }
+    while (*received < size && length > 0) {
+      size_t chunk = std::min({size - *received, length, buffer.size() - head});
+      memcpy(data + *received, buffer.data() + head, chunk);
+      head = (head + chunk) % buffer.size();
+      length -= chunk;
+      *received += static_cast<uint32_t>(chunk);
+    }
+    writable.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    readable.notify_all();
+    writable.notify_all();
+  }
+
+  std::mutex mutex;
+  std::condition_variable readable;
+  std::condition_variable writable;
+  std::vector<char> buffer;
+  size_t head = 0;
+  size_t length = 0;
+  bool closed = false;
+};
+
+std::pair<std::unique_ptr<LoopbackDTXTransport>, std::unique_ptr<LoopbackDTXTransport>>
+LoopbackDTXTransport::CreatePair(size_t capacity) {
+  std::shared_ptr<Pipe> forward = std::make_shared<Pipe>(capacity);
+  std::shared_ptr<Pipe> backward = std::make_shared<Pipe>(capacity);
+  return std::make_pair(
+      std::unique_ptr<LoopbackDTXTransport>(new LoopbackDTXTransport(backward, forward)),
+      std::unique_ptr<LoopbackDTXTransport>(new LoopbackDTXTransport(forward, backward)));
+}
+
+bool LoopbackDTXTransport::Connect() {
+  std::lock_guard<std::mutex> lock(outgoing_->mutex);
+  if (outgoing_->closed) {
+    return false;
+  }
+  connected_.store(true, std::memory_order_release);
+  return true;
+}
+
+bool LoopbackDTXTransport::Disconnect() {
+  connected_.store(false, std::memory_order_release);
+  incoming_->Close();
+  outgoing_->Close();
+  return true;
+}
+
+bool LoopbackDTXTransport::Send(const char* data, uint32_t size, uint32_t* sent) {
+  size_t written = 0;
+  bool ret = outgoing_->Write(data, size, &written);
+  *sent = static_cast<uint32_t>(written);
+  return ret;
+}
+
+bool LoopbackDTXTransport::SendV(const IoVec* segments, size_t count, size_t* sent) {
+  *sent = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!outgoing_->Write(segments[i].data, segments[i].size, sent)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LoopbackDTXTransport::Receive(char* buffer, uint32_t size, uint32_t* received) {
+  return incoming_->Read(buffer, size, 0, received);
+}
+
+bool LoopbackDTXTransport::ReceiveWithTimeout(char* buffer, uint32_t size, uint32_t timeout,
+                                              uint32_t* received) {
+  return incoming_->Read(buffer, size, timeout == 0 ? 1 : timeout, received);
+}
@@ -2,8 +2,11 @@
 
 #include <fstream>
 #include <memory>  // std::make_unique
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
+#include "idevice/utils/zlibinflater.h"
 #include "idevice/common/macro_def.h"
 #include "nskeyedarchiver/nskeyedarchiver.hpp"
 #include "nskeyedarchiver/nskeyedunarchiver.hpp"
@@ -11,6 +14,10 @@
 using namespace idevice;
 
 static constexpr int kDTXMessagePayloadHeaderSize = 0x10;
+static constexpr int kDTXCompressedPayloadHeaderSize = 0x08;
+static constexpr size_t kDTXMessageMaxDecompressedSize = 256 * 1024 * 1024;  // 256MB
+static constexpr size_t kDTXMessageMaxPooledDecompressedSize = 4 * 1024 * 1024;  // 4MB
+static constexpr size_t kMaxCachedSelectorCount = 1024;
 
 static inline void write_buffer_to_file(std::string filename, const char* buffer, uint64_t size) {
   std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
@@ -18,11 +25,54 @@ static inline void write_buffer_to_file(std::string filename, const char* buffer
   file.close();
 }
 
+// The same selectors are sent again and again, so each of them is archived only once, and the
+// archived bytes are shared by all messages with that selector. The cache is process-wide, and
+// bounded, the selectors beyond the bound are archived per message.
+static std::shared_ptr<const std::string> archived_selector(const char* selector) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::shared_ptr<const std::string>> archived_selectors;
+  thread_local std::string key;  // reuse its memory for the lookups
+  key.assign(selector);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = archived_selectors.find(key);
+    if (found != archived_selectors.end()) {
+      return found->second;
+    }
+  }
+
+  char* buffer = nullptr;
+  size_t buffer_size = 0;
+  nskeyedarchiver::NSKeyedArchiver::ArchivedData(
+      nskeyedarchiver::KAValue(selector) /* as NSString */, &buffer, &buffer_size,
+      nskeyedarchiver::NSKeyedArchiver::OutputFormat::Binary);
+  if (buffer == nullptr) {
+    return nullptr;
+  }
+  std::shared_ptr<const std::string> archived =
+      std::make_shared<const std::string>(buffer, buffer_size);
+  free(buffer);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (archived_selectors.size() >= kMaxCachedSelectorCount) {
+    return archived;
+  }
+  return archived_selectors.emplace(key, std::move(archived)).first->second;
+}
+
 // static
 std::shared_ptr<DTXMessage> DTXMessage::CreateWithSelector(const char* selector) {
   std::shared_ptr<DTXMessage> message = std::make_shared<DTXMessage>();
   message->SetMessageType(kSelectorMessageType);
-  message->SetPayloadObject(std::make_unique<nskeyedarchiver::KAValue>(selector) /* as NSString */);
+  std::shared_ptr<const std::string> archived = archived_selector(selector);
+  if (archived) {
+    // reference the cached bytes, and decode them only if someone asks for the payload object
+    message->SetPayloadBuffer(const_cast<char*>(archived->data()), archived->size(), false);
+    message->SetBackingStorage(std::const_pointer_cast<std::string>(archived));
+    message->payload_object_pending_.store(true, std::memory_order_release);
+  } else {
+    message->SetPayloadObject(std::make_unique<nskeyedarchiver::KAValue>(selector) /* as NSString */);
+  }
   message->SetAuxiliary(std::make_unique<DTXPrimitiveArray>());
   return message;
 }
@@ -48,7 +98,9 @@ std::shared_ptr<DTXMessage> DTXMessage::NewReply(std::shared_ptr<DTXMessage> rep
 }
 
 // static
-std::shared_ptr<DTXMessage> DTXMessage::Deserialize(const char* bytes, size_t size) {
+std::shared_ptr<DTXMessage> DTXMessage::Deserialize(const char* bytes, size_t size,
+                                                    std::shared_ptr<void> storage,
+                                                    BufferPool* decompression_buffers) {
   /* ONLY FOR DEBUG
   static int count = 0;
   count++;
@@ -72,36 +124,93 @@ std::shared_ptr<DTXMessage> DTXMessage::Deserialize(const char* bytes, size_t si
   uint32_t auxiliary_length = *(uint32_t*)(bytes + 0x04);
   uint64_t total_length = *(uint64_t*)(bytes + 0x08);
   uint64_t payload_length = total_length - auxiliary_length;
-#if IDEVICE_DEBUG
-  printf("message_type: %d\n", message_type);
-  printf("auxiliary_length: %d\n", auxiliary_length);
-  printf("total_length: %llu\n", total_length);
-  printf("payload_length: %llu\n", payload_length);
-#endif
+  IDEVICE_LOG_V("message_type: %u, auxiliary_length: %u, total_length: %llu, "
+                "payload_length: %llu\n", message_type, auxiliary_length,
+                (unsigned long long)total_length, (unsigned long long)payload_length);
 
   const char* auxiliary_ptr = bytes + kDTXMessagePayloadHeaderSize;
   const char* payload_ptr = bytes + kDTXMessagePayloadHeaderSize + auxiliary_length;
 
+  // with a storage, the auxiliary and the payload are just views of the bytes in the storage
+  const bool should_copy = storage == nullptr;
   std::shared_ptr<DTXMessage> message = std::make_shared<DTXMessage>(message_type);
+  message->SetBackingStorage(std::move(storage));
   if (auxiliary_length > 0) {
-    message->SetAuxiliary(
-        DTXPrimitiveArray::Deserialize(bytes + kDTXMessagePayloadHeaderSize, auxiliary_length));
+    message->SetAuxiliary(DTXPrimitiveArray::Deserialize(
+        bytes + kDTXMessagePayloadHeaderSize, auxiliary_length, should_copy));
   }
   if (payload_length > 0) {
-    message->SetPayloadBuffer(const_cast<char*>(payload_ptr), payload_length, true);
-    nskeyedarchiver::KAValue value =
-        nskeyedarchiver::NSKeyedUnarchiver::UnarchiveTopLevelObjectWithData(payload_ptr,
-                                                                            payload_length);
-    message->SetPayloadObject(std::make_unique<nskeyedarchiver::KAValue>(std::move(value)));
-  }
-  if (message_type == 7) {
-    printf("TODO: DecompressedData(), use zlib\n");  // TODO
+    bool decompressed =
+        message_type == kCompressedMessageType &&
+        message->DecompressPayload(payload_ptr, payload_length, decompression_buffers);
+    if (!decompressed) {
+      // a compressed payload which can not be decompressed is kept as it is, but never decoded
+      message->SetPayloadBuffer(const_cast<char*>(payload_ptr), payload_length, should_copy);
+    }
+    // the payload is decoded lazily, most of the messages(e.g. acks, or messages without any
+    // handler) are never looked at, see `PayloadObject()`
+    message->payload_object_pending_.store(message_type != kCompressedMessageType || decompressed,
+                                           std::memory_order_release);
   }
 
   message->SetDeserialized(true);
   return message;
 }
 
+bool DTXMessage::DecompressPayload(const char* bytes, size_t size,
+                                   BufferPool* decompression_buffers) {
+  // clang-format off
+  // Compressed Payload Memory Layout:
+  // |-----------------------------------------------------------|
+  // |  0  1  2  3  |  4  5  6  7  |  8 ...                      |
+  // |-----------------------------------------------------------|
+  // |  msg_type    |  length      |  zlib stream                | // type of the message and size of the payload before compression
+  // |-----------------------------------------------------------|
+  // clang-format on
+  if (size < kDTXCompressedPayloadHeaderSize) {
+    IDEVICE_LOG_E("Error: invalid compressed payload, size=%zu\n", size);
+    return false;
+  }
+  uint32_t message_type = *(uint32_t*)(bytes);
+  uint32_t decompressed_length = *(uint32_t*)(bytes + 0x04);
+  if (decompressed_length == 0 || decompressed_length > kDTXMessageMaxDecompressedSize) {
+    IDEVICE_LOG_E("Error: invalid decompressed length of payload: %u\n", decompressed_length);
+    return false;
+  }
+
+  // inflate directly into a pooled buffer, which grows to fit and is reused by the next message
+  // once this one dies, the rare huge payload gets a buffer of its own, so it's not kept pooled
+  SharedBufferMemory storage = nullptr;
+  if (decompression_buffers != nullptr &&
+      decompressed_length <= kDTXMessageMaxPooledDecompressedSize) {
+    storage = decompression_buffers->Acquire();
+  } else {
+    storage = std::make_shared<BufferMemory>();
+  }
+  char* buffer = storage ? storage->Allocate(decompressed_length) : nullptr;
+  if (buffer == nullptr) {
+    IDEVICE_LOG_E("Error: can not allocate memory, size=%u\n", decompressed_length);
+    return false;
+  }
+  size_t inflated_size = 0;
+  if (!ZlibInflater::ThreadLocal().Inflate(bytes + kDTXCompressedPayloadHeaderSize,
+                                           size - kDTXCompressedPayloadHeaderSize, buffer,
+                                           decompressed_length, &inflated_size) ||
+      inflated_size != decompressed_length) {
+    IDEVICE_LOG_E("Error: can not decompress payload, size=%zu, inflated=%zu, expected=%u\n",
+                  size, inflated_size, decompressed_length);
+    return false;
+  }
+
+  payload_storage_ = std::move(storage);
+  payload_buffer_ = buffer;
+  payload_size_ = decompressed_length;
+  should_free_payload_buffer_ = false;
+  message_type_ = message_type;
+  compressed_ = true;
+  return true;
+}
+
 size_t DTXMessage::SerializedLength() {
   size_t length = kDTXMessagePayloadHeaderSize;
 
@@ -117,35 +226,12 @@ size_t DTXMessage::SerializedLength() {
 }
 
 bool DTXMessage::SerializeTo(std::function<bool(const char*, size_t)> serializer) {
-  // Serialize DTXMessagePayloadHeader
-  serializer(reinterpret_cast<const char*>(&message_type_), sizeof(uint32_t));
-
-  MaybeSerializeAuxiliaryObjects();
-  uint32_t auxiliary_length = auxiliary_ ? auxiliary_->SerializedLength() : 0;
-  serializer(reinterpret_cast<const char*>(&auxiliary_length), sizeof(uint32_t));
-
-  MaybeSerializePayloadObject();
-  uint64_t total_length = auxiliary_length + payload_size_;
-  serializer(reinterpret_cast<const char*>(&total_length), sizeof(uint64_t));
-
-#if IDEVICE_DEBUG
-  printf("message_type: %d\n", message_type_);
-  printf("auxiliary_length: %d\n", auxiliary_length);
-  printf("total_length: %llu\n", total_length);
-#endif
-
-  // Serialize auxiliary
-  if (auxiliary_length > 0 /* auxiliary_ != nullptr */) {
-    if (!auxiliary_->SerializeTo(serializer)) {
-      return false;
-    }
-  }
+  return SerializeTo<std::function<bool(const char*, size_t)>&>(serializer);
+}
 
-  // Serialize payload
-  if (payload_size_ > 0) {
-    serializer(payload_buffer_, payload_size_);
-  }
-  return true;
+void DTXMessage::DumpPayloadHeader(uint32_t auxiliary_length, uint64_t total_length) const {
+  IDEVICE_LOG_V("message_type: %u, auxiliary_length: %u, total_length: %llu\n", message_type_,
+                auxiliary_length, (unsigned long long)total_length);
 }
 
 void DTXMessage::MaybeSerializePayloadObject() {
@@ -154,7 +240,22 @@ void DTXMessage::MaybeSerializePayloadObject() {
     nskeyedarchiver::NSKeyedArchiver::ArchivedData(
         *payload_object_, &payload_buffer_, &payload_size_,
         nskeyedarchiver::NSKeyedArchiver::OutputFormat::Binary);
+    should_free_payload_buffer_ = payload_buffer_ != nullptr;  // allocated by the archiver
+  }
+}
+
+void DTXMessage::MaybeDeserializePayloadObject() const {
+  std::lock_guard<std::mutex> lock(payload_object_mutex_);
+  if (!payload_object_pending_.load(std::memory_order_relaxed)) {
+    return;  // someone else has decoded it while we were waiting for the lock
+  }
+  if (payload_object_ == nullptr && payload_buffer_ != nullptr && payload_size_ > 0) {
+    nskeyedarchiver::KAValue value =
+        nskeyedarchiver::NSKeyedUnarchiver::UnarchiveTopLevelObjectWithData(payload_buffer_,
+                                                                            payload_size_);
+    payload_object_ = std::make_unique<nskeyedarchiver::KAValue>(std::move(value));
   }
+  payload_object_pending_.store(false, std::memory_order_release);
 }
 
 void DTXMessage::MaybeSerializeAuxiliaryObjects() {
@@ -214,8 +315,8 @@ void DTXMessage::Dump(bool dumphex) const {
   if (dumphex && payload_buffer_ != nullptr && payload_size_ > 0) {
     hexdump(payload_buffer_, payload_size_, 0);
   }
-  if (payload_object_ != nullptr) {
-    printf("%s\n", payload_object_->ToJson().c_str());
+  if (PayloadObject() != nullptr) {
+    printf("%s\n", PayloadObject()->ToJson().c_str());
   }
   printf("==== /DTXMessage ====\n");
 }
@@ -1,23 +1,68 @@
 #include "idevice/instrument/dtxmessageparser.h"
 
+#include <algorithm>  // std::min
+
 #include "idevice/common/macro_def.h"
 
 using namespace idevice;
 
+// the messages up to this size are read in place, larger ones may be copied out of the segments
+static constexpr size_t kMaxReservedMessageSize = 16 * 1024 * 1024;  // 16MB
+
+// the first fragment of a multi-fragment message only contains the header, and its `length` is
+// the length of the whole message
+static inline size_t data_size_of(const DTXMessageHeader& header) {
+  return (header.fragment_count > 1 && header.fragment_index == 0) ? 0 : header.length;
+}
+
 // run on worker thread
 bool DTXMessageParser::ParseIncomingBytes(const char* buffer, size_t size) {
-  // copy the data from receive buffer into parsing buffer
-  {
-#if IDEVICE_DEBUG
+  if (IDEVICE_LOG_ENABLED(kLogLevelVerbose)) {
     hexdump((void*)buffer, (int)size, 0);
-#endif
-    char* ptr = parsing_buffer_.Allocate(size);
-    if (ptr == nullptr) {
+  }
+  // copy the data from receive buffer into parsing buffer, a message at a time, once the header of
+  // a message is buffered, room is made for the whole message in one segment before the rest of it
+  // is appended, so it never straddles a segment boundary, and is read in place
+  while (size > 0) {
+    size_t buffered = parsing_buffer_.Size();
+    size_t len = size;
+    DTXMessageHeader header;
+    if (buffered < kDTXMessageHeaderSize) {
+      len = std::min(size, kDTXMessageHeaderSize - buffered);
+    } else if (parsing_buffer_.CopyTo(reinterpret_cast<char*>(&header), kDTXMessageHeaderSize)) {
+      size_t message_size_with_header = kDTXMessageHeaderSize + data_size_of(header);
+      if (buffered == kDTXMessageHeaderSize && header.fragment_count <= 1 &&
+          message_size_with_header <= kMaxReservedMessageSize &&
+          !parsing_buffer_.Reserve(message_size_with_header)) {
+        IDEVICE_LOG_E("Error: can not parse incoming bytes, OOM.\n");
+        return false;
+      }
+      if (message_size_with_header > buffered) {
+        len = std::min(size, message_size_with_header - buffered);
+      }
+    }
+    if (!parsing_buffer_.Append(buffer, len)) {
       IDEVICE_LOG_E("Error: can not parse incoming bytes, OOM.\n");
       return false;
     }
-    memcpy(ptr, buffer, size);
+    if (!ParseBufferedBytes()) {
+      return false;
+    }
+    buffer += len;
+    size -= len;
   }
+  return true;
+}
+
+// run on worker thread
+bool DTXMessageParser::ParseIncomingBuffer(SharedBufferMemory buffer) {
+  // the buffer becomes a segment of the parsing buffer, without copying
+  parsing_buffer_.Append(std::move(buffer));
+  return ParseBufferedBytes();
+}
+
+bool DTXMessageParser::ParseBufferedBytes() {
+  size_t size = parsing_buffer_.Size();
 
   // clang-format off
   // At this point the contents `parsing_buffer` can contain:
@@ -43,11 +88,13 @@ bool DTXMessageParser::ParseIncomingBytes(const char* buffer, size_t size) {
   // we will parse as much data in the buffer as possible, after this function return, the `parsing_buffer_` is
   // either empty, we parsed all the messages(see `^` in Case C)
   // or starts with the header of the next message, still incomplete.(see `^` in Case A/B/D)
+  //
+  // The `parsing_buffer_` is segmented, a header or a message may straddle the boundary of two segments,
+  // we read them in place if they are contiguous, and copy them out only if they are not.
   // clang-format on
-  size_t consumed_size = 0;  // offset of parsing buffer
-  size_t buffer_size = parsing_buffer_.Size();
   while (true) {
-    if (buffer_size < consumed_size + kDTXMessageHeaderSize) {
+    size_t buffer_size = parsing_buffer_.Size();
+    if (buffer_size < kDTXMessageHeaderSize) {
       break;  // Case A, not enough data to read even an DTXMessageHeader
     }
 
@@ -62,25 +109,27 @@ bool DTXMessageParser::ParseIncomingBytes(const char* buffer, size_t size) {
     // | ...                                                       | // `DTXMessagePayload payload`, payload of DTXMessage
     // |-----------------------------------------------------------|
     // clang-format on
-    const char* ptr = parsing_buffer_.GetPtr(consumed_size);
-#if IDEVICE_DEBUG
-    hexdump((void*)ptr, (int)kDTXMessageHeaderSize, 0);
-#endif
-    DTXMessageHeader* header = (DTXMessageHeader*)ptr; // assume little endian
-    ptr += kDTXMessageHeaderSize;
-    if (header->magic != kDTXMessageHeaderMagic) {
+    DTXMessageHeader header;  // assume little endian
+    if (!parsing_buffer_.CopyTo(reinterpret_cast<char*>(&header), kDTXMessageHeaderSize)) {
+      break;
+    }
+    if (IDEVICE_LOG_ENABLED(kLogLevelVerbose)) {
+      hexdump((void*)&header, (int)kDTXMessageHeaderSize, 0);
+    }
+    if (header.magic != kDTXMessageHeaderMagic) {
       IDEVICE_LOG_E("Error: handling %zu bytes with unexpected protocol header(magic=%d).\n", size,
-                    header->magic);
+                    header.magic);
       return false;
     }
-    if (header->message_header_size != kDTXMessageHeaderSize) {
+    if (header.message_header_size != kDTXMessageHeaderSize) {
       IDEVICE_LOG_E("Error: handling %zu bytes with unexpected protocol header(header_size=%d).\n",
-                    size, header->message_header_size);
+                    size, header.message_header_size);
       return false;
     }
 
-    size_t message_size_with_header = header->message_header_size + header->length;
-    if (buffer_size < consumed_size + message_size_with_header) {
+    size_t data_size = data_size_of(header);
+    size_t message_size_with_header = header.message_header_size + data_size;
+    if (buffer_size < message_size_with_header) {
       // Case B, we got a complete DTXMessageHeader with a partial DTXMessage payload,
       // we just leave the complete header in the buffer, and do nothing but just return,
       // wait for the next time when the buffer is filled with more received data
@@ -88,71 +137,148 @@ bool DTXMessageParser::ParseIncomingBytes(const char* buffer, size_t size) {
     }
 
     // Case C, we got at least one complete header and payload, parse(and consume) them
-    size_t consumed_length = ParseMessageWithHeader(header, ptr, header->length);
-    consumed_size += header->message_header_size + consumed_length;
+    parsing_buffer_.Consume(kDTXMessageHeaderSize);
+    bool ret = header.fragment_count > 1 ? ParseFragmentWithHeader(header, data_size)
+                                         : ParseMessageWithHeader(header, data_size);
+    parsing_buffer_.Consume(data_size);
+    if (!ret) {
+      return false;
+    }
   }  // end of while
+  return true;
+}
 
-  IDEVICE_ASSERT(consumed_size <= buffer_size, "consumed_size <= buffer_size");
-  if (consumed_size > 0) {
-    // Case D, after we consume one or more complete DTXMessageHeader+DTXMessage,
-    // but there is a leftover at the end of the buffer.
-    // Shift out the consumed bytes, so that on the next time `parsing_buffer_` starts with
-    // the header of the next unconsumed message.
-    buffer_size -= consumed_size;
-    if (buffer_size > 0) {
-      const char* fresh_start = parsing_buffer_.GetPtr(consumed_size);
-      memmove(parsing_buffer_.GetPtr(0), fresh_start, buffer_size);
-      parsing_buffer_.SetSize(buffer_size);
-    }  // else: Case C, which there is nothing left in the buffer, so we don't neet to move any
-       // memory either
+bool DTXMessageParser::ParseMessageWithHeader(const DTXMessageHeader& header, size_t size) {
+  IDEVICE_DUMP_DTXMESSAGE_HEADER(header);
+
+  // DTXMessage has only one fragment
+  SharedBufferMemory storage = nullptr;
+  const char* data = parsing_buffer_.Contiguous(size, &storage);
+  if (data == nullptr && size > 0) {
+    // the message straddles a segment boundary, copy it out to a buffer of its own
+    copied_message_count_++;
+    storage = std::make_shared<BufferMemory>(size);
+    char* ptr = storage->Allocate(size);
+    if (ptr == nullptr) {
+      IDEVICE_LOG_E("Error: can not parse incoming bytes, OOM.\n");
+      return false;
+    }
+    parsing_buffer_.CopyTo(ptr, size);
+    data = ptr;
   }
+
+  std::shared_ptr<DTXMessage> message =
+      DTXMessage::Deserialize(data, size, zero_copy_ ? storage : nullptr,
+                              decompression_buffers_.get());
+  IDEVICE_SETUP_DTXMESSAGE_WITH_HREADER(message, header);
+  message->SetCostSize(kDTXMessageHeaderSize + size);
+  parsed_message_queue_.emplace(std::move(message));
   return true;
 }
 
-size_t DTXMessageParser::ParseMessageWithHeader(const DTXMessageHeader* header, const char* data,
-                                                size_t size) {
-#if IDEVICE_DEBUG
-  IDEVICE_DUMP_DTXMESSAGE_HEADER(*header);
-#endif
-
-  if (header->fragment_count == 1) {
-    // DTXMessage has only one fragment
-    std::shared_ptr<DTXMessage> message = DTXMessage::Deserialize(data, size);
-    IDEVICE_SETUP_DTXMESSAGE_WITH_HREADER(message, *header);
-    message->SetCostSize(kDTXMessageHeaderSize + size);
+bool DTXMessageParser::ParseFragmentWithHeader(const DTXMessageHeader& header, size_t size) {
+  IDEVICE_DUMP_DTXMESSAGE_HEADER(header);
+
+  // DTXMessage has multiple fragments
+  uint64_t identifier = IDEVICE_DTXMESSAGE_IDENTIFIER(header.channel_code, header.identifier);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (header.fragment_index == 0) {
+    // the first fragment of the message only contains the header, the `length` of it is the length
+    // of the whole message, so we can allocate the buffer of the message once, and write the rest
+    // of the fragments into it in place.
+    // the buffers are accounted by their capacity, which is aligned up, on both sides of the budget
+    size_t capacity = IDEVICE_MEM_ALIGN(header.length, 128);
+    EvictFragmentedMessages(capacity, now);
+    if (fragment_memory_usage_ + capacity > fragment_memory_budget_) {
+      IDEVICE_LOG_E("Error: drop the fragmented message %d, it's too large(%u bytes).\n",
+                    header.identifier, header.length);
+      evicted_fragmented_message_count_++;
+      return true;  // the rest of its fragments will be dropped as orphans
+    }
+    SharedBufferMemory buffer = std::make_shared<BufferMemory>(header.length);
+    if (buffer->Capacity() < header.length) {
+      IDEVICE_LOG_E("Error: drop the fragmented message %d, OOM.\n", header.identifier);
+      evicted_fragmented_message_count_++;
+      return true;
+    }
+    fragment_memory_usage_ += buffer->Capacity();
+    FragmentedMessage& fragmented = fragmented_messages_[identifier];
+    if (fragmented.buffer) {  // the identifier is reused by a new message, drop the old one
+      fragment_memory_usage_ -= fragmented.buffer->Capacity();
+      evicted_fragmented_message_count_++;
+    }
+    fragmented.buffer = std::move(buffer);
+    fragmented.last_update = now;
+    return true;
+  }
+
+  auto found = fragmented_messages_.find(identifier);
+  if (found == fragmented_messages_.end()) {
+    IDEVICE_LOG_E("Can not find the fragmented buffer with identifier %d\n", header.identifier);
+    return true;  // drop the orphan fragment
+  }
+  FragmentedMessage& fragmented = found->second;
+  BufferMemory* buffer = fragmented.buffer.get();
+  if (buffer->Size() + size > buffer->Capacity()) {
+    IDEVICE_LOG_E("Error: drop the fragmented message %d, it's longer than expected.\n",
+                  header.identifier);
+    fragment_memory_usage_ -= buffer->Capacity();
+    fragmented_messages_.erase(found);
+    evicted_fragmented_message_count_++;
+    return true;
+  }
+  // copy the data to the fragmented buffer, never reallocates
+  parsing_buffer_.CopyTo(buffer->Allocate(size), size);
+  fragmented.last_update = now;
+
+  if (header.fragment_index == header.fragment_count - 1) {
+    // the last fragment of the message, the reassembled buffer is referenced by this message only,
+    // so hand it over to the message instead of copying it in zero-copy mode
+    size_t message_size = buffer->Size();
+    std::shared_ptr<DTXMessage> message = DTXMessage::Deserialize(
+        buffer->GetPtr(0), message_size,
+        zero_copy_ ? std::move(fragmented.buffer) : SharedBufferMemory(),
+        decompression_buffers_.get());
+    IDEVICE_SETUP_DTXMESSAGE_WITH_HREADER(message, header);
+    message->SetCostSize(kDTXMessageHeaderSize + message_size);
     parsed_message_queue_.emplace(std::move(message));
-    return size;
-  } else {
-    // DTXMessage has multiple fragments
-    if (header->fragment_index == 0) {
-      ByteBuffer fragmented_buffer(header->length);
-      fragmented_buffers_by_identifier.insert(
-          std::make_pair(header->identifier, std::move(fragmented_buffer)));
-      return 0;  // the first fragment of the message only contains the header, so no need to copy
-                 // the `data` to the fragmented buffer
-    } else {
-      auto found = fragmented_buffers_by_identifier.find(header->identifier);
-      if (found != fragmented_buffers_by_identifier.end()) {
-        ByteBuffer& fragmented_buffer = found->second;
-        fragmented_buffer.Append(data, size);  // copy the data to the fragmented buffer
-
-        if (header->fragment_index == header->fragment_count - 1) {
-          // the last fragment of the message
-          std::shared_ptr<DTXMessage> message =
-              DTXMessage::Deserialize(reinterpret_cast<const char*>(fragmented_buffer.GetBuffer(0)),
-                                      fragmented_buffer.Size());
-          IDEVICE_SETUP_DTXMESSAGE_WITH_HREADER(message, *header);
-          message->SetCostSize(kDTXMessageHeaderSize + fragmented_buffer.Size());
-          parsed_message_queue_.emplace(std::move(message));
-          fragmented_buffers_by_identifier.erase(found);  // release the fragmented buffer
-        }
-
-        return size;
+    fragment_memory_usage_ -= buffer->Capacity();
+    fragmented_messages_.erase(found);
+    fragments_reassembled_count_++;
+  }
+  return true;
+}
+
+void DTXMessageParser::EvictFragmentedMessages(size_t incoming_size,
+                                               std::chrono::steady_clock::time_point now) {
+  // evict the stale partial messages first
+  if (fragment_timeout_ms_ > 0) {
+    for (auto it = fragmented_messages_.begin(); it != fragmented_messages_.end();) {
+      if (now - it->second.last_update > std::chrono::milliseconds(fragment_timeout_ms_)) {
+        IDEVICE_LOG_I("evict the stale fragmented message %u\n", static_cast<uint32_t>(it->first));
+        fragment_memory_usage_ -= it->second.buffer->Capacity();
+        evicted_fragmented_message_count_++;
+        it = fragmented_messages_.erase(it);
       } else {
-        IDEVICE_LOG_E("Can not find the fragmented buffer with identifier %d\n", header->identifier);
-        return 0;
+        ++it;
+      }
+    }
+  }
+
+  // then the least recently updated ones, until the incoming message fits in the budget
+  while (!fragmented_messages_.empty() &&
+         fragment_memory_usage_ + incoming_size > fragment_memory_budget_) {
+    auto oldest = fragmented_messages_.begin();
+    for (auto it = fragmented_messages_.begin(); it != fragmented_messages_.end(); ++it) {
+      if (it->second.last_update < oldest->second.last_update) {
+        oldest = it;
       }
     }
+    IDEVICE_LOG_I("evict the fragmented message %u, out of budget\n",
+                  static_cast<uint32_t>(oldest->first));
+    fragment_memory_usage_ -= oldest->second.buffer->Capacity();
+    evicted_fragmented_message_count_++;
+    fragmented_messages_.erase(oldest);
   }
 }
 
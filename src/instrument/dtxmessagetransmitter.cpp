@@ -1,106 +1,101 @@
 #include "idevice/instrument/dtxmessagetransmitter.h"
 
 #include <algorithm>  // std::min
-#include <cmath>      // ceil
 
-#include "idevice/utils/bytebuffer.h"
-#include "idevice/common/idevice.h"  // hexdump
+#include "idevice/utils/bytesink.h"
 #include "idevice/common/macro_def.h"
 
 using namespace idevice;
 
-#if IDEVICE_DEBUG
-#define IDEVICE_TRANSMIT_DUMP_HEADER(header)          \
-  IDEVICE_LOG_D("TransmitMessage message header:\n"); \
-  IDEVICE_DUMP_DTXMESSAGE_HEADER(header);
-#else
-#define IDEVICE_TRANSMIT_DUMP_HEADER(header)
-#endif
-
-// we use a buffer to cache all data of a fragment, when the buffer is full then flush all the data
-// in it as one fragment of the DTXMessage. each framgent of the DTXMessage have their own header,
-// and most of the values of these headers are the same, except for `length` and `fragment_index`.
-#define IDEVICE_TRANSMIT_FRAGMENT_IF_BUFFER_FULL()                                                \
-  if (buffer.Size() >= this_fragment_length) {                                                    \
-    header.fragment_index += 1;                                                                   \
-    header.length = this_fragment_length;                                                         \
-    IDEVICE_TRANSMIT_DUMP_HEADER(header);                                                         \
-    bool ret = transmitter(reinterpret_cast<const char*>(&header), sizeof(DTXMessageHeader));     \
-    if (!ret) {                                                                                   \
-      return false;                                                                               \
-    }                                                                                             \
-    IDEVICE_LOG_D("TransmitMessage message payload: ptr=%p, size=%zu\n",                          \
-                  buffer.GetReadOnlyBuffer(0), buffer.Size());                                    \
-    ret = transmitter(reinterpret_cast<const char*>(buffer.GetReadOnlyBuffer(0)), buffer.Size()); \
-    serialized_offset += buffer.Size();                                                           \
-    buffer.Resize(0);                                                                             \
-    this_fragment_length = std::min(fragment_length, serialized_length - serialized_offset);      \
-    if (!ret) {                                                                                   \
-      return false;                                                                               \
-    }                                                                                             \
-  }
-
-bool DTXMessageTransmitter::TransmitMessage(const std::shared_ptr<DTXMessage>& message,
-                                            const DTXMessageRoutingInfo& routing_info,
-                                            Transmitter transmitter) {
-  const size_t serialized_length = message->SerializedLength();
-  const uint32_t number_of_pieces = FragmentsForLength(serialized_length);
-
+// the header of the first fragment, with the length of the whole message. if the message has
+// multiple fragments, the first fragment only contains the header, so it's counted as well.
+static DTXMessageHeader NewMessageHeader(const DTXMessageRoutingInfo& routing_info,
+                                         size_t serialized_length, uint32_t number_of_pieces) {
   DTXMessageHeader header;
   header.magic = kDTXMessageHeaderMagic;
   header.message_header_size = kDTXMessageHeaderSize;
   header.fragment_index = 0;
-  header.fragment_count = number_of_pieces;
+  header.fragment_count = number_of_pieces == 1 ? 1 : number_of_pieces + 1;
   header.length = serialized_length;
   header.identifier = routing_info.msg_identifier;
   header.conversation_index = routing_info.conversation_index;
   header.channel_code = routing_info.channel_code;
   header.expects_reply = routing_info.expects_reply;
+  return header;
+}
+
+bool DTXMessageTransmitter::TransmitMessage(const std::shared_ptr<DTXMessage>& message,
+                                            const DTXMessageRoutingInfo& routing_info,
+                                            Transmitter transmitter) {
+  const size_t serialized_length = message->SerializedLength();
+  DTXMessageHeader header =
+      NewMessageHeader(routing_info, serialized_length, FragmentsForLength(serialized_length));
+  IDEVICE_DUMP_DTXMESSAGE_HEADER(header);
 
-  if (number_of_pieces == 1) {  // single fragment
-    // transmit the DTXMessageHeader, size=0x20
-    IDEVICE_TRANSMIT_DUMP_HEADER(header);
-    transmitter(reinterpret_cast<const char*>(&header), sizeof(DTXMessageHeader));
+  // the fragments are written straight from the buffers of the message, each one is preceded by
+  // its own header, which only differs from the others in `length` and `fragment_index`
+  DTXFragmentWriter<Transmitter> writer(header, suggested_fragment_size_ - kDTXMessageHeaderSize,
+                                        transmitter);
+  if (!message->SerializeTo(writer) || !writer.Finished()) {
+    IDEVICE_LOG_E("Error: can not transmit the message(%d|%d), length=%zu\n",
+                  routing_info.channel_code, routing_info.msg_identifier, serialized_length);
+    return false;
+  }
+  return true;
+}
 
-    // transmit the DTXMessage(payload)
-    message->SerializeTo(transmitter);
-    return true;
-  } else {  // multiple fragments
-    // transmit the first fragment of the message, only contains the DTXMessageHeader, size=0x20
-    IDEVICE_TRANSMIT_DUMP_HEADER(header);
-    transmitter(reinterpret_cast<const char*>(&header), sizeof(DTXMessageHeader));
+bool DTXMessageTransmitter::GatherMessage(const std::shared_ptr<DTXMessage>& message,
+                                          const DTXMessageRoutingInfo& routing_info,
+                                          size_t serialized_length, GatherBuffer* output) {
+  DTXMessageHeader header =
+      NewMessageHeader(routing_info, serialized_length, FragmentsForLength(serialized_length));
+  IDEVICE_DUMP_DTXMESSAGE_HEADER(header);
 
-    const size_t fragment_length = suggested_fragment_size_ - kDTXMessageHeaderSize;
-    ByteBuffer buffer(fragment_length);
-    size_t serialized_offset = 0;
-    size_t this_fragment_length = fragment_length;
-    printf("this_fragment_length: %zu\n", this_fragment_length);
+  // the headers and the small fields are copied, while the auxiliary objects and the payload are
+  // referenced, and sliced if they straddle the boundaries of the fragments
+  DTXFragmentWriter<GatherBuffer> writer(header, suggested_fragment_size_ - kDTXMessageHeaderSize,
+                                         *output);
+  if (!message->SerializeTo(writer) || !writer.Finished()) {
+    IDEVICE_LOG_E("Error: can not serialize the message(%d|%d), length=%zu\n",
+                  routing_info.channel_code, routing_info.msg_identifier, serialized_length);
+    return false;
+  }
+  return true;
+}
 
-    message->SerializeTo([&](const char* bytes, size_t size) -> bool {
-      IDEVICE_TRANSMIT_FRAGMENT_IF_BUFFER_FULL();
-      size_t offset = 0;
-      while (offset < size) {
-        size_t consume_size =
-            std::min({size, this_fragment_length - buffer.Size(), this_fragment_length});
-        printf("offset=%zu, size=%zu, buffer.size=%zu, consume_size: %zu\n", offset, size,
-               buffer.Size(), consume_size);
-        buffer.Append(bytes + offset, consume_size);
-        IDEVICE_TRANSMIT_FRAGMENT_IF_BUFFER_FULL();
-        offset += consume_size;
-      }
-      return true;
-    });
+bool DTXMessageTransmitter::FrameMessage(const std::shared_ptr<DTXMessage>& message,
+                                         const DTXMessageRoutingInfo& routing_info,
+                                         size_t serialized_length, BufferMemory* output) {
+  if (FragmentsForLength(serialized_length) != 1) {
+    return false;
+  }
+
+  DTXMessageHeader header = NewMessageHeader(routing_info, serialized_length, 1);
+  IDEVICE_DUMP_DTXMESSAGE_HEADER(header);
+
+  const size_t frame_length = kDTXMessageHeaderSize + serialized_length;
+  output->SetSize(0);
+  char* frame = output->Allocate(frame_length);
+  if (frame == nullptr) {
+    return false;
+  }
+  BufferWriter buffer_writer(frame, frame_length);
+  DTXFragmentWriter<BufferWriter> writer(header, serialized_length, buffer_writer);
+  if (!message->SerializeTo(writer) || !writer.Finished()) {
+    IDEVICE_LOG_E("Error: can not serialize the message(%d|%d), length=%zu\n",
+                  routing_info.channel_code, routing_info.msg_identifier, serialized_length);
+    output->SetSize(0);
     return false;
   }
+  return true;
 }
 
 uint32_t DTXMessageTransmitter::FragmentsForLength(size_t length) {
-  uint32_t fragments_count = 1;
-  if (suggested_fragment_size_ >= kDTXMessageHeaderSize + 1) {
-    fragments_count = ceil(length / (float)(suggested_fragment_size_ - kDTXMessageHeaderSize));
+  if (suggested_fragment_size_ <= kDTXMessageHeaderSize || length == 0) {
+    return 1;
   }
-  return fragments_count;
+  // in integers, a float loses the precision of the lengths over 16MB
+  size_t fragment_length = suggested_fragment_size_ - kDTXMessageHeaderSize;
+  return static_cast<uint32_t>((length + fragment_length - 1) / fragment_length);
 }
 
-#undef IDEVICE_TRANSMIT_DUMP_HEADER
-#undef IDEVICE_FLUSH_FRAGMENT_BUFFER
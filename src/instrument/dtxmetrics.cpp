@@ -0,0 +1,113 @@
+#include "idevice/instrument/dtxmetrics.h"
+
+#include <cstdlib>  // std::abs
+#include <utility>  // std::move
+
+using namespace idevice;
+
+static size_t ChannelIndex(uint32_t channel_code) {
+  return static_cast<size_t>(std::abs(static_cast<int64_t>(static_cast<int32_t>(channel_code))));
+}
+
+static bool HasTraffic(const DTXMetrics::ChannelCounters& counters) {
+  return counters.messages_in.load(std::memory_order_relaxed) > 0 ||
+         counters.messages_out.load(std::memory_order_relaxed) > 0;
+}
+
+DTXMetrics::DTXMetrics() {
+  for (std::atomic<ChannelCounters*>& chunk : channel_chunks_) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+DTXMetrics::~DTXMetrics() {
+  for (std::atomic<ChannelCounters*>& chunk : channel_chunks_) {
+    delete[] chunk.load(std::memory_order_acquire);
+  }
+}
+
+DTXMetrics::ChannelCounters* DTXMetrics::Channel(uint32_t channel_code) {
+  size_t index = ChannelIndex(channel_code);
+  if (index >= kMaxChannelCount) {
+    return nullptr;
+  }
+  std::atomic<ChannelCounters*>& slot = channel_chunks_[index / kChannelChunkSize];
+  ChannelCounters* chunk = slot.load(std::memory_order_acquire);
+  if (chunk == nullptr) {
+    // the threads racing for a new chunk allocate one each, and all but the winner free theirs
+    ChannelCounters* allocated = new ChannelCounters[kChannelChunkSize];
+    if (slot.compare_exchange_strong(chunk, allocated, std::memory_order_acq_rel)) {
+      chunk = allocated;
+    } else {
+      delete[] allocated;
+    }
+  }
+  return &chunk[index % kChannelChunkSize];
+}
+
+void DTXMetrics::CountMessageIn(uint32_t channel_code, size_t bytes) {
+  messages_in_.fetch_add(1, std::memory_order_relaxed);
+  ChannelCounters* counters = Channel(channel_code);
+  if (counters != nullptr) {
+    counters->messages_in.fetch_add(1, std::memory_order_relaxed);
+    counters->bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+  }
+}
+
+void DTXMetrics::CountMessageOut(uint32_t channel_code, size_t bytes) {
+  messages_out_.fetch_add(1, std::memory_order_relaxed);
+  ChannelCounters* counters = Channel(channel_code);
+  if (counters != nullptr) {
+    counters->messages_out.fetch_add(1, std::memory_order_relaxed);
+    counters->bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+  }
+}
+
+void DTXMetrics::CountDroppedMessage(uint32_t channel_code) {
+  dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+  ChannelCounters* counters = Channel(channel_code);
+  if (counters != nullptr) {
+    counters->dropped_messages.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void DTXMetrics::RecordRoundTrip(uint32_t channel_code, uint64_t latency_us) {
+  round_trip_.Record(latency_us);
+  ChannelCounters* counters = Channel(channel_code);
+  if (counters != nullptr) {
+    counters->round_trip.Record(latency_us);
+  }
+}
+
+void DTXMetrics::Fill(DTXConnectionMetrics* metrics) const {
+  metrics->messages_in = messages_in_.load(std::memory_order_relaxed);
+  metrics->bytes_in = bytes_in.load(std::memory_order_relaxed);
+  metrics->messages_out = messages_out_.load(std::memory_order_relaxed);
+  metrics->bytes_out = bytes_out.load(std::memory_order_relaxed);
+  metrics->fragments_reassembled = fragments_reassembled.load(std::memory_order_relaxed);
+  metrics->parse_errors = parse_errors.load(std::memory_order_relaxed);
+  metrics->dropped_messages = dropped_messages_.load(std::memory_order_relaxed);
+  metrics->round_trip = round_trip_.Snapshot();
+  metrics->channels.clear();
+  for (size_t i = 0; i < kMaxChannelChunkCount; ++i) {
+    const ChannelCounters* chunk = channel_chunks_[i].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+      continue;
+    }
+    for (size_t j = 0; j < kChannelChunkSize; ++j) {
+      const ChannelCounters& counters = chunk[j];
+      if (!HasTraffic(counters)) {
+        continue;
+      }
+      DTXChannelMetrics channel;
+      channel.channel_code = static_cast<uint32_t>(i * kChannelChunkSize + j);
+      channel.messages_in = counters.messages_in.load(std::memory_order_relaxed);
+      channel.bytes_in = counters.bytes_in.load(std::memory_order_relaxed);
+      channel.messages_out = counters.messages_out.load(std::memory_order_relaxed);
+      channel.bytes_out = counters.bytes_out.load(std::memory_order_relaxed);
+      channel.dropped_messages = counters.dropped_messages.load(std::memory_order_relaxed);
+      channel.round_trip = counters.round_trip.Snapshot();
+      metrics->channels.push_back(std::move(channel));
+    }
+  }
+}
@@ -7,16 +7,10 @@
 
 using namespace idevice;
 
-constexpr size_t kDTXPrimitiveArrayDefaultSize = 0x200;
-constexpr size_t kDTXPrimitiveArrayHeaderSize = 0x10;
-constexpr size_t kDTXPrimitiveArrayCapacityAlignment =
-    kDTXPrimitiveArrayDefaultSize + kDTXPrimitiveArrayHeaderSize;  // 0x210
-constexpr size_t kDTXPrimitiveArrayDefaultCapacity =
-    kDTXPrimitiveArrayDefaultSize - kDTXPrimitiveArrayHeaderSize;  // 0x1F0, F0 01 00 00 00 00 00 00
-
 // static
 std::unique_ptr<DTXPrimitiveArray> DTXPrimitiveArray::Deserialize(const char* buffer,
-                                                                  size_t buffer_size) {
+                                                                  size_t buffer_size,
+                                                                  bool should_copy) {
   if (!buffer || buffer_size < kDTXPrimitiveArrayHeaderSize) {
     printf("Error: DTXPrimitiveArray unexpected bytes at %p of length %zu, returning nullptr.\n",
            buffer, buffer_size);
@@ -67,7 +61,11 @@ std::unique_ptr<DTXPrimitiveArray> DTXPrimitiveArray::Deserialize(const char* bu
         offset += sizeof(uint32_t);
         // str
         const char* str = ptr + offset;  // without ending \0
-        array->Append(DTXPrimitiveValue(str, length));
+        if (should_copy) {
+          array->Append(DTXPrimitiveValue(str, length));
+        } else {
+          array->Append(DTXPrimitiveValue::CreateView(DTXPrimitiveValue::kString, str, length));
+        }
         offset += length;
         break;
       }
@@ -76,7 +74,12 @@ std::unique_ptr<DTXPrimitiveArray> DTXPrimitiveArray::Deserialize(const char* bu
         length = *(uint32_t*)(ptr + offset);
         offset += sizeof(uint32_t);
         // buffer
-        array->Append(DTXPrimitiveValue(ptr + offset, static_cast<size_t>(length)));
+        if (should_copy) {
+          array->Append(DTXPrimitiveValue(ptr + offset, static_cast<size_t>(length)));
+        } else {
+          array->Append(DTXPrimitiveValue::CreateView(DTXPrimitiveValue::kBuffer, ptr + offset,
+                                                      static_cast<size_t>(length)));
+        }
         offset += length;
         break;
       }
@@ -145,68 +148,8 @@ size_t DTXPrimitiveArray::SerializedLength() const {
   return 0;
 }
 
-bool DTXPrimitiveArray::SerializeTo(std::function<bool(const char*, size_t)> serializer) {
-  // Serialize DTXPrimitiveArrayHeader
-  size_t size = SerializedLength() - kDTXPrimitiveArrayHeaderSize;
-  uint64_t capacity = IDEVICE_MEM_ALIGN(std::max(kDTXPrimitiveArrayDefaultCapacity, size),
-                                        kDTXPrimitiveArrayCapacityAlignment);
-  serializer(reinterpret_cast<const char*>(&capacity), sizeof(uint64_t));
-  serializer(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-
-  const uint32_t empty_key_type = DTXPrimitiveValue::kEmptyKey;
-  // Serialize items
-  for (auto& item : items_) {
-    uint32_t type = item.GetType();
-    if (type == DTXPrimitiveValue::kNull) {
-      continue;
-    }
-
-    if (as_dict_) {
-      // insert an empty key for DTXPrimitiveDictionary
-      serializer(reinterpret_cast<const char*>(&empty_key_type), sizeof(uint32_t));
-    }
-
-    serializer(reinterpret_cast<const char*>(&type), sizeof(uint32_t));
-    if (item.Size() == 0) {
-      continue;
-    }
-
-    switch (type) {
-      case DTXPrimitiveValue::kString: {
-        // length
-        uint32_t length = item.Size();
-        serializer(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
-        // str
-        const char* ptr = item.ToStr();
-        serializer(ptr, length);
-        break;
-      }
-      case DTXPrimitiveValue::kBuffer: {
-        // length
-        uint32_t length = item.Size();
-        serializer(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
-        // buffer
-        const char* ptr = item.ToBuffer();
-        serializer(ptr, length);
-        break;
-      }
-      case DTXPrimitiveValue::kSignedInt32:
-      case DTXPrimitiveValue::kSignedInt64:
-      case DTXPrimitiveValue::kFloat32:
-      case DTXPrimitiveValue::kFloat64:
-      case DTXPrimitiveValue::kInteger: {
-        serializer(reinterpret_cast<const char*>(item.RawData()), item.Size());
-        break;
-      }
-      case DTXPrimitiveValue::kEmptyKey: {
-        break;  // empty dictionary key, the keys are empty and we ignore them
-      }
-      default:
-        IDEVICE_ASSERT(false, "unknown type %d\n", type);
-        break;
-    }
-  }
-  return true;
+bool DTXPrimitiveArray::SerializeTo(std::function<bool(const char*, size_t)> serializer) const {
+  return SerializeTo<std::function<bool(const char*, size_t)>&>(serializer);
 }
 
 void DTXPrimitiveArray::Dump(bool dumphex) const {
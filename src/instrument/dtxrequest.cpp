@@ -0,0 +1,110 @@
+#include "idevice/instrument/dtxrequest.h"
+
+#include <chrono>
+
+#include "idevice/instrument/dtxmessage.h"
+
+using namespace idevice;
+
+const char* idevice::DTXRequestStatusName(DTXRequestStatus status) {
+  switch (status) {
+    case DTXRequestStatus::kPending:
+      return "Pending";
+    case DTXRequestStatus::kReplied:
+      return "Replied";
+    case DTXRequestStatus::kTimedOut:
+      return "TimedOut";
+    case DTXRequestStatus::kCancelled:
+      return "Cancelled";
+    case DTXRequestStatus::kDisconnected:
+      return "Disconnected";
+  }
+  return "Unknown";
+}
+
+DTXRequestStatus DTXRequest::Status() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+bool DTXRequest::Wait(uint32_t timeout_ms) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto done = [this] { return status_ != DTXRequestStatus::kPending; };
+  if (timeout_ms == static_cast<uint32_t>(-1)) {
+    completed_.wait(lock, done);
+    return true;
+  }
+  return completed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+}
+
+std::shared_ptr<DTXMessage> DTXRequest::Get(uint32_t timeout_ms) const {
+  Wait(timeout_ms);
+  return Reply();
+}
+
+std::shared_ptr<DTXMessage> DTXRequest::Reply() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reply_;
+}
+
+bool DTXRequest::Cancel() {
+  CompletionHandler handler;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_ != DTXRequestStatus::kPending) {
+      return false;
+    }
+    if (canceller_) {
+      canceller_();  // the messenger forgets it, so it's never completed by anyone else
+      canceller_ = nullptr;
+    }
+    status_ = DTXRequestStatus::kCancelled;
+    handler = std::move(completion_handler_);
+  }
+  completed_.notify_all();
+  if (handler) {
+    handler(DTXRequestStatus::kCancelled, nullptr);
+  }
+  return true;
+}
+
+void DTXRequest::OnComplete(CompletionHandler handler) {
+  DTXRequestStatus status;
+  std::shared_ptr<DTXMessage> reply;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_ == DTXRequestStatus::kPending) {
+      completion_handler_ = std::move(handler);
+      return;
+    }
+    status = status_;
+    reply = reply_;
+  }
+  if (handler) {
+    handler(status, std::move(reply));
+  }
+}
+
+bool DTXRequest::Complete(DTXRequestStatus status, std::shared_ptr<DTXMessage> reply) {
+  CompletionHandler handler;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_ != DTXRequestStatus::kPending) {
+      return false;
+    }
+    status_ = status;
+    reply_ = reply;
+    canceller_ = nullptr;
+    handler = std::move(completion_handler_);
+  }
+  completed_.notify_all();
+  if (handler) {
+    handler(status, std::move(reply));
+  }
+  return true;
+}
+
+void DTXRequest::SetCanceller(std::function<void()> canceller) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  canceller_ = std::move(canceller);
+}
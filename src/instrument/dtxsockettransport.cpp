@@ -0,0 +1,169 @@
+#include "idevice/instrument/dtxsockettransport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>  // struct iovec
+#include <unistd.h>
+
+#include <algorithm>  // std::min
+#include <vector>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_LOG_E
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // SO_NOSIGPIPE is set instead
+#endif
+
+using namespace idevice;
+
+static constexpr size_t kMaxSegmentsPerWrite = 64;  // less than IOV_MAX of all platforms
+
+bool SocketDTXTransport::Connect() {
+  int fd = PollableFd();
+  if (fd < 0) {
+    return false;
+  }
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    IDEVICE_LOG_E("Error: can not set the socket %d non-blocking, errno=%d\n", fd, errno);
+    return false;
+  }
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  connected_.store(true, std::memory_order_release);
+  return true;
+}
+
+bool SocketDTXTransport::Disconnect() {
+  connected_.store(false, std::memory_order_release);
+  int fd = fd_.exchange(-1);
+  if (owns_fd_ && fd >= 0) {
+    close(fd);
+  }
+  return true;
+}
+
+bool SocketDTXTransport::WaitForWritable() {
+  int fd = PollableFd();
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  while (IsConnected()) {
+    int ret = poll(&pfd, 1, 1000);
+    if (ret > 0) {
+      return (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) == 0;
+    }
+    if (ret < 0 && errno != EINTR) {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool SocketDTXTransport::Send(const char* data, uint32_t size, uint32_t* sent) {
+  IoVec segment = {data, size};
+  size_t segment_sent = 0;
+  bool ret = SendV(&segment, 1, &segment_sent);
+  *sent = static_cast<uint32_t>(segment_sent);
+  return ret;
+}
+
+bool SocketDTXTransport::SendV(const IoVec* segments, size_t count, size_t* sent) {
+  return SendSegments(segments, count, sent, true);
+}
+
+bool SocketDTXTransport::TrySendV(const IoVec* segments, size_t count, size_t* sent) {
+  return SendSegments(segments, count, sent, false);
+}
+
+bool SocketDTXTransport::SendSegments(const IoVec* segments, size_t count, size_t* sent,
+                                      bool wait) {
+  int fd = PollableFd();
+  *sent = 0;
+  std::vector<struct iovec> iovecs;
+  size_t index = 0;   // the first segment not fully written
+  size_t offset = 0;  // bytes of it already written
+  while (index < count) {
+    if (!IsConnected()) {
+      return false;
+    }
+    iovecs.clear();
+    size_t end = std::min(count, index + kMaxSegmentsPerWrite);
+    for (size_t i = index; i < end; ++i) {
+      size_t skip = i == index ? offset : 0;
+      iovecs.push_back({const_cast<char*>(segments[i].data) + skip, segments[i].size - skip});
+    }
+    struct msghdr message = {};
+    message.msg_iov = iovecs.data();
+    message.msg_iovlen = iovecs.size();
+    ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (!wait) {
+          return true;  // the caller resumes the rest once the socket is writable
+        }
+        if (WaitForWritable()) {
+          continue;
+        }
+      }
+      IDEVICE_LOG_E("Error: can not write to the socket %d, errno=%d\n", fd, errno);
+      return false;
+    }
+    *sent += written;
+    // skip the segments written out
+    size_t remaining = static_cast<size_t>(written);
+    while (index < count && remaining >= segments[index].size - offset) {
+      remaining -= segments[index].size - offset;
+      offset = 0;
+      index++;
+    }
+    offset += remaining;
+  }
+  return true;
+}
+
+bool SocketDTXTransport::Receive(char* buffer, uint32_t size, uint32_t* received) {
+  int fd = PollableFd();
+  *received = 0;
+  while (true) {
+    ssize_t ret = recv(fd, buffer, size, 0);
+    if (ret > 0) {
+      *received = static_cast<uint32_t>(ret);
+      return true;
+    }
+    if (ret == 0) {
+      IDEVICE_LOG_I("the socket %d is closed by the peer\n", fd);
+      connected_.store(false, std::memory_order_release);
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;  // no data for now
+    }
+    IDEVICE_LOG_E("Error: can not read from the socket %d, errno=%d\n", fd, errno);
+    connected_.store(false, std::memory_order_release);
+    return false;
+  }
+}
+
+bool SocketDTXTransport::ReceiveWithTimeout(char* buffer, uint32_t size, uint32_t timeout,
+                                            uint32_t* received) {
+  int fd = PollableFd();
+  *received = 0;
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int ret = poll(&pfd, 1, static_cast<int>(timeout));
+  if (ret == 0 || (ret < 0 && errno == EINTR)) {
+    return true;  // timed out
+  }
+  if (ret < 0) {
+    return false;
+  }
+  return Receive(buffer, size, received);
+}
@@ -6,7 +6,7 @@ using namespace idevice;
 
 bool DTXTransport::Connect() {
   InstrumentService::Result result = instrument_service_->Connect(device_);
-  printf("Connect result: %d\n", result);
+  IDEVICE_LOG_D("Connect result: %d\n", result);
   return result == InstrumentService::ResultCode::kOk;
 }
 
@@ -21,10 +21,10 @@ bool DTXTransport::IsConnected() const { return instrument_service_->IsConnected
 
 bool DTXTransport::Send(const char* data, uint32_t size, uint32_t* sent) {
   InstrumentService::Result result = instrument_service_->Send(data, size, sent);
-#if IDEVICE_DEBUG
   IDEVICE_LOG_D("Send, data=%p, size=%d, send=%d, ret=%d\n", data, size, *sent, result);
-  hexdump((void*)(data), size, 0);
-#endif
+  if (IDEVICE_LOG_ENABLED(kLogLevelVerbose)) {
+    hexdump((void*)(data), size, 0);
+  }
   return result == InstrumentService::ResultCode::kOk;
 }
 
@@ -0,0 +1,63 @@
+#include "idevice/utils/bufferpool.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace idevice;
+
+TEST(BufferPoolTest, Recycle) {
+  std::shared_ptr<BufferPool> pool = BufferPool::Create(1024, 2);
+  ASSERT_EQ(0, pool->IdleCount());
+
+  SharedBufferMemory buffer = pool->Acquire();
+  ASSERT_NE(nullptr, buffer);
+  ASSERT_GE(buffer->Capacity(), 1024);
+  ASSERT_EQ(0, buffer->Size());
+  BufferMemory* raw_buffer = buffer.get();
+  buffer->SetSize(100);
+
+  // the buffer goes back to the pool and is reused
+  buffer = nullptr;
+  ASSERT_EQ(1, pool->IdleCount());
+  buffer = pool->Acquire();
+  ASSERT_EQ(raw_buffer, buffer.get());
+  ASSERT_EQ(0, buffer->Size());
+  ASSERT_EQ(0, pool->IdleCount());
+  ASSERT_EQ(1, pool->AllocatedCount());
+
+  // no more than `max_pooled_count` idle buffers are kept
+  SharedBufferMemory buffer2 = pool->Acquire();
+  SharedBufferMemory buffer3 = pool->Acquire();
+  ASSERT_EQ(3, pool->AllocatedCount());
+  buffer = nullptr;
+  buffer2 = nullptr;
+  buffer3 = nullptr;
+  ASSERT_EQ(2, pool->IdleCount());
+}
+
+TEST(BufferPoolTest, BufferOutlivesPool) {
+  std::shared_ptr<BufferPool> pool = BufferPool::Create(1024, 2);
+  SharedBufferMemory buffer = pool->Acquire();
+  ASSERT_NE(nullptr, buffer);
+  pool = nullptr;
+
+  memset(buffer->GetPtr(0), 0, 1024);
+  buffer = nullptr;  // freed without the pool
+}
+
+TEST(BufferPoolTest, ReleasedByAnotherThread) {
+  std::shared_ptr<BufferPool> pool = BufferPool::Create(1024, 4);
+  for (int round = 0; round < 100; ++round) {
+    std::vector<SharedBufferMemory> buffers;
+    for (int i = 0; i < 4; ++i) {
+      buffers.push_back(pool->Acquire());
+      ASSERT_NE(nullptr, buffers.back());
+    }
+    std::thread releaser([&buffers]() { buffers.clear(); });
+    releaser.join();
+    ASSERT_EQ(4, pool->IdleCount());
+  }
+  ASSERT_EQ(4, pool->AllocatedCount());
+}
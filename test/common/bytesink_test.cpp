@@ -0,0 +1,28 @@
+#include "idevice/utils/bytesink.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace idevice;
+
+TEST(ByteSinkTest, BufferWriter) {
+  char buffer[8];
+  BufferWriter writer(buffer, sizeof(buffer));
+  ASSERT_TRUE(writer("abc", 3));
+  ASSERT_TRUE(writer("defgh", 5));
+  ASSERT_EQ(8, writer.Size());
+  ASSERT_EQ("abcdefgh", std::string(buffer, sizeof(buffer)));
+
+  // the buffer is full
+  ASSERT_FALSE(writer("i", 1));
+  ASSERT_EQ(8, writer.Size());
+}
+
+TEST(ByteSinkTest, SizeCounter) {
+  SizeCounter counter;
+  ASSERT_TRUE(counter("abc", 3));
+  ASSERT_TRUE(counter(nullptr, 0));
+  ASSERT_TRUE(counter("defgh", 5));
+  ASSERT_EQ(8, counter.Size());
+}
@@ -0,0 +1,76 @@
+#include "idevice/utils/bytewatermark.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <utility>  // std::pair
+#include <vector>
+
+using namespace idevice;
+
+TEST(ByteWatermarkTest, PauseAndResume) {
+  ByteWatermark watermark(100, 40);
+  std::vector<std::pair<bool, size_t>> crossings;
+  watermark.SetListener([&crossings](bool above_high_watermark, size_t bytes) {
+    crossings.emplace_back(above_high_watermark, bytes);
+  });
+
+  watermark.Add(60);
+  ASSERT_FALSE(watermark.Paused());
+  watermark.Add(60);
+  ASSERT_TRUE(watermark.Paused());
+  watermark.Add(10);  // already paused, not notified again
+  ASSERT_EQ(130, watermark.Bytes());
+  ASSERT_EQ(1, crossings.size());
+  ASSERT_TRUE(crossings[0].first);
+  ASSERT_EQ(120, crossings[0].second);
+
+  watermark.Release(50);  // below the high watermark, but still above the low one
+  ASSERT_TRUE(watermark.Paused());
+  watermark.Release(40);
+  ASSERT_FALSE(watermark.Paused());
+  ASSERT_EQ(2, crossings.size());
+  ASSERT_FALSE(crossings[1].first);
+  ASSERT_EQ(40, crossings[1].second);
+
+  watermark.Release(1000);  // never below 0
+  ASSERT_EQ(0, watermark.Bytes());
+  ASSERT_EQ(130, watermark.MaxBytes());
+  ASSERT_EQ(1, watermark.PauseCount());
+}
+
+TEST(ByteWatermarkTest, Disabled) {
+  ByteWatermark watermark(0, 0);
+  watermark.Add(1024 * 1024);
+  ASSERT_FALSE(watermark.Paused());
+  ASSERT_EQ(0, watermark.PauseCount());
+}
+
+TEST(ByteWatermarkTest, WaitUntilResumed) {
+  ByteWatermark watermark(10, 0);
+  ASSERT_TRUE(watermark.WaitUntilResumed(0));
+  watermark.Add(10);
+  ASSERT_FALSE(watermark.WaitUntilResumed(10));
+
+  std::thread consumer([&watermark]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    watermark.Release(10);
+  });
+  ASSERT_TRUE(watermark.WaitUntilResumed(10 * 1000));
+  consumer.join();
+}
+
+TEST(ByteWatermarkTest, ListenerCallsBack) {
+  ByteWatermark watermark(100, 40);
+  std::vector<std::pair<bool, size_t>> crossings;
+  watermark.SetListener([&](bool above_high_watermark, size_t /*bytes*/) {
+    // not invoked with the lock held
+    crossings.emplace_back(above_high_watermark, watermark.Bytes());
+    ASSERT_EQ(above_high_watermark, watermark.Paused());
+  });
+  watermark.Add(100);
+  watermark.Release(60);
+  ASSERT_EQ(2, crossings.size());
+  ASSERT_EQ(std::make_pair(true, static_cast<size_t>(100)), crossings[0]);
+  ASSERT_EQ(std::make_pair(false, static_cast<size_t>(40)), crossings[1]);
+}
@@ -0,0 +1,103 @@
+#include "idevice/utils/executor.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace idevice;
+
+TEST(ExecutorTest, Inline) {
+  InlineExecutor executor;
+  std::thread::id thread_id;
+  executor.Execute(1, [&thread_id]() { thread_id = std::this_thread::get_id(); });
+  ASSERT_EQ(std::this_thread::get_id(), thread_id);
+
+  ExecutorStat stat = executor.Stat();
+  ASSERT_EQ(0, stat.pending);
+  ASSERT_EQ(1, stat.executed);
+}
+
+TEST(ExecutorTest, ThreadPool) {
+  constexpr int count = 1000;
+  std::atomic<int> executed(0);
+  {
+    ThreadPoolExecutor executor(4);
+    for (int i = 0; i < count; ++i) {
+      executor.Execute(i, [&executed]() { executed++; });
+    }
+  }  // the queued tasks are run before the destruction
+  ASSERT_EQ(count, executed.load());
+}
+
+TEST(ExecutorTest, SerialKeepsOrderOfKey) {
+  constexpr int key_count = 8;
+  constexpr int count = 1000;
+  std::vector<std::vector<int>> results(key_count);
+  {
+    SerialExecutor executor(3);
+    for (int i = 0; i < count; ++i) {
+      for (int key = 0; key < key_count; ++key) {
+        // tasks of one key never run concurrently, so no lock is needed here
+        executor.Execute(key, [&results, key, i]() { results[key].push_back(i); });
+      }
+    }
+    while (executor.Stat().executed < key_count * count) {
+      std::this_thread::yield();
+    }
+    ExecutorStat stat = executor.Stat();
+    ASSERT_EQ(0, stat.pending);
+    ASSERT_GE(stat.max_pending, 1);
+  }
+  for (int key = 0; key < key_count; ++key) {
+    ASSERT_EQ(count, results[key].size());
+    for (int i = 0; i < count; ++i) {
+      ASSERT_EQ(i, results[key][i]);
+    }
+  }
+}
+
+TEST(ExecutorTest, SlowKeyDoesNotBlockOthers) {
+  SerialExecutor executor(2);
+  std::mutex mutex;
+  std::unique_lock<std::mutex> blocker(mutex);
+  executor.Execute(0, [&mutex]() { std::lock_guard<std::mutex> lock(mutex); });  // stuck
+  executor.Execute(0, []() {});
+
+  std::atomic<bool> other_done(false);
+  executor.Execute(1, [&other_done]() { other_done = true; });
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!other_done && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  ASSERT_TRUE(other_done);
+  ASSERT_GE(executor.Stat().pending, 1);  // the second task of key 0 is still waiting
+  blocker.unlock();
+}
+
+TEST(ExecutorTest, SerialExecuteAfterAll) {
+  SerialExecutor executor(4);
+  std::mutex mutex;
+  std::unique_lock<std::mutex> blocker(mutex);
+  std::atomic<int> done(0);
+  for (uint64_t key = 0; key < 8; ++key) {
+    executor.Execute(key, [&mutex, &done]() {
+      std::lock_guard<std::mutex> lock(mutex);  // stuck until unlocked below
+      done++;
+    });
+  }
+  std::atomic<int> done_before(-1);
+  executor.ExecuteAfterAll([&done, &done_before]() { done_before = done.load(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(-1, done_before.load());
+
+  blocker.unlock();
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (done_before.load() < 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(8, done_before.load());  // after the tasks of all keys
+}
@@ -0,0 +1,66 @@
+#include "idevice/utils/gatherbuffer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace idevice;
+
+static std::string concat_segments(GatherBuffer& buffer) {
+  std::string data;
+  for (const IoVec& segment : buffer.Segments()) {
+    data.append(segment.data, segment.size);
+  }
+  return data;
+}
+
+TEST(GatherBufferTest, CopyAndReference) {
+  GatherBuffer buffer(16);
+  const std::string large(64, 'x');
+  uint32_t field1 = 0x11111111;
+  uint64_t field2 = 0x2222222222222222;
+
+  // the adjacent small pieces are merged into one segment
+  buffer.Append(reinterpret_cast<const char*>(&field1), sizeof(field1));
+  buffer.Append(reinterpret_cast<const char*>(&field2), sizeof(field2));
+  ASSERT_EQ(1, buffer.SegmentCount());
+
+  // the large piece is referenced
+  buffer.Append(large.data(), large.size());
+  ASSERT_EQ(2, buffer.SegmentCount());
+  ASSERT_EQ(large.data(), buffer.Segments().at(1).data);
+
+  buffer.Append(reinterpret_cast<const char*>(&field1), sizeof(field1));
+  ASSERT_EQ(3, buffer.SegmentCount());
+  ASSERT_EQ(sizeof(field1) * 2 + sizeof(field2) + large.size(), buffer.Size());
+
+  std::string expected;
+  expected.append(reinterpret_cast<const char*>(&field1), sizeof(field1));
+  expected.append(reinterpret_cast<const char*>(&field2), sizeof(field2));
+  expected.append(large);
+  expected.append(reinterpret_cast<const char*>(&field1), sizeof(field1));
+  ASSERT_EQ(expected, concat_segments(buffer));
+
+  buffer.Clear();
+  ASSERT_EQ(0, buffer.Size());
+  ASSERT_EQ(0, buffer.SegmentCount());
+  ASSERT_TRUE(buffer.Segments().empty());
+}
+
+TEST(GatherBufferTest, ScratchGrows) {
+  // the copied pieces are still valid after the scratch buffer grows
+  GatherBuffer buffer(1024);
+  const std::string large(4096, 'y');
+  std::string expected;
+  for (int i = 0; i < 1000; ++i) {
+    std::string piece = std::to_string(i);
+    buffer.Copy(piece.data(), piece.size());
+    expected += piece;
+    if (i % 100 == 0) {
+      buffer.Append(large.data(), large.size());
+      expected += large;
+    }
+  }
+  ASSERT_EQ(expected.size(), buffer.Size());
+  ASSERT_EQ(expected, concat_segments(buffer));
+}
@@ -0,0 +1,62 @@
+#include "idevice/utils/latencyhistogram.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace idevice;
+
+TEST(LatencyHistogramTest, Buckets) {
+  ASSERT_EQ(0, LatencyHistogram::BucketIndex(0));
+  ASSERT_EQ(1, LatencyHistogram::BucketIndex(1));
+  ASSERT_EQ(2, LatencyHistogram::BucketIndex(2));
+  ASSERT_EQ(2, LatencyHistogram::BucketIndex(3));
+  ASSERT_EQ(11, LatencyHistogram::BucketIndex(1024));
+  ASSERT_EQ(LatencyHistogram::kBucketCount - 1, LatencyHistogram::BucketIndex(-1));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  LatencyHistogramSnapshot empty = histogram.Snapshot();
+  ASSERT_EQ(0, empty.count);
+  ASSERT_EQ(0, empty.PercentileUs(99));
+
+  for (int i = 0; i < 99; ++i) {
+    histogram.Record(100);  // bucket [64, 128)
+  }
+  histogram.Record(5000);
+  LatencyHistogramSnapshot snapshot = histogram.Snapshot();
+  ASSERT_EQ(100, snapshot.count);
+  ASSERT_EQ(99 * 100 + 5000, snapshot.sum_us);
+  ASSERT_EQ(5000, snapshot.max_us);
+  ASSERT_EQ(149, snapshot.MeanUs());
+  ASSERT_EQ(127, snapshot.PercentileUs(50));
+  ASSERT_EQ(127, snapshot.PercentileUs(99));
+  ASSERT_EQ(5000, snapshot.PercentileUs(100));  // capped to the max
+}
+
+TEST(LatencyHistogramTest, ConcurrentRecord) {
+  constexpr int thread_count = 4;
+  constexpr int sample_count = 10000;
+  LatencyHistogram histogram;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&histogram, t]() {
+      for (int i = 0; i < sample_count; ++i) {
+        histogram.Record(t * sample_count + i);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  LatencyHistogramSnapshot snapshot = histogram.Snapshot();
+  ASSERT_EQ(thread_count * sample_count, snapshot.count);
+  ASSERT_EQ(thread_count * sample_count - 1, snapshot.max_us);
+  uint64_t total = 0;
+  for (uint64_t bucket : snapshot.buckets) {
+    total += bucket;
+  }
+  ASSERT_EQ(snapshot.count, total);
+}
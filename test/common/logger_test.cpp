@@ -0,0 +1,129 @@
+#include "idevice/common/logger.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "idevice/common/macro_def.h"  // IDEVICE_LOG_*
+
+using namespace idevice;
+
+// captures the logs containing a marker, the other tests may be logging at the same time
+class CapturingWriter {
+ public:
+  explicit CapturingWriter(const std::string& marker) : marker_(marker) {
+    Logger::SetWriter([this](int /*level*/, const char* line, size_t size) {
+      std::string text(line, size);
+      if (text.find(marker_) != std::string::npos) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        lines_.push_back(text);
+      }
+    });
+  }
+
+  ~CapturingWriter() { Logger::SetWriter(nullptr); }
+
+  std::vector<std::string> Lines() {
+    Logger::Flush();
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lines_;
+  }
+
+ private:
+  std::string marker_;
+  std::mutex mutex_;
+  std::vector<std::string> lines_;
+};
+
+static int CountEvaluation(std::atomic<int>* count) {
+  return ++(*count);
+}
+
+TEST(LoggerTest, RuntimeLevel) {
+  int level = Logger::Level();
+  CapturingWriter writer("runtime-level");
+  Logger::SetLevel(kLogLevelInfo);
+  ASSERT_TRUE(Logger::IsEnabled(kLogLevelError));
+  ASSERT_TRUE(Logger::IsEnabled(kLogLevelInfo));
+  ASSERT_FALSE(Logger::IsEnabled(kLogLevelDebug));
+
+  // the arguments of the disabled logs are not evaluated
+  std::atomic<int> evaluation_count(0);
+  IDEVICE_LOG_D("runtime-level %d\n", CountEvaluation(&evaluation_count));
+  IDEVICE_LOG_V("runtime-level %d\n", CountEvaluation(&evaluation_count));
+  ASSERT_EQ(0, evaluation_count);
+  IDEVICE_LOG_I("runtime-level %d\n", CountEvaluation(&evaluation_count));
+  IDEVICE_LOG_E("runtime-level %d\n", CountEvaluation(&evaluation_count));
+  ASSERT_EQ(2, evaluation_count);
+
+  std::vector<std::string> lines = writer.Lines();
+  ASSERT_EQ(2, lines.size());
+  ASSERT_EQ(0, lines[0].find("[INFO] "));
+  ASSERT_NE(std::string::npos, lines[0].find("logger_test.cpp"));
+  ASSERT_NE(std::string::npos, lines[0].find("runtime-level 1\n"));
+  ASSERT_EQ(0, lines[1].find("[ERROR] "));
+  Logger::SetLevel(level);
+}
+
+TEST(LoggerTest, ConcurrentWrites) {
+  constexpr int thread_count = 4;
+  constexpr int log_count = 200;  // less than the capacity of the ring, if the writer is slow
+  int level = Logger::Level();
+  CapturingWriter writer("concurrent-writes");
+  Logger::SetLevel(kLogLevelInfo);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < log_count; ++i) {
+        IDEVICE_LOG_I("concurrent-writes %d %d\n", t, i);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(thread_count * log_count, writer.Lines().size());
+
+  // a long message is truncated, and still ends with a new line
+  std::string long_message(Logger::kMaxMessageSize * 2, 'x');
+  IDEVICE_LOG_I("concurrent-writes %s\n", long_message.c_str());
+  std::vector<std::string> lines = writer.Lines();
+  ASSERT_EQ(thread_count * log_count + 1, lines.size());
+  ASSERT_GT(lines.back().size(), Logger::kMaxMessageSize - 1);
+  ASSERT_EQ('\n', lines.back().back());
+  Logger::SetLevel(level);
+}
+
+TEST(LoggerTest, DropWhenFull) {
+  int level = Logger::Level();
+  Logger::SetLevel(kLogLevelInfo);
+  // the writer is blocked, so the ring fills up and the callers are not blocked
+  std::mutex mutex;
+  std::condition_variable released_condition;
+  bool released = false;
+  std::atomic<int> written_count(0);
+  Logger::SetWriter([&](int /*level*/, const char* /*line*/, size_t /*size*/) {
+    std::unique_lock<std::mutex> lock(mutex);
+    released_condition.wait(lock, [&]() { return released; });
+    written_count++;
+  });
+  uint64_t dropped_count = Logger::DroppedCount();
+  for (size_t i = 0; i < Logger::kRingCapacity * 2; ++i) {
+    IDEVICE_LOG_I("drop-when-full %zu\n", i);
+  }
+  ASSERT_LE(Logger::kRingCapacity - 1, Logger::DroppedCount() - dropped_count);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    released = true;
+  }
+  released_condition.notify_all();
+  Logger::Flush();
+  ASSERT_LE(Logger::kRingCapacity - 1, written_count);
+  Logger::SetWriter(nullptr);
+  Logger::SetLevel(level);
+}
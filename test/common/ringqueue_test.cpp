@@ -0,0 +1,204 @@
+#include "idevice/utils/ringqueue.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>  // std::unique_ptr
+#include <thread>
+#include <vector>
+
+using namespace idevice;
+
+TEST(RingQueueTest, SpscPushAndPop) {
+  SpscRingQueue<std::unique_ptr<int>> queue(3);
+  ASSERT_EQ(4, queue.Capacity());  // rounded up to a power of 2
+  ASSERT_TRUE(queue.Empty());
+
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(queue.TryPush(std::make_unique<int>(i)));
+  }
+  // full, and the element is not moved
+  std::unique_ptr<int> extra = std::make_unique<int>(4);
+  ASSERT_FALSE(queue.TryPush(std::move(extra)));
+  ASSERT_NE(nullptr, extra);
+  ASSERT_FALSE(queue.Push(std::move(extra), 10));
+  ASSERT_NE(nullptr, extra);
+  ASSERT_EQ(4, queue.Size());
+
+  std::unique_ptr<int> value;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(queue.TryPop(&value));
+    ASSERT_EQ(i, *value);
+  }
+  ASSERT_FALSE(queue.TryPop(&value));
+  ASSERT_FALSE(queue.Pop(&value, 10));  // timeout
+
+  ASSERT_TRUE(queue.TryPush(std::move(extra)));
+  int destructed = 0;
+  queue.Clear([&](std::unique_ptr<int>& item) { destructed += *item; });
+  ASSERT_EQ(4, destructed);
+  ASSERT_TRUE(queue.Empty());
+}
+
+TEST(RingQueueTest, SpscThreads) {
+  constexpr int count = 100000;
+  SpscRingQueue<int> queue(64);
+  std::thread producer([&]() {
+    for (int i = 0; i < count; ++i) {
+      ASSERT_TRUE(queue.Push(std::move(i), 10 * 1000));
+    }
+  });
+  for (int i = 0; i < count; ++i) {
+    int value = -1;
+    ASSERT_TRUE(queue.Pop(&value, 10 * 1000));
+    ASSERT_EQ(i, value);
+  }
+  producer.join();
+  ASSERT_TRUE(queue.Empty());
+}
+
+TEST(RingQueueTest, MpscThreads) {
+  constexpr int producer_count = 4;
+  constexpr int count = 50000;
+  MpscRingQueue<int> queue(64);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < producer_count; ++p) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < count; ++i) {
+        int value = p * count + i;
+        ASSERT_TRUE(queue.Push(std::move(value), 10 * 1000));
+      }
+    });
+  }
+
+  // each element is popped exactly once, and the elements of a producer are in order
+  std::vector<int> next(producer_count, 0);
+  for (int i = 0; i < producer_count * count; ++i) {
+    int value = -1;
+    ASSERT_TRUE(queue.Pop(&value, 10 * 1000));
+    int p = value / count;
+    ASSERT_EQ(next[p], value % count);
+    next[p]++;
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  ASSERT_TRUE(queue.Empty());
+  int value = -1;
+  ASSERT_FALSE(queue.TryPop(&value));
+}
+
+TEST(RingQueueTest, MpscPushAll) {
+  MpscRingQueue<std::unique_ptr<int>> queue(8);
+  std::vector<std::unique_ptr<int>> values;
+  for (int i = 0; i < 6; ++i) {
+    values.push_back(std::make_unique<int>(i));
+  }
+  ASSERT_TRUE(queue.TryPushAll(values.data(), 6));
+  ASSERT_EQ(6, queue.Size());
+
+  // all or nothing, and the elements are not moved if it fails
+  std::vector<std::unique_ptr<int>> more;
+  for (int i = 6; i < 9; ++i) {
+    more.push_back(std::make_unique<int>(i));
+  }
+  ASSERT_FALSE(queue.TryPushAll(more.data(), 3));
+  ASSERT_FALSE(queue.PushAll(more.data(), 3, 10));
+  ASSERT_NE(nullptr, more[0]);
+  ASSERT_EQ(6, queue.Size());
+  std::unique_ptr<int> value;
+  ASSERT_TRUE(queue.TryPop(&value));
+  ASSERT_EQ(0, *value);
+  ASSERT_TRUE(queue.TryPushAll(more.data(), 3));
+  for (int i = 1; i < 9; ++i) {
+    ASSERT_TRUE(queue.TryPop(&value));
+    ASSERT_EQ(i, *value);
+  }
+  ASSERT_FALSE(queue.TryPop(&value));
+
+  // more than the capacity never fits
+  std::vector<std::unique_ptr<int>> too_many(9);
+  ASSERT_FALSE(queue.PushAll(too_many.data(), too_many.size(), 10));
+}
+
+TEST(RingQueueTest, MpscPushAllThreads) {
+  constexpr int producer_count = 4;
+  constexpr int batch_count = 10000;
+  constexpr int batch_size = 5;
+  MpscRingQueue<int> queue(16);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < producer_count; ++p) {
+    producers.emplace_back([&, p]() {
+      for (int b = 0; b < batch_count; ++b) {
+        int batch[batch_size];
+        for (int i = 0; i < batch_size; ++i) {
+          batch[i] = (p * batch_count + b) * batch_size + i;
+        }
+        ASSERT_TRUE(queue.PushAll(batch, batch_size, 10 * 1000));
+      }
+    });
+  }
+
+  // the consumer never sees a part of a batch, the rest of it is there at once
+  for (int b = 0; b < producer_count * batch_count; ++b) {
+    int first = -1;
+    ASSERT_TRUE(queue.Pop(&first, 10 * 1000));
+    ASSERT_EQ(0, first % batch_size);
+    for (int i = 1; i < batch_size; ++i) {
+      int value = -1;
+      ASSERT_TRUE(queue.TryPop(&value));
+      ASSERT_EQ(first + i, value);
+    }
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  ASSERT_TRUE(queue.Empty());
+}
+
+TEST(RingQueueTest, BothSidesWaiting) {
+  // with the smallest queues both sides keep parking
+  constexpr int count = 20000;
+  SpscRingQueue<int> spsc_queue(1);
+  MpscRingQueue<int> mpsc_queue(1);
+  std::thread producer([&]() {
+    for (int i = 0; i < count; ++i) {
+      int value = i;
+      ASSERT_TRUE(spsc_queue.Push(std::move(value), 10 * 1000));
+      value = i;
+      ASSERT_TRUE(mpsc_queue.Push(std::move(value), 10 * 1000));
+      if (i % 1000 == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  });
+  for (int i = 0; i < count; ++i) {
+    int value = -1;
+    ASSERT_TRUE(spsc_queue.Pop(&value, 10 * 1000));
+    ASSERT_EQ(i, value);
+    ASSERT_TRUE(mpsc_queue.Pop(&value, 10 * 1000));
+    ASSERT_EQ(i, value);
+    if (i % 1000 == 500) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  producer.join();
+}
+
+TEST(RingQueueTest, WaiterOperationOutsideTheLock) {
+  // the operation of a queue notifies the waiter of the other side, here it notifies the waiter
+  // itself, which would deadlock if the operation was performed while holding the mutex
+  RingQueueWaiter waiter;
+  int attempt_count = 0;
+  bool ready = false;
+  ASSERT_TRUE(waiter.Wait(
+      [&]() {
+        waiter.Notify();
+        if (ready) {
+          attempt_count++;
+        }
+        return ready;
+      },
+      [&]() { return ready = true; }, 10 * 1000));
+  ASSERT_EQ(1, attempt_count);  // succeeded right after parking
+}
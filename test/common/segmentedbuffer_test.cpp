@@ -0,0 +1,119 @@
+#include "idevice/utils/segmentedbuffer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace idevice;
+
+static constexpr size_t kSegmentSize = 128;  // the capacity of BufferMemory is aligned to 128
+
+static std::string make_test_data(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>('0' + i % 10);
+  }
+  return data;
+}
+
+TEST(SegmentedBufferTest, AppendAndConsume) {
+  SegmentedBuffer buffer(kSegmentSize);
+  ASSERT_EQ(0, buffer.Size());
+  ASSERT_EQ(nullptr, buffer.Contiguous(1));
+
+  const std::string data = make_test_data(kSegmentSize + 100);
+  ASSERT_TRUE(buffer.Append(data.data(), 100));
+  ASSERT_EQ(100, buffer.Size());
+  ASSERT_EQ(1, buffer.SegmentCount());
+
+  // contiguous in the first segment
+  const char* ptr = buffer.Contiguous(100);
+  ASSERT_NE(nullptr, ptr);
+  ASSERT_EQ(0, memcmp(data.data(), ptr, 100));
+
+  // straddles the boundary of the segments
+  ASSERT_TRUE(buffer.Append(data.data() + 100, data.size() - 100));
+  ASSERT_EQ(data.size(), buffer.Size());
+  ASSERT_EQ(2, buffer.SegmentCount());
+  ASSERT_EQ(nullptr, buffer.Contiguous(kSegmentSize + 1));
+
+  std::string copied(data.size(), '\0');
+  ASSERT_TRUE(buffer.CopyTo(&copied[0], data.size()));
+  ASSERT_EQ(data, copied);
+  ASSERT_FALSE(buffer.CopyTo(&copied[0], data.size() + 1));
+
+  buffer.Consume(kSegmentSize);
+  ASSERT_EQ(100, buffer.Size());
+  ASSERT_EQ(1, buffer.SegmentCount());
+  ptr = buffer.Contiguous(100);
+  ASSERT_NE(nullptr, ptr);
+  ASSERT_EQ(0, memcmp(data.data() + kSegmentSize, ptr, 100));
+
+  buffer.Consume(100);
+  ASSERT_EQ(0, buffer.Size());
+}
+
+TEST(SegmentedBufferTest, SegmentOutlivesConsume) {
+  SegmentedBuffer buffer(kSegmentSize);
+  const std::string data = make_test_data(kSegmentSize);
+  ASSERT_TRUE(buffer.Append(data.data(), data.size()));
+
+  SharedBufferMemory segment = nullptr;
+  const char* ptr = buffer.Contiguous(8, &segment);
+  ASSERT_NE(nullptr, ptr);
+  ASSERT_NE(nullptr, segment);
+
+  // the bytes are still valid after they have been consumed and more data has been appended,
+  // since we hold a reference to the segment
+  buffer.Consume(data.size());
+  ASSERT_TRUE(buffer.Append(data.data(), data.size()));
+  ASSERT_TRUE(buffer.Append(data.data(), data.size()));
+  ASSERT_EQ(0, memcmp(data.data(), ptr, 8));
+  ASSERT_EQ(data.size() * 2, buffer.Size());
+}
+
+TEST(SegmentedBufferTest, AppendSegment) {
+  SegmentedBuffer buffer(kSegmentSize);
+  const std::string data = make_test_data(kSegmentSize * 2);
+
+  SharedBufferMemory segment = std::make_shared<BufferMemory>(data.size());
+  memcpy(segment->Allocate(data.size()), data.data(), data.size());
+  BufferMemory* raw_segment = segment.get();
+  buffer.Append(std::move(segment));
+  ASSERT_EQ(data.size(), buffer.Size());
+  ASSERT_EQ(1, buffer.SegmentCount());
+
+  // the segment is adopted without copying
+  SharedBufferMemory adopted = nullptr;
+  const char* ptr = buffer.Contiguous(data.size(), &adopted);
+  ASSERT_EQ(raw_segment, adopted.get());
+  ASSERT_EQ(raw_segment->GetPtr(0), ptr);
+
+  // the bytes appended afterwards go to a new segment
+  ASSERT_TRUE(buffer.Append(data.data(), 10));
+  ASSERT_EQ(2, buffer.SegmentCount());
+  std::string copied(data.size() + 10, '\0');
+  ASSERT_TRUE(buffer.CopyTo(&copied[0], copied.size()));
+  ASSERT_EQ(data + data.substr(0, 10), copied);
+}
+
+TEST(SegmentedBufferTest, Reserve) {
+  SegmentedBuffer buffer(kSegmentSize);
+  const std::string data = make_test_data(kSegmentSize * 2);
+  ASSERT_TRUE(buffer.Append(data.data(), 100));
+  buffer.Consume(90);
+
+  // fits in the tail, nothing moves
+  ASSERT_TRUE(buffer.Reserve(kSegmentSize - 90));
+  ASSERT_EQ(1, buffer.SegmentCount());
+
+  // doesn't fit, the 10 readable bytes are moved to a new segment, which holds all of them
+  ASSERT_TRUE(buffer.Reserve(kSegmentSize + 10));
+  ASSERT_EQ(1, buffer.SegmentCount());
+  ASSERT_EQ(10, buffer.Size());
+  ASSERT_TRUE(buffer.Append(data.data() + 100, kSegmentSize));
+  ASSERT_EQ(1, buffer.SegmentCount());
+  const char* ptr = buffer.Contiguous(kSegmentSize + 10);
+  ASSERT_NE(nullptr, ptr);
+  ASSERT_EQ(0, memcmp(data.data() + 90, ptr, kSegmentSize + 10));
+}
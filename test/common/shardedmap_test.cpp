@@ -0,0 +1,110 @@
+#include "idevice/utils/shardedmap.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>  // std::shared_ptr
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace idevice;
+
+TEST(ShardedMapTest, InsertFindTake) {
+  ShardedMap<uint64_t, std::string> map;
+  ASSERT_EQ(16, map.ShardCount());
+  ASSERT_EQ(0, map.Size());
+
+  ASSERT_TRUE(map.Insert(1, "one"));
+  ASSERT_TRUE(map.Insert(2, "two"));
+  ASSERT_FALSE(map.Insert(2, "deux"));  // replaced
+  ASSERT_EQ(2, map.Size());
+
+  std::string value;
+  ASSERT_TRUE(map.Find(2, &value));
+  ASSERT_EQ("deux", value);
+  ASSERT_FALSE(map.Find(3, &value));
+  ASSERT_EQ("deux", value);  // untouched
+
+  ASSERT_TRUE(map.Take(1, &value));
+  ASSERT_EQ("one", value);
+  ASSERT_FALSE(map.Take(1, &value));
+  ASSERT_TRUE(map.Erase(2));
+  ASSERT_FALSE(map.Erase(2));
+  ASSERT_EQ(0, map.Size());
+
+  for (uint64_t i = 0; i < 100; ++i) {
+    map.Insert(i, std::to_string(i));
+  }
+  size_t count = 0;
+  map.ForEach([&count](const uint64_t& key, const std::string& value) {
+    ASSERT_EQ(std::to_string(key), value);
+    count++;
+  });
+  ASSERT_EQ(100, count);
+  count = 0;
+  map.Clear([&map, &count](const uint64_t& key, std::string& value) {
+    ASSERT_FALSE(map.Find(key, nullptr));  // removed, and visited outside of the lock
+    ASSERT_EQ(std::to_string(key), value);
+    count++;
+  });
+  ASSERT_EQ(100, count);
+  ASSERT_EQ(0, map.Size());
+}
+
+TEST(ShardedMapTest, SingleShard) {
+  ShardedMap<uint64_t, int> map(0);
+  ASSERT_EQ(1, map.ShardCount());
+  for (uint64_t i = 0; i < 100; ++i) {
+    ASSERT_TRUE(map.Insert(i, static_cast<int>(i)));
+  }
+  ASSERT_EQ(100, map.Size());
+  int value = -1;
+  ASSERT_TRUE(map.Take(42, &value));
+  ASSERT_EQ(42, value);
+  ASSERT_EQ(99, map.Size());
+}
+
+TEST(ShardedMapTest, ConcurrentInsertAndTake) {
+  constexpr int thread_count = 8;
+  constexpr int count = 10000;
+  ShardedMap<uint64_t, std::shared_ptr<int>> map;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&map, t]() {
+      // the keys look like the reply identifiers of the connection: channel << 32 | msg
+      for (int i = 0; i < count; ++i) {
+        uint64_t key = static_cast<uint64_t>(t) << 32 | i;
+        ASSERT_TRUE(map.Insert(key, std::make_shared<int>(i)));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(thread_count * count, map.Size());
+
+  // every key is taken by exactly one of the racing threads
+  std::atomic<int> taken(0);
+  threads.clear();
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&map, &taken]() {
+      for (int c = 0; c < thread_count; ++c) {
+        for (int i = 0; i < count; ++i) {
+          uint64_t key = static_cast<uint64_t>(c) << 32 | i;
+          std::shared_ptr<int> value;
+          if (map.Take(key, &value)) {
+            ASSERT_EQ(i, *value);
+            taken++;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(thread_count * count, taken.load());
+  ASSERT_EQ(0, map.Size());
+}
@@ -0,0 +1,71 @@
+#include "idevice/utils/timingwheel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>  // std::sort
+#include <cstdint>
+#include <random>
+#include <utility>  // std::pair
+#include <vector>
+
+using namespace idevice;
+
+TEST(TimingWheelTest, ExpireInOrder) {
+  TimingWheel<int> wheel(10, 1000);
+  wheel.Schedule(1000, 0);  // already passed, expires at the next tick
+  wheel.Schedule(1015, 1);  // rounded up to 1020
+  wheel.Schedule(1020, 2);
+  wheel.Schedule(1000 + 10 * 100, 3);  // beyond level 0
+  ASSERT_EQ(4, wheel.Size());
+
+  std::vector<int> expired;
+  auto collect = [&expired](int value) { expired.push_back(value); };
+  ASSERT_EQ(0, wheel.Advance(1000, collect));
+  ASSERT_EQ(1, wheel.Advance(1010, collect));
+  ASSERT_EQ(0, wheel.Advance(1019, collect));
+  ASSERT_EQ(2, wheel.Advance(1020, collect));
+  ASSERT_EQ(0, wheel.Advance(1999, collect));
+  ASSERT_EQ(1, wheel.Advance(2000, collect));
+  ASSERT_EQ((std::vector<int>{0, 1, 2, 3}), expired);
+  ASSERT_EQ(0, wheel.Size());
+}
+
+TEST(TimingWheelTest, CascadeAllLevels) {
+  // deadlines spread over all levels and beyond, none expires early or late
+  constexpr uint64_t start = 123456789;
+  TimingWheel<uint64_t> wheel(1, start);
+  std::mt19937_64 random(42);
+  std::vector<uint64_t> deadlines;
+  for (int i = 0; i < 2000; ++i) {
+    uint64_t delay = 1 + random() % (static_cast<uint64_t>(1) << (6 * (i % 5) + 1));
+    deadlines.push_back(start + delay);
+    wheel.Schedule(start + delay, start + delay);
+  }
+  // far beyond the range of the top level
+  deadlines.push_back(start + (static_cast<uint64_t>(1) << 25) + 7);
+  wheel.Schedule(deadlines.back(), deadlines.back());
+
+  std::vector<uint64_t> expired;
+  uint64_t now = start;
+  while (wheel.Size() > 0) {
+    now += 1 + random() % 50000;  // jumps over many ticks at once
+    wheel.Advance(now, [&](uint64_t deadline) {
+      ASSERT_LE(deadline, now);
+      ASSERT_GT(deadline + 50000, now);  // not later than the advance following the deadline
+      expired.push_back(deadline);
+    });
+  }
+  std::sort(deadlines.begin(), deadlines.end());
+  ASSERT_EQ(deadlines, expired);  // and in the order of the deadlines
+}
+
+TEST(TimingWheelTest, IdleJump) {
+  constexpr uint64_t later = 10 * (static_cast<uint64_t>(1) << 36);
+  TimingWheel<int> wheel(10, 0);
+  ASSERT_EQ(0, wheel.Advance(later, [](int) {}));  // empty, so no tick is walked through
+  wheel.Schedule(later + 5, 1);                   // rounded up to the next tick
+  int count = 0;
+  ASSERT_EQ(0, wheel.Advance(later + 9, [&count](int) { count++; }));
+  ASSERT_EQ(1, wheel.Advance(later + 10, [&count](int) { count++; }));
+  ASSERT_EQ(1, count);
+}
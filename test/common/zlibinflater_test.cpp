@@ -0,0 +1,62 @@
+#include "idevice/utils/zlibinflater.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace idevice;
+
+static std::vector<char> compress_data(const std::string& data) {
+  uLongf compressed_size = compressBound(data.size());
+  std::vector<char> compressed(compressed_size);
+  EXPECT_EQ(Z_OK, compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+                            reinterpret_cast<const Bytef*>(data.data()), data.size(),
+                            Z_DEFAULT_COMPRESSION));
+  compressed.resize(compressed_size);
+  return compressed;
+}
+
+TEST(ZlibInflaterTest, Inflate) {
+  std::string data;
+  for (int i = 0; i < 10000; ++i) {
+    data += "DTXMessage" + std::to_string(i);
+  }
+  std::vector<char> compressed = compress_data(data);
+  ASSERT_LT(compressed.size(), data.size());
+
+  // the inflater is reused for the following streams
+  ZlibInflater inflater;
+  for (int i = 0; i < 3; ++i) {
+    std::string output(data.size(), '\0');
+    size_t output_size = 0;
+    ASSERT_TRUE(inflater.Inflate(compressed.data(), compressed.size(), &output[0], output.size(),
+                                 &output_size));
+    ASSERT_EQ(data.size(), output_size);
+    ASSERT_EQ(data, output);
+  }
+}
+
+TEST(ZlibInflaterTest, InflateInvalidStream) {
+  const std::string data(4096, 'x');
+  std::vector<char> compressed = compress_data(data);
+  std::string output(data.size(), '\0');
+  size_t output_size = 0;
+  ZlibInflater& inflater = ZlibInflater::ThreadLocal();
+
+  // truncated
+  ASSERT_FALSE(inflater.Inflate(compressed.data(), compressed.size() / 2, &output[0],
+                                output.size(), &output_size));
+  // output buffer is too small
+  ASSERT_FALSE(inflater.Inflate(compressed.data(), compressed.size(), &output[0],
+                                output.size() - 1, &output_size));
+  // corrupted
+  const std::string garbage(64, 'x');
+  ASSERT_FALSE(inflater.Inflate(garbage.data(), garbage.size(), &output[0], output.size(),
+                                &output_size));
+
+  // still usable after the failures
+  ASSERT_TRUE(inflater.Inflate(compressed.data(), compressed.size(), &output[0], output.size(),
+                               &output_size));
+  ASSERT_EQ(data, output);
+}
@@ -0,0 +1,117 @@
+#include "idevice/instrument/devicefleet.h"
+
+#include <gtest/gtest.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>  // std::shared_ptr, std::weak_ptr
+#include <string>
+#include <thread>
+
+#include "idevice/instrument/dtxmessage.h"
+#include "idevice/instrument/dtxsockettransport.h"
+
+using namespace idevice;
+
+TEST(DeviceFleetTest, ManyDevices) {
+  constexpr int device_count = 12;
+  constexpr int message_count = 50;
+  DeviceFleet fleet(2, 2);
+  DeviceFleet fake_devices(1, 1);  // the other ends of the sockets, they reply to all messages
+
+  for (int i = 0; i < device_count; ++i) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::string name = "device-" + std::to_string(i);
+    ASSERT_NE(nullptr, fleet.Add(name, std::make_unique<SocketDTXTransport>(fds[0])));
+    ASSERT_NE(nullptr, fake_devices.Add(name, std::make_unique<SocketDTXTransport>(fds[1])));
+  }
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  ASSERT_EQ(nullptr, fleet.Add("device-0", std::make_unique<SocketDTXTransport>(fds[0])));
+  close(fds[1]);
+  ASSERT_EQ(device_count, fleet.Names().size());
+
+  DeviceFleetStat stat = fleet.Stat();
+  ASSERT_EQ(device_count, stat.device_count);
+  ASSERT_EQ(device_count, stat.connected_count);
+  ASSERT_EQ(2, stat.loop_loads.size());
+  ASSERT_EQ(device_count / 2, stat.loop_loads[0]);  // balanced
+  ASSERT_EQ(device_count / 2, stat.loop_loads[1]);
+
+  std::atomic<int> replied(0);
+  for (const std::string& name : fleet.Names()) {
+    std::shared_ptr<DTXConnection> connection = fleet.Find(name);
+    ASSERT_NE(nullptr, connection);
+    for (int m = 0; m < message_count; ++m) {
+      const char payload[] = "ping";
+      connection->SendMessageAsync(DTXMessage::CreateWithBuffer(payload, sizeof(payload), true),
+                                   [&replied](std::shared_ptr<DTXMessage>) { replied++; });
+    }
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (replied.load() < device_count * message_count &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(device_count * message_count, replied.load());
+  ASSERT_EQ(device_count * message_count, fleet.Stat().dispatch.executed);
+
+  ASSERT_TRUE(fleet.Remove("device-0"));
+  ASSERT_FALSE(fleet.Remove("device-0"));
+  ASSERT_EQ(nullptr, fleet.Find("device-0"));
+  ASSERT_EQ(device_count - 1, fleet.Stat().device_count);
+}
+
+TEST(DeviceFleetTest, RemoveWithPendingHandlers) {
+  constexpr int message_count = 20;
+  DeviceFleet fleet(1, 1);
+  DeviceFleet fake_devices(1, 1);
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  std::shared_ptr<DTXConnection> connection =
+      fleet.Add("device", std::make_unique<SocketDTXTransport>(fds[0]));
+  ASSERT_NE(nullptr, connection);
+  ASSERT_NE(nullptr, fake_devices.Add("device", std::make_unique<SocketDTXTransport>(fds[1])));
+
+  // the replies pile up on the dispatch executor behind the gate
+  std::atomic_bool gate_open(false);
+  std::atomic<int> replied(0);
+  for (int m = 0; m < message_count; ++m) {
+    const char payload[] = "ping";
+    connection->SendMessageAsync(DTXMessage::CreateWithBuffer(payload, sizeof(payload), true),
+                                 [&](std::shared_ptr<DTXMessage> /*reply*/) {
+                                   while (!gate_open.load()) {
+                                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                   }
+                                   replied++;
+                                 });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (fleet.Stat().dispatch.pending == 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_LT(0, fleet.Stat().dispatch.pending);
+
+  // removed while its handlers are pending, the connection handed out is still valid
+  ASSERT_TRUE(fleet.Remove("device"));
+  ASSERT_EQ(nullptr, fleet.Find("device"));
+  ASSERT_FALSE(connection->IsConnected());
+  std::weak_ptr<DTXConnection> weak_connection = connection;
+  connection = nullptr;
+  ASSERT_FALSE(weak_connection.expired());  // kept until the pending handlers have run
+
+  gate_open = true;
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!weak_connection.expired() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_TRUE(weak_connection.expired());
+  ASSERT_LT(0, replied.load());
+}
+
+#endif  // __linux__
@@ -0,0 +1,312 @@
+#include "idevice/instrument/dtxconnection.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "idevice/instrument/dtxmessage.h"
+#include "idevice/instrument/dtxmessageparser.h"
+#include "idevice/instrument/dtxrequest.h"
+#include "idevice/instrument/dtxtransport.h"
+#include "idevice/utils/executor.h"
+
+using namespace idevice;
+
+// A transport recording all written bytes and counting the writes, nothing is ever received
+class RecordingTransport : public IDTXTransport {
+ public:
+  virtual bool Connect() override { connected_ = true; return true; }
+  virtual bool Disconnect() override { connected_ = false; return true; }
+  virtual bool IsConnected() const override { return connected_; }
+
+  virtual bool Send(const char* data, uint32_t size, uint32_t* sent) override {
+    IoVec segment = {data, size};
+    size_t segment_sent = 0;
+    bool ret = SendV(&segment, 1, &segment_sent);
+    *sent = static_cast<uint32_t>(segment_sent);
+    return ret;
+  }
+
+  virtual bool SendV(const IoVec* segments, size_t count, size_t* sent) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *sent = 0;
+    for (size_t i = 0; i < count; ++i) {
+      written_.insert(written_.end(), segments[i].data, segments[i].data + segments[i].size);
+      *sent += segments[i].size;
+    }
+    write_count_++;
+    return true;
+  }
+
+  virtual bool Receive(char* /*buffer*/, uint32_t /*size*/, uint32_t* received) override {
+    *received = 0;
+    return true;
+  }
+
+  virtual bool ReceiveWithTimeout(char* /*buffer*/, uint32_t /*size*/, uint32_t /*timeout*/,
+                                  uint32_t* received) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    *received = 0;
+    return true;
+  }
+
+  size_t WriteCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return write_count_;
+  }
+
+  std::vector<char> Written() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+  }
+
+ private:
+  std::atomic_bool connected_{false};
+  std::mutex mutex_;
+  std::vector<char> written_;
+  size_t write_count_ = 0;
+};
+
+// An executor holding the tasks until they are run explicitly
+class HoldingExecutor : public Executor {
+ public:
+  void Execute(uint64_t /*key*/, Task task) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+
+  ExecutorStat Stat() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {tasks_.size(), tasks_.size(), 0};
+  }
+
+  void RunAll() {
+    std::vector<Task> tasks;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks.swap(tasks_);
+    }
+    for (Task& task : tasks) {
+      task();
+    }
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<Task> tasks_;
+};
+
+TEST(DTXConnectionTest, SendMessagesAsync_OneWrite) {
+  constexpr size_t message_count = 20;
+  RecordingTransport transport;
+  DTXConnection connection(&transport);  // without a coalescing window
+  ASSERT_TRUE(connection.Connect());
+
+  std::vector<DTXMessenger::MessageWithHandler> batch;
+  for (size_t i = 0; i < message_count; ++i) {
+    std::string payload = "message-" + std::to_string(i);
+    batch.emplace_back(DTXMessage::CreateWithBuffer(payload.c_str(), payload.size(), true),
+                       nullptr);
+  }
+  connection.SendMessagesAsync(std::move(batch));
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (connection.SendQueueSize() > 0 || transport.WriteCount() == 0) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  connection.Disconnect();
+  ASSERT_EQ(1, transport.WriteCount());  // all messages are coalesced into one write
+
+  // and they are all there, in order
+  std::vector<char> written = transport.Written();
+  DTXMessageParser parser;
+  ASSERT_TRUE(parser.ParseIncomingBytes(written.data(), written.size()));
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  ASSERT_EQ(message_count, messages.size());
+  for (size_t i = 0; i < message_count; ++i) {
+    std::string payload = "message-" + std::to_string(i);
+    ASSERT_EQ(payload.size(), messages[i]->PayloadSize());
+    ASSERT_EQ(0, memcmp(payload.data(), messages[i]->PayloadBuffer(), payload.size()));
+    ASSERT_EQ(messages[0]->Identifier() + i, messages[i]->Identifier());
+  }
+}
+
+TEST(DTXConnectionTest, SendMessagesAsync_Disconnected) {
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect());
+  connection.Disconnect();
+
+  // the messages are never sent, so their callbacks are called with null at once
+  std::atomic<int> abandoned(0);
+  std::vector<DTXMessenger::MessageWithHandler> batch;
+  for (int i = 0; i < 10; ++i) {
+    batch.emplace_back(DTXMessage::CreateWithSelector("ping"),
+                       [&abandoned](std::shared_ptr<DTXMessage> reply) {
+                         if (reply == nullptr) {
+                           abandoned++;
+                         }
+                       });
+  }
+  connection.SendMessagesAsync(std::move(batch));
+  ASSERT_EQ(10, abandoned.load());
+  ASSERT_EQ(0, connection.PendingReplyCount());
+}
+
+TEST(DTXConnectionTest, SendMessageAsync_SingleFrame) {
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect());
+
+  const char payload[] = "ping";
+  connection.SendMessageAsync(DTXMessage::CreateWithBuffer(payload, sizeof(payload), true),
+                              nullptr);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (transport.WriteCount() == 0) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  connection.Disconnect();
+  ASSERT_EQ(1, transport.WriteCount());
+  ASSERT_EQ(0x20 + 0x10 + sizeof(payload), transport.Written().size());
+}
+
+// nothing is ever received by the recording transport, so the requests below are never replied
+
+TEST(DTXConnectionTest, SendMessage_TimedOut) {
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect());
+
+  std::atomic<int> completed(0);
+  std::shared_ptr<DTXRequest> request =
+      connection.SendMessage(DTXMessage::CreateWithSelector("ping"), 200);
+  request->OnComplete([&completed](DTXRequestStatus status, std::shared_ptr<DTXMessage> reply) {
+    if (status == DTXRequestStatus::kTimedOut && reply == nullptr) {
+      completed++;
+    }
+  });
+  ASSERT_EQ(1, connection.PendingReplyCount());
+  ASSERT_TRUE(request->Wait(10 * 1000));  // completed by the deadline, not by the waiting
+  ASSERT_EQ(DTXRequestStatus::kTimedOut, request->Status());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (completed.load() == 0) {  // the handler runs after the waiters are woken up
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(0, connection.PendingReplyCount());
+  ASSERT_EQ(1, connection.ExpiredReplyCount());
+  ASSERT_FALSE(request->Cancel());  // already completed
+
+  connection.Disconnect();
+}
+
+TEST(DTXConnectionTest, SendMessage_Cancelled) {
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect());
+
+  std::shared_ptr<DTXRequest> request =
+      connection.SendMessage(DTXMessage::CreateWithSelector("ping"));
+  ASSERT_FALSE(request->Wait(10));
+  ASSERT_EQ(1, connection.PendingReplyCount());
+  ASSERT_TRUE(request->Cancel());
+  ASSERT_EQ(DTXRequestStatus::kCancelled, request->Status());
+  ASSERT_EQ(0, connection.PendingReplyCount());
+  ASSERT_EQ(nullptr, request->Get());
+
+  connection.Disconnect();
+}
+
+TEST(DTXConnectionTest, SendMessage_FailedOnDisconnect) {
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect());
+
+  std::vector<std::shared_ptr<DTXRequest>> requests;
+  for (int i = 0; i < 10; ++i) {
+    requests.push_back(connection.SendMessage(DTXMessage::CreateWithSelector("ping"), 60 * 1000));
+  }
+  ASSERT_EQ(requests.size(), connection.PendingReplyCount());
+  connection.Disconnect();
+  ASSERT_EQ(0, connection.PendingReplyCount());
+  for (auto& request : requests) {
+    ASSERT_EQ(DTXRequestStatus::kDisconnected, request->Status());
+  }
+
+  // it's never sent after the disconnection
+  std::shared_ptr<DTXRequest> request =
+      connection.SendMessage(DTXMessage::CreateWithSelector("ping"));
+  ASSERT_EQ(DTXRequestStatus::kDisconnected, request->Status());
+}
+
+TEST(DTXConnectionTest, SendMessageAsync_ReplyTimeout) {
+  constexpr int message_count = 1000;
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  connection.SetReplyTimeout(50);
+  ASSERT_TRUE(connection.Connect());
+
+  std::atomic<int> timed_out(0);
+  for (int i = 0; i < message_count; ++i) {
+    connection.SendMessageAsync(DTXMessage::CreateWithSelector("ping"),
+                                [&timed_out](std::shared_ptr<DTXMessage> reply) {
+                                  if (reply == nullptr) {
+                                    timed_out++;
+                                  }
+                                });
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (timed_out.load() < message_count) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // the lost replies don't leak
+  ASSERT_EQ(0, connection.PendingReplyCount());
+  ASSERT_EQ(message_count, connection.ExpiredReplyCount());
+
+  connection.Disconnect();
+}
+
+TEST(DTXConnectionTest, SendMessageSync_TimedOut) {
+  RecordingTransport transport;
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect());
+
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(nullptr, connection.SendMessageSync(DTXMessage::CreateWithSelector("ping"), 50));
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  ASSERT_EQ(0, connection.PendingReplyCount());  // the handler doesn't outlive the call
+
+  connection.Disconnect();
+}
+
+TEST(DTXConnectionTest, SendMessage_CancelledAfterDestruction) {
+  RecordingTransport transport;
+  std::shared_ptr<HoldingExecutor> executor = std::make_shared<HoldingExecutor>();
+  std::unique_ptr<DTXConnection> connection(new DTXConnection(&transport));
+  connection->SetDispatchExecutor(executor);
+  ASSERT_TRUE(connection->Connect());
+
+  std::shared_ptr<DTXRequest> request =
+      connection->SendMessage(DTXMessage::CreateWithSelector("ping"), 50);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (connection->ExpiredReplyCount() == 0) {  // taken out, but it completes on the executor
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(0, connection->PendingReplyCount());
+  ASSERT_EQ(DTXRequestStatus::kPending, request->Status());
+
+  connection->Disconnect();
+  connection.reset();
+  ASSERT_TRUE(request->Cancel());  // it must not touch the destroyed connection
+  executor->RunAll();
+  ASSERT_EQ(DTXRequestStatus::kCancelled, request->Status());
+}
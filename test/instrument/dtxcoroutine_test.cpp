@@ -0,0 +1,111 @@
+#include "idevice/instrument/dtxcoroutine.h"
+
+#include <gtest/gtest.h>
+
+// only built with C++20, see the IDEVICE_ENABLE_COROUTINES option
+#if IDEVICE_HAS_COROUTINES && defined(__linux__)
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "idevice/instrument/dtxconnection.h"
+#include "idevice/instrument/dtxeventloop.h"
+#include "idevice/instrument/dtxsockettransport.h"
+
+using namespace idevice;
+
+template <typename Predicate>
+static bool wait_until(Predicate predicate, int timeout_ms = 10 * 1000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+static DTXTask Converse(std::shared_ptr<DTXChannel> channel, std::shared_ptr<Executor> executor,
+                        int rounds, std::atomic<int>* replied) {
+  for (int i = 0; i < rounds; ++i) {
+    std::shared_ptr<DTXMessage> reply =
+        co_await Send(*channel, DTXMessage::CreateWithSelector("ping"), 10 * 1000, executor);
+    if (reply) {
+      (*replied)++;
+    }
+  }
+}
+
+TEST(DTXCoroutineTest, ManyConversationsOnFewThreads) {
+  constexpr int conversation_count = 200;
+  constexpr int round_count = 5;
+  DTXEventLoop loop;
+  ASSERT_TRUE(loop.Start());
+
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport sender_transport(fds[0]);
+  SocketDTXTransport replier_transport(fds[1]);
+  DTXConnection sender(&sender_transport);
+  DTXConnection replier(&replier_transport);
+  ASSERT_TRUE(sender.Connect(&loop));
+  ASSERT_TRUE(replier.Connect(&loop));
+
+  // every conversation awaits its replies one after another, all of them run on 2 threads
+  std::shared_ptr<Executor> executor = std::make_shared<ThreadPoolExecutor>(2);
+  std::shared_ptr<DTXChannel> channel = std::make_shared<DTXChannel>(&sender, "test", 0);
+  std::atomic<int> replied(0);
+  for (int i = 0; i < conversation_count; ++i) {
+    Converse(channel, executor, round_count, &replied);
+  }
+  ASSERT_TRUE(wait_until([&]() { return replied.load() == conversation_count * round_count; }));
+
+  sender.Disconnect();
+  replier.Disconnect();
+  loop.Stop();
+}
+
+static DTXTask Drain(DTXMessageStream* stream, std::vector<std::shared_ptr<DTXMessage>>* drained,
+                     std::atomic_bool* finished) {
+  while (std::shared_ptr<DTXMessage> msg = co_await stream->Next()) {
+    drained->push_back(msg);
+  }
+  *finished = true;
+}
+
+TEST(DTXCoroutineTest, MessageStream) {
+  std::shared_ptr<DTXChannel> channel = std::make_shared<DTXChannel>(nullptr, "test", 1);
+  std::vector<std::shared_ptr<DTXMessage>> messages;
+  for (int i = 0; i < 5; ++i) {
+    messages.push_back(DTXMessage::CreateWithSelector("message"));
+  }
+  std::atomic_bool finished(false);
+  std::vector<std::shared_ptr<DTXMessage>> drained;
+  {
+    DTXMessageStream stream(channel, nullptr, 2);
+    // queued before anyone awaits, the oldest one is dropped
+    channel->MessageHandler()(messages[0]);
+    channel->MessageHandler()(messages[1]);
+    channel->MessageHandler()(messages[2]);
+    ASSERT_EQ(1, stream.DroppedCount());
+
+    Drain(&stream, &drained, &finished);  // takes the queued ones, then waits
+    ASSERT_EQ(std::vector<std::shared_ptr<DTXMessage>>(messages.begin() + 1, messages.begin() + 3),
+              drained);
+    channel->MessageHandler()(messages[3]);  // resumes it inline
+    ASSERT_EQ(3, drained.size());
+    ASSERT_EQ(messages[3], drained.back());
+    ASSERT_FALSE(finished.load());
+  }  // closed, so it resumes with null
+  ASSERT_TRUE(finished.load());
+
+  // the handler outlives the stream, and drops the messages
+  channel->MessageHandler()(messages[4]);
+  ASSERT_EQ(3, drained.size());
+}
+
+#endif  // IDEVICE_HAS_COROUTINES && __linux__
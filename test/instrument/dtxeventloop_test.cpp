@@ -0,0 +1,341 @@
+#include "idevice/instrument/dtxeventloop.h"
+
+#include <gtest/gtest.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>  // std::unique_ptr
+#include <thread>
+#include <vector>
+
+#include "idevice/instrument/dtxconnection.h"
+#include "idevice/instrument/dtxmessage.h"
+#include "idevice/instrument/dtxrequest.h"
+#include "idevice/instrument/dtxsockettransport.h"
+#include "idevice/utils/executor.h"
+
+using namespace idevice;
+
+template <typename Predicate>
+static bool wait_until(Predicate predicate, int timeout_ms = 10 * 1000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+TEST(SocketDTXTransportTest, SendVAndReceive) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport writer(fds[0]);
+  SocketDTXTransport reader(fds[1]);
+  ASSERT_TRUE(writer.Connect());
+  ASSERT_TRUE(reader.Connect());
+  ASSERT_EQ(fds[1], reader.PollableFd());
+
+  char buffer[64];
+  uint32_t received = 0;
+  ASSERT_TRUE(reader.Receive(buffer, sizeof(buffer), &received));  // doesn't block
+  ASSERT_EQ(0, received);
+
+  // larger than the socket buffer, so the writer has to wait for the reader
+  std::vector<char> large(4 * 1024 * 1024);
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<char>(i * 7);
+  }
+  IoVec segments[] = {{"head", 4}, {large.data(), large.size()}, {"", 0}, {"tail", 4}};
+  std::thread writer_thread([&]() {
+    size_t sent = 0;
+    ASSERT_TRUE(writer.SendV(segments, 4, &sent));
+    ASSERT_EQ(large.size() + 8, sent);
+  });
+
+  std::vector<char> output;
+  while (output.size() < large.size() + 8) {
+    ASSERT_TRUE(reader.ReceiveWithTimeout(buffer, sizeof(buffer), 1000, &received));
+    output.insert(output.end(), buffer, buffer + received);
+  }
+  writer_thread.join();
+  ASSERT_EQ(0, memcmp("head", output.data(), 4));
+  ASSERT_EQ(0, memcmp(large.data(), output.data() + 4, large.size()));
+  ASSERT_EQ(0, memcmp("tail", output.data() + 4 + large.size(), 4));
+
+  writer.Disconnect();
+  ASSERT_FALSE(reader.Receive(buffer, sizeof(buffer), &received));  // closed by the peer
+  ASSERT_FALSE(reader.IsConnected());
+
+  // nobody reads, so it writes no more than the socket takes
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport nonblocking_writer(fds[0]);
+  ASSERT_TRUE(nonblocking_writer.Connect());
+  size_t sent = 0;
+  ASSERT_TRUE(nonblocking_writer.TrySendV(segments, 4, &sent));
+  ASSERT_LT(0, sent);
+  ASSERT_GT(large.size() + 8, sent);
+  close(fds[1]);
+}
+
+TEST(DTXEventLoopTest, ManyConnectionsOnOneThread) {
+  constexpr int pair_count = 8;
+  constexpr int message_count = 100;
+  DTXEventLoop loop;
+  ASSERT_TRUE(loop.Start());
+
+  // every pair of connections talks over a socketpair, the second one replies to the first one
+  std::vector<std::unique_ptr<SocketDTXTransport>> transports;
+  std::vector<std::unique_ptr<DTXConnection>> connections;
+  for (int i = 0; i < pair_count * 2; i += 2) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    for (int fd : fds) {
+      transports.emplace_back(new SocketDTXTransport(fd));
+      connections.emplace_back(new DTXConnection(transports.back().get()));
+      ASSERT_TRUE(connections.back()->Connect(&loop));
+    }
+  }
+  ASSERT_EQ(pair_count * 2, loop.ConnectionCount());
+
+  std::atomic<int> replied(0);
+  std::vector<std::thread> senders;
+  for (int i = 0; i < pair_count * 2; i += 2) {
+    DTXConnection* connection = connections[i].get();
+    senders.emplace_back([connection, &replied]() {
+      for (int m = 0; m < message_count; ++m) {
+        const char payload[] = "ping";
+        std::shared_ptr<DTXMessage> message =
+            DTXMessage::CreateWithBuffer(payload, sizeof(payload), true);
+        connection->SendMessageAsync(message, [&replied](std::shared_ptr<DTXMessage> /*reply*/) {
+          replied++;
+        });
+      }
+    });
+  }
+  for (auto& sender : senders) {
+    sender.join();
+  }
+  ASSERT_TRUE(wait_until([&]() { return replied.load() == pair_count * message_count; }));
+
+  for (auto& connection : connections) {
+    connection->Disconnect();
+  }
+  ASSERT_EQ(0, loop.ConnectionCount());
+  loop.Stop();
+}
+
+TEST(DTXEventLoopTest, ReceiveBackpressure) {
+  constexpr int message_count = 100;
+  DTXEventLoop loop;
+  ASSERT_TRUE(loop.Start());
+
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport sender_transport(fds[0]);
+  SocketDTXTransport replier_transport(fds[1]);
+  DTXConnection sender(&sender_transport);
+  DTXConnection replier(&replier_transport);
+
+  // the replies are handled on a worker blocked by the gate, so they pile up on the sender
+  std::atomic_bool gate_open(false);
+  std::atomic<int> paused(0);
+  std::atomic<int> resumed(0);
+  sender.SetDispatchExecutor(std::make_shared<ThreadPoolExecutor>(1));
+  sender.SetReceiveWatermarks(1024, 0, [&](bool above_high_watermark, size_t /*bytes*/) {
+    (above_high_watermark ? paused : resumed)++;
+  });
+  ASSERT_TRUE(sender.Connect(&loop));
+  ASSERT_TRUE(replier.Connect(&loop));
+
+  std::atomic<int> replied(0);
+  for (int m = 0; m < message_count; ++m) {
+    const char payload[] = "ping";
+    sender.SendMessageAsync(DTXMessage::CreateWithBuffer(payload, sizeof(payload), true),
+                            [&](std::shared_ptr<DTXMessage> /*reply*/) {
+                              while (!gate_open.load()) {
+                                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                              }
+                              replied++;
+                            });
+  }
+  ASSERT_TRUE(wait_until([&]() { return paused.load() == 1; }));
+  ASSERT_GE(sender.ReceiveWatermark().Bytes(), 1024);
+  ASSERT_EQ(0, resumed.load());
+
+  gate_open = true;
+  ASSERT_TRUE(wait_until([&]() { return replied.load() == message_count; }));
+  // the bytes of a reply are released after its handler returns
+  ASSERT_TRUE(wait_until([&]() { return sender.ReceiveWatermark().Bytes() == 0; }));
+  ASSERT_GE(resumed.load(), 1);
+
+  sender.Disconnect();
+  replier.Disconnect();
+  loop.Stop();
+}
+
+TEST(DTXEventLoopTest, SendMessage) {
+  constexpr int request_count = 100;
+  DTXEventLoop loop;
+  ASSERT_TRUE(loop.Start());
+
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport sender_transport(fds[0]);
+  SocketDTXTransport replier_transport(fds[1]);
+  DTXConnection sender(&sender_transport);
+  DTXConnection replier(&replier_transport);
+  ASSERT_TRUE(sender.Connect(&loop));
+  ASSERT_TRUE(replier.Connect(&loop));
+
+  // all requests are in flight at the same time, without a thread waiting for each one
+  std::vector<std::shared_ptr<DTXRequest>> requests;
+  for (int i = 0; i < request_count; ++i) {
+    requests.push_back(sender.SendMessage(DTXMessage::CreateWithSelector("ping"), 10 * 1000));
+  }
+  for (auto& request : requests) {
+    ASSERT_NE(nullptr, request->Get(10 * 1000));
+    ASSERT_EQ(DTXRequestStatus::kReplied, request->Status());
+  }
+  ASSERT_EQ(0, sender.PendingReplyCount());
+
+  sender.Disconnect();
+  replier.Disconnect();
+
+  // nobody reads the peer socket, so the request times out on the loop
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport silent_transport(fds[0]);
+  DTXConnection silent(&silent_transport);
+  ASSERT_TRUE(silent.Connect(&loop));
+  std::shared_ptr<DTXRequest> request =
+      silent.SendMessage(DTXMessage::CreateWithSelector("ping"), 50);
+  ASSERT_TRUE(request->Wait(10 * 1000));
+  ASSERT_EQ(DTXRequestStatus::kTimedOut, request->Status());
+  ASSERT_EQ(0, silent.PendingReplyCount());
+  silent.Disconnect();
+  close(fds[1]);
+  loop.Stop();
+}
+
+TEST(DTXEventLoopTest, Metrics) {
+  constexpr int request_count = 50;
+  constexpr uint32_t channel_code = 3;
+  DTXEventLoop loop;
+  ASSERT_TRUE(loop.Start());
+
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport sender_transport(fds[0]);
+  SocketDTXTransport replier_transport(fds[1]);
+  DTXConnection sender(&sender_transport);
+  DTXConnection replier(&replier_transport);
+  ASSERT_TRUE(sender.Connect(&loop));
+  ASSERT_TRUE(replier.Connect(&loop));
+
+  for (int i = 0; i < request_count; ++i) {
+    std::shared_ptr<DTXMessage> msg = DTXMessage::CreateWithSelector("ping");
+    msg->SetChannelCode(channel_code);
+    ASSERT_NE(nullptr, sender.SendMessage(msg, 10 * 1000)->Get(10 * 1000));
+  }
+
+  DTXConnectionMetrics metrics = sender.Metrics();
+  ASSERT_EQ(request_count, metrics.messages_out);
+  ASSERT_EQ(request_count, metrics.messages_in);
+  ASSERT_LT(0, metrics.bytes_out);
+  ASSERT_EQ(0, metrics.parse_errors);
+  ASSERT_EQ(0, metrics.pending_replies);
+  ASSERT_EQ(request_count, metrics.round_trip.count);
+  ASSERT_LE(metrics.round_trip.PercentileUs(50), metrics.round_trip.max_us);
+  ASSERT_EQ(1, metrics.channels.size());
+  ASSERT_EQ(channel_code, metrics.channels[0].channel_code);
+  ASSERT_EQ(request_count, metrics.channels[0].messages_out);
+  ASSERT_EQ(request_count, metrics.channels[0].round_trip.count);
+
+  // the replier has no channel, so the requests are dropped after being replied
+  ASSERT_TRUE(wait_until([&]() { return replier.Metrics().messages_out == request_count; }));
+  DTXConnectionMetrics replier_metrics = replier.Metrics();
+  ASSERT_EQ(request_count, replier_metrics.messages_in);
+  ASSERT_EQ(request_count, replier_metrics.dropped_messages);
+  ASSERT_EQ(metrics.bytes_out, replier_metrics.bytes_in);
+  ASSERT_EQ(0, replier_metrics.round_trip.count);
+  ASSERT_EQ(1, replier_metrics.channels.size());
+  ASSERT_EQ(request_count, replier_metrics.channels[0].dropped_messages);
+  // the serialized lengths counted on both sides are the same
+  ASSERT_EQ(metrics.channels[0].bytes_out, replier_metrics.channels[0].bytes_in);
+
+  sender.Disconnect();
+  replier.Disconnect();
+  loop.Stop();
+}
+
+TEST(DTXEventLoopTest, SendWithoutBlocking) {
+  DTXEventLoop loop;
+  ASSERT_TRUE(loop.Start());
+
+  // nobody reads the peer of the stalled connection yet, so its large message fills the socket
+  int stalled_fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, stalled_fds));
+  SocketDTXTransport stalled_transport(stalled_fds[0]);
+  SocketDTXTransport reader(stalled_fds[1]);
+  DTXConnection stalled(&stalled_transport);
+  ASSERT_TRUE(stalled.Connect(&loop));
+  ASSERT_TRUE(reader.Connect());
+  std::vector<char> payload(8 * 1024 * 1024, 'x');
+  stalled.SendMessageAsync(DTXMessage::CreateWithBuffer(payload.data(), payload.size(), false),
+                           nullptr);
+  ASSERT_TRUE(wait_until([&]() { return stalled.Metrics().bytes_out > 0; }));
+  ASSERT_EQ(0, stalled.Metrics().messages_out);
+
+  // the loop is not blocked by the stalled connection
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport sender_transport(fds[0]);
+  SocketDTXTransport replier_transport(fds[1]);
+  DTXConnection sender(&sender_transport);
+  DTXConnection replier(&replier_transport);
+  ASSERT_TRUE(sender.Connect(&loop));
+  ASSERT_TRUE(replier.Connect(&loop));
+  ASSERT_NE(nullptr, sender.SendMessage(DTXMessage::CreateWithSelector("ping"), 10 * 1000)
+                         ->Get(10 * 1000));
+
+  // the rest of the message is written out once the peer reads
+  std::vector<char> buffer(64 * 1024);
+  size_t received_size = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (stalled.Metrics().messages_out == 0 || received_size < stalled.Metrics().bytes_out) {
+    ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+    uint32_t received = 0;
+    ASSERT_TRUE(reader.ReceiveWithTimeout(buffer.data(), buffer.size(), 100, &received));
+    received_size += received;
+  }
+  ASSERT_GT(received_size, payload.size());
+  ASSERT_EQ(received_size, stalled.Metrics().bytes_out);
+
+  sender.Disconnect();
+  replier.Disconnect();
+  stalled.Disconnect();
+  loop.Stop();
+}
+
+TEST(DTXEventLoopTest, PeerClosed) {
+  DTXEventLoop loop;
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SocketDTXTransport transport(fds[0]);
+  DTXConnection connection(&transport);
+  ASSERT_TRUE(connection.Connect(&loop));
+  ASSERT_EQ(1, loop.ConnectionCount());
+
+  // driven by hand instead of a loop thread
+  close(fds[1]);
+  ASSERT_EQ(1, loop.RunOnce(1000));
+  ASSERT_FALSE(connection.IsConnected());
+  ASSERT_EQ(0, loop.ConnectionCount());
+}
+
+#endif  // __linux__
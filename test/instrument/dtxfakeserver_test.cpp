@@ -0,0 +1,138 @@
+#include "idevice/instrument/dtxfakeserver.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>  // memcmp
+#include <thread>
+#include <vector>
+
+#include "idevice/instrument/dtxchannel.h"
+#include "idevice/instrument/dtxconnection.h"
+#include "idevice/instrument/dtxloopbacktransport.h"
+#include "idevice/instrument/dtxmessage.h"
+
+using namespace idevice;
+
+template <typename Predicate>
+static bool wait_until(Predicate predicate, int timeout_ms = 10 * 1000) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+TEST(LoopbackDTXTransportTest, SendVAndReceive) {
+  // a small pipe, so the writer has to wait for the reader
+  auto transports = LoopbackDTXTransport::CreatePair(1024);
+  LoopbackDTXTransport& writer = *transports.first;
+  LoopbackDTXTransport& reader = *transports.second;
+  ASSERT_TRUE(writer.Connect());
+  ASSERT_TRUE(reader.Connect());
+
+  char buffer[64];
+  uint32_t received = 0;
+  ASSERT_TRUE(reader.Receive(buffer, sizeof(buffer), &received));  // doesn't block
+  ASSERT_EQ(0, received);
+
+  std::vector<char> large(64 * 1024);
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<char>(i * 7);
+  }
+  IoVec segments[] = {{"head", 4}, {large.data(), large.size()}, {"", 0}, {"tail", 4}};
+  std::thread writer_thread([&]() {
+    size_t sent = 0;
+    ASSERT_TRUE(writer.SendV(segments, 4, &sent));
+    ASSERT_EQ(large.size() + 8, sent);
+  });
+
+  std::vector<char> output;
+  while (output.size() < large.size() + 8) {
+    ASSERT_TRUE(reader.ReceiveWithTimeout(buffer, sizeof(buffer), 1000, &received));
+    output.insert(output.end(), buffer, buffer + received);
+  }
+  writer_thread.join();
+  ASSERT_EQ(0, memcmp("head", output.data(), 4));
+  ASSERT_EQ(0, memcmp(large.data(), output.data() + 4, large.size()));
+  ASSERT_EQ(0, memcmp("tail", output.data() + 4 + large.size(), 4));
+
+  // the bytes in flight are still received after the peer is gone
+  uint32_t sent = 0;
+  ASSERT_TRUE(writer.Send("bye", 3, &sent));
+  writer.Disconnect();
+  ASSERT_FALSE(writer.Send("bye", 3, &sent));
+  ASSERT_TRUE(reader.Receive(buffer, sizeof(buffer), &received));
+  ASSERT_EQ(3, received);
+  ASSERT_FALSE(reader.Receive(buffer, sizeof(buffer), &received));
+  ASSERT_FALSE(reader.Connect());
+}
+
+TEST(DTXFakeServerTest, ChannelsAndSelectors) {
+  auto transports = LoopbackDTXTransport::CreatePair();
+  DTXFakeServer server(transports.second.get());
+  server.SetSelectorHandler("runningProcesses", [](const std::shared_ptr<DTXMessage>& /*msg*/) {
+    return DTXMessage::CreateWithSelector("processes");
+  });
+  ASSERT_TRUE(server.Start());
+
+  DTXConnection connection(transports.first.get());
+  ASSERT_TRUE(connection.Connect());
+  std::shared_ptr<DTXChannel> channel = connection.MakeChannelWithIdentifier(
+      "com.apple.instruments.server.services.deviceinfo");
+  ASSERT_EQ(1, server.ChannelCount());
+  ASSERT_EQ("com.apple.instruments.server.services.deviceinfo",
+            server.ChannelLabel(channel->ChannelIdentifier()));
+
+  std::shared_ptr<DTXMessage> reply =
+      channel->SendMessageSync(DTXMessage::CreateWithSelector("runningProcesses"), 10 * 1000);
+  ASSERT_NE(nullptr, reply);
+  ASSERT_EQ("processes", DTXFakeServer::SelectorOf(*reply));
+
+  // no handler, an empty reply
+  reply = channel->SendMessageSync(DTXMessage::CreateWithSelector("unknown"), 10 * 1000);
+  ASSERT_NE(nullptr, reply);
+  ASSERT_EQ("", DTXFakeServer::SelectorOf(*reply));
+
+  channel->Cancel();
+  ASSERT_EQ(0, server.ChannelCount());
+  ASSERT_LE(4, server.ReceivedMessageCount());
+
+  connection.Disconnect();
+  server.Stop();
+}
+
+TEST(DTXFakeServerTest, Streaming) {
+  constexpr uint64_t message_count = 200;
+  constexpr size_t payload_size = 1024;
+  auto transports = LoopbackDTXTransport::CreatePair();
+  DTXFakeServer server(transports.second.get());
+  server.SetSelectorHandler("start", [&server](const std::shared_ptr<DTXMessage>& msg) {
+    server.StartStreaming(msg->ChannelCode(), payload_size, 10 * 1000, message_count);
+    return nullptr;
+  });
+  ASSERT_TRUE(server.Start());
+
+  DTXConnection connection(transports.first.get());
+  ASSERT_TRUE(connection.Connect());
+  std::shared_ptr<DTXChannel> channel = connection.MakeChannelWithIdentifier("sampling");
+  std::atomic<uint64_t> received_count(0);
+  std::atomic<uint64_t> received_bytes(0);
+  channel->SetMessageHandler([&](std::shared_ptr<DTXMessage> msg) {
+    received_bytes += msg->PayloadSize();
+    received_count++;
+  });
+  ASSERT_NE(nullptr, channel->SendMessageSync(DTXMessage::CreateWithSelector("start"), 10 * 1000));
+
+  ASSERT_TRUE(wait_until([&]() { return received_count == message_count; }));
+  ASSERT_EQ(message_count, server.StreamedMessageCount());
+  ASSERT_EQ(message_count * payload_size, received_bytes);
+  ASSERT_EQ(0, connection.Metrics().dropped_messages);
+
+  connection.Disconnect();
+  server.Stop();
+}
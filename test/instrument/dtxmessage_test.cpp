@@ -0,0 +1,63 @@
+#include "idevice/instrument/dtxmessage.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>  // std::shared_ptr
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nskeyedarchiver/nskeyedarchiver.hpp"
+
+using namespace idevice;
+
+TEST(DTXMessageTest, CreateWithSelector_Cached) {
+  const char* selector = "sampleAttributes:forPIDs:";
+  char* expected = nullptr;
+  size_t expected_size = 0;
+  nskeyedarchiver::NSKeyedArchiver::ArchivedData(
+      nskeyedarchiver::KAValue(selector), &expected, &expected_size,
+      nskeyedarchiver::NSKeyedArchiver::OutputFormat::Binary);
+
+  // the messages with the same selector share the archived bytes
+  std::vector<std::shared_ptr<DTXMessage>> messages(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    threads.emplace_back([&, i]() { messages[i] = DTXMessage::CreateWithSelector(selector); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& message : messages) {
+    ASSERT_EQ(DTXMessage::kSelectorMessageType, message->MessageType());
+    ASSERT_EQ(messages.at(0)->PayloadBuffer(), message->PayloadBuffer());
+    ASSERT_EQ(expected_size, message->PayloadSize());
+    ASSERT_EQ(0, memcmp(expected, message->PayloadBuffer(), expected_size));
+    ASSERT_EQ(message->SerializedLength(), 0x10 + expected_size);
+  }
+  free(expected);
+
+  // the payload object is decoded from the archived bytes on demand
+  ASSERT_NE(nullptr, messages.at(0)->PayloadObject());
+
+  std::shared_ptr<DTXMessage> other = DTXMessage::CreateWithSelector("runningProcesses");
+  ASSERT_NE(messages.at(0)->PayloadBuffer(), other->PayloadBuffer());
+}
+
+TEST(DTXMessageTest, SetPayloadObject_ReplacesCachedSelector) {
+  std::shared_ptr<DTXMessage> message = DTXMessage::CreateWithSelector("runningProcesses");
+  const char* cached = message->PayloadBuffer();
+  message->SetPayloadObject(std::make_unique<nskeyedarchiver::KAValue>("requestDeviceGPUInfo"));
+  ASSERT_EQ(nullptr, message->PayloadBuffer());
+
+  // serialized from the new object, and the cached bytes are not touched
+  char* expected = nullptr;
+  size_t expected_size = 0;
+  nskeyedarchiver::NSKeyedArchiver::ArchivedData(
+      nskeyedarchiver::KAValue("requestDeviceGPUInfo"), &expected, &expected_size,
+      nskeyedarchiver::NSKeyedArchiver::OutputFormat::Binary);
+  ASSERT_EQ(0x10 + expected_size, message->SerializedLength());
+  ASSERT_EQ(0, memcmp(expected, message->PayloadBuffer(), expected_size));
+  free(expected);
+  ASSERT_EQ(cached, DTXMessage::CreateWithSelector("runningProcesses")->PayloadBuffer());
+}
@@ -1,9 +1,13 @@
 #include "idevice/instrument/dtxmessageparser.h"
+#include "idevice/utils/bufferpool.h"
 
 #include <gtest/gtest.h>
+#include <zlib.h>
 
+#include <algorithm>  // std::min
 #include <cstdlib>  // abs
 #include <map>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -134,3 +138,332 @@ TEST(DTXMessageParserTest, ParseIncomingBytes_MultipleFragments) {
             processes_by_name.find("iostest")->second.AsObject<nskeyedarchiver::KAMap>().at("realAppName").ToStr());
   // clang-format on
 }
+
+TEST(DTXMessageParserTest, ParseIncomingBytes_ZeroCopy) {
+  char* buffer = nullptr;
+  size_t buffer_size = 0;
+  READ_CONTENT_FROM_FILE("dtxmsg_enableexpiredpidtracking.bin");
+
+  DTXMessageParser copy_parser;
+  ASSERT_TRUE(copy_parser.ParseIncomingBytes(buffer, buffer_size));
+  std::vector<std::shared_ptr<DTXMessage>> expected = copy_parser.PopAllParsedMessages();
+  ASSERT_EQ(1, expected.size());
+  ASSERT_EQ(nullptr, expected.at(0)->BackingStorage());
+
+  DTXMessageParser parser;
+  parser.SetZeroCopy(true);
+  ASSERT_TRUE(parser.ZeroCopy());
+
+  // feed the same message three times in small packets, so every message straddles the packets
+  std::vector<std::shared_ptr<DTXMessage>> messages;
+  constexpr size_t packet_size = 100;
+  for (int i = 0; i < 3; ++i) {
+    for (size_t offset = 0; offset < buffer_size; offset += packet_size) {
+      size_t size = std::min(packet_size, buffer_size - offset);
+      ASSERT_TRUE(parser.ParseIncomingBytes(buffer + offset, size));
+      for (auto& msg : parser.PopAllParsedMessages()) {
+        messages.emplace_back(std::move(msg));
+      }
+    }
+  }
+  free(buffer);
+  ASSERT_EQ(3, messages.size());
+
+  // all messages are still valid, the buffers they reference are kept alive by themselves
+  for (const auto& msg : messages) {
+    ASSERT_NE(nullptr, msg->BackingStorage());
+    ASSERT_EQ(expected.at(0)->Identifier(), msg->Identifier());
+    ASSERT_EQ(expected.at(0)->PayloadSize(), msg->PayloadSize());
+    ASSERT_EQ(0, memcmp(expected.at(0)->PayloadBuffer(), msg->PayloadBuffer(), msg->PayloadSize()));
+
+    DTXPrimitiveValue& aux = msg->Auxiliary()->At(0);
+    DTXPrimitiveValue& expected_aux = expected.at(0)->Auxiliary()->At(0);
+    ASSERT_TRUE(aux.IsView());
+    ASSERT_FALSE(expected_aux.IsView());
+    ASSERT_EQ(expected_aux.Size(), aux.Size());
+    ASSERT_EQ(0, memcmp(expected_aux.ToBuffer(), aux.ToBuffer(), aux.Size()));
+  }
+}
+
+TEST(DTXMessageParserTest, ParseIncomingBytes_LazyPayloadObject) {
+  char* buffer = nullptr;
+  size_t buffer_size = 0;
+  READ_CONTENT_FROM_FILE("dtxmsg_enableexpiredpidtracking.bin");
+
+  DTXMessageParser parser;
+  ASSERT_TRUE(parser.ParseIncomingBytes(buffer, buffer_size));
+  free(buffer);
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  ASSERT_EQ(1, messages.size());
+  std::shared_ptr<DTXMessage> msg = messages.at(0);
+
+  // the payload object is decoded once on first use, no matter how many threads ask for it
+  std::vector<const nskeyedarchiver::KAValue*> payloads(4, nullptr);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    threads.emplace_back([&, i]() { payloads[i] = msg->PayloadObject().get(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_NE(nullptr, payloads[0]);
+  for (const auto* payload : payloads) {
+    ASSERT_EQ(payloads[0], payload);
+  }
+  ASSERT_EQ(payloads[0], msg->PayloadObject().get());
+}
+
+TEST(DTXMessageParserTest, ParseIncomingBytes_StraddlingPackets) {
+  char* buffer = nullptr;
+  size_t buffer_size = 0;
+  READ_CONTENT_FROM_FILE("dtxmsg_runningprocesses.bin");
+
+  DTXMessageParser expected_parser;
+  ASSERT_TRUE(expected_parser.ParseIncomingBytes(buffer, buffer_size));
+  std::vector<std::shared_ptr<DTXMessage>> expected = expected_parser.PopAllParsedMessages();
+  ASSERT_EQ(1, expected.size());
+
+  // the packet size is not aligned with the segments of the parsing buffer, so the headers and
+  // the fragments straddle the boundaries of the segments
+  for (bool zero_copy : {false, true}) {
+    DTXMessageParser parser;
+    parser.SetZeroCopy(zero_copy);
+    constexpr size_t packet_size = 1000;
+    for (size_t offset = 0; offset < buffer_size; offset += packet_size) {
+      ASSERT_TRUE(parser.ParseIncomingBytes(buffer + offset, std::min(packet_size, buffer_size - offset)));
+    }
+    std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+    ASSERT_EQ(1, messages.size());
+    std::shared_ptr<DTXMessage> msg = messages.at(0);
+    ASSERT_EQ(expected.at(0)->Identifier(), msg->Identifier());
+    ASSERT_EQ(expected.at(0)->CostSize(), msg->CostSize());
+    // the reassembled buffer is only referenced in zero-copy mode
+    ASSERT_EQ(zero_copy, msg->BackingStorage() != nullptr);
+    ASSERT_EQ(expected.at(0)->PayloadSize(), msg->PayloadSize());
+    ASSERT_EQ(0, memcmp(expected.at(0)->PayloadBuffer(), msg->PayloadBuffer(), msg->PayloadSize()));
+  }
+  free(buffer);
+}
+
+TEST(DTXMessageParserTest, ParseIncomingBuffer) {
+  char* buffer = nullptr;
+  size_t buffer_size = 0;
+  READ_CONTENT_FROM_FILE("dtxmsg_runningprocesses.bin");
+
+  DTXMessageParser expected_parser;
+  ASSERT_TRUE(expected_parser.ParseIncomingBytes(buffer, buffer_size));
+  std::vector<std::shared_ptr<DTXMessage>> expected = expected_parser.PopAllParsedMessages();
+  ASSERT_EQ(1, expected.size());
+
+  // the buffers are handed over to the parser, like the receive thread does in direct mode
+  for (bool zero_copy : {false, true}) {
+    std::shared_ptr<BufferPool> pool = BufferPool::Create(1000, 64);
+    DTXMessageParser parser;
+    parser.SetZeroCopy(zero_copy);
+    size_t packet_count = 0;
+    for (size_t offset = 0; offset < buffer_size; offset += pool->BufferSize()) {
+      size_t size = std::min(pool->BufferSize(), buffer_size - offset);
+      SharedBufferMemory packet = pool->Acquire();
+      ASSERT_NE(nullptr, packet);
+      memcpy(packet->Allocate(size), buffer + offset, size);
+      ASSERT_TRUE(parser.ParseIncomingBuffer(std::move(packet)));
+      packet_count++;
+    }
+    std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+    ASSERT_EQ(1, messages.size());
+    std::shared_ptr<DTXMessage> msg = messages.at(0);
+    ASSERT_EQ(expected.at(0)->Identifier(), msg->Identifier());
+    ASSERT_EQ(expected.at(0)->PayloadSize(), msg->PayloadSize());
+    ASSERT_EQ(0, memcmp(expected.at(0)->PayloadBuffer(), msg->PayloadBuffer(), msg->PayloadSize()));
+    ASSERT_LT(pool->AllocatedCount(), packet_count);  // the consumed buffers have been recycled
+  }
+  free(buffer);
+}
+
+// append a fragment of a data message with `payload_size` bytes payload to the buffer
+static void append_fragment(ByteBuffer& buffer, uint32_t identifier, uint16_t index,
+                            uint16_t count, size_t payload_size, size_t fragment_size) {
+  constexpr uint32_t payload_header_size = 0x10;
+  DTXMessageHeader header = {kDTXMessageHeaderMagic, kDTXMessageHeaderSize, index, count,
+                             static_cast<uint32_t>(index == 0 ? payload_header_size + payload_size
+                                                              : fragment_size),
+                             identifier, 0, 0, 0};
+  buffer.Append(&header, sizeof(header));
+  if (index == 0) {
+    return;
+  }
+  std::vector<char> data(fragment_size, static_cast<char>(identifier));
+  if (index == 1) {
+    uint32_t message_type = DTXMessage::kDataMessageType;
+    uint32_t auxiliary_length = 0;
+    uint64_t total_length = payload_size;
+    memcpy(&data[0], &message_type, sizeof(uint32_t));
+    memcpy(&data[4], &auxiliary_length, sizeof(uint32_t));
+    memcpy(&data[8], &total_length, sizeof(uint64_t));
+  }
+  buffer.Append(data.data(), data.size());
+}
+
+TEST(DTXMessageParserTest, ParseIncomingBytes_FragmentMemoryBudget) {
+  constexpr size_t payload_size = 1024 - 0x10;  // 2 fragments of 512 bytes
+
+  DTXMessageParser parser;
+  parser.SetFragmentMemoryBudget(1536);
+
+  // the first fragments of message #1 and #2
+  ByteBuffer stream(8192);
+  append_fragment(stream, 1, 0, 3, payload_size, 0);
+  append_fragment(stream, 1, 1, 3, payload_size, 512);
+  append_fragment(stream, 2, 0, 3, payload_size, 0);
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  ASSERT_EQ(1, parser.FragmentedMessageCount());  // #1 has been evicted to make room for #2
+  ASSERT_EQ(1, parser.EvictedFragmentedMessageCount());
+  ASSERT_EQ(1024, parser.FragmentMemoryUsage());
+
+  // the rest of message #1 is dropped, and message #2 is reassembled
+  stream.Resize(0);
+  append_fragment(stream, 1, 2, 3, payload_size, 512);
+  append_fragment(stream, 2, 1, 3, payload_size, 512);
+  append_fragment(stream, 2, 2, 3, payload_size, 512);
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  ASSERT_EQ(0, parser.FragmentedMessageCount());
+  ASSERT_EQ(0, parser.FragmentMemoryUsage());
+  ASSERT_EQ(1, parser.ReassembledMessageCount());
+
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  ASSERT_EQ(1, messages.size());
+  ASSERT_EQ(2, messages.at(0)->Identifier());
+  ASSERT_EQ(DTXMessage::kDataMessageType, messages.at(0)->MessageType());
+  ASSERT_EQ(payload_size, messages.at(0)->PayloadSize());
+  ASSERT_EQ(2, messages.at(0)->PayloadBuffer()[payload_size - 1]);
+
+  // a message larger than the budget is dropped
+  stream.Resize(0);
+  append_fragment(stream, 3, 0, 5, 2048 - 0x10, 0);
+  for (uint16_t i = 1; i < 5; ++i) {
+    append_fragment(stream, 3, i, 5, 2048 - 0x10, 512);
+  }
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  ASSERT_EQ(0, parser.FragmentedMessageCount());
+  ASSERT_EQ(0, parser.PopAllParsedMessages().size());
+  ASSERT_EQ(2, parser.EvictedFragmentedMessageCount());
+
+  // the buffer of a message is accounted by its capacity, which is aligned up to 128 bytes
+  parser.SetFragmentMemoryBudget(1000);
+  stream.Resize(0);
+  append_fragment(stream, 4, 0, 3, 1000 - 0x10, 0);
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  ASSERT_EQ(0, parser.FragmentedMessageCount());
+  ASSERT_EQ(0, parser.FragmentMemoryUsage());
+  ASSERT_EQ(3, parser.EvictedFragmentedMessageCount());
+}
+
+TEST(DTXMessageParserTest, ParseIncomingBytes_CompressedMessage) {
+  std::string payload;
+  for (int i = 0; i < 1000; ++i) {
+    payload += "compressed payload ";
+  }
+  uLongf compressed_size = compressBound(payload.size());
+  std::vector<char> compressed(compressed_size);
+  ASSERT_EQ(Z_OK, compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+                            reinterpret_cast<const Bytef*>(payload.data()), payload.size(),
+                            Z_DEFAULT_COMPRESSION));
+
+  // | header | payload header | original type | original length | zlib stream |
+  constexpr uint32_t payload_header_size = 0x10;
+  uint32_t message_length = payload_header_size + 8 + compressed_size;
+  DTXMessageHeader header = {kDTXMessageHeaderMagic, kDTXMessageHeaderSize, 0, 1, message_length,
+                             7, 0, 0, 0};
+  uint32_t message_type = DTXMessage::kCompressedMessageType;
+  uint32_t auxiliary_length = 0;
+  uint64_t total_length = 8 + compressed_size;
+  uint32_t original_type = DTXMessage::kDataMessageType;
+  uint32_t original_length = payload.size();
+  ByteBuffer stream(message_length + kDTXMessageHeaderSize);
+  stream.Append(&header, sizeof(header));
+  stream.Append(&message_type, sizeof(uint32_t));
+  stream.Append(&auxiliary_length, sizeof(uint32_t));
+  stream.Append(&total_length, sizeof(uint64_t));
+  stream.Append(&original_type, sizeof(uint32_t));
+  stream.Append(&original_length, sizeof(uint32_t));
+  stream.Append(compressed.data(), compressed_size);
+
+  DTXMessageParser parser;
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  ASSERT_EQ(1, messages.size());
+  std::shared_ptr<DTXMessage> msg = messages.at(0);
+  ASSERT_TRUE(msg->Compressed());
+  ASSERT_EQ(DTXMessage::kDataMessageType, msg->MessageType());
+  ASSERT_EQ(payload.size(), msg->PayloadSize());
+  ASSERT_EQ(0, memcmp(payload.data(), msg->PayloadBuffer(), payload.size()));
+  ASSERT_EQ(1, parser.DecompressionBufferCount());
+
+  // the buffer of a message alive is not reused
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  ASSERT_EQ(1, parser.PopAllParsedMessages().size());
+  ASSERT_EQ(2, parser.DecompressionBufferCount());
+
+  // the buffers go back to the parser when the messages die, and are reused
+  messages.clear();
+  msg.reset();
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                          stream.Size()));
+    messages = parser.PopAllParsedMessages();
+    ASSERT_EQ(1, messages.size());
+    ASSERT_EQ(payload.size(), messages.at(0)->PayloadSize());
+    ASSERT_EQ(0, memcmp(payload.data(), messages.at(0)->PayloadBuffer(), payload.size()));
+    messages.clear();
+  }
+  ASSERT_EQ(2, parser.DecompressionBufferCount());
+}
+
+TEST(DTXMessageParserTest, ParseIncomingBytes_NearSegmentSizeMessages) {
+  // messages of nearly 64KB(the size of a segment of the parsing buffer) are read in place, none of
+  // them straddles a segment boundary
+  constexpr uint32_t payload_header_size = 0x10;
+  constexpr size_t payload_size = 64 * 1024 - 100;
+  constexpr size_t message_count = 5;
+  ByteBuffer stream((kDTXMessageHeaderSize + payload_header_size + payload_size) * message_count);
+  for (uint32_t identifier = 1; identifier <= message_count; ++identifier) {
+    DTXMessageHeader header = {kDTXMessageHeaderMagic, kDTXMessageHeaderSize, 0, 1,
+                               static_cast<uint32_t>(payload_header_size + payload_size),
+                               identifier, 0, 0, 0};
+    uint32_t message_type = DTXMessage::kDataMessageType;
+    uint32_t auxiliary_length = 0;
+    uint64_t total_length = payload_size;
+    std::vector<char> payload(payload_size, static_cast<char>(identifier));
+    stream.Append(&header, sizeof(header));
+    stream.Append(&message_type, sizeof(uint32_t));
+    stream.Append(&auxiliary_length, sizeof(uint32_t));
+    stream.Append(&total_length, sizeof(uint64_t));
+    stream.Append(payload.data(), payload.size());
+  }
+
+  // fed at once, or in chunks like the reads of a socket
+  for (size_t chunk_size : std::vector<size_t>{stream.Size(), 16 * 1024, 7}) {
+    DTXMessageParser parser;
+    parser.SetZeroCopy(true);
+    const char* data = reinterpret_cast<const char*>(stream.GetBuffer(0));
+    for (size_t offset = 0; offset < stream.Size(); offset += chunk_size) {
+      ASSERT_TRUE(parser.ParseIncomingBytes(data + offset,
+                                            std::min(chunk_size, stream.Size() - offset)));
+    }
+    std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+    ASSERT_EQ(message_count, messages.size());
+    for (size_t i = 0; i < message_count; ++i) {
+      ASSERT_EQ(i + 1, messages.at(i)->Identifier());
+      ASSERT_EQ(payload_size, messages.at(i)->PayloadSize());
+      ASSERT_EQ(static_cast<char>(i + 1), messages.at(i)->PayloadBuffer()[0]);
+      ASSERT_EQ(static_cast<char>(i + 1), messages.at(i)->PayloadBuffer()[payload_size - 1]);
+    }
+    ASSERT_EQ(0, parser.CopiedMessageCount());
+  }
+}
@@ -6,10 +6,13 @@
 #include <fstream>
 #include <map>
 #include <memory>  // std::shared_ptr
+#include <string>
 #include <vector>
 
 #include "idevice/utils/bytebuffer.h"
+#include "idevice/utils/bytesink.h"
 #include "idevice/instrument/dtxmessage.h"
+#include "idevice/instrument/dtxmessageparser.h"
 #include "idevice/common/idevice.h"
 
 #ifdef ENABLE_NSKEYEDARCHIVE_TEST
@@ -148,11 +151,11 @@ TEST(DTXMessageTransmitterTest, TransmitMessage_MultipleFragments) {
   message->SetIdentifier(msg_identifier);
 
   ByteBuffer send_buffer(8192);
-  transmitter.TransmitMessage(message, {msg_identifier, 0, 0, 0},
-                              [&](const char* data, size_t size) -> bool {
-                                send_buffer.Append(data, size);
-                                return true;
-                              });
+  ASSERT_TRUE(transmitter.TransmitMessage(message, {msg_identifier, 0, 0, 0},
+                                          [&](const char* data, size_t size) -> bool {
+                                            send_buffer.Append(data, size);
+                                            return true;
+                                          }));
   // idevice::hexdump(send_buffer.GetBuffer(0), send_buffer.Size(), 0);
   write_buffer_to_file("TransmitMessage_MultipleFragments.bin",
                        reinterpret_cast<const char*>(send_buffer.GetBuffer(0)), send_buffer.Size());
@@ -172,8 +175,8 @@ TEST(DTXMessageTransmitterTest, TransmitMessage_MultipleFragments) {
   const unsigned char expect_fragment_0_header[] = {
   //     0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
   //  <DTXMessageHeader>
-      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0xA0, 0x7F, 0x03, 0x00,
-  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=0  | fg_cnt=4 | length=229280       |
+      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0xA0, 0x7F, 0x03, 0x00,
+  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=0  | fg_cnt=5 | length=229280       |
       0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   //  | identifier=1          | conv_idx=0            | channel_code=0        | expects_reply=0    |
   };
@@ -183,8 +186,8 @@ TEST(DTXMessageTransmitterTest, TransmitMessage_MultipleFragments) {
   const unsigned char expect_fragment_1_header[] = {
   //     0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
   //  <DTXMessageHeader>
-      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x01, 0x00, 0x04, 0x00, 0xE0, 0xFF, 0x00, 0x00,
-  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=1  | fg_cnt=4 | length=65504        |
+      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x01, 0x00, 0x05, 0x00, 0xE0, 0xFF, 0x00, 0x00,
+  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=1  | fg_cnt=5 | length=65504        |
       0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   //  | identifier=1          | conv_idx=0            | channel_code=0        | expects_reply=0    |
   };
@@ -193,8 +196,8 @@ TEST(DTXMessageTransmitterTest, TransmitMessage_MultipleFragments) {
   const unsigned char expect_fragment_2_header[] = {
   //     0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
   //  <DTXMessageHeader>
-      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x02, 0x00, 0x04, 0x00, 0xE0, 0xFF, 0x00, 0x00,
-  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=2  | fg_cnt=4 | length=65504        |
+      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x02, 0x00, 0x05, 0x00, 0xE0, 0xFF, 0x00, 0x00,
+  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=2  | fg_cnt=5 | length=65504        |
       0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   //  | identifier=1          | conv_idx=0            | channel_code=0        | expects_reply=0    |
   };
@@ -203,8 +206,8 @@ TEST(DTXMessageTransmitterTest, TransmitMessage_MultipleFragments) {
   const unsigned char expect_fragment_3_header[] = {
   //     0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
   //  <DTXMessageHeader>
-      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x03, 0x00, 0x04, 0x00, 0xE0, 0xFF, 0x00, 0x00,
-  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=3  | fg_cnt=4 | length=65504        |
+      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x03, 0x00, 0x05, 0x00, 0xE0, 0xFF, 0x00, 0x00,
+  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=3  | fg_cnt=5 | length=65504        |
       0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   //  | identifier=1          | conv_idx=0            | channel_code=0        | expects_reply=0    |
   };
@@ -213,13 +216,184 @@ TEST(DTXMessageTransmitterTest, TransmitMessage_MultipleFragments) {
   const unsigned char expect_fragment_4_header[] = {
   //     0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f
   //  <DTXMessageHeader>
-      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x04, 0x00, 0x04, 0x00, 0x00, 0x80, 0x00, 0x00,
-  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=4  | fg_cnt=4 | length=32768        |
+      0x79, 0x5B, 0x3D, 0x1F, 0x20, 0x00, 0x00, 0x00, 0x04, 0x00, 0x05, 0x00, 0x00, 0x80, 0x00, 0x00,
+  //  | magic=0x1F3D5B79      | msg_header_size=32    | fg_idx=4  | fg_cnt=5 | length=32768        |
       0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   //  | identifier=1          | conv_idx=0            | channel_code=0        | expects_reply=0    |
   };
   ASSERT_BYTES_EQ(actual_ptr + 0x30020, expect_fragment_4_header, sizeof(expect_fragment_4_header));
   // clang-format on
+
+  // the same bytes as the `GatherMessage()`, which can be reassembled by the parser
+  GatherBuffer gather_buffer;
+  ASSERT_TRUE(transmitter.GatherMessage(message, {msg_identifier, 0, 0, 0}, &gather_buffer));
+  ByteBuffer gathered(total_size + 8192);
+  for (const IoVec& segment : gather_buffer.Segments()) {
+    gathered.Append(segment.data, segment.size);
+  }
+  ASSERT_EQ(send_buffer.Size(), gathered.Size());
+  ASSERT_EQ(0, memcmp(send_buffer.GetBuffer(0), gathered.GetBuffer(0), send_buffer.Size()));
+
+  DTXMessageParser parser;
+  ASSERT_TRUE(parser.ParseIncomingBytes(actual_ptr, send_buffer.Size()));
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  ASSERT_EQ(1, messages.size());
+  ASSERT_EQ(total_size, messages.at(0)->PayloadSize());
+  ASSERT_EQ(0, memcmp(message->PayloadBuffer(), messages.at(0)->PayloadBuffer(), total_size));
+
+  // it stops as soon as the transmitter fails, e.g. the connection is closed
+  size_t transmit_count = 0;
+  ASSERT_FALSE(transmitter.TransmitMessage(message, {msg_identifier, 0, 0, 0},
+                                           [&](const char* /*data*/, size_t /*size*/) -> bool {
+                                             return ++transmit_count < 3;
+                                           }));
+  ASSERT_EQ(3, transmit_count);
 }
 
 #endif  // ENABLE_NSKEYEDARCHIVE_TEST
+
+static void append_segments(ByteBuffer& buffer, GatherBuffer& gather_buffer) {
+  for (const IoVec& segment : gather_buffer.Segments()) {
+    buffer.Append(segment.data, segment.size);
+  }
+}
+
+TEST(DTXMessageTransmitterTest, SerializeTo_Sinks) {
+  std::shared_ptr<DTXMessage> message = DTXMessage::CreateWithSelector("runningProcesses");
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int32_t>(2)));
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int64_t>(3)));
+
+  ByteBuffer expected(8192);
+  ASSERT_TRUE(message->SerializeTo(std::function<bool(const char*, size_t)>(
+      [&](const char* data, size_t size) -> bool {
+        expected.Append(data, size);
+        return true;
+      })));
+
+  SizeCounter counter;
+  ASSERT_TRUE(message->SerializeTo(counter));
+  ASSERT_EQ(message->SerializedLength(), counter.Size());
+  ASSERT_EQ(expected.Size(), counter.Size());
+
+  std::vector<char> buffer(counter.Size());
+  BufferWriter writer(buffer.data(), buffer.size());
+  ASSERT_TRUE(message->SerializeTo(writer));
+  ASSERT_EQ(0, memcmp(expected.GetBuffer(0), buffer.data(), buffer.size()));
+
+  // the serialization stops once the sink fails
+  BufferWriter small_writer(buffer.data(), buffer.size() - 1);
+  ASSERT_FALSE(message->SerializeTo(small_writer));
+}
+
+TEST(DTXMessageTransmitterTest, GatherMessage_SingleFragment) {
+  std::shared_ptr<DTXMessage> message = DTXMessage::CreateWithSelector("runningProcesses");
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int32_t>(2)));
+  DTXMessageRoutingInfo routing_info = {1, 0, 0, 1};
+
+  // the same bytes as the `TransmitMessage()`
+  DTXMessageTransmitter transmitter;
+  ByteBuffer expected(8192);
+  transmitter.TransmitMessage(message, routing_info, [&](const char* data, size_t size) -> bool {
+    expected.Append(data, size);
+    return true;
+  });
+
+  GatherBuffer gather_buffer;
+  ASSERT_TRUE(transmitter.GatherMessage(message, routing_info, &gather_buffer));
+  ByteBuffer actual(8192);
+  append_segments(actual, gather_buffer);
+  ASSERT_EQ(expected.Size(), actual.Size());
+  ASSERT_EQ(0, memcmp(expected.GetBuffer(0), actual.GetBuffer(0), expected.Size()));
+}
+
+TEST(DTXMessageTransmitterTest, GatherMessage_MultipleFragments) {
+  DTXMessageTransmitter transmitter;
+  size_t fragment_payload_size = transmitter.SuggestedFragmentSize() - kDTXMessageHeaderSize;
+  size_t total_size = fragment_payload_size * 3.5;
+  std::vector<char> payload(total_size);
+  for (size_t i = 0; i < total_size; ++i) {
+    payload[i] = static_cast<char>('0' + i % 10);
+  }
+
+  // the payload is referenced, not copied
+  std::shared_ptr<DTXMessage> message =
+      DTXMessage::CreateWithBuffer(payload.data(), payload.size(), false);
+  GatherBuffer gather_buffer;
+  ASSERT_TRUE(transmitter.GatherMessage(message, {1, 0, 0, 0}, &gather_buffer));
+  bool payload_referenced = false;
+  for (const IoVec& segment : gather_buffer.Segments()) {
+    payload_referenced |= segment.data >= payload.data() &&
+                          segment.data < payload.data() + payload.size();
+  }
+  ASSERT_TRUE(payload_referenced);
+
+  // 1 header-only fragment + 4 fragments of data
+  constexpr size_t kDTXMessagePayloadHeaderSize = 0x10;
+  ByteBuffer stream(total_size + 8192);
+  append_segments(stream, gather_buffer);
+  ASSERT_EQ(kDTXMessageHeaderSize * 5 + kDTXMessagePayloadHeaderSize + total_size, stream.Size());
+
+  // which can be reassembled by the parser
+  DTXMessageParser parser;
+  ASSERT_TRUE(parser.ParseIncomingBytes(reinterpret_cast<const char*>(stream.GetBuffer(0)),
+                                        stream.Size()));
+  std::vector<std::shared_ptr<DTXMessage>> messages = parser.PopAllParsedMessages();
+  ASSERT_EQ(1, messages.size());
+  ASSERT_EQ(total_size, messages.at(0)->PayloadSize());
+  ASSERT_EQ(0, memcmp(payload.data(), messages.at(0)->PayloadBuffer(), total_size));
+}
+
+TEST(DTXMessageTransmitterTest, GatherMessage_NoCopyThreshold) {
+  // a small fragment size, so the headers and the length prefixes straddle many fragments
+  DTXMessageTransmitter transmitter;
+  transmitter.SetSuggestedFragmentSize(kDTXMessageHeaderSize + 24);
+  std::string payload(100, 'p');
+  std::string text = "auxiliary string";
+  std::shared_ptr<DTXMessage> message =
+      DTXMessage::CreateWithBuffer(payload.data(), payload.size(), false);
+  message->AppendAuxiliary(DTXPrimitiveValue(text.c_str(), text.size()));
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int32_t>(2)));
+  DTXMessageRoutingInfo routing_info = {1, 0, 0, 1};
+
+  ByteBuffer expected(8192);
+  ASSERT_TRUE(transmitter.TransmitMessage(message, routing_info,
+                                          [&](const char* data, size_t size) -> bool {
+                                            expected.Append(data, size);
+                                            return true;
+                                          }));
+
+  // nothing is copied but the headers and the length prefixes, which are gone after the call
+  GatherBuffer gather_buffer(0);
+  ASSERT_TRUE(transmitter.GatherMessage(message, routing_info, &gather_buffer));
+  ByteBuffer actual(8192);
+  append_segments(actual, gather_buffer);
+  ASSERT_EQ(expected.Size(), actual.Size());
+  ASSERT_EQ(0, memcmp(expected.GetBuffer(0), actual.GetBuffer(0), expected.Size()));
+}
+
+TEST(DTXMessageTransmitterTest, FrameMessage) {
+  std::shared_ptr<DTXMessage> message = DTXMessage::CreateWithSelector("runningProcesses");
+  message->AppendAuxiliary(DTXPrimitiveValue(static_cast<int32_t>(2)));
+  DTXMessageRoutingInfo routing_info = {1, 0, 0, 1};
+
+  DTXMessageTransmitter transmitter;
+  GatherBuffer gather_buffer;
+  ASSERT_TRUE(transmitter.GatherMessage(message, routing_info, &gather_buffer));
+  ByteBuffer expected(8192);
+  append_segments(expected, gather_buffer);
+
+  // the frame has the exact size of the message, and the buffer is reused for the next message
+  BufferMemory frame;
+  ASSERT_TRUE(transmitter.FrameMessage(message, routing_info, &frame));
+  ASSERT_EQ(expected.Size(), frame.Size());
+  ASSERT_EQ(0, memcmp(expected.GetBuffer(0), frame.GetPtr(0), frame.Size()));
+  const char* frame_ptr = frame.GetPtr(0);
+  ASSERT_TRUE(transmitter.FrameMessage(DTXMessage::CreateWithSelector("runningProcesses"),
+                                       routing_info, &frame));
+  ASSERT_EQ(frame_ptr, frame.GetPtr(0));
+
+  // a message with multiple fragments can not be framed
+  std::vector<char> payload(transmitter.SuggestedFragmentSize() * 2);
+  ASSERT_FALSE(transmitter.FrameMessage(
+      DTXMessage::CreateWithBuffer(payload.data(), payload.size(), false), routing_info, &frame));
+}